@@ -1,4 +1,5 @@
-local textures = {}
+-- Global so a hot reload keeps the loaded textures
+textures = {}
 
 function load_texture(asset_name)
     local id, w, h = load_image(asset_name)
@@ -10,11 +11,13 @@ function load_texture(asset_name)
     end
 end
 
+-- Setup runs once; a hot reload re-runs this file but not init()
+function init()
+    load_texture("image.png")
+end
+
 function update(time)
     print("Lua update called with time: " .. time)
-    if not textures["image.png"] then
-        load_texture("image.png")
-    end
 
     local vertices = {
         {-150, -150}, {150, -150}, {-150, 150}, {150, 150}
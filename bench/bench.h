@@ -0,0 +1,29 @@
+// bench.h
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <libretro.h>
+
+// Benchmark body: run the measured operation `iterations` times
+typedef void (*bench_fn)(void *ctx, uint64_t iterations);
+
+// Time fn over several repeats and record the result under name
+void bench_run(const char *name, bench_fn fn, void *ctx, uint64_t iterations);
+
+// Stubbed GL loader handed to module_opengl_set_callbacks (bench_gl_stubs.c)
+retro_proc_address_t bench_gl_get_proc_address(const char *sym);
+
+// Number of GL calls that reached a stub since startup
+uint64_t bench_gl_call_count(void);
+
+// Benchmark groups
+void bench_core_run(void);
+void bench_broadphase_run(void);
+void bench_particles_run(void);
+void bench_jobs_run(void);
+void bench_cmdlist_run(void);
+void bench_memory_run(void);
+void bench_math_run(void);
+
+#endif // BENCH_H
@@ -0,0 +1,138 @@
+// bench_broadphase.c
+// Broad-phase update and queries at increasing body counts, grid vs tree.
+#include "bench.h"
+#include "module_broadphase.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORLD_SIZE 4096.0f
+#define MAX_PAIRS 262144
+#define MAX_RESULTS 4096
+
+typedef struct {
+   broadphase_world *world;
+   int count;
+   float *aabbs;
+   float *velocity;
+   int32_t *pairs;
+   int32_t *results;
+   float *hit_t;
+   uint32_t rng;
+} broadphase_bench_ctx;
+
+static volatile int bench_sink = 0;
+
+static float next_random(uint32_t *state) {
+   *state = *state * 1664525u + 1013904223u;
+   return (float)(*state >> 8) / (float)(1u << 24);
+}
+
+// Scatter bodies of 4..36 units with small random velocities
+static void init_bodies(broadphase_bench_ctx *bc) {
+   for (int i = 0; i < bc->count; i++) {
+      float x = next_random(&bc->rng) * WORLD_SIZE, y = next_random(&bc->rng) * WORLD_SIZE;
+      float w = 4.0f + next_random(&bc->rng) * 32.0f, h = 4.0f + next_random(&bc->rng) * 32.0f;
+      bc->aabbs[i * 4 + 0] = x;
+      bc->aabbs[i * 4 + 1] = y;
+      bc->aabbs[i * 4 + 2] = x + w;
+      bc->aabbs[i * 4 + 3] = y + h;
+      bc->velocity[i * 2 + 0] = next_random(&bc->rng) * 2.0f - 1.0f;
+      bc->velocity[i * 2 + 1] = next_random(&bc->rng) * 2.0f - 1.0f;
+   }
+}
+
+static void move_bodies(broadphase_bench_ctx *bc) {
+   for (int i = 0; i < bc->count; i++) {
+      float vx = bc->velocity[i * 2], vy = bc->velocity[i * 2 + 1];
+      bc->aabbs[i * 4 + 0] += vx;
+      bc->aabbs[i * 4 + 1] += vy;
+      bc->aabbs[i * 4 + 2] += vx;
+      bc->aabbs[i * 4 + 3] += vy;
+   }
+}
+
+// One frame: move every body, bulk update, collect all pairs
+static void bench_update_pairs(void *ctx, uint64_t iterations) {
+   broadphase_bench_ctx *bc = (broadphase_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      int total = 0;
+      move_bodies(bc);
+      module_broadphase_set_bodies(bc->world, bc->aabbs, bc->count, 0);
+      bench_sink += module_broadphase_query_pairs(bc->world, bc->pairs, MAX_PAIRS, &total);
+   }
+}
+
+// 256x256 rectangle queries at random positions
+static void bench_query_rect(void *ctx, uint64_t iterations) {
+   broadphase_bench_ctx *bc = (broadphase_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      float x = next_random(&bc->rng) * (WORLD_SIZE - 256.0f), y = next_random(&bc->rng) * (WORLD_SIZE - 256.0f);
+      bench_sink += module_broadphase_query_rect(bc->world, x, y, x + 256.0f, y + 256.0f,
+                                                 bc->results, MAX_RESULTS, NULL);
+   }
+}
+
+// 1024-unit rays in random directions
+static void bench_raycast(void *ctx, uint64_t iterations) {
+   broadphase_bench_ctx *bc = (broadphase_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      float x = next_random(&bc->rng) * WORLD_SIZE, y = next_random(&bc->rng) * WORLD_SIZE;
+      float dx = next_random(&bc->rng) - 0.5f, dy = next_random(&bc->rng) - 0.5f;
+      bench_sink += module_broadphase_raycast(bc->world, x, y, dx, dy, 1024.0f,
+                                              bc->results, bc->hit_t, MAX_RESULTS);
+   }
+}
+
+void bench_broadphase_run(void) {
+   static const int body_counts[] = {1000, 10000, 50000};
+   static const struct {
+      const char *name;
+      broadphase_mode mode;
+      float cell_size;
+   } modes[] = {
+      {"grid", BROADPHASE_GRID, 64.0f},
+      {"tree", BROADPHASE_TREE, 4.0f},
+   };
+   broadphase_bench_ctx bc;
+
+   bc.pairs = (int32_t *)malloc(sizeof(int32_t) * 2 * MAX_PAIRS);
+   bc.results = (int32_t *)malloc(sizeof(int32_t) * MAX_RESULTS);
+   bc.hit_t = (float *)malloc(sizeof(float) * MAX_RESULTS);
+   if (!bc.pairs || !bc.results || !bc.hit_t) {
+      fprintf(stderr, "Failed to allocate broadphase benchmark buffers\n");
+      goto cleanup;
+   }
+
+   for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      for (size_t c = 0; c < sizeof(body_counts) / sizeof(body_counts[0]); c++) {
+         char name[64];
+         bc.count = body_counts[c];
+         bc.rng = 12345u;
+         bc.aabbs = (float *)malloc(sizeof(float) * 4 * (size_t)bc.count);
+         bc.velocity = (float *)malloc(sizeof(float) * 2 * (size_t)bc.count);
+         bc.world = module_broadphase_create(modes[m].mode, modes[m].cell_size);
+         if (!bc.aabbs || !bc.velocity || !bc.world) {
+            fprintf(stderr, "Failed to set up broadphase benchmark (%d bodies)\n", bc.count);
+         } else {
+            uint64_t frames = (uint64_t)(2000000 / bc.count);
+            init_bodies(&bc);
+            module_broadphase_set_bodies(bc.world, bc.aabbs, bc.count, 0);
+
+            snprintf(name, sizeof(name), "broadphase.%s.update_pairs.%d", modes[m].name, bc.count);
+            bench_run(name, bench_update_pairs, &bc, frames);
+            snprintf(name, sizeof(name), "broadphase.%s.query_rect.%d", modes[m].name, bc.count);
+            bench_run(name, bench_query_rect, &bc, 2000);
+            snprintf(name, sizeof(name), "broadphase.%s.raycast.%d", modes[m].name, bc.count);
+            bench_run(name, bench_raycast, &bc, 2000);
+         }
+         module_broadphase_destroy(bc.world);
+         free(bc.aabbs);
+         free(bc.velocity);
+      }
+   }
+
+cleanup:
+   free(bc.pairs);
+   free(bc.results);
+   free(bc.hit_t);
+}
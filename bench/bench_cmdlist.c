@@ -0,0 +1,41 @@
+// bench_cmdlist.c
+// Cost of recording draws into a command list and replaying them (GL stubbed),
+// i.e. the overhead a frame pays for going through the pipeline.
+#include "bench.h"
+#include "module_cmdlist.h"
+#include "module_opengl.h"
+#include <stdio.h>
+
+#define BENCH_DRAWS 1000
+
+static void record_frame(cmdlist *list) {
+   module_cmdlist_reset(list);
+   module_cmdlist_begin(list);
+   for (int i = 0; i < BENCH_DRAWS; i++)
+      module_opengl_draw_solid_quad((float)(i % 512), 256.0f, 16.0f, 16.0f, 45.0f, 1.0f, 0.5f, 0.25f, 1.0f, 512, 512);
+   module_cmdlist_end();
+}
+
+static void bench_cmdlist_record(void *ctx, uint64_t iterations) {
+   for (uint64_t i = 0; i < iterations; i++)
+      record_frame((cmdlist *)ctx);
+}
+
+static void bench_cmdlist_replay(void *ctx, uint64_t iterations) {
+   for (uint64_t i = 0; i < iterations; i++)
+      module_cmdlist_replay((cmdlist *)ctx);
+}
+
+void bench_cmdlist_run(void) {
+   cmdlist *list = module_cmdlist_create();
+   if (!list) {
+      fprintf(stderr, "Failed to set up command list benchmark\n");
+      return;
+   }
+
+   bench_run("cmdlist.record_1k_quads", bench_cmdlist_record, list, 2000);
+   record_frame(list);
+   bench_run("cmdlist.replay_1k_quads", bench_cmdlist_replay, list, 200);
+
+   module_cmdlist_destroy(list);
+}
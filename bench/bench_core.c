@@ -0,0 +1,155 @@
+// bench_core.c
+// Hot paths of the core: Lua->C bindings, zip asset lookup, text layout,
+// MVP construction and logging.
+#include "bench.h"
+#include "libretro_core.h"
+#include "module_lua.h"
+#include "module_opengl.h"
+#include <miniz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static volatile float bench_sink = 0.0f;
+
+static const char *bench_script =
+   "function update(time) end\n"
+   "function bench_draw_quad(n)\n"
+   "   for i = 1, n do draw_quad(256, 256, 64, 64, 45, 1, 0.5, 0.25, 1) end\n"
+   "end\n"
+   "function bench_draw_texture(n)\n"
+   "   for i = 1, n do draw_texture(1, 256, 256, 64, 64, 45, 1, 1, 1, 1) end\n"
+   "end\n"
+   "function bench_get_input(n)\n"
+   "   local pressed = 0\n"
+   "   for i = 1, n do\n"
+   "      if get_input(RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A) then pressed = pressed + 1 end\n"
+   "   end\n"
+   "   return pressed\n"
+   "end\n";
+
+static int16_t bench_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+   (void)device; (void)index;
+   return (int16_t)((port + id) & 1);
+}
+
+// Calls a global Lua function taking the iteration count
+static void bench_lua_call(void *ctx, uint64_t iterations) {
+   lua_State *L = module_lua_get_state();
+   lua_getglobal(L, (const char *)ctx);
+   lua_pushinteger(L, (lua_Integer)iterations);
+   if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      fprintf(stderr, "Lua benchmark error: %s\n", lua_tostring(L, -1));
+      lua_pop(L, 1);
+   }
+}
+
+typedef struct {
+   const char *asset_name;
+} zip_bench_ctx;
+
+static void bench_zip_extract(void *ctx, uint64_t iterations) {
+   zip_bench_ctx *zc = (zip_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      char *data = NULL;
+      size_t size = 0;
+      if (extract_asset_from_zip(zc->asset_name, &data, &size)) {
+         bench_sink += (float)size;
+         free(data);
+      }
+   }
+}
+
+// Write a zip with `entries` small assets named asset_00000.bin ...
+static bool write_bench_zip(const char *path, int entries) {
+   mz_zip_archive zip;
+   char payload[256];
+   char name[32];
+   memset(&zip, 0, sizeof(zip));
+   for (size_t i = 0; i < sizeof(payload); i++)
+      payload[i] = (char)(i * 31);
+
+   if (!mz_zip_writer_init_file(&zip, path, 0))
+      return false;
+   for (int i = 0; i < entries; i++) {
+      snprintf(name, sizeof(name), "asset_%05d.bin", i);
+      if (!mz_zip_writer_add_mem(&zip, name, payload, sizeof(payload), MZ_BEST_SPEED)) {
+         mz_zip_writer_end(&zip);
+         return false;
+      }
+   }
+   bool ok = mz_zip_writer_finalize_archive(&zip);
+   mz_zip_writer_end(&zip);
+   return ok;
+}
+
+static void bench_draw_text(void *ctx, uint64_t iterations) {
+   const char *text = (const char *)ctx;
+   for (uint64_t i = 0; i < iterations; i++)
+      module_opengl_draw_text(16.0f, 16.0f, text, 1.0f, 1.0f, 1.0f, 1.0f, 512, 512);
+}
+
+static void bench_build_mvp(void *ctx, uint64_t iterations) {
+   float mvp[16];
+   (void)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      module_opengl_build_mvp((float)(i & 511), 256.0f, (float)(i % 360), 512, 512, mvp);
+      bench_sink += mvp[0];
+   }
+}
+
+static void bench_core_log(void *ctx, uint64_t iterations) {
+   enum retro_log_level level = *(enum retro_log_level *)ctx;
+   for (uint64_t i = 0; i < iterations; i++)
+      core_log(level, "Drew solid quad at (%f, %f), size (%f, %f), rotation %f",
+               256.0f, 256.0f, 64.0f, 64.0f, (float)i);
+}
+
+void bench_core_run(void) {
+   retro_set_input_state(bench_input_state);
+   if (!module_lua_init_from_buffer(bench_script, strlen(bench_script))) {
+      fprintf(stderr, "Failed to initialize Lua benchmark script\n");
+      return;
+   }
+
+   // Lua -> C binding overhead (GL stubbed, debug logging filtered)
+   bench_run("lua.draw_quad", bench_lua_call, (void *)"bench_draw_quad", 200000);
+   bench_run("lua.draw_texture", bench_lua_call, (void *)"bench_draw_texture", 200000);
+   bench_run("lua.get_input", bench_lua_call, (void *)"bench_get_input", 1000000);
+
+   // Asset lookup against archives of increasing entry count
+   static const int zip_sizes[] = {1, 64, 1024, 8192};
+   for (size_t i = 0; i < sizeof(zip_sizes) / sizeof(zip_sizes[0]); i++) {
+      char path[64], asset[32], name[64];
+      zip_bench_ctx zc;
+      snprintf(path, sizeof(path), "lrcgl_bench_%d.zip", zip_sizes[i]);
+      snprintf(asset, sizeof(asset), "asset_%05d.bin", zip_sizes[i] / 2);
+      if (!write_bench_zip(path, zip_sizes[i])) {
+         fprintf(stderr, "Failed to write %s\n", path);
+         continue;
+      }
+      core_set_content_path(path);
+      zc.asset_name = asset;
+      snprintf(name, sizeof(name), "zip.extract_asset.%d_entries", zip_sizes[i]);
+      bench_run(name, bench_zip_extract, &zc, 200);
+      remove(path);
+   }
+   core_set_content_path(NULL);
+
+   // Glyph layout and submission
+   bench_run("text.draw_16_chars", bench_draw_text, (void *)"Score: 00012345", 20000);
+   bench_run("text.draw_128_chars", bench_draw_text,
+             (void *)"The quick brown fox jumps over the lazy dog. 0123456789 "
+             "The quick brown fox jumps over the lazy dog. 0123456789 ABCDEFGHIJKLMNO",
+             5000);
+
+   // MVP construction with cglm
+   bench_run("math.build_mvp", bench_build_mvp, NULL, 1000000);
+
+   // Logging below and at the threshold
+   enum retro_log_level filtered = RETRO_LOG_DEBUG, unfiltered = RETRO_LOG_INFO;
+   bench_run("log.core_log_filtered", bench_core_log, &filtered, 1000000);
+   bench_run("log.core_log_unfiltered", bench_core_log, &unfiltered, 200000);
+
+   module_lua_deinit();
+}
@@ -0,0 +1,131 @@
+// bench_gl_stubs.c
+// No-op OpenGL implementation resolved through the glad loader, so the core's
+// draw paths run deterministically without a context. Functions that return a
+// value or fill an out-parameter get a typed stub; everything else resolves to
+// a shared no-op, which relies on the caller-cleans-up calling convention of
+// 64-bit targets.
+#include "bench.h"
+#include <glad/glad.h>
+#include <string.h>
+
+static GLuint next_name = 1;
+static uint64_t gl_calls = 0;
+
+static void APIENTRY stub_noop(void) { gl_calls++; }
+
+static const GLubyte *APIENTRY stub_get_string(GLenum name) {
+   gl_calls++;
+   (void)name;
+   return (const GLubyte *)"3.3.0 lrcgl-bench stub";
+}
+
+static const GLubyte *APIENTRY stub_get_stringi(GLenum name, GLuint index) {
+   gl_calls++;
+   (void)name; (void)index;
+   return NULL;
+}
+
+static void APIENTRY stub_get_integerv(GLenum pname, GLint *data) {
+   gl_calls++;
+   (void)pname;
+   if (data)
+      data[0] = 0;
+}
+
+static void APIENTRY stub_get_shaderiv(GLuint shader, GLenum pname, GLint *params) {
+   gl_calls++;
+   (void)shader; (void)pname;
+   *params = GL_TRUE;
+}
+
+static void APIENTRY stub_get_programiv(GLuint program, GLenum pname, GLint *params) {
+   gl_calls++;
+   (void)program; (void)pname;
+   *params = GL_TRUE;
+}
+
+static GLuint APIENTRY stub_create_shader(GLenum type) {
+   gl_calls++;
+   (void)type;
+   return next_name++;
+}
+
+static GLuint APIENTRY stub_create_program(void) {
+   gl_calls++;
+   return next_name++;
+}
+
+static void APIENTRY stub_gen_names(GLsizei n, GLuint *names) {
+   gl_calls++;
+   for (GLsizei i = 0; i < n; i++)
+      names[i] = next_name++;
+}
+
+static GLboolean APIENTRY stub_is_object(GLuint name) {
+   gl_calls++;
+   return name ? GL_TRUE : GL_FALSE;
+}
+
+static GLint APIENTRY stub_get_uniform_location(GLuint program, const GLchar *name) {
+   gl_calls++;
+   (void)program; (void)name;
+   return 0;
+}
+
+static GLuint APIENTRY stub_get_uniform_block_index(GLuint program, const GLchar *name) {
+   gl_calls++;
+   (void)program; (void)name;
+   return 0;
+}
+
+static GLenum APIENTRY stub_check_framebuffer_status(GLenum target) {
+   gl_calls++;
+   (void)target;
+   return GL_FRAMEBUFFER_COMPLETE;
+}
+
+static GLenum APIENTRY stub_get_error(void) {
+   gl_calls++;
+   return GL_NO_ERROR;
+}
+
+typedef struct {
+   const char *name;
+   retro_proc_address_t fn;
+} gl_stub_entry;
+
+static const gl_stub_entry gl_stubs[] = {
+   {"glGetString", (retro_proc_address_t)stub_get_string},
+   {"glGetStringi", (retro_proc_address_t)stub_get_stringi},
+   {"glGetIntegerv", (retro_proc_address_t)stub_get_integerv},
+   {"glGetShaderiv", (retro_proc_address_t)stub_get_shaderiv},
+   {"glGetProgramiv", (retro_proc_address_t)stub_get_programiv},
+   {"glCreateShader", (retro_proc_address_t)stub_create_shader},
+   {"glCreateProgram", (retro_proc_address_t)stub_create_program},
+   {"glGenTextures", (retro_proc_address_t)stub_gen_names},
+   {"glGenBuffers", (retro_proc_address_t)stub_gen_names},
+   {"glGenVertexArrays", (retro_proc_address_t)stub_gen_names},
+   {"glGenFramebuffers", (retro_proc_address_t)stub_gen_names},
+   {"glGenRenderbuffers", (retro_proc_address_t)stub_gen_names},
+   {"glIsProgram", (retro_proc_address_t)stub_is_object},
+   {"glIsVertexArray", (retro_proc_address_t)stub_is_object},
+   {"glIsBuffer", (retro_proc_address_t)stub_is_object},
+   {"glIsTexture", (retro_proc_address_t)stub_is_object},
+   {"glIsFramebuffer", (retro_proc_address_t)stub_is_object},
+   {"glGetUniformLocation", (retro_proc_address_t)stub_get_uniform_location},
+   {"glGetUniformBlockIndex", (retro_proc_address_t)stub_get_uniform_block_index},
+   {"glCheckFramebufferStatus", (retro_proc_address_t)stub_check_framebuffer_status},
+   {"glGetError", (retro_proc_address_t)stub_get_error},
+};
+
+retro_proc_address_t bench_gl_get_proc_address(const char *sym) {
+   for (size_t i = 0; i < sizeof(gl_stubs) / sizeof(gl_stubs[0]); i++) {
+      if (strcmp(gl_stubs[i].name, sym) == 0)
+         return gl_stubs[i].fn;
+   }
+   return (retro_proc_address_t)stub_noop;
+}
+
+uint64_t bench_gl_call_count(void) {
+   return gl_calls;
+}
@@ -0,0 +1,92 @@
+// bench_jobs.c
+// Job system overhead and the data-parallel kernels.
+#include "bench.h"
+#include "module_jobs.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_SORT_KEYS 100000
+
+static volatile float bench_sink = 0.0f;
+
+typedef struct {
+   uint32_t *keys;
+   uint32_t *source;
+   int32_t *values;
+} sort_bench_ctx;
+
+static void sum_range(void *ctx, int begin, int end) {
+   float *values = (float *)ctx;
+   float sum = 0.0f;
+   for (int i = begin; i < end; i++)
+      sum += values[i];
+   if (sum < 0.0f) // never true; keeps the loop from being optimized out without a shared write
+      bench_sink = sum;
+}
+
+// Dispatch/join cost of a parallel_for with almost no work per index
+static void bench_parallel_for(void *ctx, uint64_t iterations) {
+   for (uint64_t i = 0; i < iterations; i++)
+      module_jobs_parallel_for(65536, 1024, sum_range, ctx);
+}
+
+// Submit a chain of dependent empty jobs and wait for the last
+static void empty_job(void *data) {
+   (void)data;
+}
+
+static void bench_job_chain(void *ctx, uint64_t iterations) {
+   job chain[16];
+   (void)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      for (int k = 0; k < 16; k++) {
+         module_jobs_prepare(&chain[k], empty_job, NULL);
+         if (k > 0)
+            module_jobs_depend(&chain[k], &chain[k - 1]);
+      }
+      for (int k = 15; k >= 0; k--)
+         module_jobs_submit(&chain[k]);
+      for (int k = 0; k < 16; k++)
+         module_jobs_wait(&chain[k]);
+   }
+}
+
+static void bench_sort(void *ctx, uint64_t iterations) {
+   sort_bench_ctx *sc = (sort_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      for (int k = 0; k < BENCH_SORT_KEYS; k++) {
+         sc->keys[k] = sc->source[k];
+         sc->values[k] = k;
+      }
+      module_jobs_sort_keys(sc->keys, sc->values, BENCH_SORT_KEYS);
+   }
+}
+
+void bench_jobs_run(void) {
+   float *values = (float *)calloc(65536, sizeof(float));
+   sort_bench_ctx sc;
+   sc.keys = (uint32_t *)malloc(BENCH_SORT_KEYS * sizeof(uint32_t));
+   sc.source = (uint32_t *)malloc(BENCH_SORT_KEYS * sizeof(uint32_t));
+   sc.values = (int32_t *)malloc(BENCH_SORT_KEYS * sizeof(int32_t));
+   if (!values || !sc.keys || !sc.source || !sc.values) {
+      fprintf(stderr, "Failed to allocate job benchmark buffers\n");
+      goto cleanup;
+   }
+
+   uint32_t state = 12345u;
+   for (int k = 0; k < BENCH_SORT_KEYS; k++) {
+      state = state * 1664525u + 1013904223u;
+      sc.source[k] = state;
+   }
+
+   printf("Job system: %d workers\n", module_jobs_worker_count());
+   bench_run("jobs.parallel_for_64k", bench_parallel_for, values, 2000);
+   bench_run("jobs.dependency_chain_16", bench_job_chain, NULL, 20000);
+   bench_run("jobs.sort_keys_100k", bench_sort, &sc, 50);
+
+cleanup:
+   free(values);
+   free(sc.keys);
+   free(sc.source);
+   free(sc.values);
+}
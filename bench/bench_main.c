@@ -0,0 +1,128 @@
+// bench_main.c
+// Microbenchmark driver: brings the core up against stubbed GL and a null
+// log sink, runs every benchmark group and writes the results as JSON.
+#include "bench.h"
+#include "libretro_core.h"
+#include "module_opengl.h"
+#include "core_time.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_REPEATS 5
+#define BENCH_MAX_RESULTS 128
+
+typedef struct {
+   char name[64];
+   uint64_t iterations;
+   double ns_per_op_min;
+   double ns_per_op_median;
+} bench_result;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static int num_results = 0;
+static volatile size_t log_sink_bytes = 0;
+
+// Log sink: format the line as a frontend would, then drop it
+static void bench_log(enum retro_log_level level, const char *fmt, ...) {
+   (void)level;
+   char line[1024];
+   va_list args;
+   va_start(args, fmt);
+   int n = vsnprintf(line, sizeof(line), fmt, args);
+   va_end(args);
+   if (n > 0)
+      log_sink_bytes += (size_t)n;
+}
+
+static bool bench_environment(unsigned cmd, void *data) {
+   switch (cmd) {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback *)data)->log = bench_log;
+         return true;
+      case RETRO_ENVIRONMENT_SET_HW_RENDER:
+         return true;
+      default:
+         return false;
+   }
+}
+
+static uintptr_t bench_get_framebuffer(void) {
+   return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+   double da = *(const double *)a, db = *(const double *)b;
+   return (da > db) - (da < db);
+}
+
+void bench_run(const char *name, bench_fn fn, void *ctx, uint64_t iterations) {
+   double samples[BENCH_REPEATS];
+
+   // Warm-up pass, not recorded
+   fn(ctx, iterations / 10 + 1);
+
+   for (int r = 0; r < BENCH_REPEATS; r++) {
+      uint64_t start = core_time_ns();
+      fn(ctx, iterations);
+      uint64_t elapsed = core_time_ns() - start;
+      samples[r] = (double)elapsed / (double)iterations;
+   }
+   qsort(samples, BENCH_REPEATS, sizeof(double), compare_double);
+
+   if (num_results < BENCH_MAX_RESULTS) {
+      bench_result *res = &results[num_results++];
+      snprintf(res->name, sizeof(res->name), "%s", name);
+      res->iterations = iterations;
+      res->ns_per_op_min = samples[0];
+      res->ns_per_op_median = samples[BENCH_REPEATS / 2];
+   }
+   printf("%-40s %12.1f ns/op (median %.1f)\n", name, samples[0], samples[BENCH_REPEATS / 2]);
+}
+
+static bool write_json(const char *path) {
+   FILE *f = fopen(path, "w");
+   if (!f) {
+      fprintf(stderr, "Failed to open %s for writing\n", path);
+      return false;
+   }
+   fprintf(f, "{\n  \"suite\": \"lrcgl_bench\",\n  \"schema\": 1,\n  \"repeats\": %d,\n  \"results\": [\n",
+           BENCH_REPEATS);
+   for (int i = 0; i < num_results; i++) {
+      fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op_min\": %.3f, \"ns_per_op_median\": %.3f}%s\n",
+              results[i].name, (unsigned long long)results[i].iterations,
+              results[i].ns_per_op_min, results[i].ns_per_op_median,
+              i + 1 < num_results ? "," : "");
+   }
+   fprintf(f, "  ]\n}\n");
+   fclose(f);
+   return true;
+}
+
+int main(int argc, char **argv) {
+   const char *out_path = argc > 1 ? argv[1] : "bench_results.json";
+   bool use_default_fbo = false;
+
+   retro_set_environment(bench_environment);
+   retro_init();
+   core_set_log_level(RETRO_LOG_INFO);
+
+   module_opengl_set_callbacks(bench_gl_get_proc_address, bench_get_framebuffer, &use_default_fbo);
+   module_opengl_init();
+   if (!module_opengl_is_initialized()) {
+      fprintf(stderr, "Stubbed OpenGL failed to initialize\n");
+      return 1;
+   }
+
+   bench_core_run();
+   bench_broadphase_run();
+   bench_particles_run();
+   bench_jobs_run();
+   bench_cmdlist_run();
+   bench_memory_run();
+   bench_math_run();
+
+   printf("%llu stubbed GL calls\n", (unsigned long long)bench_gl_call_count());
+   retro_deinit();
+   return write_json(out_path) ? 0 : 1;
+}
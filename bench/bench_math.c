@@ -0,0 +1,51 @@
+// bench_math.c
+// Batch point transform kernel against the scalar loop it replaces.
+#include "bench.h"
+#include "module_math.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_POINTS 65536
+
+typedef struct {
+   float *src;
+   float *dst;
+   float m[6];
+} math_bench_ctx;
+
+static void bench_transform_scalar(void *ctx, uint64_t iterations) {
+   math_bench_ctx *mc = (math_bench_ctx *)ctx;
+   const float *m = mc->m;
+   for (uint64_t i = 0; i < iterations; i++) {
+      for (int k = 0; k < BENCH_POINTS; k++) {
+         float x = mc->src[k * 2], y = mc->src[k * 2 + 1];
+         mc->dst[k * 2] = m[0] * x + m[2] * y + m[4];
+         mc->dst[k * 2 + 1] = m[1] * x + m[3] * y + m[5];
+      }
+   }
+}
+
+static void bench_transform_kernel(void *ctx, uint64_t iterations) {
+   math_bench_ctx *mc = (math_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++)
+      module_math_transform_points(mc->m, mc->src, mc->dst, BENCH_POINTS);
+}
+
+void bench_math_run(void) {
+   math_bench_ctx mc = {NULL, NULL, {0.8f, 0.6f, -0.6f, 0.8f, 100.0f, 50.0f}};
+   mc.src = (float *)malloc(BENCH_POINTS * 2 * sizeof(float));
+   mc.dst = (float *)malloc(BENCH_POINTS * 2 * sizeof(float));
+   if (!mc.src || !mc.dst) {
+      fprintf(stderr, "Failed to allocate math benchmark buffers\n");
+      goto cleanup;
+   }
+   for (int k = 0; k < BENCH_POINTS * 2; k++)
+      mc.src[k] = (float)(k % 512);
+
+   bench_run("math.transform_64k_scalar", bench_transform_scalar, &mc, 2000);
+   bench_run("math.transform_64k_simd", bench_transform_kernel, &mc, 2000);
+
+cleanup:
+   free(mc.src);
+   free(mc.dst);
+}
@@ -0,0 +1,52 @@
+// bench_memory.c
+// Lua allocator: pooled small blocks against the system heap, with the
+// allocation pattern of short-lived tables (many small blocks, freed in bulk).
+#include "bench.h"
+#include "module_memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_BLOCKS 1000
+
+typedef struct {
+   lua_Alloc alloc;
+   void *ud;
+   void *blocks[BENCH_BLOCKS];
+} alloc_bench_ctx;
+
+static void *system_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+   (void)ud; (void)osize;
+   if (nsize == 0) {
+      free(ptr);
+      return NULL;
+   }
+   return realloc(ptr, nsize);
+}
+
+// One "frame": allocate BENCH_BLOCKS blocks of 16..256 bytes, then free them
+static void bench_alloc_frame(void *ctx, uint64_t iterations) {
+   alloc_bench_ctx *ac = (alloc_bench_ctx *)ctx;
+   for (uint64_t i = 0; i < iterations; i++) {
+      for (int b = 0; b < BENCH_BLOCKS; b++)
+         ac->blocks[b] = ac->alloc(ac->ud, NULL, 5, 16 + (size_t)(b % 16) * 16);
+      for (int b = 0; b < BENCH_BLOCKS; b++)
+         ac->alloc(ac->ud, ac->blocks[b], 16 + (size_t)(b % 16) * 16, 0);
+   }
+}
+
+void bench_memory_run(void) {
+   static alloc_bench_ctx ctx;
+   lua_State *L = module_memory_new_state("bench");
+   if (!L) {
+      fprintf(stderr, "Failed to set up allocator benchmark\n");
+      return;
+   }
+
+   ctx.alloc = lua_getallocf(L, &ctx.ud);
+   bench_run("memory.pooled_1k_small", bench_alloc_frame, &ctx, 2000);
+   ctx.alloc = system_alloc;
+   ctx.ud = NULL;
+   bench_run("memory.system_1k_small", bench_alloc_frame, &ctx, 2000);
+
+   module_memory_close_state(L);
+}
@@ -0,0 +1,46 @@
+// bench_particles.c
+// Particle simulation and draw preparation at 100k live particles.
+#include "bench.h"
+#include "module_particles.h"
+#include <stdio.h>
+
+#define BENCH_PARTICLES 100000
+
+// One simulated frame with a steady-state particle count
+static void bench_particles_update(void *ctx, uint64_t iterations) {
+   (void)ctx;
+   for (uint64_t i = 0; i < iterations; i++)
+      module_particles_update(0.016f);
+}
+
+// Colour/size kernels plus the instanced submission (GL stubbed)
+static void bench_particles_render(void *ctx, uint64_t iterations) {
+   (void)ctx;
+   for (uint64_t i = 0; i < iterations; i++)
+      module_particles_render(512, 512);
+}
+
+void bench_particles_run(void) {
+   particle_emitter_config config;
+   module_particles_default_config(&config);
+   config.max_particles = BENCH_PARTICLES;
+   config.life[0] = config.life[1] = 1000.0f; // particles outlive the benchmark
+   config.speed[0] = 10.0f;
+   config.speed[1] = 80.0f;
+   config.gravity[1] = 50.0f;
+   config.drag = 0.1f;
+   config.size[0] = 8.0f;
+   config.size[1] = 0.0f;
+
+   int emitter = module_particles_create(&config, 0.0f, 0.0f);
+   if (emitter < 0 || module_particles_burst(emitter, BENCH_PARTICLES) != BENCH_PARTICLES) {
+      fprintf(stderr, "Failed to set up particle benchmark\n");
+      module_particles_destroy(emitter);
+      return;
+   }
+
+   bench_run("particles.update_100k", bench_particles_update, NULL, 200);
+   bench_run("particles.render_100k", bench_particles_render, NULL, 200);
+
+   module_particles_destroy(emitter);
+}
@@ -0,0 +1,190 @@
+// core_thread.h
+#ifndef CORE_THREAD_H
+#define CORE_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+// Threads, mutexes and condition variables over Win32 or pthreads.
+// Thread entry points are declared with CORE_THREAD_FUNC and end with
+// `return CORE_THREAD_RETURN;`.
+#ifdef _WIN32
+typedef HANDLE core_thread;
+typedef SRWLOCK core_mutex;
+typedef CONDITION_VARIABLE core_cond;
+#define CORE_THREAD_FUNC(name) DWORD WINAPI name(LPVOID arg)
+#define CORE_THREAD_RETURN 0
+typedef LPTHREAD_START_ROUTINE core_thread_fn;
+#else
+typedef pthread_t core_thread;
+typedef pthread_mutex_t core_mutex;
+typedef pthread_cond_t core_cond;
+#define CORE_THREAD_FUNC(name) void *name(void *arg)
+#define CORE_THREAD_RETURN NULL
+typedef void *(*core_thread_fn)(void *);
+#endif
+
+// Thread-local storage qualifier
+#ifdef _MSC_VER
+#define CORE_THREAD_LOCAL __declspec(thread)
+#else
+#define CORE_THREAD_LOCAL __thread
+#endif
+
+static inline bool core_thread_create(core_thread *thread, core_thread_fn fn, void *arg) {
+#ifdef _WIN32
+   *thread = CreateThread(NULL, 0, fn, arg, 0, NULL);
+   return *thread != NULL;
+#else
+   return pthread_create(thread, NULL, fn, arg) == 0;
+#endif
+}
+
+static inline void core_thread_join(core_thread thread) {
+#ifdef _WIN32
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+#else
+   pthread_join(thread, NULL);
+#endif
+}
+
+static inline void core_thread_yield(void) {
+#ifdef _WIN32
+   SwitchToThread();
+#else
+   sched_yield();
+#endif
+}
+
+// Number of logical processors (at least 1)
+static inline int core_cpu_count(void) {
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (int)n : 1;
+#endif
+}
+
+static inline void core_mutex_init(core_mutex *m) {
+#ifdef _WIN32
+   InitializeSRWLock(m);
+#else
+   pthread_mutex_init(m, NULL);
+#endif
+}
+
+static inline void core_mutex_destroy(core_mutex *m) {
+#ifdef _WIN32
+   (void)m;
+#else
+   pthread_mutex_destroy(m);
+#endif
+}
+
+static inline void core_mutex_lock(core_mutex *m) {
+#ifdef _WIN32
+   AcquireSRWLockExclusive(m);
+#else
+   pthread_mutex_lock(m);
+#endif
+}
+
+static inline void core_mutex_unlock(core_mutex *m) {
+#ifdef _WIN32
+   ReleaseSRWLockExclusive(m);
+#else
+   pthread_mutex_unlock(m);
+#endif
+}
+
+static inline void core_cond_init(core_cond *c) {
+#ifdef _WIN32
+   InitializeConditionVariable(c);
+#else
+   pthread_cond_init(c, NULL);
+#endif
+}
+
+static inline void core_cond_destroy(core_cond *c) {
+#ifdef _WIN32
+   (void)c;
+#else
+   pthread_cond_destroy(c);
+#endif
+}
+
+static inline void core_cond_wait(core_cond *c, core_mutex *m) {
+#ifdef _WIN32
+   SleepConditionVariableSRW(c, m, INFINITE, 0);
+#else
+   pthread_cond_wait(c, m);
+#endif
+}
+
+static inline void core_cond_signal(core_cond *c) {
+#ifdef _WIN32
+   WakeConditionVariable(c);
+#else
+   pthread_cond_signal(c);
+#endif
+}
+
+static inline void core_cond_broadcast(core_cond *c) {
+#ifdef _WIN32
+   WakeAllConditionVariable(c);
+#else
+   pthread_cond_broadcast(c);
+#endif
+}
+
+// Sequentially consistent 32-bit atomics
+static inline int32_t core_atomic_load(volatile int32_t *p) {
+#ifdef _WIN32
+   return (int32_t)InterlockedCompareExchange((volatile LONG *)p, 0, 0);
+#else
+   return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void core_atomic_store(volatile int32_t *p, int32_t v) {
+#ifdef _WIN32
+   InterlockedExchange((volatile LONG *)p, (LONG)v);
+#else
+   __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Add v and return the new value
+static inline int32_t core_atomic_add(volatile int32_t *p, int32_t v) {
+#ifdef _WIN32
+   return (int32_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)v) + v;
+#else
+   return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Replace *p with desired if it equals expected; returns true on success
+static inline bool core_atomic_cas(volatile int32_t *p, int32_t expected, int32_t desired) {
+#ifdef _WIN32
+   return InterlockedCompareExchange((volatile LONG *)p, (LONG)desired, (LONG)expected) == (LONG)expected;
+#else
+   return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#endif // CORE_THREAD_H
@@ -0,0 +1,37 @@
+// core_time.h
+#ifndef CORE_TIME_H
+#define CORE_TIME_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Monotonic clock in nanoseconds (only differences are meaningful)
+static inline uint64_t core_time_ns(void) {
+#ifdef _WIN32
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER now;
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&now);
+   return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Monotonic clock in seconds
+static inline double core_time_seconds(void) {
+   return (double)core_time_ns() * 1e-9;
+}
+
+#endif // CORE_TIME_H
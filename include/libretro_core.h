@@ -2,6 +2,21 @@
 #define LIBRETRO_CORE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <libretro.h>
+
+// Unified logging helper (lib.c)
+void core_log(enum retro_log_level level, const char *fmt, ...);
+
+// Drop log messages below this level before they are formatted
+void core_set_log_level(enum retro_log_level level);
+
+// Set the content zip path used for asset extraction
+void core_set_content_path(const char *path);
+
+// Whether the content zip holds asset_name; logs nothing, for callers that
+// probe for optional assets
+bool asset_exists_in_zip(const char *asset_name);
 
 // Extract asset from zip file
 bool extract_asset_from_zip(const char *asset_name, char **asset_data, size_t *asset_size);
@@ -0,0 +1,46 @@
+// module_broadphase.h
+#ifndef MODULE_BROADPHASE_H
+#define MODULE_BROADPHASE_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+   BROADPHASE_GRID = 0, // uniform spatial hash, rebuilt lazily after updates
+   BROADPHASE_TREE      // dynamic AABB tree with fattened leaves
+} broadphase_mode;
+
+typedef struct broadphase_world broadphase_world;
+
+// Create a world. cell_size is the grid cell edge (grid) or the leaf margin (tree).
+broadphase_world *module_broadphase_create(broadphase_mode mode, float cell_size);
+
+// Destroy a world
+void module_broadphase_destroy(broadphase_world *world);
+
+// Set bodies first..first+count-1 from packed AABBs {min_x, min_y, max_x, max_y}
+bool module_broadphase_set_bodies(broadphase_world *world, const float *aabbs, int count, int first);
+
+// Remove a body
+void module_broadphase_remove(broadphase_world *world, int body);
+
+// Remove every body
+void module_broadphase_clear(broadphase_world *world);
+
+// Write overlapping body pairs (a < b) as out_pairs[2k], out_pairs[2k + 1].
+// Returns the number written; *total receives the number found.
+int module_broadphase_query_pairs(broadphase_world *world, int32_t *out_pairs, int max_pairs, int *total);
+
+// Write bodies overlapping a rectangle; returns the number written (*total as above)
+int module_broadphase_query_rect(broadphase_world *world, float min_x, float min_y, float max_x, float max_y,
+                                 int32_t *out_bodies, int max_bodies, int *total);
+
+// Write bodies hit by a ray, nearest first, with their hit distance (out_t may be NULL)
+int module_broadphase_raycast(broadphase_world *world, float ox, float oy, float dx, float dy, float max_dist,
+                              int32_t *out_bodies, float *out_t, int max_hits);
+
+// Register the `broadphase` table in a Lua state
+void module_broadphase_register(lua_State *L);
+
+#endif // MODULE_BROADPHASE_H
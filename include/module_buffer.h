@@ -0,0 +1,43 @@
+// module_buffer.h
+#ifndef MODULE_BUFFER_H
+#define MODULE_BUFFER_H
+
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Element types of a typed buffer
+typedef enum {
+   BUFFER_F32 = 0,
+   BUFFER_I32,
+   BUFFER_U32
+} buffer_type;
+
+// Fixed-size array of 32-bit elements shared between Lua and C without
+// per-element tables. The elements follow the header in the same userdata.
+typedef struct {
+   buffer_type type;
+   size_t count;
+   void *data;
+} core_buffer;
+
+#define BUFFER_F32_DATA(buf) ((float *)(buf)->data)
+#define BUFFER_I32_DATA(buf) ((int32_t *)(buf)->data)
+#define BUFFER_U32_DATA(buf) ((uint32_t *)(buf)->data)
+
+// Create a zero-filled buffer and push it onto the Lua stack
+core_buffer *module_buffer_push(lua_State *L, buffer_type type, size_t count);
+
+// Check that argument arg is a buffer of the given type (raises a Lua error otherwise)
+core_buffer *module_buffer_check(lua_State *L, int arg, buffer_type type);
+
+// Return the buffer at arg, or NULL if it is not one
+core_buffer *module_buffer_test(lua_State *L, int arg);
+
+// Name of an element type ("f32", "i32", "u32")
+const char *module_buffer_type_name(buffer_type type);
+
+// Register the `buffer` table in a Lua state
+void module_buffer_register(lua_State *L);
+
+#endif // MODULE_BUFFER_H
@@ -0,0 +1,28 @@
+// module_camera.h
+#ifndef MODULE_CAMERA_H
+#define MODULE_CAMERA_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Depth of the transform stack
+#define CAMERA_STACK_DEPTH 32
+
+// Centre the virtual viewport on world (x, y), scaled by zoom (> 0) and
+// turned by rotation degrees. Kept across frames.
+void module_camera_set(float x, float y, float zoom, float rotation);
+
+// Compose a local transform (translate to (x, y), rotate by rotation
+// degrees, scale by sx, sy) under the current one for the draws up to the
+// matching pop; false when the stack is full / empty
+bool module_camera_push(float x, float y, float rotation, float sx, float sy);
+bool module_camera_pop(void);
+
+// Empty the transform stack and apply the camera to the frame's draws; call
+// once per frame after the frame's command list begins recording
+void module_camera_begin_frame(void);
+
+// Register set_camera, get_camera, push_transform and pop_transform
+void module_camera_register(lua_State *L);
+
+#endif // MODULE_CAMERA_H
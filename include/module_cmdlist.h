@@ -0,0 +1,96 @@
+// module_cmdlist.h
+#ifndef MODULE_CMDLIST_H
+#define MODULE_CMDLIST_H
+
+#include <glad/glad.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recorded frame of draw calls. While a list is being recorded on a thread,
+// the module_opengl draw functions called from that thread append to it
+// instead of touching GL; replaying the list on the GL thread issues them.
+typedef struct cmdlist cmdlist;
+
+cmdlist *module_cmdlist_create(void);
+void module_cmdlist_destroy(cmdlist *list);
+
+// Drop all recorded commands (keeps the storage)
+void module_cmdlist_reset(cmdlist *list);
+
+// Route this thread's draw calls into list until module_cmdlist_end
+void module_cmdlist_begin(cmdlist *list);
+void module_cmdlist_end(void);
+
+// List recorded by the calling thread, NULL if draws go straight to GL
+cmdlist *module_cmdlist_recording(void);
+
+// Issue the recorded commands (GL thread only). Draws are sorted through
+// the module_opengl render queue; the result matches issuing them in order
+// within each layer.
+void module_cmdlist_replay(const cmdlist *list);
+
+// Issue only what a list changes on the GPU (uploads, frees and render
+// target passes) without drawing the frame; for lists that are dropped or
+// duped instead of replayed. GL thread only.
+void module_cmdlist_replay_resources(const cmdlist *list);
+
+// Number of commands and bytes recorded
+int module_cmdlist_count(const cmdlist *list);
+size_t module_cmdlist_size(const cmdlist *list);
+
+// The recorded bytes (module_cmdlist_size of them). Recording the same draws
+// with the same arguments yields the same bytes.
+const void *module_cmdlist_data(const cmdlist *list);
+
+// Whether the frame asked to be shown; Lua's present(false) clears it for
+// the frame being recorded. Reset to true by module_cmdlist_reset.
+void module_cmdlist_set_present(cmdlist *list, bool present);
+bool module_cmdlist_wants_present(const cmdlist *list);
+
+// Render queue layer of the draws recorded from now on (clamped to
+// CMDLIST_MIN_LAYER..CMDLIST_MAX_LAYER, 0 after a reset). On replay, lower
+// layers are drawn first; within a layer opaque draws are grouped by state.
+#define CMDLIST_MIN_LAYER -128
+#define CMDLIST_MAX_LAYER 127
+void module_cmdlist_set_layer(cmdlist *list, int layer);
+
+// View of the draws recorded from now on (see module_opengl_set_view;
+// the identity after a reset). Only changes are recorded.
+void module_cmdlist_set_view(cmdlist *list, const float *affine);
+
+// True if the list uploads, frees or redraws GPU resources, so replaying it
+// matters even when nothing new reaches the screen
+bool module_cmdlist_mutates(const cmdlist *list);
+
+// Recorders, with the arguments of the matching module_opengl functions.
+// Vertex, text, glyph and instance arrays are copied into the list.
+void module_cmdlist_solid_quad(cmdlist *list, float x, float y, float w, float h, float rotation,
+                               float r, float g, float b, float a, float vp_width, float vp_height);
+void module_cmdlist_triangles(cmdlist *list, const float *vertices, int num_vertices, float x, float y,
+                              float rotation, float r, float g, float b, float a,
+                              float vp_width, float vp_height);
+void module_cmdlist_text(cmdlist *list, float x, float y, const char *text,
+                         float r, float g, float b, float a, float vp_width, float vp_height);
+void module_cmdlist_glyphs(cmdlist *list, const float *quads, int count, float x, float y,
+                           float r, float g, float b, float a, float vp_width, float vp_height);
+void module_cmdlist_texture(cmdlist *list, GLuint texture_id, float x, float y, float w, float h,
+                            float rotation, float r, float g, float b, float a,
+                            float vp_width, float vp_height);
+void module_cmdlist_texture_instanced(cmdlist *list, GLuint texture_id, int count,
+                                      const float *xs, const float *ys, const float *sizes,
+                                      const uint32_t *colors, bool additive,
+                                      float vp_width, float vp_height);
+void module_cmdlist_free_texture(cmdlist *list, GLuint texture_id);
+bool module_cmdlist_upload_glyph(cmdlist *list, int x, int y, int w, int h, const unsigned char *pixels);
+void module_cmdlist_upload_mesh(cmdlist *list, GLuint vbo, const float *vertices, int num_vertices);
+void module_cmdlist_draw_mesh(cmdlist *list, GLuint vao, int num_vertices, GLuint texture_id, float x, float y,
+                              float r, float g, float b, float a, float vp_width, float vp_height);
+void module_cmdlist_free_meshes(cmdlist *list, int count, const GLuint *vaos, const GLuint *vbos);
+void module_cmdlist_begin_target(cmdlist *list, GLuint fbo, int width, int height);
+void module_cmdlist_end_target(cmdlist *list);
+void module_cmdlist_draw_target(cmdlist *list, GLuint texture, float x, float y, float w, float h,
+                                float opacity, float vp_width, float vp_height);
+void module_cmdlist_free_target(cmdlist *list, GLuint fbo, GLuint texture);
+
+#endif // MODULE_CMDLIST_H
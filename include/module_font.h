@@ -0,0 +1,43 @@
+// module_font.h
+#ifndef MODULE_FONT_H
+#define MODULE_FONT_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Pixel sizes load_font accepts, and how many fonts may be loaded
+#define FONT_MIN_SIZE 4
+#define FONT_MAX_SIZE 256
+#define FONT_MAX_FONTS 64
+
+// TrueType fonts. Text is UTF-8; glyphs are rasterized into the shared
+// glyph atlas the first time they are drawn. Everything but
+// module_font_context_reset runs on the thread that runs Lua.
+
+// Load a TrueType asset at size pixels per line; returns the font's id
+// (> 0), the same one for the same asset and size, or 0 on failure
+int module_font_load(const char *asset_name, float size);
+
+// Draw text with its top-left corner at (x, y), like module_opengl_draw_text;
+// '\n' starts a new line
+void module_font_draw(int font, float x, float y, const char *text,
+                      float r, float g, float b, float a, float vp_width, float vp_height);
+
+// Size of the box module_font_draw lays text out in; false for an unknown font
+bool module_font_measure(int font, const char *text, float *width, float *height);
+
+// Start a frame: the glyphs drawn from now on keep their atlas space until
+// the next call. Call once per frame before the frame's draws.
+void module_font_begin_frame(void);
+
+// The GL context was recreated with an empty atlas; glyphs are rasterized
+// again from the next frame on. Safe from any thread.
+void module_font_context_reset(void);
+
+// Free every font and cached glyph and layout
+void module_font_shutdown(void);
+
+// Register load_font and measure_text
+void module_font_register(lua_State *L);
+
+#endif // MODULE_FONT_H
@@ -0,0 +1,19 @@
+// module_hotreload.h
+#ifndef MODULE_HOTRELOAD_H
+#define MODULE_HOTRELOAD_H
+
+#include <stdbool.h>
+
+// Watch the content zip at zip_path and remember the checksums of its Lua
+// chunks; returns false if the file cannot be watched
+bool module_hotreload_start(const char *zip_path);
+
+// Check for changes to the zip and, once it has stopped changing, reload the
+// modified Lua chunks into the main state and call on_reload(). Call once per
+// frame while no update is running (after module_pipeline_sync).
+void module_hotreload_poll(void);
+
+// Stop watching
+void module_hotreload_stop(void);
+
+#endif // MODULE_HOTRELOAD_H
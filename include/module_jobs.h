@@ -0,0 +1,62 @@
+// module_jobs.h
+#ifndef MODULE_JOBS_H
+#define MODULE_JOBS_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define JOB_MAX_CONTINUATIONS 8
+
+typedef void (*job_func)(void *data);
+typedef void (*job_range_func)(void *ctx, int begin, int end);
+
+// A unit of work. Jobs are owned by the caller and must stay alive until
+// module_jobs_wait returns (or module_jobs_done reports true).
+typedef struct job {
+   job_func fn;
+   void *data;
+   volatile int32_t pending;  // unfinished dependencies, plus one until submitted
+   volatile int32_t lock;     // guards the continuation list
+   volatile int32_t closed;   // finished running; no new continuations
+   volatile int32_t done;     // set last; the job may be reused or freed after
+   int32_t num_continuations;
+   struct job *continuations[JOB_MAX_CONTINUATIONS];
+} job;
+
+// Start the worker threads (num_workers < 0 picks one per core minus the caller)
+bool module_jobs_init(int num_workers);
+
+// Stop and join the worker threads; queued jobs are finished first
+void module_jobs_shutdown(void);
+
+// Number of worker threads (0 if jobs run on the waiting thread only)
+int module_jobs_worker_count(void);
+
+// Initialize a job before adding dependencies or submitting it
+void module_jobs_prepare(job *j, job_func fn, void *data);
+
+// Make j run only after `before` finished. Call before submitting j.
+// Returns false if before already has JOB_MAX_CONTINUATIONS dependents.
+bool module_jobs_depend(job *j, job *before);
+
+// Queue a job; it runs once all its dependencies are done
+void module_jobs_submit(job *j);
+
+// True once the job has run
+bool module_jobs_done(job *j);
+
+// Block until the job has run, executing queued jobs meanwhile
+void module_jobs_wait(job *j);
+
+// Call fn over [0, count) split into ranges of at least grain indices,
+// across the workers and the calling thread; returns when all ranges are done
+void module_jobs_parallel_for(int count, int grain, job_range_func fn, void *ctx);
+
+// Sort keys ascending (stable LSD radix sort), permuting values alongside if not NULL
+bool module_jobs_sort_keys(uint32_t *keys, int32_t *values, int count);
+
+// Register the `jobs` table in a Lua state
+void module_jobs_register(lua_State *L);
+
+#endif // MODULE_JOBS_H
@@ -0,0 +1,57 @@
+// module_layer.h
+#ifndef MODULE_LAYER_H
+#define MODULE_LAYER_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Create an offscreen layer of width x height pixels that holds the whole
+// virtual screen; returns its id or -1. New layers start dirty.
+int module_layer_create(int width, int height);
+
+// Free a layer (ordered after the recorded draws that use it)
+void module_layer_destroy(int id);
+
+// Start redrawing a layer if it is dirty (or force is set): the layer is
+// cleared and the draws up to module_layer_finish land in it. Returns false,
+// and redirects nothing, when the layer is clean. Layers do not nest.
+bool module_layer_begin(int id, bool force);
+void module_layer_finish(void);
+
+// Mark a layer for redrawing
+void module_layer_invalidate(int id);
+bool module_layer_is_dirty(int id);
+
+// Composite a layer as one textured quad covering the virtual screen, offset
+// by (x, y)
+void module_layer_draw(int id, float x, float y, float opacity, float vp_width, float vp_height);
+
+// Start a frame; after a context reset, recreates every layer's target and
+// marks it dirty. Call once per frame before the frame's draws.
+void module_layer_begin_frame(void);
+
+// The GL context was recreated and the layers' targets are gone; they are
+// rebuilt by the next module_layer_begin_frame. Safe from any thread.
+void module_layer_context_reset(void);
+
+// Close a layer the script left open (after an error in update); call once
+// per frame after update()
+void module_layer_end_frame(void);
+
+// Bracket a run of script.lua's top level. Layers it creates are numbered in
+// order; on a reload, the n-th layer.new returns the previous run's n-th
+// layer (marked dirty) instead of a new one, and a completed reload frees
+// the previous run's layers it did not ask for again.
+void module_layer_begin_script(bool reload);
+void module_layer_end_script(bool completed);
+
+// Free every layer, when the Lua state that created them is closed
+void module_layer_clear(void);
+
+// Free every layer and the module's storage
+void module_layer_shutdown(void);
+
+// Register the `layer` table in a Lua state
+void module_layer_register(lua_State *L);
+
+#endif // MODULE_LAYER_H
@@ -7,6 +7,22 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+// What the watchdog does when update() runs past its per-frame budget
+typedef enum {
+   WATCHDOG_OFF = 0,
+   WATCHDOG_WARN,    // log the overrun with a traceback, once per frame
+   WATCHDOG_ABORT,   // raise an error that ends this frame's update()
+   WATCHDOG_YIELD    // yield the running task (resumed next frame); warn elsewhere
+} lua_watchdog_mode;
+
+// Configure the update() watchdog; set it before init so coroutines created
+// by the script inherit the hook
+void module_lua_set_watchdog(lua_watchdog_mode mode, double budget_ms);
+
+// (Re)install the count hook for the watchdog and profiler settings on the
+// main thread of T's state and on T; coroutines created afterwards inherit it
+void module_lua_refresh_hook(lua_State *T);
+
 // Initialize Lua and load script from file
 bool module_lua_init(void);
 
@@ -19,6 +35,9 @@ void module_lua_deinit(void);
 // Run Lua update function
 void module_lua_update(float animation_time);
 
+// Let require() load modules from the content zip ("a.b" -> a/b.lua)
+void module_lua_install_zip_searcher(lua_State *L);
+
 // Get Lua state for external use
 lua_State *module_lua_get_state(void);
 
@@ -0,0 +1,15 @@
+// module_math.h
+#ifndef MODULE_MATH_H
+#define MODULE_MATH_H
+
+#include <lua.h>
+
+// Apply the affine transform m = {a, b, c, d, tx, ty} to count x, y pairs:
+// x' = a*x + c*y + tx, y' = b*x + d*y + ty. dst may be src. Runs as a SIMD
+// kernel (AVX or SSE2 when the compiler targets them).
+void module_math_transform_points(const float m[6], const float *src, float *dst, int count);
+
+// Register the `vec2`, `mat3` and `transform` tables in a Lua state
+void module_math_register(lua_State *L);
+
+#endif // MODULE_MATH_H
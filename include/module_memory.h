@@ -0,0 +1,73 @@
+// module_memory.h
+#ifndef MODULE_MEMORY_H
+#define MODULE_MEMORY_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How the garbage collector of a state is scheduled
+typedef enum {
+   LUA_GC_AUTO = 0,        // Lua's own pacing (collects during allocations)
+   LUA_GC_INCREMENTAL,     // stopped; incremental steps in the frame's spare time
+   LUA_GC_GENERATIONAL     // stopped; one young collection per frame
+} lua_gc_mode;
+
+// Allocation statistics of one Lua state
+typedef struct {
+   size_t live_bytes;
+   size_t peak_bytes;
+   size_t limit_bytes;           // 0 = unlimited
+   uint64_t total_allocs;
+   uint32_t frame_allocs;        // in the frame being run
+   size_t frame_bytes;
+   uint32_t last_frame_allocs;   // in the last completed frame
+   size_t last_frame_bytes;
+   uint32_t limit_failures;      // allocations refused by the limit, since start
+
+   lua_gc_mode gc_mode;
+   uint64_t frame_gc_ns;         // collector time in the frame being run
+   uint64_t last_frame_gc_ns;
+   uint64_t max_gc_ns;           // longest per-frame collector time since the last summary
+   uint64_t gc_steps;
+   uint32_t gc_cycles;           // completed incremental cycles
+} lua_memory_stats;
+
+// Create a Lua state backed by the pooled allocator with its own accounting.
+// name tags log messages; the limit set by module_memory_set_limit applies.
+lua_State *module_memory_new_state(const char *name);
+
+// Close a state created by module_memory_new_state and free its accounting
+void module_memory_close_state(lua_State *L);
+
+// Hard cap on live bytes for states created afterwards (0 = unlimited)
+void module_memory_set_limit(size_t bytes);
+
+// Statistics of a state created by module_memory_new_state (NULL otherwise)
+const lua_memory_stats *module_memory_stats(lua_State *L);
+
+// Switch the collector mode of a state created by module_memory_new_state
+void module_memory_set_gc_mode(lua_State *L, lua_gc_mode mode);
+
+// Run collector steps for up to budget_ns (at least one step) unless the
+// state uses LUA_GC_AUTO; the time spent is added to the frame's GC pause.
+// A state whose heap outgrows its last collected size by a wide margin
+// finishes the cycle regardless of the budget.
+void module_memory_collect(lua_State *L, uint64_t budget_ns);
+
+// Close the state's current frame: roll over the per-frame counters and
+// periodically log a summary
+void module_memory_end_frame(lua_State *L);
+
+// Hand the calling thread's cached blocks back to the shared pool; call
+// before a thread that ran Lua states exits
+void module_memory_thread_exit(void);
+
+// Free the pools once no state is left (retro_deinit)
+void module_memory_shutdown(void);
+
+// Register the `memory` table in a Lua state
+void module_memory_register(lua_State *L);
+
+#endif // MODULE_MEMORY_H
@@ -4,6 +4,11 @@
 #include <libretro.h>
 #include <glad/glad.h>
 
+// Scripts draw in a fixed virtual space of this size; the render resolution
+// only changes how many pixels cover it
+#define VIRTUAL_WIDTH 512
+#define VIRTUAL_HEIGHT 512
+
 // Set RetroArch HW render callbacks (call before init)
 void module_opengl_set_callbacks(retro_hw_get_proc_address_t get_proc_address,
                                 retro_hw_get_current_framebuffer_t get_current_framebuffer,
@@ -21,14 +26,79 @@ void module_opengl_draw_solid_quad(float x, float y, float w, float h,
                                    float r, float g, float b, float a,
                                    float vp_width, float vp_height);
 
+// Draw a solid shape from its vertices around (x, y): four vertices are a
+// quad in strip order (0-1-2, 1-2-3), any other count of 3 or more the
+// outline of a simple polygon, triangulated by module_shape
 void module_opengl_draw_custom_quad(float *vertices, int num_vertices, float x, float y,
                                    float rotation, float r, float g, float b, float a,
                                    float vp_width, float vp_height);
 
-// Bind framebuffer for rendering
+// Draw a solid triangle list (x, y per vertex) moved to (x, y) and rotated.
+// Solid geometry is appended to one shared vertex stream.
+void module_opengl_draw_triangles(const float *vertices, int num_vertices, float x, float y,
+                                  float rotation, float r, float g, float b, float a,
+                                  float vp_width, float vp_height);
+
+// Build the 2D model-view-projection the draw shaders apply under the
+// identity view (column-major 4x4)
+void module_opengl_build_mvp(float x, float y, float rotation,
+                             float vp_width, float vp_height, float *out_mvp);
+
+// Views: 2D affine transforms {a, b, c, d, tx, ty} (x' = a x + c y + tx,
+// y' = b x + d y + ty) from the draws' coordinates to the virtual viewport.
+// The shaders read the view-projection from one uniform buffer, so a draw
+// only sets its own model transform; the projection always spans the
+// virtual space, and the vp_width/vp_height arguments of the draw functions
+// only size the culling viewport.
+//
+// set_view applies to the draws that follow on the recording thread: recorded
+// into the list being recorded, or uploaded straight away in direct mode.
+void module_opengl_set_view(const float *affine);
+
+// Upload count views (count >= 1) as the buffer's slots and select slot 0;
+// use_view selects the slot later draws read. GL thread only.
+void module_opengl_upload_views(const float *affines, int count);
+void module_opengl_use_view(int index);
+
+// World-space box the viewport shows under the recording thread's view
+void module_opengl_view_bounds(float vp_width, float vp_height,
+                               float *min_x, float *min_y, float *max_x, float *max_y);
+
+// Viewport culling of recorded draws. True if a w x h box centred at (x, y)
+// and rotated by rotation degrees overlaps the viewport under the recording
+// thread's view, in the draw functions' coordinates.
+bool module_opengl_rect_visible(float x, float y, float w, float h, float rotation,
+                                float vp_width, float vp_height);
+
+// Copy the sprites that overlap the viewport to the out arrays (which may
+// not alias the inputs); returns how many there are
+int module_opengl_cull_sprites(int count, const float *xs, const float *ys, const float *sizes,
+                               const uint32_t *colors, float vp_width, float vp_height,
+                               float *out_xs, float *out_ys, float *out_sizes, uint32_t *out_colors);
+
+// Close the frame's culling counts (call once per frame before recording);
+// module_opengl_cull_stats then reports the draws and instanced sprites of
+// that frame that were submitted and culled. Culling state is shared, not
+// per thread: only the thread recording frames may use these, set_view,
+// view_bounds and the culling tests.
+void module_opengl_end_cull_frame(void);
+void module_opengl_cull_stats(int *submitted, int *culled);
+
+// Size of the frame handed to the frontend (defaults to the virtual size)
+void module_opengl_set_output_size(int width, int height);
+
+// Draw frames into fbo at width x height instead of the frontend
+// framebuffer; fbo 0 goes back to the frontend framebuffer at output size
+void module_opengl_set_render_target(GLuint fbo, int width, int height);
+
+// Bind the framebuffer frames are drawn into (the render target if one is
+// set); false when the frontend's is unusable and 0 is bound instead
 bool module_opengl_bind_framebuffer(void);
 
-// Set viewport
+// Bind the frontend's framebuffer whatever the render target
+bool module_opengl_bind_output_framebuffer(void);
+
+// Set the viewport to the render size
 void module_opengl_set_viewport(void);
 
 // Clear framebuffer
@@ -40,20 +110,90 @@ void module_opengl_check_error(const char *context);
 // Get OpenGL initialization status
 bool module_opengl_is_initialized(void);
 
-// Draw text
+// Draw text in the built-in 8x8 font, its top-left corner at (x, y), as one
+// batch
 void module_opengl_draw_text(float x, float y, const char *text,
                              float r, float g, float b, float a,
                              float vp_width, float vp_height);
 
+// Glyph atlas: one GLYPH_ATLAS_SIZE square single-channel texture holding
+// the glyphs of every loaded font (see module_font), which manages its space.
+#define GLYPH_ATLAS_SIZE 1024
+
+// Copy a w x h glyph bitmap (a byte per pixel, top row first) into the atlas
+// at (x, y). A recorded upload is replayed before the frame's first draw, so
+// it must not overwrite a glyph drawn earlier in the same frame. False if it
+// could not be recorded.
+bool module_opengl_upload_glyph(int x, int y, int w, int h, const unsigned char *pixels);
+
+// Draw count glyph quads from the atlas in one batch. Each quad is
+// {x0, y0, x1, y1, u0, v0, u1, v1}: corners relative to (x, y), the text's
+// top-left corner as for module_opengl_draw_text, and atlas texcoords.
+void module_opengl_draw_glyphs(const float *quads, int count, float x, float y,
+                               float r, float g, float b, float a,
+                               float vp_width, float vp_height);
+
 // Load image from data and create OpenGL texture
 GLuint module_opengl_load_image(const char *asset_name, int *width, int *height);
 
+// The two halves of module_opengl_load_image. Decoding touches no GL state
+// and may run on any thread; it returns RGBA8 pixels to pass to
+// module_opengl_free_image, or NULL. Uploading from a pipelined update is
+// handed to the GL thread.
+unsigned char *module_opengl_decode_image(const char *asset_name, int *width, int *height);
+GLuint module_opengl_upload_image(const unsigned char *pixels, int width, int height);
+void module_opengl_free_image(unsigned char *pixels);
+
 // Draw textured quad
 void module_opengl_draw_texture(GLuint texture_id, float x, float y, float w, float h,
                                 float rotation, float r, float g, float b, float a,
                                 float vp_width, float vp_height);
 
+// Draw count square sprites centred at (xs[i], ys[i]) with edge sizes[i] and packed
+// RGBA8 colours in one instanced call. Texture 0 draws untextured sprites.
+void module_opengl_draw_texture_instanced(GLuint texture_id, int count,
+                                          const float *xs, const float *ys, const float *sizes,
+                                          const uint32_t *colors, bool additive,
+                                          float vp_width, float vp_height);
+
 // Free OpenGL texture
 void module_opengl_free_texture(GLuint texture_id);
 
+// Static meshes: textured triangles (x, y, u, v per vertex) kept in their own
+// vertex buffer, for geometry that rarely changes. Creating meshes from a
+// pipelined update is handed to the GL thread; uploads, draws and frees are
+// recorded like the draw calls.
+bool module_opengl_create_meshes(int count, GLuint *vaos, GLuint *vbos);
+void module_opengl_upload_mesh(GLuint vbo, const float *vertices, int num_vertices);
+void module_opengl_draw_mesh(GLuint vao, int num_vertices, GLuint texture_id, float x, float y,
+                             float r, float g, float b, float a, float vp_width, float vp_height);
+void module_opengl_free_meshes(int count, const GLuint *vaos, const GLuint *vbos);
+
+// Offscreen render targets: an RGBA8 texture behind a framebuffer object,
+// created cleared to transparent (handed to the GL thread from a pipelined
+// update). Between begin and end, draws land in the target with
+// premultiplied alpha; draw_target composites it as one quad covering
+// (x, y, w, h). Begin, end, draw and free are recorded like the draw calls.
+bool module_opengl_create_target(int width, int height, GLuint *fbo, GLuint *texture);
+void module_opengl_begin_target(GLuint fbo, int width, int height);
+void module_opengl_end_target(void);
+void module_opengl_draw_target(GLuint texture, float x, float y, float w, float h, float opacity,
+                               float vp_width, float vp_height);
+void module_opengl_free_target(GLuint fbo, GLuint texture);
+
+// Render queue: draws replayed from a command list are queued with their
+// layer (-128..127), the program they use, their texture and their alpha,
+// then issued sorted so that opaque draws of a layer are grouped by state
+// and translucent ones keep their order. draw is handed back to issue() on
+// flush. Flush before anything that changes what later draws see.
+typedef enum {
+   DRAW_PROGRAM_SOLID = 0,
+   DRAW_PROGRAM_TEXTURE,
+   DRAW_PROGRAM_TEXT,
+   DRAW_PROGRAM_INSTANCED
+} draw_program;
+
+bool module_opengl_queue_draw(int layer, draw_program program, GLuint texture, float alpha, const void *draw);
+void module_opengl_flush_queue(void (*issue)(const void *draw));
+
 #endif // MODULE_OPENGL_H
\ No newline at end of file
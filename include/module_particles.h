@@ -0,0 +1,61 @@
+// module_particles.h
+#ifndef MODULE_PARTICLES_H
+#define MODULE_PARTICLES_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Emitter settings; ranges are {min, max} and sampled uniformly per particle
+typedef struct {
+   int max_particles;
+   unsigned int texture;  // 0 for untextured sprites
+   bool additive;         // additive instead of alpha blending
+   float rate;            // particles per second spawned continuously
+   float life[2];         // seconds
+   float speed[2];
+   float angle[2];        // launch direction in degrees
+   float radius;          // spawn disc radius around the emitter position
+   float gravity[2];
+   float drag;            // fraction of velocity lost per second
+   float size[2];         // size at birth, size at death
+   float color_start[4];
+   float color_end[4];
+} particle_emitter_config;
+
+// Fill a config with defaults
+void module_particles_default_config(particle_emitter_config *config);
+
+// Create an emitter at (x, y); returns its id or -1
+int module_particles_create(const particle_emitter_config *config, float x, float y);
+
+// Destroy an emitter and its particles
+void module_particles_destroy(int emitter);
+
+// Destroy every emitter
+void module_particles_clear(void);
+
+// Free all storage
+void module_particles_deinit(void);
+
+// Emitter controls
+void module_particles_set_position(int emitter, float x, float y);
+void module_particles_set_rate(int emitter, float rate);
+void module_particles_set_visible(int emitter, bool visible);
+
+// Spawn count particles at the emitter position; returns the number spawned
+int module_particles_burst(int emitter, int count);
+
+// Live particles of one emitter (-1 for all emitters)
+int module_particles_count(int emitter);
+
+// Spawn, integrate and retire particles of every emitter
+void module_particles_update(float dt);
+
+// Draw every visible emitter, one instanced draw each
+void module_particles_render(float vp_width, float vp_height);
+
+// Register the `particles` table in a Lua state
+void module_particles_register(lua_State *L);
+
+#endif // MODULE_PARTICLES_H
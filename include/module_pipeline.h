@@ -0,0 +1,47 @@
+// module_pipeline.h
+#ifndef MODULE_PIPELINE_H
+#define MODULE_PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Switch between direct frames (update, then draw) and pipelined frames,
+// where the Lua update for frame N+1 runs on its own thread while the GL
+// thread replays frame N. Pipelining adds one frame of input latency.
+bool module_pipeline_set_enabled(bool enabled);
+bool module_pipeline_enabled(void);
+
+// Wait for the update in flight. Call before touching input snapshots or
+// anything else the update reads; no-op in direct mode.
+void module_pipeline_sync(void);
+
+// Run the particles, Lua update and scene for animation_time, recording
+// their draws, and replay a recorded frame into the frontend framebuffer.
+// With can_skip set, a frame identical to the last one drawn (or one the
+// script declined to present) is not replayed; returns false then, and the
+// caller should ask the frontend to dupe.
+bool module_pipeline_frame(float animation_time, float vp_width, float vp_height, bool can_skip);
+
+// Forget the frame on screen so the next one is drawn (after a context reset)
+void module_pipeline_invalidate_frame(void);
+
+// Collect Lua garbage in the time the frame that began at frame_start_ns
+// has left (at most the GC budget), then close the frame's memory
+// statistics. Called at the end of retro_run; pipelined updates do this on
+// the update thread instead.
+void module_pipeline_end_frame(uint64_t frame_start_ns);
+
+// Upper bound on garbage collection time per frame
+void module_pipeline_set_gc_budget(double milliseconds);
+
+// True on the thread running pipelined updates
+bool module_pipeline_is_update_thread(void);
+
+// Run fn on the GL thread and wait for it (called from the update thread;
+// serviced while the GL thread waits in module_pipeline_sync)
+void module_pipeline_call_gl(void (*fn)(void *), void *data);
+
+// Stop the update thread and free the command lists
+void module_pipeline_shutdown(void);
+
+#endif // MODULE_PIPELINE_H
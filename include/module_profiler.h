@@ -0,0 +1,22 @@
+// module_profiler.h
+#ifndef MODULE_PROFILER_H
+#define MODULE_PROFILER_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Instructions between hook calls while profiling
+#define PROFILER_HOOK_INSTRUCTIONS 100
+
+// True between profiler.start() and profiler.stop()
+bool module_profiler_running(void);
+
+// Called from the Lua count hook: take a stack sample of T if the sampling
+// interval has passed at time now
+void module_profiler_sample(lua_State *T, uint64_t now);
+
+// Register the `profiler` table in a Lua state
+void module_profiler_register(lua_State *L);
+
+#endif // MODULE_PROFILER_H
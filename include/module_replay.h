@@ -0,0 +1,38 @@
+// module_replay.h
+#ifndef MODULE_REPLAY_H
+#define MODULE_REPLAY_H
+
+#include <libretro.h>
+#include <stdbool.h>
+
+typedef enum {
+   REPLAY_OFF = 0,
+   REPLAY_RECORD,
+   REPLAY_PLAYBACK
+} replay_mode;
+
+// Start recording to or playing back from path
+bool module_replay_start(replay_mode mode, const char *path);
+
+// Stop and close the replay file (records flush their frame count)
+void module_replay_stop(void);
+
+// Current mode (REPLAY_OFF once playback reaches the end of the file)
+replay_mode module_replay_get_mode(void);
+
+// Call once per frame after polling input: snapshots the frontend's joypad
+// state and animation time into the file, or restores both from it
+void module_replay_frame(retro_input_state_t frontend_cb, float *animation_time);
+
+// Snapshot the frontend's joypad state without recording it, so the
+// current frame's input can be read from another thread (pipelined frames)
+void module_replay_latch(retro_input_state_t frontend_cb);
+
+// Read the frontend's input directly again (frames updated on the frontend
+// thread); starting or stopping a replay does this too
+void module_replay_unlatch(void);
+
+// Input callback answering from the current frame's snapshot
+int16_t module_replay_input_state(unsigned port, unsigned device, unsigned index, unsigned id);
+
+#endif // MODULE_REPLAY_H
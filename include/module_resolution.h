@@ -0,0 +1,30 @@
+// module_resolution.h
+#ifndef MODULE_RESOLUTION_H
+#define MODULE_RESOLUTION_H
+
+#include <stdbool.h>
+
+// Largest output size the frontend is told to expect
+#define RESOLUTION_MAX_SIZE 1024
+
+// Set the size of the frames handed to the frontend. With budget_ms > 0,
+// frames are drawn into an internal target scaled between min_scale and 1
+// of that size so that their GPU time stays under budget_ms, and upscaled
+// into the frontend framebuffer; 0 draws at output size directly.
+void module_resolution_configure(int width, int height, double budget_ms, float min_scale);
+void module_resolution_output_size(int *width, int *height);
+
+// Current render scale (1 when drawing at output size)
+float module_resolution_scale(void);
+
+// Bracket the GL work of a frame: begin picks the render size from the GPU
+// times measured so far and redirects module_opengl_bind_framebuffer to it;
+// end upscales the frame into the frontend framebuffer. GL thread only.
+void module_resolution_begin_frame(void);
+void module_resolution_end_frame(void);
+
+// Forget GL objects lost with the context / delete them before it goes
+void module_resolution_context_reset(void);
+void module_resolution_context_destroy(void);
+
+#endif // MODULE_RESOLUTION_H
@@ -0,0 +1,83 @@
+// module_scene.h
+#ifndef MODULE_SCENE_H
+#define MODULE_SCENE_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Node kinds
+typedef enum {
+   SCENE_NODE_GROUP = 0,
+   SCENE_NODE_QUAD,
+   SCENE_NODE_SPRITE,
+   SCENE_NODE_TEXT
+} scene_node_kind;
+
+// Single float properties of a node, for code that animates them generically
+typedef enum {
+   SCENE_PROP_X = 0,
+   SCENE_PROP_Y,
+   SCENE_PROP_ROTATION,
+   SCENE_PROP_SX,
+   SCENE_PROP_SY,
+   SCENE_PROP_W,
+   SCENE_PROP_H,
+   SCENE_PROP_R,
+   SCENE_PROP_G,
+   SCENE_PROP_B,
+   SCENE_PROP_A,
+   SCENE_PROP_COUNT
+} scene_property;
+
+// Id of the implicit root group every node hangs off
+#define SCENE_ROOT 0
+
+// Create the scene with its root node
+bool module_scene_init(void);
+
+// Free every node and the storage
+void module_scene_deinit(void);
+
+// Remove every node except the root
+void module_scene_clear(void);
+
+// Create a node under parent, returns its id or -1
+int module_scene_create(scene_node_kind kind, int parent);
+
+// Destroy a node and its subtree (ids are reused afterwards)
+void module_scene_destroy(int node);
+
+// Check that an id refers to a live node
+bool module_scene_is_valid(int node);
+
+// Node properties; transform setters mark the node's subtree dirty
+bool module_scene_set_parent(int node, int parent);
+void module_scene_set_position(int node, float x, float y);
+void module_scene_set_rotation(int node, float degrees);
+void module_scene_set_scale(int node, float sx, float sy);
+void module_scene_set_size(int node, float w, float h);
+void module_scene_set_color(int node, float r, float g, float b, float a);
+void module_scene_set_texture(int node, unsigned int texture_id);
+// Text nodes draw in the built-in 8x8 font with their top-left corner at
+// their world position, in the same centred coordinates as other nodes;
+// their own and their parents' rotation and scale are not applied
+void module_scene_set_text(int node, const char *text);
+void module_scene_set_visible(int node, bool visible);
+
+// Read or write one property; 0 for dead nodes
+float module_scene_get_property(int node, scene_property prop);
+void module_scene_set_property(int node, scene_property prop, float value);
+
+// World transform of a node (recomputed on demand if dirty)
+void module_scene_get_world(int node, float *x, float *y, float *rotation, float *sx, float *sy);
+
+// Recompute world transforms of dirty subtrees
+void module_scene_update(void);
+
+// Update, then draw every visible node in tree order
+void module_scene_render(float vp_width, float vp_height);
+
+// Register the `scene` table in a Lua state
+void module_scene_register(lua_State *L);
+
+#endif // MODULE_SCENE_H
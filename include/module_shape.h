@@ -0,0 +1,36 @@
+// module_shape.h
+#ifndef MODULE_SHAPE_H
+#define MODULE_SHAPE_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Shape tessellation. Each function turns a shape around its own origin
+// into a triangle list (x, y per vertex), sets *out to it and returns the
+// vertex count, 0 when there is nothing to draw. Results are cached by shape
+// and parameters, so a shape drawn every frame is tessellated once; *out
+// stays valid until the next call. Call from the thread that runs Lua.
+
+// Fill a simple polygon given by its outline (ear clipping, either winding)
+int module_shape_polygon(const float *points, int count, const float **out);
+
+// Stroke a polyline of width (mitred joins, bevelled where sharp); closed
+// also joins the last point to the first
+int module_shape_stroke(const float *points, int count, float width, bool closed, const float **out);
+
+// Circle of radius centred on the origin: filled when thickness <= 0,
+// otherwise a ring thickness wide centred on the radius
+int module_shape_circle(float radius, float thickness, const float **out);
+
+// Arc from start to end degrees (clockwise on screen): a pie slice when
+// thickness <= 0, otherwise a band like module_shape_circle's ring
+int module_shape_arc(float radius, float start, float end, float thickness, const float **out);
+
+// w x h rectangle centred on the origin with corners rounded by radius
+int module_shape_rounded_rect(float w, float h, float radius, const float **out);
+
+// Register the draw_polygon, draw_line, draw_polyline, draw_circle, draw_arc
+// and draw_rounded_rect functions
+void module_shape_register(lua_State *L);
+
+#endif // MODULE_SHAPE_H
@@ -0,0 +1,24 @@
+// module_tasks.h
+#ifndef MODULE_TASKS_H
+#define MODULE_TASKS_H
+
+#include <lua.h>
+#include <stdbool.h>
+
+// Resume the tasks that are due at time (the animation time passed to
+// update) and finish completed async loads; call once per frame before
+// update() on the thread running the main state
+void module_tasks_update(lua_State *L, double time);
+
+// Drop all tasks and wait for async loads still running; call after the
+// main state was closed
+void module_tasks_shutdown(void);
+
+// True if T is the thread of the task being resumed, which the scheduler
+// resumes again on the next frame if it yields
+bool module_tasks_is_running(lua_State *T);
+
+// Register the `tasks` table in a Lua state
+void module_tasks_register(lua_State *L);
+
+#endif // MODULE_TASKS_H
@@ -0,0 +1,55 @@
+// module_tilemap.h
+#ifndef MODULE_TILEMAP_H
+#define MODULE_TILEMAP_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Tile values follow Tiled's global ids: 0 is empty, 1 is the first tile of
+// the tileset (left to right, top to bottom). The flip bits of Tiled are
+// honoured for horizontal and vertical flips.
+#define TILEMAP_FLIP_H 0x80000000u
+#define TILEMAP_FLIP_V 0x40000000u
+#define TILEMAP_FLIP_D 0x20000000u  // diagonal flip, ignored
+#define TILEMAP_TILE_MASK 0x1fffffffu
+
+typedef struct tilemap tilemap;
+
+// Create an empty cols x rows map drawn from the tileset image (loaded with
+// module_opengl_load_image) cut into tile_w x tile_h tiles
+tilemap *module_tilemap_create(const char *tileset_asset, int tile_w, int tile_h, int cols, int rows);
+
+// Create a map from a CSV grid in the content zip (Tiled's CSV export: one
+// row of comma-separated tile ids per line)
+tilemap *module_tilemap_load_csv(const char *tileset_asset, int tile_w, int tile_h, const char *csv_asset);
+
+// Free the map; its GL objects are released in order with the recorded draws,
+// or dropped once the GL context they belong to is gone
+void module_tilemap_destroy(tilemap *map);
+
+// Tile access by 0-based column and row; set marks the tile's chunk for rebuild
+uint32_t module_tilemap_get(const tilemap *map, int col, int row);
+void module_tilemap_set(tilemap *map, int col, int row, uint32_t tile);
+
+// Draw the chunks that intersect the viewport with the map's top-left corner
+// at (x, y); dirty visible chunks are rebuilt first
+void module_tilemap_draw(tilemap *map, float x, float y, float r, float g, float b, float a,
+                         float vp_width, float vp_height);
+
+// Release the GL objects of maps collected by Lua since the last call; call
+// once per frame while draws are being recorded
+void module_tilemap_flush(void);
+
+// The GL context was recreated; maps rebuild their chunk meshes the next
+// time they are drawn. Safe from any thread.
+void module_tilemap_context_reset(void);
+
+// Free the list of GL objects waiting for module_tilemap_flush; call after
+// the Lua state is closed
+void module_tilemap_shutdown(void);
+
+// Register the `tilemap` table in a Lua state
+void module_tilemap_register(lua_State *L);
+
+#endif // MODULE_TILEMAP_H
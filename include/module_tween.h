@@ -0,0 +1,19 @@
+// module_tween.h
+#ifndef MODULE_TWEEN_H
+#define MODULE_TWEEN_H
+
+#include <lua.h>
+
+// Advance every tween to time (the animation time passed to update), write
+// the new values to their scene nodes and buffers, then call the completion
+// handler once with the ids of the tweens that finished. Call once per frame
+// before update() on the thread running the main state.
+void module_tween_update(lua_State *L, double time);
+
+// Drop all tweens; call after the main state was closed
+void module_tween_shutdown(void);
+
+// Register the `tween` table in a Lua state
+void module_tween_register(lua_State *L);
+
+#endif // MODULE_TWEEN_H
@@ -0,0 +1,35 @@
+// module_worker.h
+#ifndef MODULE_WORKER_H
+#define MODULE_WORKER_H
+
+#include <lua.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Serialized Lua value passed between states
+typedef struct {
+   size_t size;
+   unsigned char data[];
+} worker_message;
+
+typedef struct lua_worker lua_worker;
+
+// Serialize the value at idx (nil, booleans, numbers, strings, typed buffers
+// and tables of those). Returns NULL and pushes nothing on failure; *err
+// receives a static description.
+worker_message *module_worker_serialize(lua_State *L, int idx, const char **err);
+
+// Push a deserialized value; returns false if the message is malformed.
+// Allocates, so it may raise a memory error: call it protected.
+bool module_worker_deserialize(lua_State *L, const worker_message *msg);
+
+// Start a Lua state on its own thread running a script from the content zip
+lua_worker *module_worker_spawn(const char *asset_name);
+
+// Stop the worker thread, close its state and free the worker
+void module_worker_destroy(lua_worker *worker);
+
+// Register the `worker` table in the main Lua state
+void module_worker_register(lua_State *L);
+
+#endif // MODULE_WORKER_H
@@ -0,0 +1,38 @@
+-- scene_sprites.lua
+-- Retained scene: nodes are created once, the core draws them after update()
+
+local spinner
+local arms = {}
+
+local function build_scene()
+    local id, w, h = load_image("image.png")
+
+    spinner = scene.group()
+    for i = 0, 7 do
+        local arm = scene.group(spinner)
+        scene.set_rotation(arm, i * 45)
+        local quad = scene.quad(24, 24, 0.0, 0.5, 0.0, 1.0, arm)
+        scene.set_position(quad, 150, 0)
+        -- A label at its parent's position starts at the quad's centre
+        scene.text(tostring(i + 1), 1.0, 1.0, 1.0, 1.0, quad)
+        if id then
+            local sprite = scene.sprite(id, w / 4, h / 4, arm)
+            scene.set_position(sprite, 90, 0)
+        end
+        arms[#arms + 1] = arm
+    end
+
+    -- Scene coordinates are centred: this is 10 pixels in from the top left
+    local label = scene.text("Retained scene", 1.0, 1.0, 1.0, 1.0)
+    scene.set_position(label, 10 - 256, 10 - 256)
+end
+
+function update(time)
+    if not spinner then
+        build_scene()
+    end
+
+    -- Only the group moves; its children are re-transformed by the core
+    scene.set_rotation(spinner, time * 30)
+    scene.set_visible(arms[1], not get_input(RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A))
+end
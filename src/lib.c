@@ -1,5 +1,6 @@
 #include <libretro.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
@@ -7,18 +8,26 @@
 #include <miniz.h>
 #include "module_lua.h"
 #include "libretro_core.h" // Add this
+#include "module_replay.h"
+#include "module_scene.h"
+#include "module_particles.h"
+#include "module_jobs.h"
+#include "module_pipeline.h"
+#include "module_memory.h"
+#include "module_hotreload.h"
+#include "module_resolution.h"
+#include "module_font.h"
+#include "module_tilemap.h"
+#include "module_layer.h"
+#include "core_time.h"
 
-// Framebuffer dimensions
-#define WIDTH 320
-#define HEIGHT 240
-#define HW_WIDTH 512
-#define HW_HEIGHT 512
 
 // Global variables
 static retro_environment_t environ_cb;
 static retro_log_printf_t log_cb;
 static retro_video_refresh_t video_cb;
 static retro_input_poll_t input_poll_cb;
+static retro_input_state_t frontend_input_state_cb;
 retro_input_state_t input_state_cb;
 static struct retro_hw_render_callback hw_render;
 static bool initialized = false;
@@ -26,6 +35,25 @@ static FILE *log_file = NULL;
 static float animation_time = 0.0f;
 static bool use_default_fbo = false;
 static char zip_file_path[512] = {0}; // Store zip file path
+static enum retro_log_level log_level = RETRO_LOG_DEBUG;
+static bool frame_dupe = false; // frontend can dupe and the option is on
+
+// Core options
+static const struct retro_variable core_options[] = {
+   { "lrcgl_input_replay", "Input replay (content.zip.replay); off|record|replay" },
+   { "lrcgl_pipelined", "Pipelined frames (adds one frame of input latency); off|on" },
+   { "lrcgl_lua_memory_limit", "Lua memory limit per state (MB); off|16|32|64|128|256|512" },
+   { "lrcgl_lua_gc", "Lua garbage collector; auto|incremental|generational" },
+   { "lrcgl_lua_gc_budget", "Lua GC budget per frame (ms); 2|1|3|4|6|8" },
+   { "lrcgl_lua_watchdog", "Lua update() watchdog; off|warn|abort|yield" },
+   { "lrcgl_lua_watchdog_ms", "Lua update() budget (ms); 12|4|8|16|33|100|1000" },
+   { "lrcgl_hot_reload", "Reload Lua scripts when the content zip changes; off|on" },
+   { "lrcgl_resolution", "Output resolution; 512|640|768|1024|256|384" },
+   { "lrcgl_dynamic_resolution", "Dynamic resolution GPU budget per frame (ms); off|12|8|10|14|16" },
+   { "lrcgl_dynamic_resolution_min", "Dynamic resolution lowest scale (%); 50|25|33|75" },
+   { "lrcgl_frame_dupe", "Skip unchanged frames (frontend repeats the last one); on|off" },
+   { NULL, NULL },
+};
 
 // File-based logging
 static void fallback_log(const char *level, const char *msg) {
@@ -41,29 +69,36 @@ static void fallback_log(const char *level, const char *msg) {
    fprintf(stderr, "[%s] %s\n", level, msg);
 }
 
-static void fallback_log_format(const char *level, const char *fmt, ...) {
-   va_list args;
-   va_start(args, fmt);
+static void fallback_log_format(const char *level, const char *fmt, va_list args) {
+   va_list args_copy;
    if (!log_file) {
       log_file = fopen("core.log", "a");
       if (!log_file) {
          fprintf(stderr, "[ERROR] Failed to open core.log\n");
-         va_end(args);
          return;
       }
    }
+   va_copy(args_copy, args);
    fprintf(log_file, "[%s] ", level);
    vfprintf(log_file, fmt, args);
    fprintf(log_file, "\n");
    fflush(log_file);
    fprintf(stderr, "[%s] ", level);
-   vfprintf(stderr, fmt, args);
+   vfprintf(stderr, fmt, args_copy);
    fprintf(stderr, "\n");
-   va_end(args);
+   va_end(args_copy);
+}
+
+// Set minimum log level; messages below it are dropped before formatting
+void core_set_log_level(enum retro_log_level level) {
+    log_level = level;
 }
 
 // Unified logging helper
 void core_log(enum retro_log_level level, const char *fmt, ...) {
+    if (level < log_level)
+        return;
+
     va_list args;
     va_start(args, fmt);
 
@@ -192,6 +227,28 @@ static bool extract_lua_script_from_file(const char *zip_path, char **script_dat
     return true;
 }
 
+// Set the content zip used by extract_asset_from_zip (NULL or "" clears it)
+void core_set_content_path(const char *path) {
+    if (!path) {
+        zip_file_path[0] = '\0';
+        return;
+    }
+    strncpy(zip_file_path, path, sizeof(zip_file_path) - 1);
+    zip_file_path[sizeof(zip_file_path) - 1] = '\0';
+}
+
+bool asset_exists_in_zip(const char *asset_name) {
+    if (!zip_file_path[0])
+        return false;
+    mz_zip_archive zip_archive;
+    memset(&zip_archive, 0, sizeof(zip_archive));
+    if (!mz_zip_reader_init_file(&zip_archive, zip_file_path, 0))
+        return false;
+    bool found = mz_zip_reader_locate_file(&zip_archive, asset_name, NULL, 0) >= 0;
+    mz_zip_reader_end(&zip_archive);
+    return found;
+}
+
 bool extract_asset_from_zip(const char *asset_name, char **asset_data, size_t *asset_size) {
     if (!zip_file_path[0]) {
         core_log(RETRO_LOG_ERROR, "No zip file path set for asset extraction");
@@ -241,6 +298,160 @@ bool extract_asset_from_zip(const char *asset_name, char **asset_data, size_t *a
     return true;
 }
 
+// Read a core option value, NULL if unset
+static const char *core_get_option(const char *key) {
+   struct retro_variable var = { key, NULL };
+   if (environ_cb && environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+      return var.value;
+   return NULL;
+}
+
+// Start input recording or playback as selected by the core option
+static void start_input_replay(void) {
+   const char *value = core_get_option("lrcgl_input_replay");
+   replay_mode mode = REPLAY_OFF;
+   char path[sizeof(zip_file_path) + 8];
+
+   if (value && strcmp(value, "record") == 0)
+      mode = REPLAY_RECORD;
+   else if (value && strcmp(value, "replay") == 0)
+      mode = REPLAY_PLAYBACK;
+   if (mode == REPLAY_OFF)
+      return;
+
+   snprintf(path, sizeof(path), "%s.replay", zip_file_path[0] ? zip_file_path : "core");
+   if (module_replay_start(mode, path))
+      input_state_cb = module_replay_input_state;
+}
+
+// Run Lua updates on their own thread, one frame ahead of GL, if the option is on.
+// Lua then reads input from a per-frame snapshot instead of the frontend.
+static void start_pipeline(void) {
+   const char *value = core_get_option("lrcgl_pipelined");
+   if (!value || strcmp(value, "on") != 0 || !module_lua_get_state())
+      return;
+   if (module_pipeline_set_enabled(true))
+      input_state_cb = module_replay_input_state;
+}
+
+// Options that apply to Lua states created from now on: memory cap and watchdog
+static void apply_lua_options(void) {
+   const char *value = core_get_option("lrcgl_lua_memory_limit");
+   size_t megabytes = value ? (size_t)strtoul(value, NULL, 10) : 0;  // "off" parses as 0
+   module_memory_set_limit(megabytes * 1024 * 1024);
+   if (megabytes)
+      core_log(RETRO_LOG_INFO, "Lua memory limit: %zu MB per state", megabytes);
+
+   const char *mode_name = core_get_option("lrcgl_lua_watchdog");
+   const char *budget = core_get_option("lrcgl_lua_watchdog_ms");
+   lua_watchdog_mode mode = WATCHDOG_OFF;
+   if (mode_name && strcmp(mode_name, "warn") == 0)
+      mode = WATCHDOG_WARN;
+   else if (mode_name && strcmp(mode_name, "abort") == 0)
+      mode = WATCHDOG_ABORT;
+   else if (mode_name && strcmp(mode_name, "yield") == 0)
+      mode = WATCHDOG_YIELD;
+   module_lua_set_watchdog(mode, budget ? atof(budget) : 12.0);
+   if (mode != WATCHDOG_OFF)
+      core_log(RETRO_LOG_INFO, "Lua watchdog: %s after %s ms", mode_name, budget ? budget : "12");
+}
+
+// Take the Lua collector off Lua's own pacing if the option asks for it;
+// retro_run then steps it in the time left after each frame
+static void start_lua_gc(void) {
+   const char *mode = core_get_option("lrcgl_lua_gc");
+   const char *budget = core_get_option("lrcgl_lua_gc_budget");
+   lua_State *L = module_lua_get_state();
+   if (!L)
+      return;
+
+   module_pipeline_set_gc_budget(budget ? atof(budget) : 2.0);
+   if (mode && strcmp(mode, "incremental") == 0)
+      module_memory_set_gc_mode(L, LUA_GC_INCREMENTAL);
+   else if (mode && strcmp(mode, "generational") == 0)
+      module_memory_set_gc_mode(L, LUA_GC_GENERATIONAL);
+   else
+      return;
+   core_log(RETRO_LOG_INFO, "Lua GC: %s, up to %s ms per frame", mode, budget ? budget : "2");
+}
+
+// Watch the content zip for script changes if the option is on
+static void start_hot_reload(void) {
+   const char *value = core_get_option("lrcgl_hot_reload");
+   if (value && strcmp(value, "on") == 0 && zip_file_path[0] && module_lua_get_state())
+      module_hotreload_start(zip_file_path);
+}
+
+// Let the frontend repeat the last frame when a frame draws exactly what it
+// showed, if it supports duping and the option is on
+static void start_frame_dupe(void) {
+   bool can_dupe = false;
+   const char *value = core_get_option("lrcgl_frame_dupe");
+   if (environ_cb)
+      environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &can_dupe);
+   frame_dupe = can_dupe && !(value && strcmp(value, "off") == 0);
+   core_log(RETRO_LOG_INFO, "Frame duping %s", frame_dupe ? "enabled" : "disabled");
+}
+
+// Read the output size and dynamic resolution options. Once running, they
+// are only applied when one of them changed, and a new output size is passed
+// on with SET_GEOMETRY, keeping the virtual space's aspect ratio.
+static void apply_resolution_options(bool running) {
+   // Values last applied; reconfiguring restarts dynamic resolution, so
+   // changes to unrelated options must leave it alone
+   static struct {
+      int width;
+      double budget_ms;
+      float min_scale;
+   } applied;
+
+   const char *size = core_get_option("lrcgl_resolution");
+   const char *budget = core_get_option("lrcgl_dynamic_resolution");
+   const char *min_scale = core_get_option("lrcgl_dynamic_resolution_min");
+   int width = size ? atoi(size) : 0;
+   if (width <= 0 || width > RESOLUTION_MAX_SIZE)
+      width = VIRTUAL_WIDTH;
+   double budget_ms = budget ? atof(budget) : 0.0;
+   float min = min_scale ? atoi(min_scale) / 100.0f : 0.5f;
+   if (running && width == applied.width && budget_ms == applied.budget_ms && min == applied.min_scale)
+      return;
+   applied.width = width;
+   applied.budget_ms = budget_ms;
+   applied.min_scale = min;
+
+   int height = width * VIRTUAL_HEIGHT / VIRTUAL_WIDTH;
+   int old_width, old_height;
+   module_resolution_output_size(&old_width, &old_height);
+   module_resolution_configure(width, height, budget_ms, min);
+   if (!running || (width == old_width && height == old_height) || !environ_cb)
+      return;
+
+   struct retro_game_geometry geometry = {0};
+   geometry.base_width = width;
+   geometry.base_height = height;
+   geometry.max_width = RESOLUTION_MAX_SIZE;
+   geometry.max_height = RESOLUTION_MAX_SIZE;
+   geometry.aspect_ratio = (float)VIRTUAL_WIDTH / VIRTUAL_HEIGHT;
+   environ_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
+   module_pipeline_invalidate_frame();
+}
+
+// A new context has none of the old GL objects; rebuild ours and redraw the
+// next frame in full
+static void context_reset(void) {
+   module_resolution_context_reset();
+   module_opengl_init();
+   module_font_context_reset();
+   module_tilemap_context_reset();
+   module_layer_context_reset();
+   module_pipeline_invalidate_frame();
+}
+
+static void context_destroy(void) {
+   module_resolution_context_destroy();
+   module_opengl_deinit();
+}
+
 // Set environment
 void retro_set_environment(retro_environment_t cb) {
    environ_cb = cb;
@@ -253,6 +464,8 @@ void retro_set_environment(retro_environment_t cb) {
   bool contentless = false;
   environ_cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &contentless);
 
+  environ_cb(RETRO_ENVIRONMENT_SET_VARIABLES, (void *)core_options);
+
   //  bool contentless = true;
   //  if (environ_cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &contentless)) {
   //     core_log(RETRO_LOG_INFO, "Content-less support enabled");
@@ -274,7 +487,8 @@ void retro_set_input_poll(retro_input_poll_t cb) {
 }
 
 void retro_set_input_state(retro_input_state_t cb) {
-    input_state_cb = cb;
+    frontend_input_state_cb = cb;
+    input_state_cb = module_replay_get_mode() != REPLAY_OFF || module_pipeline_enabled() ? module_replay_input_state : cb;
     core_log(RETRO_LOG_INFO, "Input state callback set: %p", cb);
     // DO NOT INIT CHECK FOR LUA HERE
 }
@@ -291,14 +505,25 @@ void retro_init(void) {
       log_cb = logging.log;
    }
    core_log(RETRO_LOG_INFO, "Hello World core initialized");
+   module_jobs_init(-1);
   //  printf("Input constants: RETRO_DEVICE_JOYPAD=%d, A=%d, B=%d\n",
   //           RETRO_DEVICE_JOYPAD, RETRO_DEVICE_ID_JOYPAD_A, RETRO_DEVICE_ID_JOYPAD_B);
 }
 
 // Deinitialize core
 void retro_deinit(void) {
+   module_pipeline_shutdown();
+   module_hotreload_stop();
+   module_replay_stop();
    module_opengl_deinit();
    module_lua_deinit();
+   module_font_shutdown();
+   module_tilemap_shutdown();
+   module_layer_shutdown();
+   module_memory_shutdown();
+   module_scene_deinit();
+   module_particles_deinit();
+   module_jobs_shutdown();
    if (log_file) {
       fclose(log_file);
       log_file = NULL;
@@ -320,16 +545,18 @@ void retro_get_system_info(struct retro_system_info *info) {
 
 // AV info
 void retro_get_system_av_info(struct retro_system_av_info *info) {
+   int width, height;
+   module_resolution_output_size(&width, &height);
    memset(info, 0, sizeof(*info));
-   info->geometry.base_width = WIDTH;
-   info->geometry.base_height = HEIGHT;
-   info->geometry.max_width = HW_WIDTH;
-   info->geometry.max_height = HW_HEIGHT;
-   info->geometry.aspect_ratio = (float)WIDTH / HEIGHT;
+   info->geometry.base_width = width;
+   info->geometry.base_height = height;
+   info->geometry.max_width = RESOLUTION_MAX_SIZE;
+   info->geometry.max_height = RESOLUTION_MAX_SIZE;
+   info->geometry.aspect_ratio = (float)VIRTUAL_WIDTH / VIRTUAL_HEIGHT;
    info->timing.fps = 60.0;
    info->timing.sample_rate = 48000.0;
    core_log(RETRO_LOG_INFO, "AV info: %dx%d, max %dx%d, %.2f fps",
-            WIDTH, HEIGHT, HW_WIDTH, HW_HEIGHT, info->timing.fps);
+            width, height, RESOLUTION_MAX_SIZE, RESOLUTION_MAX_SIZE, info->timing.fps);
 }
 
 // Controller port
@@ -353,8 +580,8 @@ bool retro_load_game(const struct retro_game_info *game) {
     hw_render.context_type = RETRO_HW_CONTEXT_OPENGL_CORE;
     hw_render.version_major = 3;
     hw_render.version_minor = 3;
-    hw_render.context_reset = module_opengl_init;
-    hw_render.context_destroy = module_opengl_deinit;
+    hw_render.context_reset = context_reset;
+    hw_render.context_destroy = context_destroy;
     hw_render.bottom_left_origin = true;
     hw_render.depth = true;
     hw_render.stencil = false;
@@ -366,12 +593,12 @@ bool retro_load_game(const struct retro_game_info *game) {
     }
 
     module_opengl_set_callbacks(hw_render.get_proc_address, hw_render.get_current_framebuffer, &use_default_fbo);
+    apply_lua_options();
 
     // Handle game data (script.zip)
     if (game && game->path) {
         // Store zip file path
-        strncpy(zip_file_path, game->path, sizeof(zip_file_path) - 1);
-        zip_file_path[sizeof(zip_file_path) - 1] = '\0';
+        core_set_content_path(game->path);
         core_log(RETRO_LOG_INFO, "Zip file path: %s", zip_file_path);
 
         // Extract and load script.lua
@@ -398,6 +625,13 @@ bool retro_load_game(const struct retro_game_info *game) {
         }
     }
 
+    start_input_replay();
+    start_lua_gc();
+    start_pipeline();
+    start_hot_reload();
+    start_frame_dupe();
+    apply_resolution_options(false);
+
     core_log(RETRO_LOG_INFO, "Game loaded");
     return true;
 }
@@ -414,6 +648,8 @@ void retro_run(void) {
       return;
    }
 
+   uint64_t frame_start = core_time_ns();
+
    // Poll input
    if (input_poll_cb) {
       input_poll_cb();
@@ -421,6 +657,26 @@ void retro_run(void) {
       core_log(RETRO_LOG_WARN, "No input_poll_cb set");
    }
 
+   // A pipelined update still in flight reads the previous input snapshot
+   module_pipeline_sync();
+
+   // Reload changed scripts while no update is running
+   module_hotreload_poll();
+
+   // Resolution options take effect while running; the others at the next load
+   bool options_updated = false;
+   if (environ_cb && environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &options_updated) && options_updated)
+      apply_resolution_options(true);
+
+   // Increment animation time, then record or restore this frame's input and time
+   animation_time += 0.016f;
+   if (module_replay_get_mode() != REPLAY_OFF)
+      module_replay_frame(frontend_input_state_cb, &animation_time);
+   else if (module_pipeline_enabled())
+      module_replay_latch(frontend_input_state_cb);
+   else
+      module_replay_unlatch();
+
    // Log input state
    if (input_state_cb) {
       int a_state = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A);
@@ -429,24 +685,26 @@ void retro_run(void) {
                RETRO_DEVICE_ID_JOYPAD_A, a_state, RETRO_DEVICE_ID_JOYPAD_B, b_state);
    }
 
-   // Bind framebuffer
-   module_opengl_bind_framebuffer();
-   module_opengl_check_error("framebuffer binding");
-
-   // Set viewport
-   module_opengl_set_viewport();
-
-   // Clear framebuffer
-   module_opengl_clear();
-
-   // Increment animation time
-   animation_time += 0.016f;
-
    // Run Lua update
    lua_State *L = module_lua_get_state();
+   bool presented = true;
    if (L) {
-      module_lua_update(animation_time);
+      // Update and record this frame, then draw it (or the previous one when
+      // pipelined) unless it matches the frame on screen
+      presented = module_pipeline_frame(animation_time, VIRTUAL_WIDTH, VIRTUAL_HEIGHT, frame_dupe);
+      module_opengl_check_error("frame replay");
    } else {
+      // Bind framebuffer
+      module_resolution_begin_frame();
+      module_opengl_bind_framebuffer();
+      module_opengl_check_error("framebuffer binding");
+
+      // Set viewport
+      module_opengl_set_viewport();
+
+      // Clear framebuffer
+      module_opengl_clear();
+
       // Fallback quad drawing
       float r = 0.0f, g = 0.5f, b = 0.0f;
       if (input_state_cb) {
@@ -459,32 +717,41 @@ void retro_run(void) {
       }
 
       float scale = 0.8f + 0.2f * sinf(animation_time * 2.0f);
-      float quad_width = HW_WIDTH * scale;
-      float quad_height = HW_HEIGHT * scale;
-      float quad_x = HW_WIDTH / 2.0f;
-      float quad_y = HW_HEIGHT / 2.0f;
+      float quad_width = VIRTUAL_WIDTH * scale;
+      float quad_height = VIRTUAL_HEIGHT * scale;
+      float quad_x = VIRTUAL_WIDTH / 2.0f;
+      float quad_y = VIRTUAL_HEIGHT / 2.0f;
       float rotation = animation_time * 30.0f;
 
-      module_opengl_draw_solid_quad(quad_x, quad_y, quad_width, quad_height, rotation, r, g, b, 1.0f, HW_WIDTH, HW_HEIGHT);
+      module_opengl_draw_solid_quad(quad_x, quad_y, quad_width, quad_height, rotation, r, g, b, 1.0f, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
       module_opengl_check_error("draw_solid_quad");
+      module_resolution_end_frame();
    }
 
-   // Log FBO binding
-   GLint current_fbo;
-   glGetIntegerv(GL_FRAMEBUFFER_BINDING, &current_fbo);
-   core_log(RETRO_LOG_DEBUG, "Current FBO binding after rendering: %d", current_fbo);
+   if (presented) {
+      // Log FBO binding
+      GLint current_fbo;
+      glGetIntegerv(GL_FRAMEBUFFER_BINDING, &current_fbo);
+      core_log(RETRO_LOG_DEBUG, "Current FBO binding after rendering: %d", current_fbo);
 
-   // Unbind framebuffer
-   glBindFramebuffer(GL_FRAMEBUFFER, 0);
-   module_opengl_check_error("unbind framebuffer");
+      // Unbind framebuffer
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      module_opengl_check_error("unbind framebuffer");
+   }
 
-   // Present frame
+   // Present frame; a NULL frame asks the frontend to show the last one again
+   int out_width, out_height;
+   module_resolution_output_size(&out_width, &out_height);
    if (video_cb) {
-      video_cb(RETRO_HW_FRAME_BUFFER_VALID, HW_WIDTH, HW_HEIGHT, 0);
-      core_log(RETRO_LOG_DEBUG, "Frame presented with size %dx%d", HW_WIDTH, HW_HEIGHT);
+      video_cb(presented ? RETRO_HW_FRAME_BUFFER_VALID : NULL, out_width, out_height, 0);
+      core_log(RETRO_LOG_DEBUG, "Frame %s with size %dx%d", presented ? "presented" : "duped", out_width, out_height);
    } else {
       core_log(RETRO_LOG_ERROR, "No video callback set");
    }
+
+   // Collect Lua garbage with what is left of the frame
+   if (L)
+      module_pipeline_end_frame(frame_start);
 }
 
 
@@ -501,8 +768,8 @@ bool retro_load_game_special(unsigned game_type, const struct retro_game_info *i
     hw_render.context_type = RETRO_HW_CONTEXT_OPENGL_CORE;
     hw_render.version_major = 3;
     hw_render.version_minor = 3;
-    hw_render.context_reset = module_opengl_init;
-    hw_render.context_destroy = module_opengl_deinit;
+    hw_render.context_reset = context_reset;
+    hw_render.context_destroy = context_destroy;
     hw_render.bottom_left_origin = true;
     hw_render.depth = true;
     hw_render.stencil = false;
@@ -514,6 +781,7 @@ bool retro_load_game_special(unsigned game_type, const struct retro_game_info *i
     }
 
     module_opengl_set_callbacks(hw_render.get_proc_address, hw_render.get_current_framebuffer, &use_default_fbo);
+    apply_lua_options();
 
     // Process first valid zip file
     bool lua_initialized = false;
@@ -521,8 +789,7 @@ bool retro_load_game_special(unsigned game_type, const struct retro_game_info *i
         if (info[i].path) {
             // Store zip file path (use first valid path)
             if (zip_file_path[0] == '\0') {
-                strncpy(zip_file_path, info[i].path, sizeof(zip_file_path) - 1);
-                zip_file_path[sizeof(zip_file_path) - 1] = '\0';
+                core_set_content_path(info[i].path);
                 core_log(RETRO_LOG_INFO, "Zip file path (special): %s", zip_file_path);
             }
 
@@ -552,6 +819,13 @@ bool retro_load_game_special(unsigned game_type, const struct retro_game_info *i
         }
     }
 
+    start_input_replay();
+    start_lua_gc();
+    start_pipeline();
+    start_hot_reload();
+    start_frame_dupe();
+    apply_resolution_options(false);
+
     core_log(RETRO_LOG_INFO, "Game special loaded");
     return true;
 }
@@ -560,6 +834,10 @@ bool retro_load_game_special(unsigned game_type, const struct retro_game_info *i
 
 // Unload game
 void retro_unload_game(void) {
+   module_pipeline_shutdown();
+   module_hotreload_stop();
+   module_replay_stop();
+   input_state_cb = frontend_input_state_cb;
    core_log(RETRO_LOG_INFO, "Game unloaded");
 }
 
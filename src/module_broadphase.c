@@ -0,0 +1,1009 @@
+// module_broadphase.c
+// Broad-phase collision queries. Bodies are AABBs indexed by id and stored
+// structure-of-arrays. Two acceleration structures are available:
+//  - a uniform spatial hash grid, rebuilt with a counting sort on the first
+//    query after bodies changed (best when most bodies move every frame);
+//  - a dynamic AABB tree with fattened leaves, updated incrementally (best for
+//    mostly-static bodies or widely varying sizes).
+#include "module_broadphase.h"
+#include "module_buffer.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BROADPHASE_METATABLE "lrcgl.broadphase"
+#define GRID_MAX_CELLS_PER_BODY 64 // larger bodies go to the oversize list
+
+typedef struct {
+   float min_x, min_y, max_x, max_y;
+   int32_t parent;  // next free node while on the free list
+   int32_t child1;  // -1 for leaves
+   int32_t child2;
+   int32_t height;  // 0 for leaves, -1 while free
+   int32_t body;
+} tree_node;
+
+typedef struct {
+   int32_t body;
+   float t;
+} ray_hit;
+
+struct broadphase_world {
+   broadphase_mode mode;
+   float cell_size;
+   float inv_cell_size;
+
+   // Bodies
+   int capacity;
+   int count;            // highest body id + 1
+   uint8_t *active;
+   float *min_x, *min_y, *max_x, *max_y;
+   uint32_t *stamp;      // per-query visit marks
+   uint32_t query_stamp;
+
+   // Grid: entries sorted into hashed buckets
+   bool grid_dirty;
+   int num_entries;
+   int entry_capacity;
+   int32_t *entry_body;
+   int32_t *entry_cx, *entry_cy;
+   int num_buckets;
+   uint32_t *bucket_start; // num_buckets + 1
+   int32_t *oversize;
+   int num_oversize;
+   float bounds[4];        // union of gridded bodies, limits ray marching
+
+   // Tree
+   tree_node *nodes;
+   int node_capacity;
+   int32_t root;
+   int32_t free_node;
+   int32_t *proxy;        // body -> leaf node
+   int32_t *stack;
+   int stack_capacity;
+
+   // Scratch
+   ray_hit *hits;
+   int hit_capacity;
+};
+
+static inline bool aabb_overlap(float ax0, float ay0, float ax1, float ay1,
+                                float bx0, float by0, float bx1, float by1) {
+   return ax0 <= bx1 && bx0 <= ax1 && ay0 <= by1 && by0 <= ay1;
+}
+
+static inline int cell_coord(const broadphase_world *w, float v) {
+   return (int)floorf(v * w->inv_cell_size);
+}
+
+static inline uint32_t cell_hash(int cx, int cy) {
+   return ((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u);
+}
+
+static bool grow_array(void **p, int count, size_t elem) {
+   void *np = realloc(*p, (size_t)count * elem);
+   if (!np)
+      return false;
+   *p = np;
+   return true;
+}
+
+static bool ensure_bodies(broadphase_world *w, int count) {
+   if (count <= w->capacity)
+      return true;
+   // Double, but never past the request: ids go up to INT32_MAX
+   int cap = w->capacity ? w->capacity : 64;
+   while (cap < count)
+      cap = cap > INT_MAX / 2 ? count : cap * 2;
+   if (!grow_array((void **)&w->active, cap, sizeof(*w->active)) ||
+       !grow_array((void **)&w->min_x, cap, sizeof(float)) ||
+       !grow_array((void **)&w->min_y, cap, sizeof(float)) ||
+       !grow_array((void **)&w->max_x, cap, sizeof(float)) ||
+       !grow_array((void **)&w->max_y, cap, sizeof(float)) ||
+       !grow_array((void **)&w->stamp, cap, sizeof(uint32_t)) ||
+       !grow_array((void **)&w->proxy, cap, sizeof(int32_t)))
+      return false;
+   memset(w->active + w->capacity, 0, (size_t)(cap - w->capacity));
+   memset(w->stamp + w->capacity, 0, (size_t)(cap - w->capacity) * sizeof(uint32_t));
+   for (int i = w->capacity; i < cap; i++)
+      w->proxy[i] = -1;
+   w->capacity = cap;
+   return true;
+}
+
+// Start a new visit-mark generation
+static uint32_t next_stamp(broadphase_world *w) {
+   if (++w->query_stamp == 0) {
+      memset(w->stamp, 0, (size_t)w->capacity * sizeof(uint32_t));
+      w->query_stamp = 1;
+   }
+   return w->query_stamp;
+}
+
+static bool push_hit(broadphase_world *w, int *num_hits, int32_t body, float t) {
+   if (*num_hits == w->hit_capacity) {
+      int cap = w->hit_capacity ? w->hit_capacity * 2 : 64;
+      if (!grow_array((void **)&w->hits, cap, sizeof(ray_hit)))
+         return false;
+      w->hit_capacity = cap;
+   }
+   w->hits[*num_hits].body = body;
+   w->hits[*num_hits].t = t;
+   (*num_hits)++;
+   return true;
+}
+
+static int compare_hits(const void *a, const void *b) {
+   float ta = ((const ray_hit *)a)->t, tb = ((const ray_hit *)b)->t;
+   return (ta > tb) - (ta < tb);
+}
+
+// Slab test of a ray against an AABB; inv_dx/inv_dy may be infinite
+static bool ray_aabb(float ox, float oy, float inv_dx, float inv_dy, float max_dist,
+                     float x0, float y0, float x1, float y1, float *t_hit) {
+   float tx0 = (x0 - ox) * inv_dx, tx1 = (x1 - ox) * inv_dx;
+   float ty0 = (y0 - oy) * inv_dy, ty1 = (y1 - oy) * inv_dy;
+   if (isnan(tx0) || isnan(tx1)) { // ray parallel and on a slab edge
+      if (ox < x0 || ox > x1) return false;
+      tx0 = -FLT_MAX; tx1 = FLT_MAX;
+   }
+   if (isnan(ty0) || isnan(ty1)) {
+      if (oy < y0 || oy > y1) return false;
+      ty0 = -FLT_MAX; ty1 = FLT_MAX;
+   }
+   float tmin = fmaxf(fminf(tx0, tx1), fminf(ty0, ty1));
+   float tmax = fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1));
+   if (tmax < 0.0f || tmin > tmax || tmin > max_dist)
+      return false;
+   *t_hit = tmin > 0.0f ? tmin : 0.0f;
+   return true;
+}
+
+// ---------------------------------------------------------------------------
+// Spatial hash grid
+
+static bool body_is_oversize(const broadphase_world *w, int b, int *x0, int *y0, int *x1, int *y1) {
+   *x0 = cell_coord(w, w->min_x[b]);
+   *y0 = cell_coord(w, w->min_y[b]);
+   *x1 = cell_coord(w, w->max_x[b]);
+   *y1 = cell_coord(w, w->max_y[b]);
+   return (int64_t)(*x1 - *x0 + 1) * (int64_t)(*y1 - *y0 + 1) > GRID_MAX_CELLS_PER_BODY;
+}
+
+static bool grid_rebuild(broadphase_world *w) {
+   int total = 0;
+   w->num_oversize = 0;
+   w->bounds[0] = w->bounds[1] = FLT_MAX;
+   w->bounds[2] = w->bounds[3] = -FLT_MAX;
+
+   // Count entries; oversize bodies are kept in a separate list
+   if (!grow_array((void **)&w->oversize, w->capacity > 0 ? w->capacity : 1, sizeof(int32_t)))
+      return false;
+   for (int b = 0; b < w->count; b++) {
+      int x0, y0, x1, y1;
+      if (!w->active[b])
+         continue;
+      if (body_is_oversize(w, b, &x0, &y0, &x1, &y1)) {
+         w->oversize[w->num_oversize++] = b;
+         continue;
+      }
+      total += (x1 - x0 + 1) * (y1 - y0 + 1);
+      w->bounds[0] = fminf(w->bounds[0], w->min_x[b]);
+      w->bounds[1] = fminf(w->bounds[1], w->min_y[b]);
+      w->bounds[2] = fmaxf(w->bounds[2], w->max_x[b]);
+      w->bounds[3] = fmaxf(w->bounds[3], w->max_y[b]);
+   }
+
+   if (total > w->entry_capacity) {
+      int cap = w->entry_capacity ? w->entry_capacity : 256;
+      while (cap < total)
+         cap *= 2;
+      if (!grow_array((void **)&w->entry_body, cap, sizeof(int32_t)) ||
+          !grow_array((void **)&w->entry_cx, cap, sizeof(int32_t)) ||
+          !grow_array((void **)&w->entry_cy, cap, sizeof(int32_t)))
+         return false;
+      w->entry_capacity = cap;
+   }
+
+   int buckets = 64;
+   while (buckets < total)
+      buckets *= 2;
+   if (buckets != w->num_buckets || !w->bucket_start) {
+      if (!grow_array((void **)&w->bucket_start, buckets + 1, sizeof(uint32_t)))
+         return false;
+      w->num_buckets = buckets;
+   }
+   uint32_t mask = (uint32_t)buckets - 1;
+   memset(w->bucket_start, 0, (size_t)(buckets + 1) * sizeof(uint32_t));
+
+   // Counting sort of (cell, body) entries into buckets
+   for (int b = 0; b < w->count; b++) {
+      int x0, y0, x1, y1;
+      if (!w->active[b] || body_is_oversize(w, b, &x0, &y0, &x1, &y1))
+         continue;
+      for (int cy = y0; cy <= y1; cy++)
+         for (int cx = x0; cx <= x1; cx++)
+            w->bucket_start[(cell_hash(cx, cy) & mask) + 1]++;
+   }
+   for (int i = 0; i < buckets; i++)
+      w->bucket_start[i + 1] += w->bucket_start[i];
+
+   // Scatter using the bucket starts as cursors, then restore them
+   for (int b = 0; b < w->count; b++) {
+      int x0, y0, x1, y1;
+      if (!w->active[b] || body_is_oversize(w, b, &x0, &y0, &x1, &y1))
+         continue;
+      for (int cy = y0; cy <= y1; cy++) {
+         for (int cx = x0; cx <= x1; cx++) {
+            uint32_t slot = w->bucket_start[cell_hash(cx, cy) & mask]++;
+            w->entry_body[slot] = b;
+            w->entry_cx[slot] = cx;
+            w->entry_cy[slot] = cy;
+         }
+      }
+   }
+   for (int i = buckets; i > 0; i--)
+      w->bucket_start[i] = w->bucket_start[i - 1];
+   w->bucket_start[0] = 0;
+
+   w->num_entries = total;
+   w->grid_dirty = false;
+   return true;
+}
+
+static int grid_query_pairs(broadphase_world *w, int32_t *out, int max_pairs, int *total) {
+   int found = 0, written = 0;
+
+   for (int bucket = 0; bucket < w->num_buckets; bucket++) {
+      uint32_t start = w->bucket_start[bucket], end = w->bucket_start[bucket + 1];
+      for (uint32_t i = start; i < end; i++) {
+         int a = w->entry_body[i];
+         int cx = w->entry_cx[i], cy = w->entry_cy[i];
+         for (uint32_t j = i + 1; j < end; j++) {
+            int b = w->entry_body[j];
+            if (w->entry_cx[j] != cx || w->entry_cy[j] != cy)
+               continue;
+            if (!aabb_overlap(w->min_x[a], w->min_y[a], w->max_x[a], w->max_y[a],
+                              w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+               continue;
+            // Report each pair only from the cell holding the overlap's min corner
+            if (cell_coord(w, fmaxf(w->min_x[a], w->min_x[b])) != cx ||
+                cell_coord(w, fmaxf(w->min_y[a], w->min_y[b])) != cy)
+               continue;
+            if (written < max_pairs) {
+               out[written * 2] = a < b ? a : b;
+               out[written * 2 + 1] = a < b ? b : a;
+               written++;
+            }
+            found++;
+         }
+      }
+   }
+
+   // Oversize bodies against every other body
+   for (int k = 0; k < w->num_oversize; k++) {
+      int a = w->oversize[k];
+      for (int b = 0; b < w->count; b++) {
+         int x0, y0, x1, y1;
+         if (b == a || !w->active[b])
+            continue;
+         if (body_is_oversize(w, b, &x0, &y0, &x1, &y1) && b < a)
+            continue; // oversize/oversize pairs are reported once
+         if (!aabb_overlap(w->min_x[a], w->min_y[a], w->max_x[a], w->max_y[a],
+                           w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+            continue;
+         if (written < max_pairs) {
+            out[written * 2] = a < b ? a : b;
+            out[written * 2 + 1] = a < b ? b : a;
+            written++;
+         }
+         found++;
+      }
+   }
+
+   if (total)
+      *total = found;
+   return written;
+}
+
+static int grid_query_rect(broadphase_world *w, float qx0, float qy0, float qx1, float qy1,
+                           int32_t *out, int max_bodies, int *total) {
+   int found = 0, written = 0;
+   uint32_t stamp = next_stamp(w);
+   uint32_t mask = (uint32_t)w->num_buckets - 1;
+   int x0 = cell_coord(w, qx0), y0 = cell_coord(w, qy0);
+   int x1 = cell_coord(w, qx1), y1 = cell_coord(w, qy1);
+
+   // Huge queries are cheaper as a linear scan
+   if ((int64_t)(x1 - x0 + 1) * (int64_t)(y1 - y0 + 1) > (int64_t)w->num_buckets) {
+      for (int b = 0; b < w->count; b++) {
+         if (!w->active[b] || !aabb_overlap(qx0, qy0, qx1, qy1, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+            continue;
+         if (written < max_bodies)
+            out[written++] = b;
+         found++;
+      }
+      if (total)
+         *total = found;
+      return written;
+   }
+
+   for (int cy = y0; cy <= y1; cy++) {
+      for (int cx = x0; cx <= x1; cx++) {
+         uint32_t bucket = cell_hash(cx, cy) & mask;
+         for (uint32_t i = w->bucket_start[bucket]; i < w->bucket_start[bucket + 1]; i++) {
+            int b = w->entry_body[i];
+            if (w->entry_cx[i] != cx || w->entry_cy[i] != cy || w->stamp[b] == stamp)
+               continue;
+            w->stamp[b] = stamp;
+            if (!aabb_overlap(qx0, qy0, qx1, qy1, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+               continue;
+            if (written < max_bodies)
+               out[written++] = b;
+            found++;
+         }
+      }
+   }
+   for (int k = 0; k < w->num_oversize; k++) {
+      int b = w->oversize[k];
+      if (!aabb_overlap(qx0, qy0, qx1, qy1, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+         continue;
+      if (written < max_bodies)
+         out[written++] = b;
+      found++;
+   }
+
+   if (total)
+      *total = found;
+   return written;
+}
+
+// Walk grid cells along the ray (Amanatides & Woo) collecting hits
+static int grid_raycast(broadphase_world *w, float ox, float oy, float dx, float dy, float max_dist) {
+   int num_hits = 0;
+   uint32_t stamp = next_stamp(w);
+   uint32_t mask = (uint32_t)w->num_buckets - 1;
+   float inv_dx = 1.0f / dx, inv_dy = 1.0f / dy;
+   float t_enter;
+
+   // Only march the part of the ray inside the bounds of the gridded bodies
+   if (w->num_entries > 0 &&
+       ray_aabb(ox, oy, inv_dx, inv_dy, max_dist, w->bounds[0], w->bounds[1], w->bounds[2], w->bounds[3], &t_enter)) {
+      float exit_x = dx > 0.0f ? (w->bounds[2] - ox) * inv_dx : dx < 0.0f ? (w->bounds[0] - ox) * inv_dx : FLT_MAX;
+      float exit_y = dy > 0.0f ? (w->bounds[3] - oy) * inv_dy : dy < 0.0f ? (w->bounds[1] - oy) * inv_dy : FLT_MAX;
+      float t_exit = fminf(max_dist, fminf(exit_x, exit_y));
+      float px = ox + dx * t_enter, py = oy + dy * t_enter;
+      int cx = cell_coord(w, px), cy = cell_coord(w, py);
+      int step_x = dx > 0.0f ? 1 : -1, step_y = dy > 0.0f ? 1 : -1;
+      float t_max_x = dx != 0.0f ? t_enter + ((float)(cx + (step_x > 0)) * w->cell_size - px) * inv_dx : FLT_MAX;
+      float t_max_y = dy != 0.0f ? t_enter + ((float)(cy + (step_y > 0)) * w->cell_size - py) * inv_dy : FLT_MAX;
+      float t_delta_x = dx != 0.0f ? w->cell_size * fabsf(inv_dx) : FLT_MAX;
+      float t_delta_y = dy != 0.0f ? w->cell_size * fabsf(inv_dy) : FLT_MAX;
+      float t = t_enter;
+
+      while (t <= t_exit) {
+         uint32_t bucket = cell_hash(cx, cy) & mask;
+         for (uint32_t i = w->bucket_start[bucket]; i < w->bucket_start[bucket + 1]; i++) {
+            int b = w->entry_body[i];
+            float t_hit;
+            if (w->entry_cx[i] != cx || w->entry_cy[i] != cy || w->stamp[b] == stamp)
+               continue;
+            w->stamp[b] = stamp;
+            if (ray_aabb(ox, oy, inv_dx, inv_dy, max_dist, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b], &t_hit))
+               push_hit(w, &num_hits, b, t_hit);
+         }
+         if (t_max_x < t_max_y) {
+            t = t_max_x;
+            t_max_x += t_delta_x;
+            cx += step_x;
+         } else {
+            t = t_max_y;
+            t_max_y += t_delta_y;
+            cy += step_y;
+         }
+      }
+   }
+
+   for (int k = 0; k < w->num_oversize; k++) {
+      int b = w->oversize[k];
+      float t_hit;
+      if (ray_aabb(ox, oy, inv_dx, inv_dy, max_dist, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b], &t_hit))
+         push_hit(w, &num_hits, b, t_hit);
+   }
+   return num_hits;
+}
+
+// ---------------------------------------------------------------------------
+// Dynamic AABB tree
+
+static inline float node_perimeter(float x0, float y0, float x1, float y1) {
+   return 2.0f * ((x1 - x0) + (y1 - y0));
+}
+
+static int32_t tree_alloc_node(broadphase_world *w) {
+   if (w->free_node < 0) {
+      int cap = w->node_capacity ? w->node_capacity * 2 : 128;
+      if (!grow_array((void **)&w->nodes, cap, sizeof(tree_node)))
+         return -1;
+      for (int i = w->node_capacity; i < cap; i++) {
+         w->nodes[i].parent = i + 1 < cap ? i + 1 : -1;
+         w->nodes[i].height = -1;
+      }
+      w->free_node = w->node_capacity;
+      w->node_capacity = cap;
+   }
+   int32_t id = w->free_node;
+   tree_node *n = &w->nodes[id];
+   w->free_node = n->parent;
+   n->parent = n->child1 = n->child2 = -1;
+   n->height = 0;
+   n->body = -1;
+   return id;
+}
+
+static void tree_free_node(broadphase_world *w, int32_t id) {
+   w->nodes[id].parent = w->free_node;
+   w->nodes[id].height = -1;
+   w->free_node = id;
+}
+
+static void tree_fit(broadphase_world *w, int32_t id) {
+   tree_node *n = &w->nodes[id];
+   const tree_node *a = &w->nodes[n->child1], *b = &w->nodes[n->child2];
+   n->min_x = fminf(a->min_x, b->min_x);
+   n->min_y = fminf(a->min_y, b->min_y);
+   n->max_x = fmaxf(a->max_x, b->max_x);
+   n->max_y = fmaxf(a->max_y, b->max_y);
+   n->height = 1 + (a->height > b->height ? a->height : b->height);
+}
+
+static void tree_replace_child(broadphase_world *w, int32_t parent, int32_t old_child, int32_t new_child) {
+   if (parent < 0)
+      w->root = new_child;
+   else if (w->nodes[parent].child1 == old_child)
+      w->nodes[parent].child1 = new_child;
+   else
+      w->nodes[parent].child2 = new_child;
+}
+
+// Rotate the taller grandchild subtree up if node a is unbalanced; returns the subtree root
+static int32_t tree_balance(broadphase_world *w, int32_t ia) {
+   tree_node *nodes = w->nodes;
+   tree_node *a = &nodes[ia];
+   if (a->child1 < 0 || a->height < 2)
+      return ia;
+
+   int32_t ib = a->child1, ic = a->child2;
+   int balance = nodes[ic].height - nodes[ib].height;
+
+   if (balance > 1) {
+      // Rotate C up
+      int32_t i_f = nodes[ic].child1, ig = nodes[ic].child2;
+      nodes[ic].child1 = ia;
+      nodes[ic].parent = a->parent;
+      a->parent = ic;
+      tree_replace_child(w, nodes[ic].parent, ia, ic);
+      if (nodes[i_f].height > nodes[ig].height) {
+         nodes[ic].child2 = i_f;
+         a->child2 = ig;
+         nodes[ig].parent = ia;
+      } else {
+         nodes[ic].child2 = ig;
+         a->child2 = i_f;
+         nodes[i_f].parent = ia;
+      }
+      tree_fit(w, ia);
+      tree_fit(w, ic);
+      return ic;
+   }
+
+   if (balance < -1) {
+      // Rotate B up
+      int32_t id = nodes[ib].child1, ie = nodes[ib].child2;
+      nodes[ib].child1 = ia;
+      nodes[ib].parent = a->parent;
+      a->parent = ib;
+      tree_replace_child(w, nodes[ib].parent, ia, ib);
+      if (nodes[id].height > nodes[ie].height) {
+         nodes[ib].child2 = id;
+         a->child1 = ie;
+         nodes[ie].parent = ia;
+      } else {
+         nodes[ib].child2 = ie;
+         a->child1 = id;
+         nodes[id].parent = ia;
+      }
+      tree_fit(w, ia);
+      tree_fit(w, ib);
+      return ib;
+   }
+
+   return ia;
+}
+
+static void tree_refit_upwards(broadphase_world *w, int32_t index) {
+   while (index >= 0) {
+      index = tree_balance(w, index);
+      tree_fit(w, index);
+      index = w->nodes[index].parent;
+   }
+}
+
+static bool tree_insert_leaf(broadphase_world *w, int32_t leaf) {
+   if (w->root < 0) {
+      w->root = leaf;
+      w->nodes[leaf].parent = -1;
+      return true;
+   }
+
+   // Descend choosing the child with the cheaper perimeter increase
+   const tree_node l = w->nodes[leaf];
+   int32_t index = w->root;
+   while (w->nodes[index].child1 >= 0) {
+      const tree_node *n = &w->nodes[index];
+      float area = node_perimeter(n->min_x, n->min_y, n->max_x, n->max_y);
+      float combined = node_perimeter(fminf(n->min_x, l.min_x), fminf(n->min_y, l.min_y),
+                                      fmaxf(n->max_x, l.max_x), fmaxf(n->max_y, l.max_y));
+      float cost = 2.0f * combined;
+      float inheritance = 2.0f * (combined - area);
+      float child_cost[2];
+      int32_t children[2] = {n->child1, n->child2};
+      for (int k = 0; k < 2; k++) {
+         const tree_node *c = &w->nodes[children[k]];
+         float merged = node_perimeter(fminf(c->min_x, l.min_x), fminf(c->min_y, l.min_y),
+                                       fmaxf(c->max_x, l.max_x), fmaxf(c->max_y, l.max_y));
+         child_cost[k] = (c->child1 < 0 ? merged : merged - node_perimeter(c->min_x, c->min_y, c->max_x, c->max_y))
+                         + inheritance;
+      }
+      if (cost < child_cost[0] && cost < child_cost[1])
+         break;
+      index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+   }
+
+   int32_t sibling = index;
+   int32_t new_parent = tree_alloc_node(w);
+   if (new_parent < 0)
+      return false;
+   int32_t old_parent = w->nodes[sibling].parent;
+   w->nodes[new_parent].parent = old_parent;
+   w->nodes[new_parent].child1 = sibling;
+   w->nodes[new_parent].child2 = leaf;
+   w->nodes[sibling].parent = new_parent;
+   w->nodes[leaf].parent = new_parent;
+   tree_replace_child(w, old_parent, sibling, new_parent);
+
+   tree_refit_upwards(w, new_parent);
+   return true;
+}
+
+static void tree_remove_leaf(broadphase_world *w, int32_t leaf) {
+   if (leaf == w->root) {
+      w->root = -1;
+      return;
+   }
+   int32_t parent = w->nodes[leaf].parent;
+   int32_t grand = w->nodes[parent].parent;
+   int32_t sibling = w->nodes[parent].child1 == leaf ? w->nodes[parent].child2 : w->nodes[parent].child1;
+
+   tree_replace_child(w, grand, parent, sibling);
+   w->nodes[sibling].parent = grand;
+   tree_free_node(w, parent);
+   tree_refit_upwards(w, grand);
+}
+
+static bool tree_update_body(broadphase_world *w, int b) {
+   int32_t leaf = w->proxy[b];
+   float margin = w->cell_size;
+   if (leaf >= 0) {
+      const tree_node *n = &w->nodes[leaf];
+      if (n->min_x <= w->min_x[b] && n->min_y <= w->min_y[b] &&
+          n->max_x >= w->max_x[b] && n->max_y >= w->max_y[b])
+         return true; // still inside its fat AABB
+      tree_remove_leaf(w, leaf);
+   } else {
+      leaf = tree_alloc_node(w);
+      if (leaf < 0)
+         return false;
+      w->nodes[leaf].body = b;
+      w->proxy[b] = leaf;
+   }
+   tree_node *n = &w->nodes[leaf];
+   n->min_x = w->min_x[b] - margin;
+   n->min_y = w->min_y[b] - margin;
+   n->max_x = w->max_x[b] + margin;
+   n->max_y = w->max_y[b] + margin;
+   n->child1 = n->child2 = -1;
+   n->height = 0;
+   return tree_insert_leaf(w, leaf);
+}
+
+static void tree_remove_body(broadphase_world *w, int b) {
+   if (w->proxy[b] < 0)
+      return;
+   tree_remove_leaf(w, w->proxy[b]);
+   tree_free_node(w, w->proxy[b]);
+   w->proxy[b] = -1;
+}
+
+static bool ensure_stack(broadphase_world *w, int size) {
+   if (size <= w->stack_capacity)
+      return true;
+   int cap = w->stack_capacity ? w->stack_capacity * 2 : 64;
+   while (cap < size)
+      cap *= 2;
+   if (!grow_array((void **)&w->stack, cap, sizeof(int32_t)))
+      return false;
+   w->stack_capacity = cap;
+   return true;
+}
+
+// Visit leaves whose fat AABB overlaps the rectangle; tight bounds are checked
+// by the caller. Returns false to abort.
+typedef bool (*tree_visit_fn)(broadphase_world *w, int body, void *ctx);
+
+static void tree_query(broadphase_world *w, float x0, float y0, float x1, float y1, tree_visit_fn visit, void *ctx) {
+   if (w->root < 0)
+      return;
+   // Height bounds the depth; two pushes per level
+   if (!ensure_stack(w, 2 * w->nodes[w->root].height + 2))
+      return;
+   int top = 0;
+   w->stack[top++] = w->root;
+   while (top > 0) {
+      const tree_node *n = &w->nodes[w->stack[--top]];
+      if (!aabb_overlap(x0, y0, x1, y1, n->min_x, n->min_y, n->max_x, n->max_y))
+         continue;
+      if (n->child1 < 0) {
+         if (!visit(w, n->body, ctx))
+            return;
+      } else {
+         w->stack[top++] = n->child1;
+         w->stack[top++] = n->child2;
+      }
+   }
+}
+
+typedef struct {
+   int self;
+   int32_t *out;
+   int max;
+   int written;
+   int found;
+   float x0, y0, x1, y1;
+} tree_collect_ctx;
+
+static bool tree_collect_pair(broadphase_world *w, int b, void *ctx) {
+   tree_collect_ctx *c = (tree_collect_ctx *)ctx;
+   int a = c->self;
+   if (b <= a)
+      return true;
+   if (!aabb_overlap(w->min_x[a], w->min_y[a], w->max_x[a], w->max_y[a],
+                     w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+      return true;
+   if (c->written < c->max) {
+      c->out[c->written * 2] = a;
+      c->out[c->written * 2 + 1] = b;
+      c->written++;
+   }
+   c->found++;
+   return true;
+}
+
+static bool tree_collect_rect(broadphase_world *w, int b, void *ctx) {
+   tree_collect_ctx *c = (tree_collect_ctx *)ctx;
+   if (!aabb_overlap(c->x0, c->y0, c->x1, c->y1, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b]))
+      return true;
+   if (c->written < c->max)
+      c->out[c->written++] = b;
+   c->found++;
+   return true;
+}
+
+static int tree_raycast(broadphase_world *w, float ox, float oy, float dx, float dy, float max_dist) {
+   int num_hits = 0;
+   float inv_dx = 1.0f / dx, inv_dy = 1.0f / dy;
+   if (w->root < 0 || !ensure_stack(w, 2 * w->nodes[w->root].height + 2))
+      return 0;
+   int top = 0;
+   w->stack[top++] = w->root;
+   while (top > 0) {
+      const tree_node *n = &w->nodes[w->stack[--top]];
+      float t_hit;
+      if (!ray_aabb(ox, oy, inv_dx, inv_dy, max_dist, n->min_x, n->min_y, n->max_x, n->max_y, &t_hit))
+         continue;
+      if (n->child1 < 0) {
+         int b = n->body;
+         if (ray_aabb(ox, oy, inv_dx, inv_dy, max_dist, w->min_x[b], w->min_y[b], w->max_x[b], w->max_y[b], &t_hit))
+            push_hit(w, &num_hits, b, t_hit);
+      } else {
+         w->stack[top++] = n->child1;
+         w->stack[top++] = n->child2;
+      }
+   }
+   return num_hits;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+broadphase_world *module_broadphase_create(broadphase_mode mode, float cell_size) {
+   broadphase_world *w = (broadphase_world *)calloc(1, sizeof(broadphase_world));
+   if (!w) {
+      core_log(RETRO_LOG_ERROR, "Broadphase: failed to allocate world");
+      return NULL;
+   }
+   if (cell_size <= 0.0f)
+      cell_size = mode == BROADPHASE_GRID ? 64.0f : 4.0f;
+   w->mode = mode;
+   w->cell_size = cell_size;
+   w->inv_cell_size = 1.0f / cell_size;
+   w->root = -1;
+   w->free_node = -1;
+   w->grid_dirty = true;
+   return w;
+}
+
+void module_broadphase_destroy(broadphase_world *w) {
+   if (!w)
+      return;
+   free(w->active); free(w->min_x); free(w->min_y); free(w->max_x); free(w->max_y);
+   free(w->stamp); free(w->proxy);
+   free(w->entry_body); free(w->entry_cx); free(w->entry_cy);
+   free(w->bucket_start); free(w->oversize);
+   free(w->nodes); free(w->stack); free(w->hits);
+   free(w);
+}
+
+bool module_broadphase_set_bodies(broadphase_world *w, const float *aabbs, int count, int first) {
+   if (count <= 0 || first < 0)
+      return count == 0;
+   if (!ensure_bodies(w, first + count)) {
+      core_log(RETRO_LOG_ERROR, "Broadphase: failed to grow body storage to %d", first + count);
+      return false;
+   }
+   if (first + count > w->count)
+      w->count = first + count;
+
+   for (int i = 0; i < count; i++) {
+      int b = first + i;
+      const float *box = aabbs + i * 4;
+      w->min_x[b] = fminf(box[0], box[2]);
+      w->min_y[b] = fminf(box[1], box[3]);
+      w->max_x[b] = fmaxf(box[0], box[2]);
+      w->max_y[b] = fmaxf(box[1], box[3]);
+      w->active[b] = 1;
+      if (w->mode == BROADPHASE_TREE && !tree_update_body(w, b))
+         return false;
+   }
+   w->grid_dirty = true;
+   return true;
+}
+
+void module_broadphase_remove(broadphase_world *w, int b) {
+   if (b < 0 || b >= w->count || !w->active[b])
+      return;
+   w->active[b] = 0;
+   if (w->mode == BROADPHASE_TREE)
+      tree_remove_body(w, b);
+   w->grid_dirty = true;
+}
+
+void module_broadphase_clear(broadphase_world *w) {
+   for (int b = 0; b < w->count; b++)
+      module_broadphase_remove(w, b);
+   w->count = 0;
+}
+
+int module_broadphase_query_pairs(broadphase_world *w, int32_t *out_pairs, int max_pairs, int *total) {
+   if (w->mode == BROADPHASE_GRID) {
+      if (w->grid_dirty && !grid_rebuild(w))
+         return 0;
+      return grid_query_pairs(w, out_pairs, max_pairs, total);
+   }
+
+   tree_collect_ctx c = {0, out_pairs, max_pairs, 0, 0, 0, 0, 0, 0};
+   for (int a = 0; a < w->count; a++) {
+      if (!w->active[a])
+         continue;
+      c.self = a;
+      tree_query(w, w->min_x[a], w->min_y[a], w->max_x[a], w->max_y[a], tree_collect_pair, &c);
+   }
+   if (total)
+      *total = c.found;
+   return c.written;
+}
+
+int module_broadphase_query_rect(broadphase_world *w, float min_x, float min_y, float max_x, float max_y,
+                                 int32_t *out_bodies, int max_bodies, int *total) {
+   if (w->mode == BROADPHASE_GRID) {
+      if (w->grid_dirty && !grid_rebuild(w))
+         return 0;
+      return grid_query_rect(w, min_x, min_y, max_x, max_y, out_bodies, max_bodies, total);
+   }
+
+   tree_collect_ctx c = {-1, out_bodies, max_bodies, 0, 0, min_x, min_y, max_x, max_y};
+   tree_query(w, min_x, min_y, max_x, max_y, tree_collect_rect, &c);
+   if (total)
+      *total = c.found;
+   return c.written;
+}
+
+int module_broadphase_raycast(broadphase_world *w, float ox, float oy, float dx, float dy, float max_dist,
+                              int32_t *out_bodies, float *out_t, int max_hits) {
+   float len = sqrtf(dx * dx + dy * dy);
+   if (len <= 0.0f || max_dist <= 0.0f)
+      return 0;
+   dx /= len;
+   dy /= len;
+
+   int num_hits;
+   if (w->mode == BROADPHASE_GRID) {
+      if (w->grid_dirty && !grid_rebuild(w))
+         return 0;
+      num_hits = grid_raycast(w, ox, oy, dx, dy, max_dist);
+   } else {
+      num_hits = tree_raycast(w, ox, oy, dx, dy, max_dist);
+   }
+
+   qsort(w->hits, (size_t)num_hits, sizeof(ray_hit), compare_hits);
+   int written = num_hits < max_hits ? num_hits : max_hits;
+   for (int i = 0; i < written; i++) {
+      out_bodies[i] = w->hits[i].body;
+      if (out_t)
+         out_t[i] = w->hits[i].t;
+   }
+   return written;
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings (body ids are 1-based in Lua)
+
+static broadphase_world *check_world(lua_State *L, int arg) {
+   broadphase_world **ud = (broadphase_world **)luaL_checkudata(L, arg, BROADPHASE_METATABLE);
+   luaL_argcheck(L, *ud != NULL, arg, "broadphase world is destroyed");
+   return *ud;
+}
+
+// broadphase.new([mode [, cell_size]]) -- mode "grid" (default) or "tree"
+static int lua_broadphase_new(lua_State *L) {
+   static const char *const modes[] = {"grid", "tree", NULL};
+   broadphase_mode mode = (broadphase_mode)luaL_checkoption(L, 1, "grid", modes);
+   float cell_size = (float)luaL_optnumber(L, 2, 0.0);
+   broadphase_world **ud = (broadphase_world **)lua_newuserdatauv(L, sizeof(broadphase_world *), 0);
+   *ud = module_broadphase_create(mode, cell_size);
+   if (!*ud)
+      return luaL_error(L, "failed to create broadphase world");
+   luaL_setmetatable(L, BROADPHASE_METATABLE);
+   return 1;
+}
+
+static int lua_broadphase_gc(lua_State *L) {
+   broadphase_world **ud = (broadphase_world **)luaL_checkudata(L, 1, BROADPHASE_METATABLE);
+   module_broadphase_destroy(*ud);
+   *ud = NULL;
+   return 0;
+}
+
+// world:update(aabbs, count [, first_id]) -- aabbs: f32 buffer of min_x, min_y, max_x, max_y
+static int lua_broadphase_update(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   core_buffer *buf = module_buffer_check(L, 2, BUFFER_F32);
+   lua_Integer count = luaL_optinteger(L, 3, (lua_Integer)(buf->count / 4));
+   lua_Integer first = luaL_optinteger(L, 4, 1);
+   luaL_argcheck(L, count >= 0 && (size_t)count * 4 <= buf->count, 3, "count exceeds buffer size");
+   luaL_argcheck(L, first >= 1 && first + count - 1 <= INT32_MAX, 4, "invalid first id");
+   if (!module_broadphase_set_bodies(w, BUFFER_F32_DATA(buf), (int)count, (int)first - 1))
+      return luaL_error(L, "out of memory updating broadphase bodies");
+   return 0;
+}
+
+// world:set(id, min_x, min_y, max_x, max_y)
+static int lua_broadphase_set(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   lua_Integer id = luaL_checkinteger(L, 2);
+   float box[4];
+   luaL_argcheck(L, id >= 1 && id <= INT32_MAX, 2, "invalid body id");
+   for (int i = 0; i < 4; i++)
+      box[i] = (float)luaL_checknumber(L, 3 + i);
+   if (!module_broadphase_set_bodies(w, box, 1, (int)id - 1))
+      return luaL_error(L, "out of memory updating broadphase body");
+   return 0;
+}
+
+static int lua_broadphase_remove(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   lua_Integer id = luaL_checkinteger(L, 2);
+   if (id >= 1 && id <= w->count)
+      module_broadphase_remove(w, (int)id - 1);
+   return 0;
+}
+
+static int lua_broadphase_clear(lua_State *L) {
+   module_broadphase_clear(check_world(L, 1));
+   return 0;
+}
+
+static void ids_to_lua(int32_t *ids, int n) {
+   for (int i = 0; i < n; i++)
+      ids[i] += 1;
+}
+
+// world:query_pairs(out_i32) -> written, total (pairs stored as a1, b1, a2, b2, ...)
+static int lua_broadphase_query_pairs(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   core_buffer *out = module_buffer_check(L, 2, BUFFER_I32);
+   int total = 0;
+   int max_pairs = (int)(out->count / 2 > INT32_MAX ? INT32_MAX : out->count / 2);
+   int n = module_broadphase_query_pairs(w, BUFFER_I32_DATA(out), max_pairs, &total);
+   ids_to_lua(BUFFER_I32_DATA(out), n * 2);
+   lua_pushinteger(L, n);
+   lua_pushinteger(L, total);
+   return 2;
+}
+
+// world:query_rect(min_x, min_y, max_x, max_y, out_i32) -> written, total
+static int lua_broadphase_query_rect(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   float x0 = (float)luaL_checknumber(L, 2), y0 = (float)luaL_checknumber(L, 3);
+   float x1 = (float)luaL_checknumber(L, 4), y1 = (float)luaL_checknumber(L, 5);
+   core_buffer *out = module_buffer_check(L, 6, BUFFER_I32);
+   int total = 0;
+   int max = (int)(out->count > INT32_MAX ? INT32_MAX : out->count);
+   int n = module_broadphase_query_rect(w, fminf(x0, x1), fminf(y0, y1), fmaxf(x0, x1), fmaxf(y0, y1),
+                                        BUFFER_I32_DATA(out), max, &total);
+   ids_to_lua(BUFFER_I32_DATA(out), n);
+   lua_pushinteger(L, n);
+   lua_pushinteger(L, total);
+   return 2;
+}
+
+// world:raycast(ox, oy, dx, dy, max_dist, out_i32 [, out_t_f32]) -> hits (nearest first)
+static int lua_broadphase_raycast(lua_State *L) {
+   broadphase_world *w = check_world(L, 1);
+   float ox = (float)luaL_checknumber(L, 2), oy = (float)luaL_checknumber(L, 3);
+   float dx = (float)luaL_checknumber(L, 4), dy = (float)luaL_checknumber(L, 5);
+   float max_dist = (float)luaL_checknumber(L, 6);
+   core_buffer *out = module_buffer_check(L, 7, BUFFER_I32);
+   core_buffer *out_t = lua_isnoneornil(L, 8) ? NULL : module_buffer_check(L, 8, BUFFER_F32);
+   size_t max = out->count;
+   if (out_t && out_t->count < max)
+      max = out_t->count;
+   int n = module_broadphase_raycast(w, ox, oy, dx, dy, max_dist, BUFFER_I32_DATA(out),
+                                     out_t ? BUFFER_F32_DATA(out_t) : NULL, (int)(max > INT32_MAX ? INT32_MAX : max));
+   ids_to_lua(BUFFER_I32_DATA(out), n);
+   lua_pushinteger(L, n);
+   return 1;
+}
+
+static const luaL_Reg broadphase_methods[] = {
+   {"update", lua_broadphase_update},
+   {"set", lua_broadphase_set},
+   {"remove", lua_broadphase_remove},
+   {"clear", lua_broadphase_clear},
+   {"query_pairs", lua_broadphase_query_pairs},
+   {"query_rect", lua_broadphase_query_rect},
+   {"raycast", lua_broadphase_raycast},
+   {NULL, NULL}
+};
+
+static const luaL_Reg broadphase_funcs[] = {
+   {"new", lua_broadphase_new},
+   {NULL, NULL}
+};
+
+void module_broadphase_register(lua_State *L) {
+   if (luaL_newmetatable(L, BROADPHASE_METATABLE)) {
+      lua_pushcfunction(L, lua_broadphase_gc);
+      lua_setfield(L, -2, "__gc");
+      luaL_newlib(L, broadphase_methods);
+      lua_setfield(L, -2, "__index");
+   }
+   lua_pop(L, 1);
+
+   luaL_newlib(L, broadphase_funcs);
+   lua_setglobal(L, "broadphase");
+}
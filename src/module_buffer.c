@@ -0,0 +1,184 @@
+// module_buffer.c
+// Typed buffers: flat arrays of f32/i32/u32 that native subsystems read and
+// write directly, so bulk data never goes through Lua tables.
+#include "module_buffer.h"
+#include <lauxlib.h>
+#include <string.h>
+
+#define BUFFER_METATABLE "lrcgl.buffer"
+
+static const char *const type_names[] = {"f32", "i32", "u32", NULL};
+
+const char *module_buffer_type_name(buffer_type type) {
+   return type_names[type];
+}
+
+core_buffer *module_buffer_push(lua_State *L, buffer_type type, size_t count) {
+   // Elements start after the header, padded to 16 bytes
+   size_t header = (sizeof(core_buffer) + 15) & ~(size_t)15;
+   if (count > (((size_t)-1) - header) / 4)
+      luaL_error(L, "buffer too large (%I elements)", (lua_Integer)count);
+
+   core_buffer *buf = (core_buffer *)lua_newuserdatauv(L, header + count * 4, 0);
+   buf->type = type;
+   buf->count = count;
+   buf->data = (char *)buf + header;
+   memset(buf->data, 0, count * 4);
+   luaL_setmetatable(L, BUFFER_METATABLE);
+   return buf;
+}
+
+core_buffer *module_buffer_test(lua_State *L, int arg) {
+   return (core_buffer *)luaL_testudata(L, arg, BUFFER_METATABLE);
+}
+
+core_buffer *module_buffer_check(lua_State *L, int arg, buffer_type type) {
+   core_buffer *buf = (core_buffer *)luaL_checkudata(L, arg, BUFFER_METATABLE);
+   if (buf->type != type)
+      luaL_argerror(L, arg, lua_pushfstring(L, "%s buffer expected, got %s",
+                                            type_names[type], type_names[buf->type]));
+   return buf;
+}
+
+static void push_element(lua_State *L, core_buffer *buf, size_t i) {
+   switch (buf->type) {
+      case BUFFER_F32: lua_pushnumber(L, BUFFER_F32_DATA(buf)[i]); break;
+      case BUFFER_I32: lua_pushinteger(L, BUFFER_I32_DATA(buf)[i]); break;
+      case BUFFER_U32: lua_pushinteger(L, BUFFER_U32_DATA(buf)[i]); break;
+   }
+}
+
+static void set_element(lua_State *L, core_buffer *buf, size_t i, int arg) {
+   switch (buf->type) {
+      case BUFFER_F32: BUFFER_F32_DATA(buf)[i] = (float)luaL_checknumber(L, arg); break;
+      case BUFFER_I32: BUFFER_I32_DATA(buf)[i] = (int32_t)luaL_checkinteger(L, arg); break;
+      case BUFFER_U32: BUFFER_U32_DATA(buf)[i] = (uint32_t)luaL_checkinteger(L, arg); break;
+   }
+}
+
+// buffer.new(type, count)
+static int lua_buffer_new(lua_State *L) {
+   buffer_type type = (buffer_type)luaL_checkoption(L, 1, NULL, type_names);
+   lua_Integer count = luaL_checkinteger(L, 2);
+   luaL_argcheck(L, count >= 0, 2, "count must be non-negative");
+   module_buffer_push(L, type, (size_t)count);
+   return 1;
+}
+
+// buffer.from(type, {values...})
+static int lua_buffer_from(lua_State *L) {
+   buffer_type type = (buffer_type)luaL_checkoption(L, 1, NULL, type_names);
+   luaL_checktype(L, 2, LUA_TTABLE);
+   size_t count = (size_t)lua_rawlen(L, 2);
+   core_buffer *buf = module_buffer_push(L, type, count);
+   for (size_t i = 0; i < count; i++) {
+      lua_rawgeti(L, 2, (lua_Integer)i + 1);
+      set_element(L, buf, i, -1);
+      lua_pop(L, 1);
+   }
+   return 1;
+}
+
+// buf[i] (1-based) or method lookup
+static int lua_buffer_index(lua_State *L) {
+   core_buffer *buf = (core_buffer *)lua_touserdata(L, 1);
+   if (lua_type(L, 2) == LUA_TNUMBER) {
+      lua_Integer i = lua_tointeger(L, 2);
+      if (i >= 1 && (size_t)i <= buf->count)
+         push_element(L, buf, (size_t)i - 1);
+      else
+         lua_pushnil(L);
+      return 1;
+   }
+   luaL_getmetatable(L, BUFFER_METATABLE);
+   lua_getfield(L, -1, "methods");
+   lua_pushvalue(L, 2);
+   lua_rawget(L, -2);
+   return 1;
+}
+
+static int lua_buffer_newindex(lua_State *L) {
+   core_buffer *buf = (core_buffer *)lua_touserdata(L, 1);
+   lua_Integer i = luaL_checkinteger(L, 2);
+   luaL_argcheck(L, i >= 1 && (size_t)i <= buf->count, 2, "index out of range");
+   set_element(L, buf, (size_t)i - 1, 3);
+   return 0;
+}
+
+static int lua_buffer_len(lua_State *L) {
+   core_buffer *buf = (core_buffer *)lua_touserdata(L, 1);
+   lua_pushinteger(L, (lua_Integer)buf->count);
+   return 1;
+}
+
+static int lua_buffer_tostring(lua_State *L) {
+   core_buffer *buf = (core_buffer *)lua_touserdata(L, 1);
+   lua_pushfstring(L, "buffer(%s, %I)", type_names[buf->type], (lua_Integer)buf->count);
+   return 1;
+}
+
+// buf:fill(value [, first [, last]])
+static int lua_buffer_fill(lua_State *L) {
+   core_buffer *buf = (core_buffer *)luaL_checkudata(L, 1, BUFFER_METATABLE);
+   lua_Integer first = luaL_optinteger(L, 3, 1);
+   lua_Integer last = luaL_optinteger(L, 4, (lua_Integer)buf->count);
+   luaL_argcheck(L, first >= 1, 3, "index out of range");
+   luaL_argcheck(L, last <= (lua_Integer)buf->count, 4, "index out of range");
+   for (lua_Integer i = first; i <= last; i++)
+      set_element(L, buf, (size_t)i - 1, 2);
+   return 0;
+}
+
+// buf:type()
+static int lua_buffer_type(lua_State *L) {
+   core_buffer *buf = (core_buffer *)luaL_checkudata(L, 1, BUFFER_METATABLE);
+   lua_pushstring(L, type_names[buf->type]);
+   return 1;
+}
+
+// buf:copy(src [, dst_first [, src_first [, count]]])
+static int lua_buffer_copy(lua_State *L) {
+   core_buffer *dst = (core_buffer *)luaL_checkudata(L, 1, BUFFER_METATABLE);
+   core_buffer *src = module_buffer_check(L, 2, dst->type);
+   lua_Integer dst_first = luaL_optinteger(L, 3, 1);
+   lua_Integer src_first = luaL_optinteger(L, 4, 1);
+   lua_Integer count = luaL_optinteger(L, 5, (lua_Integer)src->count - src_first + 1);
+   luaL_argcheck(L, dst_first >= 1 && dst_first - 1 + count <= (lua_Integer)dst->count, 3, "range out of bounds");
+   luaL_argcheck(L, src_first >= 1 && src_first - 1 + count <= (lua_Integer)src->count, 4, "range out of bounds");
+   if (count > 0)
+      memmove((char *)dst->data + (dst_first - 1) * 4, (char *)src->data + (src_first - 1) * 4, (size_t)count * 4);
+   return 0;
+}
+
+static const luaL_Reg buffer_methods[] = {
+   {"fill", lua_buffer_fill},
+   {"type", lua_buffer_type},
+   {"copy", lua_buffer_copy},
+   {NULL, NULL}
+};
+
+static const luaL_Reg buffer_meta[] = {
+   {"__index", lua_buffer_index},
+   {"__newindex", lua_buffer_newindex},
+   {"__len", lua_buffer_len},
+   {"__tostring", lua_buffer_tostring},
+   {NULL, NULL}
+};
+
+static const luaL_Reg buffer_funcs[] = {
+   {"new", lua_buffer_new},
+   {"from", lua_buffer_from},
+   {NULL, NULL}
+};
+
+void module_buffer_register(lua_State *L) {
+   if (luaL_newmetatable(L, BUFFER_METATABLE)) {
+      luaL_setfuncs(L, buffer_meta, 0);
+      luaL_newlib(L, buffer_methods);
+      lua_setfield(L, -2, "methods");
+   }
+   lua_pop(L, 1);
+
+   luaL_newlib(L, buffer_funcs);
+   lua_setglobal(L, "buffer");
+}
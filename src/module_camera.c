@@ -0,0 +1,154 @@
+// module_camera.c
+// 2D camera and transform stack. The camera maps world coordinates to the
+// virtual viewport: its (x, y) lands on the centre of the screen, zoom
+// scales around that point and rotation turns the world the opposite way.
+// push_transform composes a translation, rotation and scale under the camera
+// for the draws that follow, until the matching pop_transform.
+//
+// Whenever either changes, the combined affine is handed to
+// module_opengl_set_view. It is recorded once, turned into a view-projection
+// once per frame on replay and shared by every shader through a uniform
+// buffer, so a draw still carries only its own position and rotation.
+// Culling tests draws against the viewport as the current view sees it.
+#include "module_camera.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <math.h>
+
+// Affines are {a, b, c, d, tx, ty}: x' = a x + c y + tx, y' = b x + d y + ty
+typedef float affine[6];
+
+#define CAMERA_DEG_TO_RAD (3.14159265358979323846f / 180.0f)
+
+static struct {
+   float x, y, zoom, rotation;
+   affine view;                      // world to viewport
+   affine stack[CAMERA_STACK_DEPTH]; // composed local transforms
+   int depth;
+} camera = {
+   0.0f, 0.0f, 1.0f, 0.0f,
+   {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f}
+};
+
+// out = m * n (apply n first)
+static void multiply(const float *m, const float *n, float *out) {
+   affine r = {
+      m[0] * n[0] + m[2] * n[1],
+      m[1] * n[0] + m[3] * n[1],
+      m[0] * n[2] + m[2] * n[3],
+      m[1] * n[2] + m[3] * n[3],
+      m[0] * n[4] + m[2] * n[5] + m[4],
+      m[1] * n[4] + m[3] * n[5] + m[5]
+   };
+   for (int i = 0; i < 6; i++)
+      out[i] = r[i];
+}
+
+// Hand the camera and the top of the stack to the draw functions
+static void publish(void) {
+   if (camera.depth == 0) {
+      module_opengl_set_view(camera.view);
+      return;
+   }
+   affine combined;
+   multiply(camera.view, camera.stack[camera.depth - 1], combined);
+   module_opengl_set_view(combined);
+}
+
+void module_camera_set(float x, float y, float zoom, float rotation) {
+   float rad = rotation * CAMERA_DEG_TO_RAD;
+   float c = cosf(rad) * zoom, s = sinf(rad) * zoom;
+   camera.x = x;
+   camera.y = y;
+   camera.zoom = zoom;
+   camera.rotation = rotation;
+   // Rotate by -rotation and scale, after moving (x, y) to the origin
+   camera.view[0] = c;
+   camera.view[1] = -s;
+   camera.view[2] = s;
+   camera.view[3] = c;
+   camera.view[4] = -(c * x + s * y);
+   camera.view[5] = s * x - c * y;
+   publish();
+}
+
+bool module_camera_push(float x, float y, float rotation, float sx, float sy) {
+   if (camera.depth == CAMERA_STACK_DEPTH)
+      return false;
+   float rad = rotation * CAMERA_DEG_TO_RAD;
+   float c = cosf(rad), s = sinf(rad);
+   affine local = {c * sx, s * sx, -s * sy, c * sy, x, y};
+   if (camera.depth == 0) {
+      for (int i = 0; i < 6; i++)
+         camera.stack[0][i] = local[i];
+   } else {
+      multiply(camera.stack[camera.depth - 1], local, camera.stack[camera.depth]);
+   }
+   camera.depth++;
+   publish();
+   return true;
+}
+
+bool module_camera_pop(void) {
+   if (camera.depth == 0)
+      return false;
+   camera.depth--;
+   publish();
+   return true;
+}
+
+void module_camera_begin_frame(void) {
+   if (camera.depth > 0)
+      core_log(RETRO_LOG_WARN, "Camera: %d transforms left pushed last frame, dropping them", camera.depth);
+   camera.depth = 0;
+   publish();
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings
+
+// set_camera([x, y [, zoom [, rotation]]]); no arguments resets the camera
+static int lua_set_camera(lua_State *L) {
+   float x = (float)luaL_optnumber(L, 1, 0.0);
+   float y = (float)luaL_optnumber(L, 2, 0.0);
+   float zoom = (float)luaL_optnumber(L, 3, 1.0);
+   float rotation = (float)luaL_optnumber(L, 4, 0.0);
+   luaL_argcheck(L, zoom > 0.0f, 3, "zoom must be positive");
+   module_camera_set(x, y, zoom, rotation);
+   return 0;
+}
+
+// get_camera() -> x, y, zoom, rotation
+static int lua_get_camera(lua_State *L) {
+   lua_pushnumber(L, camera.x);
+   lua_pushnumber(L, camera.y);
+   lua_pushnumber(L, camera.zoom);
+   lua_pushnumber(L, camera.rotation);
+   return 4;
+}
+
+// push_transform([x, y [, rotation [, sx [, sy]]]])
+static int lua_push_transform(lua_State *L) {
+   float x = (float)luaL_optnumber(L, 1, 0.0);
+   float y = (float)luaL_optnumber(L, 2, 0.0);
+   float rotation = (float)luaL_optnumber(L, 3, 0.0);
+   float sx = (float)luaL_optnumber(L, 4, 1.0);
+   float sy = (float)luaL_optnumber(L, 5, sx);
+   if (!module_camera_push(x, y, rotation, sx, sy))
+      return luaL_error(L, "transform stack overflow (%d deep)", CAMERA_STACK_DEPTH);
+   return 0;
+}
+
+static int lua_pop_transform(lua_State *L) {
+   if (!module_camera_pop())
+      return luaL_error(L, "pop_transform without push_transform");
+   return 0;
+}
+
+void module_camera_register(lua_State *L) {
+   lua_register(L, "set_camera", lua_set_camera);
+   lua_register(L, "get_camera", lua_get_camera);
+   lua_register(L, "push_transform", lua_push_transform);
+   lua_register(L, "pop_transform", lua_pop_transform);
+}
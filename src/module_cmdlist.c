@@ -0,0 +1,629 @@
+// module_cmdlist.c
+// Draw command lists. Commands are packed back to back in one growable
+// arena: an 8-byte header (type, layer, view, total size) followed by the
+// call's arguments and any copied arrays, padded to 8 bytes. Recording a
+// frame therefore costs one memcpy per draw and no allocation once the arena
+// has reached the frame's size.
+//
+// Views are recorded once, as CMD_VIEW commands, when they change; draws
+// refer to them by index (0 is the identity, n the n-th CMD_VIEW). Replay
+// uploads them all before the first draw, so the render queue may reorder
+// draws across view changes. Glyph uploads run up front too; the font cache
+// never reuses atlas space that a glyph drawn in the same frame occupies.
+#include "module_cmdlist.h"
+#include "module_opengl.h"
+#include "core_thread.h"
+#include "libretro_core.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CMDLIST_INITIAL_CAPACITY (64 * 1024)
+#define CMD_ALIGN 8
+
+typedef enum {
+   CMD_SOLID_QUAD = 0,
+   CMD_TRIANGLES,
+   CMD_TEXT,
+   CMD_TEXTURE,
+   CMD_TEXTURE_INSTANCED,
+   CMD_FREE_TEXTURE,
+   CMD_UPLOAD_MESH,
+   CMD_DRAW_MESH,
+   CMD_FREE_MESHES,
+   CMD_BEGIN_TARGET,
+   CMD_END_TARGET,
+   CMD_DRAW_TARGET,
+   CMD_FREE_TARGET,
+   CMD_VIEW,
+   CMD_UPLOAD_GLYPH,
+   CMD_GLYPHS
+} cmd_type;
+
+typedef struct {
+   uint8_t type;
+   int8_t layer;   // render queue layer the command was recorded in
+   uint16_t view;  // view the command was recorded under
+   uint32_t size;  // header, payload and trailing data, aligned
+} cmd_header;
+
+#define CMDLIST_MAX_VIEWS UINT16_MAX
+
+typedef struct {
+   float x, y, w, h, rotation;
+   float r, g, b, a;
+   float vp_width, vp_height;
+} cmd_quad;
+
+typedef struct {
+   int32_t num_vertices;  // followed by 2 * num_vertices floats
+   float x, y, rotation;
+   float r, g, b, a;
+   float vp_width, vp_height;
+} cmd_triangles;
+
+typedef struct {
+   float x, y;
+   float r, g, b, a;
+   float vp_width, vp_height;  // followed by the NUL-terminated text
+} cmd_text;
+
+typedef struct {
+   GLuint texture_id;
+   cmd_quad quad;
+} cmd_texture;
+
+typedef struct {
+   int32_t x, y, w, h;  // followed by w * h bytes
+} cmd_upload_glyph;
+
+typedef struct {
+   int32_t count;  // followed by 8 * count floats
+   float x, y;
+   float r, g, b, a;
+   float vp_width, vp_height;
+} cmd_glyphs;
+
+typedef struct {
+   GLuint texture_id;
+   int32_t count;  // followed by xs, ys, sizes and colors, count each
+   int32_t additive;
+   float vp_width, vp_height;
+} cmd_instanced;
+
+typedef struct {
+   GLuint vbo;
+   int32_t num_vertices;  // followed by 4 * num_vertices floats
+} cmd_upload_mesh;
+
+typedef struct {
+   GLuint vao;
+   int32_t num_vertices;
+   GLuint texture_id;
+   float x, y;
+   float r, g, b, a;
+   float vp_width, vp_height;
+} cmd_draw_mesh;
+
+typedef struct {
+   int32_t count;  // followed by count VAOs, then count VBOs
+} cmd_free_meshes;
+
+typedef struct {
+   GLuint fbo;
+   int32_t width, height;
+} cmd_begin_target;
+
+typedef struct {
+   GLuint texture;
+   float x, y, w, h;
+   float opacity;
+   float vp_width, vp_height;
+} cmd_draw_target;
+
+typedef struct {
+   GLuint fbo, texture;
+} cmd_free_target;
+
+struct cmdlist {
+   unsigned char *data;
+   size_t size;
+   size_t capacity;
+   int count;
+   bool overflowed;  // a command was dropped since the last reset
+   bool present;     // cleared by module_cmdlist_set_present(list, false)
+   bool mutates;     // uploads, frees or redraws a GPU resource
+   int layer;        // for the draws recorded from now on
+   int view;         // likewise
+   int view_count;   // CMD_VIEW commands recorded
+   float view_affine[6];  // of the current view
+};
+
+static const float identity_view[6] = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+
+static CORE_THREAD_LOCAL cmdlist *recording = NULL;
+
+// Views collected by module_cmdlist_replay (GL thread only)
+static float *replay_views = NULL;
+static int replay_view_capacity = 0;
+
+cmdlist *module_cmdlist_create(void) {
+   cmdlist *list = (cmdlist *)calloc(1, sizeof(cmdlist));
+   if (!list)
+      core_log(RETRO_LOG_ERROR, "Failed to allocate command list");
+   else
+      module_cmdlist_reset(list);
+   return list;
+}
+
+void module_cmdlist_destroy(cmdlist *list) {
+   if (!list)
+      return;
+   if (recording == list)
+      recording = NULL;
+   free(list->data);
+   free(list);
+}
+
+void module_cmdlist_reset(cmdlist *list) {
+   list->size = 0;
+   list->count = 0;
+   list->overflowed = false;
+   list->present = true;
+   list->mutates = false;
+   list->layer = 0;
+   list->view = 0;
+   list->view_count = 0;
+   memcpy(list->view_affine, identity_view, sizeof(identity_view));
+}
+
+void module_cmdlist_begin(cmdlist *list) {
+   recording = list;
+}
+
+void module_cmdlist_end(void) {
+   recording = NULL;
+}
+
+cmdlist *module_cmdlist_recording(void) {
+   return recording;
+}
+
+int module_cmdlist_count(const cmdlist *list) {
+   return list->count;
+}
+
+size_t module_cmdlist_size(const cmdlist *list) {
+   return list->size;
+}
+
+const void *module_cmdlist_data(const cmdlist *list) {
+   return list->data;
+}
+
+void module_cmdlist_set_present(cmdlist *list, bool present) {
+   list->present = present;
+}
+
+bool module_cmdlist_wants_present(const cmdlist *list) {
+   return list->present;
+}
+
+bool module_cmdlist_mutates(const cmdlist *list) {
+   return list->mutates;
+}
+
+void module_cmdlist_set_layer(cmdlist *list, int layer) {
+   list->layer = layer < CMDLIST_MIN_LAYER ? CMDLIST_MIN_LAYER : layer > CMDLIST_MAX_LAYER ? CMDLIST_MAX_LAYER : layer;
+}
+
+// Reserve a command with payload_size bytes of arguments and extra_size bytes
+// of trailing data; returns the payload or NULL if the arena cannot grow
+static void *push_command(cmdlist *list, cmd_type type, size_t payload_size, size_t extra_size) {
+   size_t size = (sizeof(cmd_header) + payload_size + extra_size + CMD_ALIGN - 1) & ~(size_t)(CMD_ALIGN - 1);
+   if (size > UINT32_MAX)
+      goto fail;
+   if (list->size + size > list->capacity) {
+      size_t capacity = list->capacity ? list->capacity : CMDLIST_INITIAL_CAPACITY;
+      while (capacity < list->size + size)
+         capacity *= 2;
+      unsigned char *data = (unsigned char *)realloc(list->data, capacity);
+      if (!data)
+         goto fail;
+      list->data = data;
+      list->capacity = capacity;
+   }
+
+   // Zero the alignment padding so identical frames compare equal byte for byte
+   cmd_header *header = (cmd_header *)(list->data + list->size);
+   memset((unsigned char *)header + size - CMD_ALIGN, 0, CMD_ALIGN);
+   header->type = (uint8_t)type;
+   header->layer = (int8_t)list->layer;
+   header->view = (uint16_t)list->view;
+   header->size = (uint32_t)size;
+   list->size += size;
+   list->count++;
+   if (type == CMD_FREE_TEXTURE || type == CMD_UPLOAD_MESH || type == CMD_FREE_MESHES ||
+       type == CMD_BEGIN_TARGET || type == CMD_FREE_TARGET || type == CMD_UPLOAD_GLYPH)
+      list->mutates = true;
+   return header + 1;
+
+fail:
+   if (!list->overflowed)
+      core_log(RETRO_LOG_ERROR, "Command list out of memory, dropping draws this frame");
+   list->overflowed = true;
+   return NULL;
+}
+
+void module_cmdlist_set_view(cmdlist *list, const float *affine) {
+   if (memcmp(affine, list->view_affine, sizeof(list->view_affine)) == 0)
+      return;
+   if (list->view_count == CMDLIST_MAX_VIEWS) {
+      if (!list->overflowed)
+         core_log(RETRO_LOG_ERROR, "More than %d views in one frame, keeping the last", CMDLIST_MAX_VIEWS);
+      list->overflowed = true;
+      return;
+   }
+   float *cmd = (float *)push_command(list, CMD_VIEW, sizeof(list->view_affine), 0);
+   if (!cmd)
+      return;
+   memcpy(cmd, affine, sizeof(list->view_affine));
+   memcpy(list->view_affine, affine, sizeof(list->view_affine));
+   list->view = ++list->view_count;
+}
+
+void module_cmdlist_solid_quad(cmdlist *list, float x, float y, float w, float h, float rotation,
+                               float r, float g, float b, float a, float vp_width, float vp_height) {
+   cmd_quad *cmd = (cmd_quad *)push_command(list, CMD_SOLID_QUAD, sizeof(cmd_quad), 0);
+   if (!cmd)
+      return;
+   *cmd = (cmd_quad){x, y, w, h, rotation, r, g, b, a, vp_width, vp_height};
+}
+
+void module_cmdlist_triangles(cmdlist *list, const float *vertices, int num_vertices, float x, float y,
+                              float rotation, float r, float g, float b, float a,
+                              float vp_width, float vp_height) {
+   if (num_vertices < 0)
+      num_vertices = 0;
+   size_t vertex_bytes = (size_t)num_vertices * 2 * sizeof(float);
+   cmd_triangles *cmd = (cmd_triangles *)push_command(list, CMD_TRIANGLES, sizeof(cmd_triangles), vertex_bytes);
+   if (!cmd)
+      return;
+   *cmd = (cmd_triangles){num_vertices, x, y, rotation, r, g, b, a, vp_width, vp_height};
+   memcpy(cmd + 1, vertices, vertex_bytes);
+}
+
+void module_cmdlist_text(cmdlist *list, float x, float y, const char *text,
+                         float r, float g, float b, float a, float vp_width, float vp_height) {
+   size_t len = strlen(text);
+   cmd_text *cmd = (cmd_text *)push_command(list, CMD_TEXT, sizeof(cmd_text), len + 1);
+   if (!cmd)
+      return;
+   *cmd = (cmd_text){x, y, r, g, b, a, vp_width, vp_height};
+   memcpy(cmd + 1, text, len + 1);
+}
+
+bool module_cmdlist_upload_glyph(cmdlist *list, int x, int y, int w, int h, const unsigned char *pixels) {
+   size_t pixel_bytes = (size_t)w * (size_t)h;
+   cmd_upload_glyph *cmd = (cmd_upload_glyph *)push_command(list, CMD_UPLOAD_GLYPH, sizeof(cmd_upload_glyph), pixel_bytes);
+   if (!cmd)
+      return false;
+   *cmd = (cmd_upload_glyph){x, y, w, h};
+   memcpy(cmd + 1, pixels, pixel_bytes);
+   return true;
+}
+
+void module_cmdlist_glyphs(cmdlist *list, const float *quads, int count, float x, float y,
+                           float r, float g, float b, float a, float vp_width, float vp_height) {
+   size_t quad_bytes = (size_t)count * 8 * sizeof(float);
+   cmd_glyphs *cmd = (cmd_glyphs *)push_command(list, CMD_GLYPHS, sizeof(cmd_glyphs), quad_bytes);
+   if (!cmd)
+      return;
+   *cmd = (cmd_glyphs){count, x, y, r, g, b, a, vp_width, vp_height};
+   memcpy(cmd + 1, quads, quad_bytes);
+}
+
+void module_cmdlist_texture(cmdlist *list, GLuint texture_id, float x, float y, float w, float h,
+                            float rotation, float r, float g, float b, float a,
+                            float vp_width, float vp_height) {
+   cmd_texture *cmd = (cmd_texture *)push_command(list, CMD_TEXTURE, sizeof(cmd_texture), 0);
+   if (!cmd)
+      return;
+   cmd->texture_id = texture_id;
+   cmd->quad = (cmd_quad){x, y, w, h, rotation, r, g, b, a, vp_width, vp_height};
+}
+
+void module_cmdlist_texture_instanced(cmdlist *list, GLuint texture_id, int count,
+                                      const float *xs, const float *ys, const float *sizes,
+                                      const uint32_t *colors, bool additive,
+                                      float vp_width, float vp_height) {
+   if (count <= 0)
+      return;
+   size_t column = (size_t)count * 4;
+   cmd_instanced *cmd = (cmd_instanced *)push_command(list, CMD_TEXTURE_INSTANCED, sizeof(cmd_instanced), column * 4);
+   if (!cmd)
+      return;
+   *cmd = (cmd_instanced){texture_id, count, additive, vp_width, vp_height};
+   unsigned char *arrays = (unsigned char *)(cmd + 1);
+   memcpy(arrays, xs, column);
+   memcpy(arrays + column, ys, column);
+   memcpy(arrays + column * 2, sizes, column);
+   memcpy(arrays + column * 3, colors, column);
+}
+
+void module_cmdlist_free_texture(cmdlist *list, GLuint texture_id) {
+   GLuint *cmd = (GLuint *)push_command(list, CMD_FREE_TEXTURE, sizeof(GLuint), 0);
+   if (cmd)
+      *cmd = texture_id;
+}
+
+void module_cmdlist_upload_mesh(cmdlist *list, GLuint vbo, const float *vertices, int num_vertices) {
+   if (num_vertices < 0)
+      num_vertices = 0;
+   size_t vertex_bytes = (size_t)num_vertices * 4 * sizeof(float);
+   cmd_upload_mesh *cmd = (cmd_upload_mesh *)push_command(list, CMD_UPLOAD_MESH, sizeof(cmd_upload_mesh), vertex_bytes);
+   if (!cmd)
+      return;
+   *cmd = (cmd_upload_mesh){vbo, num_vertices};
+   memcpy(cmd + 1, vertices, vertex_bytes);
+}
+
+void module_cmdlist_draw_mesh(cmdlist *list, GLuint vao, int num_vertices, GLuint texture_id, float x, float y,
+                              float r, float g, float b, float a, float vp_width, float vp_height) {
+   cmd_draw_mesh *cmd = (cmd_draw_mesh *)push_command(list, CMD_DRAW_MESH, sizeof(cmd_draw_mesh), 0);
+   if (cmd)
+      *cmd = (cmd_draw_mesh){vao, num_vertices, texture_id, x, y, r, g, b, a, vp_width, vp_height};
+}
+
+void module_cmdlist_free_meshes(cmdlist *list, int count, const GLuint *vaos, const GLuint *vbos) {
+   size_t names = (size_t)count * sizeof(GLuint);
+   cmd_free_meshes *cmd = (cmd_free_meshes *)push_command(list, CMD_FREE_MESHES, sizeof(cmd_free_meshes), names * 2);
+   if (!cmd)
+      return;
+   cmd->count = count;
+   memcpy(cmd + 1, vaos, names);
+   memcpy((unsigned char *)(cmd + 1) + names, vbos, names);
+}
+
+void module_cmdlist_begin_target(cmdlist *list, GLuint fbo, int width, int height) {
+   cmd_begin_target *cmd = (cmd_begin_target *)push_command(list, CMD_BEGIN_TARGET, sizeof(cmd_begin_target), 0);
+   if (cmd)
+      *cmd = (cmd_begin_target){fbo, width, height};
+}
+
+void module_cmdlist_end_target(cmdlist *list) {
+   push_command(list, CMD_END_TARGET, 0, 0);
+}
+
+void module_cmdlist_draw_target(cmdlist *list, GLuint texture, float x, float y, float w, float h,
+                                float opacity, float vp_width, float vp_height) {
+   cmd_draw_target *cmd = (cmd_draw_target *)push_command(list, CMD_DRAW_TARGET, sizeof(cmd_draw_target), 0);
+   if (cmd)
+      *cmd = (cmd_draw_target){texture, x, y, w, h, opacity, vp_width, vp_height};
+}
+
+void module_cmdlist_free_target(cmdlist *list, GLuint fbo, GLuint texture) {
+   cmd_free_target *cmd = (cmd_free_target *)push_command(list, CMD_FREE_TARGET, sizeof(cmd_free_target), 0);
+   if (cmd)
+      *cmd = (cmd_free_target){fbo, texture};
+}
+
+// Execute one recorded command
+static void issue(const void *command) {
+   const cmd_header *header = (const cmd_header *)command;
+   const void *payload = header + 1;
+   module_opengl_use_view(header->view);
+   switch ((cmd_type)header->type) {
+      case CMD_SOLID_QUAD: {
+         const cmd_quad *c = (const cmd_quad *)payload;
+         module_opengl_draw_solid_quad(c->x, c->y, c->w, c->h, c->rotation,
+                                       c->r, c->g, c->b, c->a, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_TRIANGLES: {
+         const cmd_triangles *c = (const cmd_triangles *)payload;
+         module_opengl_draw_triangles((const float *)(c + 1), c->num_vertices, c->x, c->y, c->rotation,
+                                      c->r, c->g, c->b, c->a, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_TEXT: {
+         const cmd_text *c = (const cmd_text *)payload;
+         module_opengl_draw_text(c->x, c->y, (const char *)(c + 1),
+                                 c->r, c->g, c->b, c->a, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_TEXTURE: {
+         const cmd_texture *c = (const cmd_texture *)payload;
+         const cmd_quad *q = &c->quad;
+         module_opengl_draw_texture(c->texture_id, q->x, q->y, q->w, q->h, q->rotation,
+                                    q->r, q->g, q->b, q->a, q->vp_width, q->vp_height);
+         break;
+      }
+      case CMD_TEXTURE_INSTANCED: {
+         const cmd_instanced *c = (const cmd_instanced *)payload;
+         const float *xs = (const float *)(c + 1);
+         module_opengl_draw_texture_instanced(c->texture_id, c->count, xs, xs + c->count, xs + c->count * 2,
+                                              (const uint32_t *)(xs + c->count * 3), c->additive != 0,
+                                              c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_FREE_TEXTURE:
+         module_opengl_free_texture(*(const GLuint *)payload);
+         break;
+      case CMD_UPLOAD_MESH: {
+         const cmd_upload_mesh *c = (const cmd_upload_mesh *)payload;
+         module_opengl_upload_mesh(c->vbo, (const float *)(c + 1), c->num_vertices);
+         break;
+      }
+      case CMD_DRAW_MESH: {
+         const cmd_draw_mesh *c = (const cmd_draw_mesh *)payload;
+         module_opengl_draw_mesh(c->vao, c->num_vertices, c->texture_id, c->x, c->y,
+                                 c->r, c->g, c->b, c->a, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_FREE_MESHES: {
+         const cmd_free_meshes *c = (const cmd_free_meshes *)payload;
+         const GLuint *vaos = (const GLuint *)(c + 1);
+         module_opengl_free_meshes(c->count, vaos, vaos + c->count);
+         break;
+      }
+      case CMD_BEGIN_TARGET: {
+         const cmd_begin_target *c = (const cmd_begin_target *)payload;
+         module_opengl_begin_target(c->fbo, c->width, c->height);
+         break;
+      }
+      case CMD_END_TARGET:
+         module_opengl_end_target();
+         break;
+      case CMD_DRAW_TARGET: {
+         const cmd_draw_target *c = (const cmd_draw_target *)payload;
+         module_opengl_draw_target(c->texture, c->x, c->y, c->w, c->h, c->opacity, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_FREE_TARGET: {
+         const cmd_free_target *c = (const cmd_free_target *)payload;
+         module_opengl_free_target(c->fbo, c->texture);
+         break;
+      }
+      case CMD_GLYPHS: {
+         const cmd_glyphs *c = (const cmd_glyphs *)payload;
+         module_opengl_draw_glyphs((const float *)(c + 1), c->count, c->x, c->y,
+                                   c->r, c->g, c->b, c->a, c->vp_width, c->vp_height);
+         break;
+      }
+      case CMD_VIEW:
+      case CMD_UPLOAD_GLYPH:
+         break;  // uploaded before the first draw
+   }
+}
+
+// Queue a draw command for the render queue with its state; false for
+// commands that are not draws
+static bool queue_command(const cmd_header *header) {
+   const void *payload = header + 1;
+   draw_program program;
+   GLuint texture = 0;
+   float alpha = 0.0f;  // translucent unless known otherwise
+   switch ((cmd_type)header->type) {
+      case CMD_SOLID_QUAD:
+         program = DRAW_PROGRAM_SOLID;
+         alpha = ((const cmd_quad *)payload)->a;
+         break;
+      case CMD_TRIANGLES:
+         program = DRAW_PROGRAM_SOLID;
+         alpha = ((const cmd_triangles *)payload)->a;
+         break;
+      case CMD_TEXT:
+      case CMD_GLYPHS:
+         program = DRAW_PROGRAM_TEXT;
+         break;
+      case CMD_TEXTURE:
+         program = DRAW_PROGRAM_TEXTURE;
+         texture = ((const cmd_texture *)payload)->texture_id;
+         alpha = ((const cmd_texture *)payload)->quad.a;
+         break;
+      case CMD_TEXTURE_INSTANCED:
+         program = DRAW_PROGRAM_INSTANCED;
+         texture = ((const cmd_instanced *)payload)->texture_id;
+         break;
+      case CMD_DRAW_MESH:
+         program = DRAW_PROGRAM_TEXTURE;
+         texture = ((const cmd_draw_mesh *)payload)->texture_id;
+         alpha = ((const cmd_draw_mesh *)payload)->a;
+         break;
+      case CMD_DRAW_TARGET:
+         program = DRAW_PROGRAM_TEXTURE;
+         texture = ((const cmd_draw_target *)payload)->texture;
+         break;
+      default:
+         return false;
+   }
+   if (!module_opengl_queue_draw(header->layer, program, texture, alpha, header)) {
+      module_opengl_flush_queue(issue);
+      issue(header);
+   }
+   return true;
+}
+
+static bool is_free(uint32_t type) {
+   return type == CMD_FREE_TEXTURE || type == CMD_FREE_MESHES || type == CMD_FREE_TARGET;
+}
+
+// Upload the frame's glyphs, then the identity and every recorded view, in
+// index order
+static void upload_shared(const cmdlist *list) {
+   int count = 1 + list->view_count;
+   if (count > replay_view_capacity) {
+      float *grown = (float *)realloc(replay_views, (size_t)count * sizeof(identity_view));
+      if (grown) {
+         replay_views = grown;
+         replay_view_capacity = count;
+      } else {
+         core_log(RETRO_LOG_ERROR, "Out of memory for %d views, drawing without them", count);
+         count = 1;
+      }
+   }
+   float *next = NULL;  // where the next recorded view goes, if any are kept
+   if (count > 1) {
+      memcpy(replay_views, identity_view, sizeof(identity_view));
+      next = replay_views + 6;
+   }
+   const unsigned char *p = list->data, *end = list->data + list->size;
+   for (; p < end; p += ((const cmd_header *)p)->size) {
+      const cmd_header *header = (const cmd_header *)p;
+      if (header->type == CMD_VIEW && next) {
+         memcpy(next, header + 1, sizeof(identity_view));
+         next += 6;
+      } else if (header->type == CMD_UPLOAD_GLYPH) {
+         const cmd_upload_glyph *c = (const cmd_upload_glyph *)(header + 1);
+         module_opengl_upload_glyph(c->x, c->y, c->w, c->h, (const unsigned char *)(c + 1));
+      }
+   }
+   module_opengl_upload_views(count > 1 ? replay_views : identity_view, count);
+}
+
+void module_cmdlist_replay(const cmdlist *list) {
+   // Draws go through the render queue; other commands flush it first so
+   // they stay ordered with the draws around them. Frees only have to follow
+   // every draw that may use them, so they run after the last flush, and
+   // views and glyphs were all uploaded up front.
+   upload_shared(list);
+   const unsigned char *p = list->data, *end = list->data + list->size;
+   while (p < end) {
+      const cmd_header *header = (const cmd_header *)p;
+      if (header->type != CMD_VIEW && header->type != CMD_UPLOAD_GLYPH &&
+          !is_free(header->type) && !queue_command(header)) {
+         module_opengl_flush_queue(issue);
+         issue(header);
+      }
+      p += header->size;
+   }
+   module_opengl_flush_queue(issue);
+
+   for (p = list->data; p < end; p += ((const cmd_header *)p)->size) {
+      if (is_free(((const cmd_header *)p)->type))
+         issue(p);
+   }
+}
+
+void module_cmdlist_replay_resources(const cmdlist *list) {
+   if (!list->mutates)
+      return;
+   // Render target passes are drawn in full, since the target's texture
+   // keeps what they drew; draws to the frame itself are skipped
+   upload_shared(list);
+   const unsigned char *p = list->data, *end = list->data + list->size;
+   bool in_target = false;
+   for (; p < end; p += ((const cmd_header *)p)->size) {
+      uint32_t type = ((const cmd_header *)p)->type;
+      if (type == CMD_BEGIN_TARGET)
+         in_target = true;
+      if (in_target || type == CMD_UPLOAD_MESH)
+         issue(p);
+      if (type == CMD_END_TARGET)
+         in_target = false;
+   }
+   for (p = list->data; p < end; p += ((const cmd_header *)p)->size) {
+      if (is_free(((const cmd_header *)p)->type))
+         issue(p);
+   }
+}
@@ -0,0 +1,618 @@
+// module_font.c
+// TrueType text through stb_truetype. A font is a TTF asset at one pixel
+// size; drawing lays its UTF-8 text out once, rasterizes glyphs into the
+// shared glyph atlas the first time they are needed, and issues the whole
+// string as one batch of atlas quads.
+//
+// The atlas is packed in shelves: full-width rows of one height, filled left
+// to right. A glyph goes on the shortest shelf it fits, else on a new shelf
+// below the last one. Once the atlas is full, the least recently drawn run
+// of adjacent shelves tall enough for the glyph is emptied and merged into
+// one shelf. Shelves holding a glyph drawn this frame are never reused,
+// which lets a recorded frame upload all its glyphs before its first draw.
+//
+// Layouts (each glyph's index and pen position, kerning applied) live in a
+// direct-mapped cache keyed by font and string, so text redrawn every frame
+// costs a hash, a compare and one glyph lookup per character.
+#include "module_font.h"
+#include "module_opengl.h"
+#include "core_thread.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "stb_truetype.h"
+
+#define FONT_PADDING 1           // transparent pixels around each glyph
+#define SHELF_ROUNDING 4         // shelf heights are multiples of this
+#define MAX_SHELVES (GLYPH_ATLAS_SIZE / SHELF_ROUNDING)
+#define MAX_GLYPHS 4096          // glyphs cached at once
+#define GLYPH_BUCKETS 1024       // power of two
+#define LAYOUT_CACHE_SLOTS 256   // power of two
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+typedef struct {
+   char *asset;
+   float size;
+   unsigned char *data;  // the TTF file, which info points into
+   stbtt_fontinfo info;
+   float scale;          // font units to pixels
+   float ascent;         // pixels from a line's top to its baseline
+   float line_height;    // pixels from one line's top to the next
+} font;
+
+static font fonts[FONT_MAX_FONTS];  // id n is fonts[n - 1]
+static int font_count = 0;
+
+typedef struct {
+   int font;        // id, 0 for a free entry
+   int glyph;       // glyph index in the font
+   int next;        // next entry in the bucket (or free list), -1 at the end
+   int shelf;       // -1 for glyphs without pixels
+   int x, y, w, h;  // padded cell in the atlas
+   int dx, dy;      // cell's top-left from the pen on the baseline
+   uint32_t stamp;  // last frame a glyph without pixels was drawn
+} glyph_entry;
+
+static glyph_entry glyphs[MAX_GLYPHS];
+static int buckets[GLYPH_BUCKETS];
+static int free_glyphs = -1;
+static bool glyphs_ready = false;  // buckets and free list set up
+
+typedef struct {
+   int y, height;   // atlas rows
+   int used;        // columns taken from the left
+   int glyphs;      // glyphs on the shelf
+   uint32_t stamp;  // last frame one of them was drawn, 0 if never
+} shelf;
+
+static shelf shelves[MAX_SHELVES];  // top to bottom, back to back
+static int shelf_count = 0;
+static int atlas_bottom = 0;        // first row below the last shelf
+
+static uint32_t frame = 1;
+static bool warned_full = false;          // this frame
+static volatile int32_t atlas_lost = 0;   // set by module_font_context_reset
+
+typedef struct {
+   int glyph;
+   float x, y;  // pen on the baseline, from the text's top-left corner
+} placed_glyph;
+
+typedef struct {
+   uint64_t hash;
+   int font;  // 0 for an empty slot
+   char *text;
+   int len, text_capacity;
+   placed_glyph *glyphs;
+   int count, glyph_capacity;
+   float width, height;
+} layout_entry;
+
+static layout_entry layouts[LAYOUT_CACHE_SLOTS];
+
+// Glyph bitmap being rasterized, and the quads of the text being drawn
+static unsigned char *bitmap = NULL;
+static int bitmap_capacity = 0;
+static float *quads = NULL;
+static int quad_capacity = 0;  // glyphs
+
+static bool grow(void **buf, int *capacity, int needed, size_t item_size) {
+   if (needed <= *capacity)
+      return true;
+   int capacity_new = *capacity ? *capacity : 64;
+   while (capacity_new < needed)
+      capacity_new *= 2;
+   void *grown = realloc(*buf, (size_t)capacity_new * item_size);
+   if (!grown)
+      return false;
+   *buf = grown;
+   *capacity = capacity_new;
+   return true;
+}
+
+static font *get_font(int id) {
+   return id >= 1 && id <= font_count ? &fonts[id - 1] : NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Loading
+
+int module_font_load(const char *asset_name, float size) {
+   if (!(size >= FONT_MIN_SIZE && size <= FONT_MAX_SIZE)) {
+      core_log(RETRO_LOG_ERROR, "Font %s: size %g is outside %d..%d", asset_name, size, FONT_MIN_SIZE, FONT_MAX_SIZE);
+      return 0;
+   }
+   for (int i = 0; i < font_count; i++) {
+      if (fonts[i].size == size && strcmp(fonts[i].asset, asset_name) == 0)
+         return i + 1;
+   }
+   if (font_count == FONT_MAX_FONTS) {
+      core_log(RETRO_LOG_ERROR, "Font %s: %d fonts are already loaded", asset_name, FONT_MAX_FONTS);
+      return 0;
+   }
+
+   char *data = NULL;
+   size_t data_size = 0;
+   if (!extract_asset_from_zip(asset_name, &data, &data_size)) {
+      core_log(RETRO_LOG_ERROR, "Failed to extract font asset: %s", asset_name);
+      return 0;
+   }
+   font *f = &fonts[font_count];
+   memset(f, 0, sizeof(*f));
+   f->data = (unsigned char *)data;
+   int offset = data_size >= 12 ? stbtt_GetFontOffsetForIndex(f->data, 0) : -1;
+   f->asset = (char *)malloc(strlen(asset_name) + 1);
+   if (offset < 0 || !f->asset || !stbtt_InitFont(&f->info, f->data, offset)) {
+      core_log(RETRO_LOG_ERROR, "Failed to load font %s: not a TrueType font", asset_name);
+      free(f->asset);
+      free(data);
+      return 0;
+   }
+   strcpy(f->asset, asset_name);
+   f->size = size;
+   f->scale = stbtt_ScaleForPixelHeight(&f->info, size);
+   int ascent, descent, line_gap;
+   stbtt_GetFontVMetrics(&f->info, &ascent, &descent, &line_gap);
+   f->ascent = roundf(ascent * f->scale);
+   f->line_height = roundf((ascent - descent + line_gap) * f->scale);
+   font_count++;
+
+   core_log(RETRO_LOG_INFO, "Loaded font %s at %gpx as font %d (%zu bytes)", asset_name, size, font_count, data_size);
+   return font_count;
+}
+
+// ---------------------------------------------------------------------------
+// Atlas shelves
+
+// Forget every glyph on shelves first..last; the shelves after them move by
+// shift places
+static void drop_glyphs(int first, int last, int shift) {
+   for (int b = 0; b < GLYPH_BUCKETS; b++) {
+      int *link = &buckets[b];
+      while (*link >= 0) {
+         glyph_entry *e = &glyphs[*link];
+         if (e->shelf >= first && e->shelf <= last) {
+            int index = *link;
+            *link = e->next;
+            e->font = 0;
+            e->next = free_glyphs;
+            free_glyphs = index;
+            continue;
+         }
+         if (e->shelf > last)
+            e->shelf += shift;
+         link = &e->next;
+      }
+   }
+}
+
+// Empty shelves first..last and make them one shelf of height rows at the
+// run's top (the rows left over become an empty shelf, or free rows at the
+// bottom of the atlas); returns its index
+static int reclaim(int first, int last, int height) {
+   int top = shelves[first].y;
+   bool at_bottom = last == shelf_count - 1;
+   int rows = (at_bottom ? atlas_bottom : shelves[last].y + shelves[last].height) - top;
+   int replacing = last - first + 1;
+   int replaced_by = rows > height && !at_bottom ? 2 : 1;
+   int shift = replaced_by - replacing;
+
+   drop_glyphs(first, last, shift);
+   memmove(&shelves[first + replaced_by], &shelves[last + 1], (size_t)(shelf_count - last - 1) * sizeof(shelf));
+   shelf_count += shift;
+   shelves[first] = (shelf){top, height, 0, 0, 0};
+   if (replaced_by == 2)
+      shelves[first + 1] = (shelf){top + height, rows - height, 0, 0, 0};
+   else if (at_bottom)
+      atlas_bottom = top + height;
+   return first;
+}
+
+// Empty the least recently drawn run of adjacent shelves with room for
+// height rows (counting free rows below the last shelf); -1 if every run
+// that tall holds a glyph drawn this frame
+static int evict_rows(int height) {
+   int best_first = -1, best_last = -1;
+   uint32_t best_stamp = UINT32_MAX;
+   for (int i = 0; i < shelf_count; i++) {
+      int rows = 0;
+      uint32_t newest = 0;
+      for (int j = i; j < shelf_count && shelves[j].stamp != frame; j++) {
+         rows += shelves[j].height;
+         if (shelves[j].stamp > newest)
+            newest = shelves[j].stamp;
+         if (rows + (j == shelf_count - 1 ? GLYPH_ATLAS_SIZE - atlas_bottom : 0) >= height) {
+            if (newest < best_stamp) {
+               best_first = i;
+               best_last = j;
+               best_stamp = newest;
+            }
+            break;
+         }
+      }
+   }
+   if (best_first < 0)
+      return -1;
+   if (best_last == shelf_count - 1)
+      atlas_bottom = GLYPH_ATLAS_SIZE;  // the free rows join the run
+   return reclaim(best_first, best_last, height);
+}
+
+// Find atlas space for a w x h cell; returns its shelf (and the cell's
+// corner) or -1 when the atlas has no room this frame
+static int place_cell(int w, int h, int *x, int *y) {
+   if (w > GLYPH_ATLAS_SIZE || h > GLYPH_ATLAS_SIZE)
+      return -1;
+   int height = (h + SHELF_ROUNDING - 1) / SHELF_ROUNDING * SHELF_ROUNDING;
+
+   // The shortest shelf with room, if it wastes less than half the cell's height
+   int best = -1;
+   for (int i = 0; i < shelf_count; i++) {
+      const shelf *s = &shelves[i];
+      if (s->height >= height && s->height <= height + height / 2 && s->used + w <= GLYPH_ATLAS_SIZE &&
+          (best < 0 || s->height < shelves[best].height))
+         best = i;
+   }
+   if (best < 0 && atlas_bottom + height <= GLYPH_ATLAS_SIZE) {
+      best = shelf_count++;
+      shelves[best] = (shelf){atlas_bottom, height, 0, 0, 0};
+      atlas_bottom += height;
+   }
+   if (best < 0)
+      best = evict_rows(height);
+   if (best < 0)
+      return -1;
+
+   shelf *s = &shelves[best];
+   *x = s->used;
+   *y = s->y;
+   s->used += w;
+   s->glyphs++;
+   s->stamp = frame;
+   return best;
+}
+
+static int glyph_bucket(int font_id, int glyph);
+
+// Free a glyph entry: the least recently drawn glyph without pixels, or
+// every glyph of the least recently drawn shelf if that is older; false if
+// all of them were drawn this frame
+static bool evict_entries(void) {
+   int oldest = -1;
+   for (int i = 0; i < shelf_count; i++) {
+      if (shelves[i].glyphs > 0 && shelves[i].stamp != frame &&
+          (oldest < 0 || shelves[i].stamp < shelves[oldest].stamp))
+         oldest = i;
+   }
+   int blank = -1;
+   for (int i = 0; i < MAX_GLYPHS; i++) {
+      const glyph_entry *e = &glyphs[i];
+      if (e->font && e->shelf < 0 && e->stamp != frame && (blank < 0 || e->stamp < glyphs[blank].stamp))
+         blank = i;
+   }
+
+   if (blank >= 0 && (oldest < 0 || glyphs[blank].stamp <= shelves[oldest].stamp)) {
+      int *link = &buckets[glyph_bucket(glyphs[blank].font, glyphs[blank].glyph)];
+      while (*link != blank)
+         link = &glyphs[*link].next;
+      *link = glyphs[blank].next;
+      glyphs[blank].font = 0;
+      glyphs[blank].next = free_glyphs;
+      free_glyphs = blank;
+      return true;
+   }
+   if (oldest < 0)
+      return false;
+   reclaim(oldest, oldest, shelves[oldest].height);
+   return true;
+}
+
+static void reset_glyphs(void) {
+   for (int b = 0; b < GLYPH_BUCKETS; b++)
+      buckets[b] = -1;
+   for (int i = 0; i < MAX_GLYPHS; i++) {
+      glyphs[i].font = 0;
+      glyphs[i].next = i + 1 < MAX_GLYPHS ? i + 1 : -1;
+   }
+   free_glyphs = 0;
+   shelf_count = 0;
+   atlas_bottom = 0;
+   glyphs_ready = true;
+}
+
+// ---------------------------------------------------------------------------
+// Glyph cache
+
+static int glyph_bucket(int font_id, int glyph) {
+   return (int)(((uint32_t)font_id * 2654435761u ^ (uint32_t)glyph * 40503u) & (GLYPH_BUCKETS - 1));
+}
+
+static void warn_full(const font *f) {
+   if (!warned_full)
+      core_log(RETRO_LOG_WARN, "Font %s: glyph atlas is full this frame, skipping glyphs", f->asset);
+   warned_full = true;
+}
+
+// The cached glyph, rasterized and uploaded on a miss; NULL if it could not be
+static const glyph_entry *get_glyph(int font_id, font *f, int glyph) {
+   int bucket = glyph_bucket(font_id, glyph);
+   for (int i = buckets[bucket]; i >= 0; i = glyphs[i].next) {
+      glyph_entry *e = &glyphs[i];
+      if (e->font == font_id && e->glyph == glyph) {
+         if (e->shelf >= 0)
+            shelves[e->shelf].stamp = frame;
+         else
+            e->stamp = frame;
+         return e;
+      }
+   }
+
+   if (free_glyphs < 0 && !evict_entries()) {
+      warn_full(f);
+      return NULL;
+   }
+
+   int x0, y0, x1, y1;
+   stbtt_GetGlyphBitmapBox(&f->info, glyph, f->scale, f->scale, &x0, &y0, &x1, &y1);
+   int w = x1 - x0, h = y1 - y0;
+   glyph_entry cell = {font_id, glyph, -1, -1, 0, 0, 0, 0, 0, 0, frame};
+   if (w > 0 && h > 0) {
+      cell.w = w + 2 * FONT_PADDING;
+      cell.h = h + 2 * FONT_PADDING;
+      cell.dx = x0 - FONT_PADDING;
+      cell.dy = y0 - FONT_PADDING;
+      cell.shelf = place_cell(cell.w, cell.h, &cell.x, &cell.y);
+      if (cell.shelf < 0) {
+         warn_full(f);
+         return NULL;
+      }
+
+      // Rasterize inside a cleared border so the upload also clears whatever
+      // an evicted glyph left around the cell
+      if (!grow((void **)&bitmap, &bitmap_capacity, cell.w * cell.h, 1)) {
+         core_log(RETRO_LOG_ERROR, "Font %s: out of memory for a %dx%d glyph", f->asset, w, h);
+         return NULL;
+      }
+      memset(bitmap, 0, (size_t)cell.w * cell.h);
+      stbtt_MakeGlyphBitmap(&f->info, bitmap + FONT_PADDING * cell.w + FONT_PADDING, w, h, cell.w,
+                            f->scale, f->scale, glyph);
+      if (!module_opengl_upload_glyph(cell.x, cell.y, cell.w, cell.h, bitmap))
+         return NULL;
+   }
+
+   // Placing the cell only ever frees entries
+   int index = free_glyphs;
+   free_glyphs = glyphs[index].next;
+   cell.next = buckets[bucket];
+   glyphs[index] = cell;
+   buckets[bucket] = index;
+   return &glyphs[index];
+}
+
+// ---------------------------------------------------------------------------
+// Layout
+
+// Decode the UTF-8 sequence at *p, advancing past it. Malformed, truncated,
+// overlong and surrogate sequences read as U+FFFD one byte at a time.
+static uint32_t next_codepoint(const unsigned char **p, const unsigned char *end) {
+   const unsigned char *s = *p;
+   uint32_t c = s[0], min;
+   int extra;
+   *p = s + 1;
+   if (c < 0x80)
+      return c;
+   if ((c & 0xE0) == 0xC0) {
+      extra = 1;
+      c &= 0x1F;
+      min = 0x80;
+   } else if ((c & 0xF0) == 0xE0) {
+      extra = 2;
+      c &= 0x0F;
+      min = 0x800;
+   } else if ((c & 0xF8) == 0xF0) {
+      extra = 3;
+      c &= 0x07;
+      min = 0x10000;
+   } else {
+      return REPLACEMENT_CHARACTER;
+   }
+   if (end - s <= extra)
+      return REPLACEMENT_CHARACTER;
+   for (int i = 1; i <= extra; i++) {
+      if ((s[i] & 0xC0) != 0x80)
+         return REPLACEMENT_CHARACTER;
+      c = c << 6 | (s[i] & 0x3F);
+   }
+   if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+      return REPLACEMENT_CHARACTER;
+   *p = s + 1 + extra;
+   return c;
+}
+
+// Lay text out with font f into e
+static bool build_layout(layout_entry *e, const font *f, const char *text, int len) {
+   const unsigned char *p = (const unsigned char *)text, *end = p + len;
+   float pen_x = 0.0f, baseline = f->ascent;
+   int previous = 0;
+   e->count = 0;
+   e->width = 0.0f;
+   e->height = len > 0 ? f->line_height : 0.0f;
+   while (p < end) {
+      uint32_t c = next_codepoint(&p, end);
+      if (c == '\n') {
+         pen_x = 0.0f;
+         baseline += f->line_height;
+         e->height += f->line_height;
+         previous = 0;
+         continue;
+      }
+      if (c < 32 || c == 127)
+         continue;
+      int glyph = stbtt_FindGlyphIndex(&f->info, (int)c);
+      if (previous)
+         pen_x += stbtt_GetGlyphKernAdvance(&f->info, previous, glyph) * f->scale;
+      if (!grow((void **)&e->glyphs, &e->glyph_capacity, e->count + 1, sizeof(placed_glyph)))
+         return false;
+      e->glyphs[e->count++] = (placed_glyph){glyph, pen_x, baseline};
+      int advance, left_bearing;
+      stbtt_GetGlyphHMetrics(&f->info, glyph, &advance, &left_bearing);
+      pen_x += advance * f->scale;
+      if (pen_x > e->width)
+         e->width = pen_x;
+      previous = glyph;
+   }
+   return true;
+}
+
+// Cached layout of text in font; NULL when out of memory
+static const layout_entry *get_layout(int font_id, const font *f, const char *text) {
+   size_t length = strlen(text);
+   if (length > INT32_MAX / 2)
+      return NULL;
+   int len = (int)length;
+
+   // FNV-1a over the font id and the text
+   uint64_t hash = 14695981039346656037ull;
+   hash = (hash ^ (uint64_t)font_id) * 1099511628211ull;
+   for (int i = 0; i < len; i++)
+      hash = (hash ^ (unsigned char)text[i]) * 1099511628211ull;
+
+   layout_entry *e = &layouts[hash & (LAYOUT_CACHE_SLOTS - 1)];
+   if (e->font == font_id && e->hash == hash && e->len == len && memcmp(e->text, text, (size_t)len) == 0)
+      return e;
+
+   e->font = 0;
+   if (!grow((void **)&e->text, &e->text_capacity, len + 1, 1) || !build_layout(e, f, text, len)) {
+      core_log(RETRO_LOG_ERROR, "Font %s: out of memory laying out %d bytes of text", f->asset, len);
+      return NULL;
+   }
+   memcpy(e->text, text, (size_t)len + 1);
+   e->len = len;
+   e->hash = hash;
+   e->font = font_id;
+   return e;
+}
+
+// ---------------------------------------------------------------------------
+// Drawing
+
+void module_font_draw(int font_id, float x, float y, const char *text,
+                      float r, float g, float b, float a, float vp_width, float vp_height) {
+   font *f = get_font(font_id);
+   if (!f) {
+      core_log(RETRO_LOG_ERROR, "draw_text: unknown font %d", font_id);
+      return;
+   }
+   if (!glyphs_ready)
+      reset_glyphs();
+   const layout_entry *layout = get_layout(font_id, f, text);
+   if (!layout || layout->count == 0)
+      return;
+   if (!grow((void **)&quads, &quad_capacity, layout->count, 8 * sizeof(float))) {
+      core_log(RETRO_LOG_ERROR, "Font %s: out of memory for %d glyphs", f->asset, layout->count);
+      return;
+   }
+
+   // Glyphs snap to whole pixels from (x, y) so they sample the atlas 1:1
+   const float texel = 1.0f / GLYPH_ATLAS_SIZE;
+   int count = 0;
+   for (int i = 0; i < layout->count; i++) {
+      const placed_glyph *p = &layout->glyphs[i];
+      const glyph_entry *e = get_glyph(font_id, f, p->glyph);
+      if (!e || e->shelf < 0)
+         continue;
+      float *q = quads + count++ * 8;
+      q[0] = floorf(p->x + 0.5f) + e->dx;
+      q[1] = p->y + e->dy;
+      q[2] = q[0] + e->w;
+      q[3] = q[1] + e->h;
+      q[4] = e->x * texel;
+      q[5] = e->y * texel;
+      q[6] = (e->x + e->w) * texel;
+      q[7] = (e->y + e->h) * texel;
+   }
+   module_opengl_draw_glyphs(quads, count, x, y, r, g, b, a, vp_width, vp_height);
+}
+
+bool module_font_measure(int font_id, const char *text, float *width, float *height) {
+   font *f = get_font(font_id);
+   const layout_entry *layout = f ? get_layout(font_id, f, text) : NULL;
+   if (!layout)
+      return false;
+   *width = layout->width;
+   *height = layout->height;
+   return true;
+}
+
+void module_font_begin_frame(void) {
+   if (core_atomic_load(&atlas_lost)) {
+      core_atomic_store(&atlas_lost, 0);
+      glyphs_ready = false;
+   }
+   frame++;
+   warned_full = false;
+}
+
+void module_font_context_reset(void) {
+   core_atomic_store(&atlas_lost, 1);
+}
+
+void module_font_shutdown(void) {
+   for (int i = 0; i < font_count; i++) {
+      free(fonts[i].asset);
+      free(fonts[i].data);
+   }
+   memset(fonts, 0, sizeof(fonts));
+   font_count = 0;
+   for (int i = 0; i < LAYOUT_CACHE_SLOTS; i++) {
+      free(layouts[i].text);
+      free(layouts[i].glyphs);
+   }
+   memset(layouts, 0, sizeof(layouts));
+   free(bitmap);
+   free(quads);
+   bitmap = NULL;
+   quads = NULL;
+   bitmap_capacity = quad_capacity = 0;
+   glyphs_ready = false;
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings
+
+// load_font(asset_name, size) -> font id, or nil
+static int lua_load_font(lua_State *L) {
+   const char *asset_name = luaL_checkstring(L, 1);
+   float size = (float)luaL_checknumber(L, 2);
+   int id = module_font_load(asset_name, size);
+   if (id == 0)
+      lua_pushnil(L);
+   else
+      lua_pushinteger(L, id);
+   return 1;
+}
+
+// measure_text(text [, font]) -> width, height; without a font, of the
+// built-in 8x8 one
+static int lua_measure_text(lua_State *L) {
+   size_t len;
+   const char *text = luaL_checklstring(L, 1, &len);
+   float width = 8.0f * (float)len, height = len > 0 ? 8.0f : 0.0f;
+   if (!lua_isnoneornil(L, 2)) {
+      int id = (int)luaL_checkinteger(L, 2);
+      if (!module_font_measure(id, text, &width, &height))
+         return luaL_error(L, "unknown font %d", id);
+   }
+   lua_pushnumber(L, width);
+   lua_pushnumber(L, height);
+   return 2;
+}
+
+void module_font_register(lua_State *L) {
+   lua_register(L, "load_font", lua_load_font);
+   lua_register(L, "measure_text", lua_measure_text);
+}
@@ -0,0 +1,396 @@
+// module_hotreload.c
+// Hot reload of Lua code from the content zip. The zip is watched with
+// inotify on Linux (on its directory, since zip tools usually replace the
+// file by renaming a temporary one) and by polling its size and mtime
+// elsewhere. After a change, the reload waits until the file has been quiet
+// for HOTRELOAD_SETTLE_FRAMES frames, then compares the CRC-32 of every .lua
+// entry in the central directory with the last load and re-runs only the
+// chunks that changed, in the existing state:
+//
+//  - script.lua runs again in _G. A global that held a table before and is
+//    assigned a new table keeps the old one: the new table's functions
+//    replace the old ones and keys the old table lacks are added, so data
+//    survives while code is updated. Every top-level statement runs again,
+//    side effects included (loading images, spawning workers and tasks), so
+//    scripts keep their setup in init(), which a reload does not call.
+//    Layers are the exception: layer.new hands back the layers the previous
+//    run created (see module_layer_begin_script).
+//  - A module loaded through require ("a/b.lua" -> "a.b") is re-run and
+//    merged into its package.loaded table the same way, so code holding a
+//    reference to the module sees the new functions.
+//
+// Then on_reload(changed_chunks) is called if the script defines it. Textures
+// and other GL resources are untouched.
+#include "module_hotreload.h"
+#include "module_layer.h"
+#include "module_lua.h"
+#include "libretro_core.h"
+#include <miniz.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#define HOTRELOAD_SETTLE_FRAMES 10   // quiet frames before reloading
+#define HOTRELOAD_POLL_FRAMES 30     // stat interval without inotify
+#define HOTRELOAD_RETRY_FRAMES 60    // wait after an unreadable zip
+#define HOTRELOAD_MAX_CHUNKS 256
+#define HOTRELOAD_MAIN_CHUNK "script.lua"
+
+typedef struct {
+   char name[256];
+   uint32_t crc;
+} chunk_crc;
+
+static struct {
+   bool active;
+   char path[512];
+   int inotify_fd;   // -1 when polling
+   int watch;
+   const char *basename;
+
+   long long size;   // last seen by stat
+   long long mtime;
+   int poll_countdown;
+   int settle;       // frames left until a pending reload runs (0 = none)
+
+   chunk_crc chunks[HOTRELOAD_MAX_CHUNKS];
+   int num_chunks;
+} reload = {.inotify_fd = -1};
+
+static bool is_lua_chunk(const char *name) {
+   size_t len = strlen(name);
+   return len > 4 && strcmp(name + len - 4, ".lua") == 0;
+}
+
+// Read the CRCs of the zip's Lua entries; returns -1 if the zip cannot be read
+static int scan_chunks(chunk_crc *out, int max) {
+   mz_zip_archive zip;
+   memset(&zip, 0, sizeof(zip));
+   if (!mz_zip_reader_init_file(&zip, reload.path, 0))
+      return -1;
+   int count = 0;
+   mz_uint files = mz_zip_reader_get_num_files(&zip);
+   for (mz_uint i = 0; i < files && count < max; i++) {
+      mz_zip_archive_file_stat st;
+      if (!mz_zip_reader_file_stat(&zip, i, &st) || st.m_is_directory || !is_lua_chunk(st.m_filename))
+         continue;
+      if (strlen(st.m_filename) >= sizeof(out[count].name))
+         continue;
+      strcpy(out[count].name, st.m_filename);
+      out[count].crc = st.m_crc32;
+      count++;
+   }
+   mz_zip_reader_end(&zip);
+   return count;
+}
+
+static bool stat_file(long long *size, long long *mtime) {
+   struct stat st;
+   if (stat(reload.path, &st) != 0)
+      return false;
+   *size = (long long)st.st_size;
+   *mtime = (long long)st.st_mtime;
+   return true;
+}
+
+// Merge the table at -1 into the table at -2 (functions replaced, missing
+// keys added) and pop it
+static void merge_table(lua_State *L) {
+   lua_pushnil(L);
+   while (lua_next(L, -2)) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, -5);
+      bool missing = lua_isnil(L, -1);
+      lua_pop(L, 1);
+      if (missing || lua_isfunction(L, -1)) {
+         lua_pushvalue(L, -2);
+         lua_insert(L, -2);
+         lua_rawset(L, -5);
+      } else {
+         lua_pop(L, 1);
+      }
+   }
+   lua_pop(L, 1);
+}
+
+// Re-run script.lua in _G, keeping global tables that it replaces
+static bool reload_main_chunk(lua_State *L, const char *data, size_t size) {
+   if (luaL_loadbuffer(L, data, size, HOTRELOAD_MAIN_CHUNK) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "Hot reload: %s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+      return false;
+   }
+
+   // saved[name] = table, for every global table before the chunk runs
+   lua_newtable(L);
+   int saved = lua_gettop(L);
+   lua_pushglobaltable(L);
+   lua_pushnil(L);
+   while (lua_next(L, -2)) {
+      if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+         lua_pushvalue(L, -2);
+         lua_insert(L, -2);
+         lua_rawset(L, saved);
+      } else {
+         lua_pop(L, 1);
+      }
+   }
+   lua_pop(L, 1);
+
+   lua_pushvalue(L, saved - 1);
+   module_layer_begin_script(true);
+   bool ok = lua_pcall(L, 0, 0, 0) == LUA_OK;
+   module_layer_end_script(ok);
+   if (!ok) {
+      core_log(RETRO_LOG_ERROR, "Hot reload: %s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+   }
+
+   // Put the old tables back, with the new code merged in (also after an error,
+   // so a half-run chunk does not lose state)
+   lua_pushglobaltable(L);
+   int globals = lua_gettop(L);
+   lua_pushnil(L);
+   while (lua_next(L, saved)) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, globals);
+      if (lua_istable(L, -1) && !lua_rawequal(L, -1, -2)) {
+         lua_pushvalue(L, -2);
+         lua_insert(L, -2);
+         merge_table(L);
+         lua_pop(L, 1);
+         lua_pushvalue(L, -2);
+         lua_pushvalue(L, -2);
+         lua_rawset(L, globals);
+         lua_pop(L, 1);
+      } else {
+         lua_pop(L, 2);
+      }
+   }
+   lua_pop(L, 3);
+   return ok;
+}
+
+// Re-run a module loaded by require and merge it into package.loaded;
+// returns false (quietly) if it was never required
+static bool reload_module(lua_State *L, const char *path, const char *data, size_t size) {
+   char name[256];
+   size_t len = strlen(path) - 4;  // without ".lua"
+   if (len >= sizeof(name))
+      return false;
+   for (size_t i = 0; i < len; i++)
+      name[i] = path[i] == '/' ? '.' : path[i];
+   name[len] = '\0';
+
+   lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+   if (lua_getfield(L, -1, name) == LUA_TNIL) {
+      lua_pop(L, 2);
+      return false;
+   }
+   if (luaL_loadbuffer(L, data, size, path) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "Hot reload: %s", lua_tostring(L, -1));
+      lua_pop(L, 3);
+      return false;
+   }
+   lua_pushstring(L, name);
+   lua_pushstring(L, path);
+   if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "Hot reload: %s", lua_tostring(L, -1));
+      lua_pop(L, 3);
+      return false;
+   }
+   if (lua_istable(L, -2) && lua_istable(L, -1)) {
+      merge_table(L);
+   } else {
+      if (lua_isnil(L, -1)) {
+         lua_pop(L, 1);
+         lua_pushboolean(L, 1);
+      }
+      lua_setfield(L, -3, name);
+   }
+   lua_pop(L, 2);
+   return true;
+}
+
+static void call_on_reload(lua_State *L, const char **changed, int count) {
+   if (lua_getglobal(L, "on_reload") != LUA_TFUNCTION) {
+      lua_pop(L, 1);
+      return;
+   }
+   lua_createtable(L, count, 0);
+   for (int i = 0; i < count; i++) {
+      lua_pushstring(L, changed[i]);
+      lua_rawseti(L, -2, i + 1);
+   }
+   if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "on_reload error: %s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+   }
+}
+
+static uint32_t previous_crc(const char *name, bool *found) {
+   for (int i = 0; i < reload.num_chunks; i++) {
+      if (strcmp(reload.chunks[i].name, name) == 0) {
+         *found = true;
+         return reload.chunks[i].crc;
+      }
+   }
+   *found = false;
+   return 0;
+}
+
+// Returns false if the zip could not be read (the reload is retried)
+static bool reload_changed_chunks(void) {
+   static chunk_crc current[HOTRELOAD_MAX_CHUNKS];
+   int count = scan_chunks(current, HOTRELOAD_MAX_CHUNKS);
+   if (count < 0)
+      return false;
+
+   lua_State *L = module_lua_get_state();
+   const char *changed[HOTRELOAD_MAX_CHUNKS];
+   int num_changed = 0;
+
+   // The main chunk goes first so modules it requires anew are loaded by it
+   for (int pass = 0; pass < 2 && L; pass++) {
+      for (int i = 0; i < count; i++) {
+         bool is_main = strcmp(current[i].name, HOTRELOAD_MAIN_CHUNK) == 0;
+         if (is_main != (pass == 0))
+            continue;
+         bool found;
+         uint32_t crc = previous_crc(current[i].name, &found);
+         if (found && crc == current[i].crc)
+            continue;
+
+         char *data = NULL;
+         size_t size = 0;
+         if (!extract_asset_from_zip(current[i].name, &data, &size))
+            continue;
+         bool reloaded = is_main ? reload_main_chunk(L, data, size)
+                                 : reload_module(L, current[i].name, data, size);
+         free(data);
+         if (reloaded) {
+            changed[num_changed++] = current[i].name;
+            core_log(RETRO_LOG_INFO, "Hot reload: reloaded %s", current[i].name);
+         }
+      }
+   }
+
+   if (num_changed)
+      call_on_reload(L, changed, num_changed);
+   else
+      core_log(RETRO_LOG_INFO, "Hot reload: content changed, no loaded Lua chunk differs");
+
+   memcpy(reload.chunks, current, (size_t)count * sizeof(chunk_crc));
+   reload.num_chunks = count;
+   return true;
+}
+
+// True if the watched file changed since the last call
+static bool file_changed(void) {
+#ifdef __linux__
+   if (reload.inotify_fd >= 0) {
+      bool changed = false;
+      char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+      ssize_t n;
+      while ((n = read(reload.inotify_fd, buffer, sizeof(buffer))) > 0) {
+         for (char *p = buffer; p < buffer + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->len && strcmp(event->name, reload.basename) == 0)
+               changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+         }
+      }
+      return changed;
+   }
+#endif
+   if (--reload.poll_countdown > 0)
+      return false;
+   reload.poll_countdown = HOTRELOAD_POLL_FRAMES;
+   long long size, mtime;
+   if (!stat_file(&size, &mtime) || (size == reload.size && mtime == reload.mtime))
+      return false;
+   reload.size = size;
+   reload.mtime = mtime;
+   return true;
+}
+
+bool module_hotreload_start(const char *zip_path) {
+   module_hotreload_stop();
+   if (!zip_path || !zip_path[0] || strlen(zip_path) >= sizeof(reload.path))
+      return false;
+   strcpy(reload.path, zip_path);
+   const char *slash = strrchr(reload.path, '/');
+#ifdef _WIN32
+   const char *backslash = strrchr(reload.path, '\\');
+   if (backslash && (!slash || backslash > slash))
+      slash = backslash;
+#endif
+   reload.basename = slash ? slash + 1 : reload.path;
+
+   int count = scan_chunks(reload.chunks, HOTRELOAD_MAX_CHUNKS);
+   if (count < 0 || !stat_file(&reload.size, &reload.mtime)) {
+      core_log(RETRO_LOG_WARN, "Hot reload: cannot read %s", reload.path);
+      return false;
+   }
+   reload.num_chunks = count;
+
+#ifdef __linux__
+   char dir[sizeof(reload.path)];
+   if (slash) {
+      size_t len = (size_t)(slash - reload.path);
+      memcpy(dir, reload.path, len);
+      dir[len ? len : 1] = '\0';
+      if (!len)
+         dir[0] = '/';
+   } else {
+      strcpy(dir, ".");
+   }
+   reload.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (reload.inotify_fd >= 0) {
+      reload.watch = inotify_add_watch(reload.inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+      if (reload.watch < 0) {
+         core_log(RETRO_LOG_WARN, "Hot reload: inotify on %s failed (%s), polling instead", dir, strerror(errno));
+         close(reload.inotify_fd);
+         reload.inotify_fd = -1;
+      }
+   }
+#endif
+
+   reload.poll_countdown = HOTRELOAD_POLL_FRAMES;
+   reload.settle = 0;
+   reload.active = true;
+   core_log(RETRO_LOG_INFO, "Hot reload: watching %s (%d Lua chunks, %s)", reload.path, count,
+            reload.inotify_fd >= 0 ? "inotify" : "polling");
+   return true;
+}
+
+void module_hotreload_poll(void) {
+   if (!reload.active)
+      return;
+   // Restart the countdown on every change, so a zip still being written is not read
+   if (file_changed())
+      reload.settle = HOTRELOAD_SETTLE_FRAMES;
+   if (reload.settle == 0 || --reload.settle > 0)
+      return;
+   if (!reload_changed_chunks()) {
+      core_log(RETRO_LOG_WARN, "Hot reload: cannot read %s yet, retrying", reload.path);
+      reload.settle = HOTRELOAD_RETRY_FRAMES;
+   }
+}
+
+void module_hotreload_stop(void) {
+#ifdef __linux__
+   if (reload.inotify_fd >= 0)
+      close(reload.inotify_fd);
+#endif
+   reload.inotify_fd = -1;
+   reload.active = false;
+   reload.num_chunks = 0;
+}
@@ -0,0 +1,561 @@
+// module_jobs.c
+// Work-stealing job system. Every worker owns a deque: it pushes and pops its
+// own jobs LIFO at the bottom, idle workers steal FIFO from the top of other
+// deques. Jobs submitted from non-worker threads (the frontend thread) go to a
+// shared injection queue. Threads that wait on a job run queued jobs meanwhile,
+// so waiting from inside a job cannot deadlock the pool.
+#include "module_jobs.h"
+#include "module_buffer.h"
+#include "module_math.h"
+#include "core_thread.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOBS_MAX_WORKERS 16
+#define JOBS_MAX_RANGES 128   // ranges one parallel_for splits into at most
+#define JOBS_QUEUE_INITIAL 256
+
+typedef struct {
+   core_mutex lock;
+   job **ring;
+   int capacity;  // power of two
+   int top;       // steal end
+   int bottom;    // owner end
+} job_queue;
+
+static struct {
+   bool running;
+   int num_workers;
+   core_thread threads[JOBS_MAX_WORKERS];
+   job_queue queues[JOBS_MAX_WORKERS + 1]; // last one is the injection queue
+   volatile int32_t queued;                // jobs sitting in any queue
+   volatile int32_t sleepers;
+   volatile int32_t quit;
+   core_mutex sleep_lock;
+   core_cond wake;
+} pool;
+
+// Index of the current thread's queue (the injection queue for non-workers)
+static CORE_THREAD_LOCAL int current_queue = -1;
+
+#define INJECTION_QUEUE (pool.num_workers)
+
+static int thread_queue(void) {
+   return current_queue >= 0 ? current_queue : INJECTION_QUEUE;
+}
+
+static void spin_lock(volatile int32_t *lock) {
+   while (!core_atomic_cas(lock, 0, 1))
+      core_thread_yield();
+}
+
+static void spin_unlock(volatile int32_t *lock) {
+   core_atomic_store(lock, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Queues
+
+static bool queue_init(job_queue *q) {
+   core_mutex_init(&q->lock);
+   q->ring = (job **)malloc(JOBS_QUEUE_INITIAL * sizeof(job *));
+   q->capacity = JOBS_QUEUE_INITIAL;
+   q->top = q->bottom = 0;
+   return q->ring != NULL;
+}
+
+static void queue_destroy(job_queue *q) {
+   core_mutex_destroy(&q->lock);
+   free(q->ring);
+   q->ring = NULL;
+}
+
+static bool queue_push(job_queue *q, job *j) {
+   core_mutex_lock(&q->lock);
+   if (q->bottom - q->top == q->capacity) {
+      job **ring = (job **)malloc((size_t)q->capacity * 2 * sizeof(job *));
+      if (!ring) {
+         core_mutex_unlock(&q->lock);
+         return false;
+      }
+      for (int i = q->top; i < q->bottom; i++)
+         ring[i & (q->capacity * 2 - 1)] = q->ring[i & (q->capacity - 1)];
+      free(q->ring);
+      q->ring = ring;
+      q->capacity *= 2;
+   }
+   q->ring[q->bottom & (q->capacity - 1)] = j;
+   q->bottom++;
+   core_mutex_unlock(&q->lock);
+   return true;
+}
+
+static job *queue_pop(job_queue *q, bool from_top) {
+   job *j = NULL;
+   core_mutex_lock(&q->lock);
+   if (q->bottom != q->top) {
+      if (from_top)
+         j = q->ring[q->top++ & (q->capacity - 1)];
+      else
+         j = q->ring[--q->bottom & (q->capacity - 1)];
+   }
+   core_mutex_unlock(&q->lock);
+   return j;
+}
+
+static void run(job *j);
+
+static void enqueue(job *j) {
+   // Without a pool (not started or shut down) jobs run right away on this thread
+   if (!pool.running || !queue_push(&pool.queues[thread_queue()], j)) {
+      run(j);
+      return;
+   }
+   core_atomic_add(&pool.queued, 1);
+   if (core_atomic_load(&pool.sleepers) > 0) {
+      core_mutex_lock(&pool.sleep_lock);
+      core_cond_signal(&pool.wake);
+      core_mutex_unlock(&pool.sleep_lock);
+   }
+}
+
+// Own queue first (LIFO for cache locality), then the injection queue, then steal
+static job *find_job(void) {
+   if (!pool.running || core_atomic_load(&pool.queued) == 0)
+      return NULL;
+   int self = thread_queue();
+   job *j = queue_pop(&pool.queues[self], self == INJECTION_QUEUE);
+   if (!j && self != INJECTION_QUEUE)
+      j = queue_pop(&pool.queues[INJECTION_QUEUE], true);
+   for (int k = 1; !j && k <= pool.num_workers; k++) {
+      int victim = (self + k) % (pool.num_workers + 1);
+      if (victim != INJECTION_QUEUE)
+         j = queue_pop(&pool.queues[victim], true);
+   }
+   if (j)
+      core_atomic_add(&pool.queued, -1);
+   return j;
+}
+
+static void finish(job *j) {
+   job *ready[JOB_MAX_CONTINUATIONS];
+   int n;
+
+   spin_lock(&j->lock);
+   core_atomic_store(&j->closed, 1);
+   n = j->num_continuations;
+   memcpy(ready, j->continuations, (size_t)n * sizeof(job *));
+   spin_unlock(&j->lock);
+
+   for (int i = 0; i < n; i++)
+      if (core_atomic_add(&ready[i]->pending, -1) == 0)
+         enqueue(ready[i]);
+
+   // Last access: the owner may free the job as soon as it sees this
+   core_atomic_store(&j->done, 1);
+}
+
+static void run(job *j) {
+   j->fn(j->data);
+   finish(j);
+}
+
+static CORE_THREAD_FUNC(worker_main) {
+   current_queue = (int)(intptr_t)arg;
+   while (!core_atomic_load(&pool.quit)) {
+      job *j = find_job();
+      if (j) {
+         run(j);
+         continue;
+      }
+      core_mutex_lock(&pool.sleep_lock);
+      core_atomic_add(&pool.sleepers, 1);
+      while (core_atomic_load(&pool.queued) == 0 && !core_atomic_load(&pool.quit))
+         core_cond_wait(&pool.wake, &pool.sleep_lock);
+      core_atomic_add(&pool.sleepers, -1);
+      core_mutex_unlock(&pool.sleep_lock);
+   }
+   return CORE_THREAD_RETURN;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+bool module_jobs_init(int num_workers) {
+   if (pool.running)
+      return true;
+   if (num_workers < 0)
+      num_workers = core_cpu_count() - 1;
+   if (num_workers > JOBS_MAX_WORKERS)
+      num_workers = JOBS_MAX_WORKERS;
+
+   memset(&pool, 0, sizeof(pool));
+   pool.num_workers = num_workers;
+   core_mutex_init(&pool.sleep_lock);
+   core_cond_init(&pool.wake);
+   for (int i = 0; i <= num_workers; i++) {
+      if (!queue_init(&pool.queues[i])) {
+         core_log(RETRO_LOG_ERROR, "Jobs: failed to allocate queue %d", i);
+         for (int k = 0; k <= i; k++)
+            queue_destroy(&pool.queues[k]);
+         return false;
+      }
+   }
+   pool.running = true;
+
+   for (int i = 0; i < num_workers; i++) {
+      if (!core_thread_create(&pool.threads[i], worker_main, (void *)(intptr_t)i)) {
+         core_log(RETRO_LOG_WARN, "Jobs: failed to start worker %d, continuing with %d", i, i);
+         // Nothing is queued yet: queue i becomes the injection queue, the rest go
+         pool.num_workers = i;
+         for (int k = i + 1; k <= num_workers; k++)
+            queue_destroy(&pool.queues[k]);
+         break;
+      }
+   }
+
+   core_log(RETRO_LOG_INFO, "Job system started with %d worker threads", pool.num_workers);
+   return true;
+}
+
+void module_jobs_shutdown(void) {
+   if (!pool.running)
+      return;
+
+   // Drain whatever is still queued before stopping the workers
+   job *j;
+   while ((j = find_job()) != NULL)
+      run(j);
+
+   core_mutex_lock(&pool.sleep_lock);
+   core_atomic_store(&pool.quit, 1);
+   core_cond_broadcast(&pool.wake);
+   core_mutex_unlock(&pool.sleep_lock);
+   for (int i = 0; i < pool.num_workers; i++)
+      core_thread_join(pool.threads[i]);
+
+   for (int i = 0; i <= pool.num_workers; i++)
+      queue_destroy(&pool.queues[i]);
+   core_cond_destroy(&pool.wake);
+   core_mutex_destroy(&pool.sleep_lock);
+   pool.running = false;
+   core_log(RETRO_LOG_INFO, "Job system stopped");
+}
+
+int module_jobs_worker_count(void) {
+   return pool.running ? pool.num_workers : 0;
+}
+
+void module_jobs_prepare(job *j, job_func fn, void *data) {
+   memset(j, 0, sizeof(*j));
+   j->fn = fn;
+   j->data = data;
+   j->pending = 1;
+}
+
+bool module_jobs_depend(job *j, job *before) {
+   bool ok = true;
+   spin_lock(&before->lock);
+   if (!core_atomic_load(&before->closed)) {
+      if (before->num_continuations < JOB_MAX_CONTINUATIONS) {
+         before->continuations[before->num_continuations++] = j;
+         core_atomic_add(&j->pending, 1);
+      } else {
+         ok = false;
+      }
+   }
+   spin_unlock(&before->lock);
+   return ok;
+}
+
+void module_jobs_submit(job *j) {
+   if (core_atomic_add(&j->pending, -1) == 0)
+      enqueue(j);
+}
+
+bool module_jobs_done(job *j) {
+   return core_atomic_load(&j->done) != 0;
+}
+
+void module_jobs_wait(job *j) {
+   while (!core_atomic_load(&j->done)) {
+      job *other = find_job();
+      if (other)
+         run(other);
+      else
+         core_thread_yield();
+   }
+}
+
+typedef struct {
+   job_range_func fn;
+   void *ctx;
+   int begin, end;
+} range_job;
+
+static void range_job_run(void *data) {
+   range_job *r = (range_job *)data;
+   r->fn(r->ctx, r->begin, r->end);
+}
+
+void module_jobs_parallel_for(int count, int grain, job_range_func fn, void *ctx) {
+   if (count <= 0)
+      return;
+   if (grain < 1)
+      grain = 1;
+   int workers = module_jobs_worker_count();
+   int ranges = (count + grain - 1) / grain;
+   if (ranges > (workers + 1) * 4)
+      ranges = (workers + 1) * 4;
+   if (ranges > JOBS_MAX_RANGES)
+      ranges = JOBS_MAX_RANGES;
+   if (workers == 0 || ranges <= 1) {
+      fn(ctx, 0, count);
+      return;
+   }
+
+   job jobs[JOBS_MAX_RANGES];
+   range_job data[JOBS_MAX_RANGES];
+   // The calling thread takes the first range itself
+   for (int i = 1; i < ranges; i++) {
+      data[i].fn = fn;
+      data[i].ctx = ctx;
+      data[i].begin = (int)((int64_t)count * i / ranges);
+      data[i].end = (int)((int64_t)count * (i + 1) / ranges);
+      module_jobs_prepare(&jobs[i], range_job_run, &data[i]);
+      module_jobs_submit(&jobs[i]);
+   }
+   fn(ctx, 0, (int)((int64_t)count / ranges));
+   for (int i = ranges - 1; i >= 1; i--)
+      module_jobs_wait(&jobs[i]);
+}
+
+// ---------------------------------------------------------------------------
+// Radix sort: per-range digit histograms, a serial prefix over ranges, then a
+// parallel stable scatter, one pass per key byte
+
+#define SORT_MAX_RANGES 32
+
+typedef struct {
+   const uint32_t *src_keys;
+   const int32_t *src_values;
+   uint32_t *dst_keys;
+   int32_t *dst_values;
+   int count;
+   int ranges;
+   int shift;
+   uint32_t (*histograms)[256];  // [range][digit], prefix offsets after the scan
+} radix_pass;
+
+static void radix_histogram(void *ctx, int begin, int end) {
+   radix_pass *p = (radix_pass *)ctx;
+   for (int r = begin; r < end; r++) {
+      uint32_t *hist = p->histograms[r];
+      int lo = (int)((int64_t)p->count * r / p->ranges), hi = (int)((int64_t)p->count * (r + 1) / p->ranges);
+      memset(hist, 0, 256 * sizeof(uint32_t));
+      for (int i = lo; i < hi; i++)
+         hist[(p->src_keys[i] >> p->shift) & 0xFF]++;
+   }
+}
+
+static void radix_scatter(void *ctx, int begin, int end) {
+   radix_pass *p = (radix_pass *)ctx;
+   for (int r = begin; r < end; r++) {
+      uint32_t *offsets = p->histograms[r];
+      int lo = (int)((int64_t)p->count * r / p->ranges), hi = (int)((int64_t)p->count * (r + 1) / p->ranges);
+      for (int i = lo; i < hi; i++) {
+         uint32_t slot = offsets[(p->src_keys[i] >> p->shift) & 0xFF]++;
+         p->dst_keys[slot] = p->src_keys[i];
+         if (p->dst_values)
+            p->dst_values[slot] = p->src_values[i];
+      }
+   }
+}
+
+bool module_jobs_sort_keys(uint32_t *keys, int32_t *values, int count) {
+   if (count < 2)
+      return true;
+
+   uint32_t (*histograms)[256] = malloc(SORT_MAX_RANGES * sizeof(*histograms));
+   uint32_t *tmp_keys = (uint32_t *)malloc((size_t)count * sizeof(uint32_t));
+   int32_t *tmp_values = values ? (int32_t *)malloc((size_t)count * sizeof(int32_t)) : NULL;
+   if (!histograms || !tmp_keys || (values && !tmp_values)) {
+      free(histograms);
+      free(tmp_keys);
+      free(tmp_values);
+      return false;
+   }
+
+   radix_pass p;
+   p.count = count;
+   p.ranges = (module_jobs_worker_count() + 1) * 2;
+   if (p.ranges > SORT_MAX_RANGES)
+      p.ranges = SORT_MAX_RANGES;
+   if (p.ranges > count / 4096 + 1)
+      p.ranges = count / 4096 + 1;
+   p.histograms = histograms;
+   p.src_keys = keys;
+   p.src_values = values;
+   p.dst_keys = tmp_keys;
+   p.dst_values = tmp_values;
+
+   for (p.shift = 0; p.shift < 32; p.shift += 8) {
+      module_jobs_parallel_for(p.ranges, 1, radix_histogram, &p);
+
+      // Exclusive prefix, digit-major so equal digits keep range order (stable)
+      uint32_t sum = 0;
+      bool single_digit = false;
+      for (int d = 0; d < 256; d++) {
+         uint32_t digit_total = 0;
+         for (int r = 0; r < p.ranges; r++) {
+            uint32_t n = histograms[r][d];
+            histograms[r][d] = sum;
+            sum += n;
+            digit_total += n;
+         }
+         if (digit_total == (uint32_t)count)
+            single_digit = true;
+      }
+      if (single_digit)
+         continue; // every key has the same byte here
+
+      module_jobs_parallel_for(p.ranges, 1, radix_scatter, &p);
+      uint32_t *k = (uint32_t *)p.src_keys;
+      int32_t *v = (int32_t *)p.src_values;
+      p.src_keys = p.dst_keys;
+      p.src_values = p.dst_values;
+      p.dst_keys = k;
+      p.dst_values = v;
+   }
+
+   if (p.src_keys != keys) {
+      memcpy(keys, p.src_keys, (size_t)count * sizeof(uint32_t));
+      if (values)
+         memcpy(values, p.src_values, (size_t)count * sizeof(int32_t));
+   }
+   free(histograms);
+   free(tmp_keys);
+   free(tmp_values);
+   return true;
+}
+
+// ---------------------------------------------------------------------------
+// Lua kernels. Each call splits its buffer across the workers and returns once
+// every range is done, so results are ready before drawing.
+
+typedef struct {
+   const float *src;
+   float *dst;
+   float m[6]; // x' = m0*x + m2*y + m4, y' = m1*x + m3*y + m5
+} transform_ctx;
+
+static void transform_range(void *ctx, int begin, int end) {
+   transform_ctx *t = (transform_ctx *)ctx;
+   module_math_transform_points(t->m, t->src + begin * 2, t->dst + begin * 2, end - begin);
+}
+
+// jobs.transform(src, dst, a, b, c, d, tx, ty) -- affine transform of x, y pairs (dst may be src)
+static int lua_jobs_transform(lua_State *L) {
+   core_buffer *src = module_buffer_check(L, 1, BUFFER_F32);
+   core_buffer *dst = module_buffer_check(L, 2, BUFFER_F32);
+   transform_ctx t;
+   luaL_argcheck(L, dst->count >= src->count, 2, "destination smaller than source");
+   for (int k = 0; k < 6; k++)
+      t.m[k] = (float)luaL_checknumber(L, 3 + k);
+   t.src = BUFFER_F32_DATA(src);
+   t.dst = BUFFER_F32_DATA(dst);
+   module_jobs_parallel_for((int)(src->count / 2), 4096, transform_range, &t);
+   return 0;
+}
+
+typedef struct {
+   const float *rects;
+   int32_t *out;
+   int32_t *range_counts;
+   int ranges;
+   int count;
+   float min_x, min_y, max_x, max_y;
+} cull_ctx;
+
+static void cull_range(void *ctx, int begin, int end) {
+   cull_ctx *c = (cull_ctx *)ctx;
+   for (int r = begin; r < end; r++) {
+      int lo = (int)((int64_t)c->count * r / c->ranges), hi = (int)((int64_t)c->count * (r + 1) / c->ranges);
+      int n = 0;
+      for (int i = lo; i < hi; i++) {
+         const float *s = c->rects + i * 4; // centre x, centre y, w, h
+         float hw = s[2] * 0.5f, hh = s[3] * 0.5f;
+         if (s[0] + hw >= c->min_x && s[0] - hw <= c->max_x && s[1] + hh >= c->min_y && s[1] - hh <= c->max_y)
+            c->out[lo + n++] = i + 1;
+      }
+      c->range_counts[r] = n;
+   }
+}
+
+// jobs.cull(rects, out, min_x, min_y, max_x, max_y) -> visible
+// rects: f32 buffer of centre x, centre y, w, h per sprite; out: i32 buffer
+// with room for every sprite, receives the 1-based indices of visible ones
+static int lua_jobs_cull(lua_State *L) {
+   core_buffer *rects = module_buffer_check(L, 1, BUFFER_F32);
+   core_buffer *out = module_buffer_check(L, 2, BUFFER_I32);
+   int32_t range_counts[JOBS_MAX_RANGES];
+   cull_ctx c;
+   c.count = (int)(rects->count / 4);
+   luaL_argcheck(L, out->count >= (size_t)c.count, 2, "output buffer smaller than sprite count");
+   c.rects = BUFFER_F32_DATA(rects);
+   c.out = BUFFER_I32_DATA(out);
+   c.range_counts = range_counts;
+   c.min_x = (float)luaL_checknumber(L, 3);
+   c.min_y = (float)luaL_checknumber(L, 4);
+   c.max_x = (float)luaL_checknumber(L, 5);
+   c.max_y = (float)luaL_checknumber(L, 6);
+   c.ranges = c.count / 4096 + 1;
+   if (c.ranges > JOBS_MAX_RANGES)
+      c.ranges = JOBS_MAX_RANGES;
+
+   module_jobs_parallel_for(c.ranges, 1, cull_range, &c);
+
+   // Compact the per-range runs
+   int visible = 0;
+   for (int r = 0; r < c.ranges; r++) {
+      int lo = (int)((int64_t)c.count * r / c.ranges);
+      if (lo != visible)
+         memmove(c.out + visible, c.out + lo, (size_t)range_counts[r] * sizeof(int32_t));
+      visible += range_counts[r];
+   }
+   lua_pushinteger(L, visible);
+   return 1;
+}
+
+// jobs.sort(keys [, values [, count]]) -- keys: u32 buffer, values: i32 buffer permuted alongside
+static int lua_jobs_sort(lua_State *L) {
+   core_buffer *keys = module_buffer_check(L, 1, BUFFER_U32);
+   core_buffer *values = lua_isnoneornil(L, 2) ? NULL : module_buffer_check(L, 2, BUFFER_I32);
+   lua_Integer count = luaL_optinteger(L, 3, (lua_Integer)keys->count);
+   luaL_argcheck(L, count >= 0 && (size_t)count <= keys->count && count <= INT32_MAX, 3, "count out of range");
+   luaL_argcheck(L, !values || values->count >= (size_t)count, 2, "values buffer smaller than count");
+   if (!module_jobs_sort_keys(BUFFER_U32_DATA(keys), values ? BUFFER_I32_DATA(values) : NULL, (int)count))
+      return luaL_error(L, "out of memory sorting %d keys", (int)count);
+   return 0;
+}
+
+// jobs.workers()
+static int lua_jobs_workers(lua_State *L) {
+   lua_pushinteger(L, module_jobs_worker_count());
+   return 1;
+}
+
+static const luaL_Reg jobs_funcs[] = {
+   {"transform", lua_jobs_transform},
+   {"cull", lua_jobs_cull},
+   {"sort", lua_jobs_sort},
+   {"workers", lua_jobs_workers},
+   {NULL, NULL}
+};
+
+void module_jobs_register(lua_State *L) {
+   luaL_newlib(L, jobs_funcs);
+   lua_setglobal(L, "jobs");
+}
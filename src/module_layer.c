@@ -0,0 +1,342 @@
+// module_layer.c
+// Offscreen layers. Each layer is a render target that holds the whole
+// virtual screen; scripts redraw a layer only while it is dirty and
+// composite it every frame as one textured quad, so static backgrounds and
+// HUDs cost a single draw on the frames where nothing about them changed.
+// Redrawing and compositing are recorded like any other draw, so layers work
+// the same in direct and pipelined frames.
+//
+// Layers belong to the Lua state and are freed with it. The ones the top
+// level of script.lua creates are numbered in creation order, so a hot
+// reload that runs it again gets the same layers back instead of new ones.
+#include "module_layer.h"
+#include "module_opengl.h"
+#include "core_thread.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LAYER_MAX_SIZE 4096
+#define LAYER_DEFAULT_SIZE VIRTUAL_WIDTH  // one pixel per virtual unit
+
+typedef struct {
+   GLuint fbo, texture;
+   int width, height;
+   bool alive;
+   bool dirty;
+   int script_order;  // creation order in script.lua's top level, -1 if created later
+} layer;
+
+static layer *layers = NULL;
+static int layer_capacity = 0;
+static int active_layer = -1;  // between begin and finish
+static volatile int32_t targets_lost = 0;  // set by module_layer_context_reset
+
+// Top-level run of script.lua in progress
+static struct {
+   bool running;
+   bool reloading;  // reuse the layers of the previous run
+   int next;        // script_order of the next layer.new
+} script;
+
+// Targets released outside a frame, freed by the next module_layer_begin_frame
+// so that they follow the recorded draws that may still use them
+static struct {
+   GLuint *fbos, *textures;
+   int count, capacity;
+} released;
+
+static layer *get_layer(int id) {
+   return id >= 0 && id < layer_capacity && layers[id].alive ? &layers[id] : NULL;
+}
+
+// Queue a target for module_layer_begin_frame; false if out of memory
+static bool release_target(GLuint fbo, GLuint texture) {
+   if (released.count == released.capacity) {
+      int capacity = released.capacity ? released.capacity * 2 : 8;
+      GLuint *fbos = (GLuint *)realloc(released.fbos, (size_t)capacity * sizeof(GLuint));
+      if (fbos)
+         released.fbos = fbos;
+      GLuint *textures = (GLuint *)realloc(released.textures, (size_t)capacity * sizeof(GLuint));
+      if (textures)
+         released.textures = textures;
+      if (!fbos || !textures)
+         return false;
+      released.capacity = capacity;
+   }
+   released.fbos[released.count] = fbo;
+   released.textures[released.count++] = texture;
+   return true;
+}
+
+// The layer the previous run of script.lua created order-th, or -1
+static int find_script_layer(int order) {
+   for (int id = 0; id < layer_capacity; id++) {
+      if (layers[id].alive && layers[id].script_order == order)
+         return id;
+   }
+   return -1;
+}
+
+// Hand layer id, which the previous run of a reloaded script.lua created at
+// this point, back redrawn (with a new target if its size changed)
+static int reuse_layer(int id, int width, int height) {
+   layer *l = &layers[id];
+   if (l->width != width || l->height != height) {
+      GLuint fbo, texture;
+      if (!module_opengl_create_target(width, height, &fbo, &texture))
+         return -1;
+      if (!release_target(l->fbo, l->texture))
+         core_log(RETRO_LOG_WARN, "Layer %d: leaking its old target", id);
+      l->fbo = fbo;
+      l->texture = texture;
+      l->width = width;
+      l->height = height;
+   }
+   l->dirty = true;
+   return id;
+}
+
+int module_layer_create(int width, int height) {
+   if (width <= 0 || height <= 0 || width > LAYER_MAX_SIZE || height > LAYER_MAX_SIZE) {
+      core_log(RETRO_LOG_ERROR, "Layer: invalid size %dx%d", width, height);
+      return -1;
+   }
+   int order = script.running ? script.next++ : -1;
+   int id = order >= 0 && script.reloading ? find_script_layer(order) : -1;
+   if (id >= 0)
+      return reuse_layer(id, width, height);
+   id = 0;
+   while (id < layer_capacity && layers[id].alive)
+      id++;
+   if (id == layer_capacity) {
+      int capacity = layer_capacity ? layer_capacity * 2 : 8;
+      layer *grown = (layer *)realloc(layers, (size_t)capacity * sizeof(layer));
+      if (!grown)
+         return -1;
+      for (int i = layer_capacity; i < capacity; i++)
+         grown[i].alive = false;
+      layers = grown;
+      layer_capacity = capacity;
+   }
+
+   layer *l = &layers[id];
+   if (!module_opengl_create_target(width, height, &l->fbo, &l->texture))
+      return -1;
+   l->width = width;
+   l->height = height;
+   l->alive = true;
+   l->dirty = true;
+   l->script_order = order;
+   core_log(RETRO_LOG_INFO, "Layer %d created (%dx%d)", id, width, height);
+   return id;
+}
+
+void module_layer_destroy(int id) {
+   layer *l = get_layer(id);
+   if (!l)
+      return;
+   if (active_layer == id)
+      module_layer_finish();
+   module_opengl_free_target(l->fbo, l->texture);
+   l->alive = false;
+}
+
+bool module_layer_begin(int id, bool force) {
+   layer *l = get_layer(id);
+   if (!l || active_layer >= 0 || !(l->dirty || force))
+      return false;
+   module_opengl_begin_target(l->fbo, l->width, l->height);
+   active_layer = id;
+   return true;
+}
+
+void module_layer_finish(void) {
+   if (active_layer < 0)
+      return;
+   module_opengl_end_target();
+   layers[active_layer].dirty = false;
+   active_layer = -1;
+}
+
+void module_layer_invalidate(int id) {
+   layer *l = get_layer(id);
+   if (l)
+      l->dirty = true;
+}
+
+bool module_layer_is_dirty(int id) {
+   layer *l = get_layer(id);
+   return l && l->dirty;
+}
+
+void module_layer_draw(int id, float x, float y, float opacity, float vp_width, float vp_height) {
+   layer *l = get_layer(id);
+   if (!l || id == active_layer)
+      return;
+   module_opengl_draw_target(l->texture, x, y, vp_width, vp_height, opacity, vp_width, vp_height);
+}
+
+void module_layer_begin_frame(void) {
+   if (!core_atomic_load(&targets_lost)) {
+      for (int i = 0; i < released.count; i++)
+         module_opengl_free_target(released.fbos[i], released.textures[i]);
+      released.count = 0;
+      return;
+   }
+   core_atomic_store(&targets_lost, 0);
+   released.count = 0;  // died with the old context
+   // The old names died with the context: make new targets and redraw them
+   for (int id = 0; id < layer_capacity; id++) {
+      layer *l = &layers[id];
+      if (!l->alive)
+         continue;
+      if (!module_opengl_create_target(l->width, l->height, &l->fbo, &l->texture)) {
+         core_log(RETRO_LOG_ERROR, "Layer %d: failed to recreate its %dx%d target", id, l->width, l->height);
+         l->alive = false;
+         continue;
+      }
+      l->dirty = true;
+   }
+}
+
+void module_layer_context_reset(void) {
+   core_atomic_store(&targets_lost, 1);
+}
+
+void module_layer_begin_script(bool reload) {
+   script.running = true;
+   script.reloading = reload;
+   script.next = 0;
+}
+
+void module_layer_end_script(bool completed) {
+   // A completed reload no longer creates the previous run's remaining
+   // layers; after an error they are kept, like the rest of the old state
+   if (script.reloading && completed) {
+      for (int id = 0; id < layer_capacity; id++) {
+         layer *l = &layers[id];
+         if (!l->alive || l->script_order < script.next)
+            continue;
+         if (active_layer == id)
+            module_layer_finish();
+         if (!release_target(l->fbo, l->texture))
+            core_log(RETRO_LOG_WARN, "Layer %d: leaking its target", id);
+         l->alive = false;
+      }
+   }
+   script.running = false;
+   script.reloading = false;
+}
+
+void module_layer_clear(void) {
+   // Outside a frame with the context alive, free the targets now; once GL
+   // is torn down the names are already gone
+   bool free_targets = module_opengl_is_initialized();
+   for (int id = 0; id < layer_capacity; id++) {
+      if (layers[id].alive && free_targets)
+         module_opengl_free_target(layers[id].fbo, layers[id].texture);
+      layers[id].alive = false;
+   }
+   for (int i = 0; i < released.count && free_targets; i++)
+      module_opengl_free_target(released.fbos[i], released.textures[i]);
+   released.count = 0;
+   active_layer = -1;
+}
+
+void module_layer_shutdown(void) {
+   module_layer_clear();
+   free(layers);
+   layers = NULL;
+   layer_capacity = 0;
+   free(released.fbos);
+   free(released.textures);
+   memset(&released, 0, sizeof(released));
+}
+
+void module_layer_end_frame(void) {
+   if (active_layer < 0)
+      return;
+   // The redraw did not complete; close it and try again next frame
+   int id = active_layer;
+   module_layer_finish();
+   layers[id].dirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings
+
+static int check_layer(lua_State *L, int arg) {
+   lua_Integer id = luaL_checkinteger(L, arg);
+   luaL_argcheck(L, id == (int)id && get_layer((int)id) != NULL, arg, "invalid layer id");
+   return (int)id;
+}
+
+// layer.new([width, height]) -> id or nil
+static int lua_layer_new(lua_State *L) {
+   int width = (int)luaL_optinteger(L, 1, LAYER_DEFAULT_SIZE);
+   int height = (int)luaL_optinteger(L, 2, width);
+   int id = module_layer_create(width, height);
+   if (id < 0)
+      lua_pushnil(L);
+   else
+      lua_pushinteger(L, id);
+   return 1;
+}
+
+static int lua_layer_free(lua_State *L) {
+   module_layer_destroy(check_layer(L, 1));
+   return 0;
+}
+
+// layer.begin(id [, force]) -> true if the layer is being redrawn
+static int lua_layer_begin(lua_State *L) {
+   int id = check_layer(L, 1);
+   bool force = lua_toboolean(L, 2);
+   if (active_layer >= 0)
+      return luaL_error(L, "layer %d is still open; call layer.finish() first", active_layer);
+   lua_pushboolean(L, module_layer_begin(id, force));
+   return 1;
+}
+
+static int lua_layer_finish(lua_State *L) {
+   (void)L;
+   module_layer_finish();
+   return 0;
+}
+
+static int lua_layer_invalidate(lua_State *L) {
+   module_layer_invalidate(check_layer(L, 1));
+   return 0;
+}
+
+static int lua_layer_is_dirty(lua_State *L) {
+   lua_pushboolean(L, module_layer_is_dirty(check_layer(L, 1)));
+   return 1;
+}
+
+// layer.draw(id [, x, y [, opacity]])
+static int lua_layer_draw(lua_State *L) {
+   int id = check_layer(L, 1);
+   float x = (float)luaL_optnumber(L, 2, 0.0);
+   float y = (float)luaL_optnumber(L, 3, 0.0);
+   float opacity = (float)luaL_optnumber(L, 4, 1.0);
+   module_layer_draw(id, x, y, opacity, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
+   return 0;
+}
+
+void module_layer_register(lua_State *L) {
+   static const luaL_Reg layer_funcs[] = {
+      {"new", lua_layer_new},
+      {"free", lua_layer_free},
+      {"begin", lua_layer_begin},
+      {"finish", lua_layer_finish},
+      {"invalidate", lua_layer_invalidate},
+      {"is_dirty", lua_layer_is_dirty},
+      {"draw", lua_layer_draw},
+      {NULL, NULL}
+   };
+   luaL_newlib(L, layer_funcs);
+   lua_setglobal(L, "layer");
+}
@@ -1,12 +1,47 @@
 // module_lua.c
 #include "module_lua.h"
 #include "module_opengl.h"
+#include "module_scene.h"
+#include "module_buffer.h"
+#include "module_broadphase.h"
+#include "module_particles.h"
+#include "module_jobs.h"
+#include "module_worker.h"
+#include "module_memory.h"
+#include "module_profiler.h"
+#include "module_tasks.h"
+#include "module_tilemap.h"
+#include "module_tween.h"
+#include "module_layer.h"
+#include "module_math.h"
+#include "module_camera.h"
+#include "module_shape.h"
+#include "module_font.h"
+#include "module_cmdlist.h"
+#include "libretro_core.h"
+#include "core_time.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Global variables
 static lua_State *L = NULL;
 
+// Watchdog for update(): a count hook compares the clock to a per-frame deadline
+#define WATCHDOG_HOOK_INSTRUCTIONS 1000
+
+static struct {
+   lua_watchdog_mode mode;
+   uint64_t budget_ns;
+   uint64_t deadline_ns;
+   uint64_t frame_start_ns;
+   bool armed;          // update() is running
+   bool reported;       // overrun already logged this frame
+   uint32_t overruns;
+   uint32_t preemptions;
+} watchdog;
+
 // External input callback from main.c
 extern retro_input_state_t input_state_cb;
 
@@ -27,7 +62,7 @@ static int lua_core_print(lua_State *L) {
 
 
 // Lua-exposed function: load_image(asset_name)
-static int lua_load_image(lua_State *L) {
+int lua_load_image(lua_State *L) {
    const char *asset_name = luaL_checkstring(L, 1);
    int width, height;
    GLuint texture_id = module_opengl_load_image(asset_name, &width, &height);
@@ -45,7 +80,7 @@ static int lua_load_image(lua_State *L) {
 
 
 // Lua-exposed function: draw_texture(texture_id, x, y, w, h, rotation, r, g, b, a)
-static int lua_draw_texture(lua_State *L) {
+int lua_draw_texture(lua_State *L) {
    GLuint texture_id = (GLuint)luaL_checkinteger(L, 1);
    float x = (float)luaL_checknumber(L, 2);
    float y = (float)luaL_checknumber(L, 3);
@@ -56,7 +91,7 @@ static int lua_draw_texture(lua_State *L) {
    float g = (float)luaL_checknumber(L, 8);
    float b = (float)luaL_checknumber(L, 9);
    float a = (float)luaL_checknumber(L, 10);
-   module_opengl_draw_texture(texture_id, x, y, w, h, rotation, r, g, b, a, 512, 512);
+   module_opengl_draw_texture(texture_id, x, y, w, h, rotation, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
    return 0;
 }
 
@@ -72,7 +107,7 @@ static int lua_draw_quad(lua_State *L) {
    float g = (float)luaL_checknumber(L, 7);
    float b = (float)luaL_checknumber(L, 8);
    float a = (float)luaL_checknumber(L, 9);
-   module_opengl_draw_solid_quad(x, y, w, h, rotation, r, g, b, a, 512, 512);
+   module_opengl_draw_solid_quad(x, y, w, h, rotation, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
    return 0;
 }
 
@@ -116,7 +151,7 @@ static int lua_draw_custom_quad(lua_State *L) {
         lua_pop(L, 3);
     }
 
-    module_opengl_draw_custom_quad(vertices, (int)num_vertices, x, y, rotation, r, g, b, a, 512, 512);
+    module_opengl_draw_custom_quad(vertices, (int)num_vertices, x, y, rotation, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
 
     free(vertices);
     return 0;
@@ -126,7 +161,8 @@ static int lua_draw_custom_quad(lua_State *L) {
 
 
 
-// Lua-exposed function: draw_text(x, y, text, r, g, b, a)
+// Lua-exposed function: draw_text(x, y, text, r, g, b, a [, font]); without
+// a font from load_font, in the built-in 8x8 one
 static int lua_draw_text(lua_State *L) {
    float x = (float)luaL_checknumber(L, 1);
    float y = (float)luaL_checknumber(L, 2);
@@ -135,7 +171,10 @@ static int lua_draw_text(lua_State *L) {
    float g = (float)luaL_checknumber(L, 5);
    float b = (float)luaL_checknumber(L, 6);
    float a = (float)luaL_checknumber(L, 7);
-   module_opengl_draw_text(x, y, text, r, g, b, a, 512, 512);
+   if (lua_isnoneornil(L, 8))
+      module_opengl_draw_text(x, y, text, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
+   else
+      module_font_draw((int)luaL_checkinteger(L, 8), x, y, text, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
    return 0;
 }
 
@@ -211,28 +250,189 @@ static int lua_free_texture(lua_State *L) {
 }
 
 
+// Lua-exposed function: present(flag)
+// present(false) lets the frontend show the previous frame again instead of
+// this one (when it can dupe and the frame frees or redraws no GPU resource)
+static int lua_present(lua_State *L) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list)
+      module_cmdlist_set_present(list, lua_toboolean(L, 1));
+   return 0;
+}
 
-bool module_lua_init(void) {
-   if (L) {
-      core_log(RETRO_LOG_INFO, "Lua already initialized, skipping");
-      return true;
+
+// Lua-exposed function: set_layer(n)
+// Draws after this call go to layer n (-128..127, 0 at the start of each
+// frame); lower layers are drawn first whatever the call order
+static int lua_set_layer(lua_State *L) {
+   lua_Integer layer = luaL_checkinteger(L, 1);
+   cmdlist *list = module_cmdlist_recording();
+   if (list)
+      module_cmdlist_set_layer(list, layer < INT_MIN ? INT_MIN : layer > INT_MAX ? INT_MAX : (int)layer);
+   return 0;
+}
+
+
+// Lua-exposed function: draw_stats() -> submitted, culled
+// Draws and instanced sprites of the previous frame that were recorded and
+// that viewport culling dropped
+static int lua_draw_stats(lua_State *L) {
+   int submitted, culled;
+   module_opengl_cull_stats(&submitted, &culled);
+   lua_pushinteger(L, submitted);
+   lua_pushinteger(L, culled);
+   return 2;
+}
+
+
+// package.searchers entry: require("a.b") loads a/b.lua from the content zip
+static int lua_zip_searcher(lua_State *L) {
+   const char *name = luaL_checkstring(L, 1);
+   char path[256];
+   char *data = NULL;
+   size_t size = 0;
+
+   snprintf(path, sizeof(path), "%s.lua", name);
+   size_t name_len = strlen(name);
+   for (size_t i = 0; i < name_len && i < sizeof(path); i++) {
+      if (path[i] == '.')
+         path[i] = '/';
+   }
+   // Most requires are for other searchers' modules: probe quietly and
+   // report a miss only through the returned message
+   if (!asset_exists_in_zip(path) || !extract_asset_from_zip(path, &data, &size)) {
+      lua_pushfstring(L, "no file '%s' in content", path);
+      return 1;
    }
+   int status = luaL_loadbuffer(L, data, size, path);
+   free(data);
+   if (status != LUA_OK)
+      return luaL_error(L, "error loading module '%s' from content:\n\t%s", name, lua_tostring(L, -1));
+   lua_pushstring(L, path);
+   return 2;
+}
 
-   core_log(RETRO_LOG_INFO, "Lua init with input_state_cb: %p", input_state_cb);
+void module_lua_install_zip_searcher(lua_State *L) {
+   lua_getglobal(L, "package");
+   lua_getfield(L, -1, "searchers");
+   if (lua_istable(L, -1)) {
+      // Insert after the preload searcher so content modules win over the filesystem
+      lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+      for (lua_Integer i = n; i >= 2; i--) {
+         lua_rawgeti(L, -1, i);
+         lua_rawseti(L, -2, i + 1);
+      }
+      lua_pushcfunction(L, lua_zip_searcher);
+      lua_rawseti(L, -2, 2);
+   }
+   lua_pop(L, 2);
+}
 
-   L = luaL_newstate();
-   if (!L) {
-      core_log(RETRO_LOG_ERROR, "Failed to create Lua state");
-      return false;
+
+// Count hook shared by the profiler and the watchdog. The watchdog acts once
+// update() has run past its deadline.
+static void core_hook(lua_State *T, lua_Debug *ar) {
+   (void)ar;
+   if (!watchdog.armed && !module_profiler_running())
+      return;
+   uint64_t now = core_time_ns();
+   module_profiler_sample(T, now);
+   if (!watchdog.armed || now < watchdog.deadline_ns)
+      return;
+
+   double elapsed_ms = (now - watchdog.frame_start_ns) / 1e6;
+   if (watchdog.mode == WATCHDOG_YIELD && lua_isyieldable(T) && module_tasks_is_running(T)) {
+      // Preempt the task; the scheduler resumes it on the next frame. Other
+      // coroutines are not preempted: their resumer would take the yield
+      // for a value.
+      watchdog.preemptions++;
+      lua_yield(T, 0);
+      return;
    }
+   if (watchdog.mode == WATCHDOG_ABORT) {
+      // Stays armed, so a script that catches the error is stopped again
+      watchdog.overruns++;
+      luaL_error(T, "update() aborted after %f ms (budget %f ms)", elapsed_ms, watchdog.budget_ns / 1e6);
+      return;
+   }
+   // In yield mode, code outside tasks gets a second budget before it counts as stuck
+   if (watchdog.mode == WATCHDOG_YIELD && now < watchdog.deadline_ns + watchdog.budget_ns)
+      return;
+   if (!watchdog.reported) {
+      watchdog.overruns++;
+      watchdog.reported = true;
+      luaL_traceback(T, T, NULL, 0);
+      core_log(RETRO_LOG_WARN, "Lua update() over its %.1f ms budget (%.1f ms so far):\n%s",
+               watchdog.budget_ns / 1e6, elapsed_ms, lua_tostring(T, -1));
+      lua_pop(T, 1);
+   }
+}
+
+// watchdog.stats() -> {mode, budget_ms, overruns, preemptions}
+static int lua_watchdog_stats(lua_State *L) {
+   static const char *const modes[] = {"off", "warn", "abort", "yield"};
+   lua_createtable(L, 0, 4);
+   lua_pushstring(L, modes[watchdog.mode]);
+   lua_setfield(L, -2, "mode");
+   lua_pushnumber(L, watchdog.budget_ns / 1e6);
+   lua_setfield(L, -2, "budget_ms");
+   lua_pushinteger(L, watchdog.overruns);
+   lua_setfield(L, -2, "overruns");
+   lua_pushinteger(L, watchdog.preemptions);
+   lua_setfield(L, -2, "preemptions");
+   return 1;
+}
 
+void module_lua_set_watchdog(lua_watchdog_mode mode, double budget_ms) {
+   watchdog.mode = budget_ms > 0.0 ? mode : WATCHDOG_OFF;
+   watchdog.budget_ns = (uint64_t)(budget_ms * 1e6);
+   if (L)
+      module_lua_refresh_hook(L);
+}
+
+void module_lua_refresh_hook(lua_State *T) {
+   lua_Hook hook = NULL;
+   int count = 0;
+   if (module_profiler_running()) {
+      hook = core_hook;
+      count = PROFILER_HOOK_INSTRUCTIONS;
+   } else if (watchdog.mode != WATCHDOG_OFF) {
+      hook = core_hook;
+      count = WATCHDOG_HOOK_INSTRUCTIONS;
+   }
+   // Hooks are per thread: set the main thread's and the caller's
+   lua_rawgeti(T, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+   lua_State *main_thread = lua_tothread(T, -1);
+   lua_pop(T, 1);
+   lua_sethook(main_thread, hook, hook ? LUA_MASKCOUNT : 0, count);
+   if (T != main_thread)
+      lua_sethook(T, hook, hook ? LUA_MASKCOUNT : 0, count);
+}
+
+
+// Open standard libraries and register the core's functions, tables and constants
+static void register_core_api(lua_State *L) {
    luaL_openlibs(L);
 
+   // Remember the standard globals so the profiler can tell core bindings apart
+   lua_newtable(L);
+   lua_pushglobaltable(L);
+   lua_pushnil(L);
+   while (lua_next(L, -2)) {
+      lua_pop(L, 1);
+      lua_pushvalue(L, -1);
+      lua_pushboolean(L, 1);
+      lua_rawset(L, -5);
+   }
+   lua_pop(L, 1);
+   lua_setfield(L, LUA_REGISTRYINDEX, "lrcgl.std_globals");
+
    // Override print function
    lua_getglobal(L, "_G");
    lua_pushcfunction(L, lua_core_print);
    lua_setfield(L, -2, "print");
    lua_pop(L, 1);
+   module_lua_install_zip_searcher(L);
 
    // Register C functions
    lua_register(L, "draw_quad", lua_draw_quad);
@@ -242,18 +442,94 @@ bool module_lua_init(void) {
    lua_register(L, "load_image", lua_load_image);
    lua_register(L, "draw_texture", lua_draw_texture);
    lua_register(L, "free_texture", lua_free_texture);
+   lua_register(L, "present", lua_present);
+   lua_register(L, "set_layer", lua_set_layer);
+   lua_register(L, "draw_stats", lua_draw_stats);
+   module_math_register(L);
+   module_camera_register(L);
+   module_shape_register(L);
+   module_font_register(L);
+
+   // Register subsystem tables
+   module_scene_register(L);
+   module_buffer_register(L);
+   module_broadphase_register(L);
+   module_particles_register(L);
+   module_jobs_register(L);
+   module_worker_register(L);
+   module_memory_register(L);
+   module_profiler_register(L);
+   module_tasks_register(L);
+   module_tween_register(L);
+   module_tilemap_register(L);
+   module_layer_register(L);
 
    // Register Libretro constants
    register_libretro_constants(L);
 
+   static const luaL_Reg watchdog_funcs[] = {
+      {"stats", lua_watchdog_stats},
+      {NULL, NULL}
+   };
+   luaL_newlib(L, watchdog_funcs);
+   lua_setglobal(L, "watchdog");
+
+   // Install the watchdog before the script runs so the coroutines it creates inherit the hook
+   module_lua_refresh_hook(L);
+}
+
+
+// Close the main state and drop the tasks, tweens and layers it created
+static void close_lua_state(void) {
+   module_memory_close_state(L);
+   L = NULL;
+   module_tasks_shutdown();
+   module_tween_shutdown();
+   module_layer_clear();
+}
+
+
+// Run the script's init() if it defines one. Unlike the top level of
+// script.lua, it runs once per state and not again on a hot reload.
+static bool call_init(lua_State *L) {
+   if (lua_getglobal(L, "init") != LUA_TFUNCTION) {
+      lua_pop(L, 1);
+      return true;
+   }
+   if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "init error: %s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+      return false;
+   }
+   return true;
+}
+
+bool module_lua_init(void) {
+   if (L) {
+      core_log(RETRO_LOG_INFO, "Lua already initialized, skipping");
+      return true;
+   }
+
+   core_log(RETRO_LOG_INFO, "Lua init with input_state_cb: %p", input_state_cb);
+
+   L = module_memory_new_state("main");
+   if (!L) {
+      core_log(RETRO_LOG_ERROR, "Failed to create Lua state");
+      return false;
+   }
+
+   register_core_api(L);
+
    // Load Lua script
    const char *script_path = "script.lua";
-   if (luaL_dofile(L, script_path) != LUA_OK) {
+   module_layer_begin_script(false);
+   int status = luaL_dofile(L, script_path);
+   module_layer_end_script(status == LUA_OK);
+   if (status != LUA_OK) {
       const char *err = lua_tostring(L, -1);
       core_log(RETRO_LOG_ERROR, "Failed to load Lua script '%s': %s", script_path, err);
       lua_pop(L, 1);
-      lua_close(L);
-      L = NULL;
+      close_lua_state();
       return false;
    }
 
@@ -262,11 +538,14 @@ bool module_lua_init(void) {
    if (!lua_isfunction(L, -1)) {
       core_log(RETRO_LOG_ERROR, "No 'update' function found in script.lua");
       lua_pop(L, 1);
-      lua_close(L);
-      L = NULL;
+      close_lua_state();
       return false;
    }
    lua_pop(L, 1);
+   if (!call_init(L)) {
+      close_lua_state();
+      return false;
+   }
 
    core_log(RETRO_LOG_INFO, "Lua initialized and script loaded");
    return true;
@@ -282,35 +561,24 @@ bool module_lua_init_from_buffer(const char *script_data, size_t script_size) {
 
    core_log(RETRO_LOG_INFO, "Lua init from buffer with input_state_cb: %p", input_state_cb);
 
-   L = luaL_newstate();
+   L = module_memory_new_state("main");
    if (!L) {
       core_log(RETRO_LOG_ERROR, "Failed to create Lua state");
       return false;
    }
 
-   luaL_openlibs(L);
+   register_core_api(L);
 
-   lua_getglobal(L, "_G");
-   lua_pushcfunction(L, lua_core_print);
-   lua_setfield(L, -2, "print");
-   lua_pop(L, 1);
-
-   lua_register(L, "draw_quad", lua_draw_quad);
-   lua_register(L, "get_input", lua_get_input);
-   lua_register(L, "draw_text", lua_draw_text);
-   lua_register(L, "draw_custom_quad", lua_draw_custom_quad);
-   lua_register(L, "load_image", lua_load_image);
-   lua_register(L, "draw_texture", lua_draw_texture);
-   lua_register(L, "free_texture", lua_free_texture);
-
-   register_libretro_constants(L);
-
-   if (luaL_loadbuffer(L, script_data, script_size, "script.lua") != LUA_OK || lua_pcall(L, 0, 0, 0) != LUA_OK) {
+   module_layer_begin_script(false);
+   int status = luaL_loadbuffer(L, script_data, script_size, "script.lua");
+   if (status == LUA_OK)
+      status = lua_pcall(L, 0, 0, 0);
+   module_layer_end_script(status == LUA_OK);
+   if (status != LUA_OK) {
       const char *err = lua_tostring(L, -1);
       core_log(RETRO_LOG_ERROR, "Failed to load Lua script from buffer: %s", err);
       lua_pop(L, 1);
-      lua_close(L);
-      L = NULL;
+      close_lua_state();
       return false;
    }
 
@@ -318,11 +586,14 @@ bool module_lua_init_from_buffer(const char *script_data, size_t script_size) {
    if (!lua_isfunction(L, -1)) {
       core_log(RETRO_LOG_ERROR, "No 'update' function found in script");
       lua_pop(L, 1);
-      lua_close(L);
-      L = NULL;
+      close_lua_state();
       return false;
    }
    lua_pop(L, 1);
+   if (!call_init(L)) {
+      close_lua_state();
+      return false;
+   }
 
    core_log(RETRO_LOG_INFO, "Lua initialized and script loaded from buffer");
    return true;
@@ -333,8 +604,7 @@ bool module_lua_init_from_buffer(const char *script_data, size_t script_size) {
 
 void module_lua_deinit(void) {
     if (L) {
-        lua_close(L);
-        L = NULL;
+        close_lua_state();
         core_log(RETRO_LOG_INFO, "Lua deinitialized");
     }
 }
@@ -346,6 +616,16 @@ void module_lua_update(float animation_time) {
       return;
    }
 
+   // The watchdog covers the tween events and tasks of this frame as well as update()
+   if (watchdog.mode != WATCHDOG_OFF) {
+      watchdog.frame_start_ns = core_time_ns();
+      watchdog.deadline_ns = watchdog.frame_start_ns + watchdog.budget_ns;
+      watchdog.reported = false;
+      watchdog.armed = true;
+   }
+   module_tween_update(L, animation_time);
+   module_tasks_update(L, animation_time);
+
    lua_getglobal(L, "update");
    if (lua_isfunction(L, -1)) {
       lua_pushnumber(L, animation_time);
@@ -358,6 +638,7 @@ void module_lua_update(float animation_time) {
       core_log(RETRO_LOG_WARN, "No Lua update function found");
       lua_pop(L, 1);
    }
+   watchdog.armed = false;
 }
 
 lua_State *module_lua_get_state(void) {
@@ -0,0 +1,748 @@
+// module_math.c
+// 2D math userdata for Lua on top of cglm: vec2, mat3 (affine, column-major
+// as in cglm) and transform (position, rotation, scale with a cached matrix).
+// Methods update their receiver in place and return it, so per-frame math
+// allocates nothing; the arithmetic metamethods (+, -, *) return new values
+// for convenience. Angles are in degrees, like the draw functions.
+//
+// mat3:transform_points and transform:transform_points apply the matrix to a
+// whole f32 buffer of x, y pairs with a SIMD kernel, split across the job
+// system for large buffers.
+#include "module_math.h"
+#include "module_buffer.h"
+#include "module_jobs.h"
+#include <cglm/cglm.h>
+#include <lauxlib.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MATH_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MATH_LANES 4
+#else
+#define MATH_LANES 1
+#endif
+
+#define VEC2_METATABLE "lrcgl.vec2"
+#define MAT3_METATABLE "lrcgl.mat3"
+#define TRANSFORM_METATABLE "lrcgl.transform"
+#define MATH_BATCH_GRAIN 4096  // points per job range
+
+typedef struct {
+   float x, y;
+   float rotation;   // degrees
+   float sx, sy;
+   float m[6];       // affine matrix, valid unless dirty
+   bool dirty;
+} transform2d;
+
+// ---------------------------------------------------------------------------
+// Batch kernel
+
+void module_math_transform_points(const float m[6], const float *src, float *dst, int count) {
+   int n = count * 2, i = 0;
+#if MATH_LANES == 8
+   // Four interleaved points per register: duplicate x and y into both lanes of each pair
+   const __m256 v_ab = _mm256_setr_ps(m[0], m[1], m[0], m[1], m[0], m[1], m[0], m[1]);
+   const __m256 v_cd = _mm256_setr_ps(m[2], m[3], m[2], m[3], m[2], m[3], m[2], m[3]);
+   const __m256 v_t = _mm256_setr_ps(m[4], m[5], m[4], m[5], m[4], m[5], m[4], m[5]);
+   for (; i + 8 <= n; i += 8) {
+      __m256 p = _mm256_loadu_ps(src + i);
+      __m256 xx = _mm256_moveldup_ps(p);
+      __m256 yy = _mm256_movehdup_ps(p);
+      _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, v_ab), _mm256_mul_ps(yy, v_cd)), v_t));
+   }
+#elif MATH_LANES == 4
+   const __m128 v_ab = _mm_setr_ps(m[0], m[1], m[0], m[1]);
+   const __m128 v_cd = _mm_setr_ps(m[2], m[3], m[2], m[3]);
+   const __m128 v_t = _mm_setr_ps(m[4], m[5], m[4], m[5]);
+   for (; i + 4 <= n; i += 4) {
+      __m128 p = _mm_loadu_ps(src + i);
+      __m128 xx = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+      __m128 yy = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+      _mm_storeu_ps(dst + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx, v_ab), _mm_mul_ps(yy, v_cd)), v_t));
+   }
+#endif
+   for (; i < n; i += 2) {
+      float x = src[i], y = src[i + 1];
+      dst[i] = m[0] * x + m[2] * y + m[4];
+      dst[i + 1] = m[1] * x + m[3] * y + m[5];
+   }
+}
+
+typedef struct {
+   const float *m;
+   const float *src;
+   float *dst;
+} batch_ctx;
+
+static void batch_range(void *ctx, int begin, int end) {
+   batch_ctx *b = (batch_ctx *)ctx;
+   module_math_transform_points(b->m, b->src + begin * 2, b->dst + begin * 2, end - begin);
+}
+
+// Shared by mat3:transform_points and transform:transform_points:
+// (self, src, dst [, count]) with count defaulting to every pair in src
+static int transform_buffer(lua_State *L, const float m[6]) {
+   core_buffer *src = module_buffer_check(L, 2, BUFFER_F32);
+   core_buffer *dst = lua_isnoneornil(L, 3) ? src : module_buffer_check(L, 3, BUFFER_F32);
+   lua_Integer count = luaL_optinteger(L, 4, (lua_Integer)(src->count / 2));
+   luaL_argcheck(L, count >= 0 && (size_t)count * 2 <= src->count && count <= INT32_MAX / 2, 4, "count out of range");
+   luaL_argcheck(L, dst->count >= (size_t)count * 2, 3, "destination smaller than source");
+   batch_ctx b = {m, BUFFER_F32_DATA(src), BUFFER_F32_DATA(dst)};
+   module_jobs_parallel_for((int)count, MATH_BATCH_GRAIN, batch_range, &b);
+   return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Helpers
+
+static float *check_vec2(lua_State *L, int arg) {
+   return (float *)luaL_checkudata(L, arg, VEC2_METATABLE);
+}
+
+static vec3 *check_mat3(lua_State *L, int arg) {
+   return (vec3 *)luaL_checkudata(L, arg, MAT3_METATABLE);
+}
+
+static transform2d *check_transform(lua_State *L, int arg) {
+   return (transform2d *)luaL_checkudata(L, arg, TRANSFORM_METATABLE);
+}
+
+static float *push_vec2(lua_State *L, float x, float y) {
+   float *v = (float *)lua_newuserdatauv(L, sizeof(float) * 2, 0);
+   v[0] = x;
+   v[1] = y;
+   luaL_setmetatable(L, VEC2_METATABLE);
+   return v;
+}
+
+static vec3 *push_mat3(lua_State *L) {
+   vec3 *m = (vec3 *)lua_newuserdatauv(L, sizeof(mat3), 0);
+   glm_mat3_identity(m);
+   luaL_setmetatable(L, MAT3_METATABLE);
+   return m;
+}
+
+static void mat3_to_affine(vec3 *m, float out[6]) {
+   out[0] = m[0][0];
+   out[1] = m[0][1];
+   out[2] = m[1][0];
+   out[3] = m[1][1];
+   out[4] = m[2][0];
+   out[5] = m[2][1];
+}
+
+static void affine_to_mat3(const float a[6], vec3 *m) {
+   m[0][0] = a[0]; m[0][1] = a[1]; m[0][2] = 0.0f;
+   m[1][0] = a[2]; m[1][1] = a[3]; m[1][2] = 0.0f;
+   m[2][0] = a[4]; m[2][1] = a[5]; m[2][2] = 1.0f;
+}
+
+static const float *transform_matrix(transform2d *t) {
+   if (t->dirty) {
+      float r = glm_rad(t->rotation);
+      float c = cosf(r), s = sinf(r);
+      t->m[0] = c * t->sx;
+      t->m[1] = s * t->sx;
+      t->m[2] = -s * t->sy;
+      t->m[3] = c * t->sy;
+      t->m[4] = t->x;
+      t->m[5] = t->y;
+      t->dirty = false;
+   }
+   return t->m;
+}
+
+// Affine matrix of the mat3 or transform at arg
+static void check_affine(lua_State *L, int arg, float out[6]) {
+   void *p = luaL_testudata(L, arg, MAT3_METATABLE);
+   if (p) {
+      mat3_to_affine((vec3 *)p, out);
+      return;
+   }
+   p = luaL_testudata(L, arg, TRANSFORM_METATABLE);
+   if (!p)
+      luaL_typeerror(L, arg, "mat3 or transform");
+   memcpy(out, transform_matrix((transform2d *)p), sizeof(float) * 6);
+}
+
+// A vec2 at arg, or two numbers at arg and arg + 1
+static void check_xy(lua_State *L, int arg, float *x, float *y) {
+   float *v = (float *)luaL_testudata(L, arg, VEC2_METATABLE);
+   if (v) {
+      *x = v[0];
+      *y = v[1];
+   } else {
+      *x = (float)luaL_checknumber(L, arg);
+      *y = (float)luaL_checknumber(L, arg + 1);
+   }
+}
+
+// Dispatch __index: named fields first, then the methods table in upvalue 1
+static int index_field(lua_State *L, const char *const *fields, const float *values) {
+   const char *key = lua_type(L, 2) == LUA_TSTRING ? lua_tostring(L, 2) : NULL;
+   if (key) {
+      for (int i = 0; fields[i]; i++) {
+         if (strcmp(key, fields[i]) == 0) {
+            lua_pushnumber(L, values[i]);
+            return 1;
+         }
+      }
+   }
+   lua_pushvalue(L, 2);
+   lua_rawget(L, lua_upvalueindex(1));
+   return 1;
+}
+
+// ---------------------------------------------------------------------------
+// vec2
+
+// vec2.new([x, y]) / vec2(x, y)
+static int lua_vec2_new(lua_State *L) {
+   int base = lua_istable(L, 1) ? 2 : 1;  // called as vec2(...)
+   push_vec2(L, (float)luaL_optnumber(L, base, 0.0), (float)luaL_optnumber(L, base + 1, 0.0));
+   return 1;
+}
+
+static int lua_vec2_index(lua_State *L) {
+   static const char *const fields[] = {"x", "y", NULL};
+   return index_field(L, fields, check_vec2(L, 1));
+}
+
+static int lua_vec2_newindex(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   const char *key = luaL_checkstring(L, 2);
+   if (strcmp(key, "x") == 0)
+      v[0] = (float)luaL_checknumber(L, 3);
+   else if (strcmp(key, "y") == 0)
+      v[1] = (float)luaL_checknumber(L, 3);
+   else
+      return luaL_error(L, "vec2 has no field '%s'", key);
+   return 0;
+}
+
+// v:set(x, y | other) -> v
+static int lua_vec2_set(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   check_xy(L, 2, &v[0], &v[1]);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:add(x, y | other) -> v
+static int lua_vec2_add(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   float x, y;
+   check_xy(L, 2, &x, &y);
+   glm_vec2_add(v, (vec2){x, y}, v);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:sub(x, y | other) -> v
+static int lua_vec2_sub(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   float x, y;
+   check_xy(L, 2, &x, &y);
+   glm_vec2_sub(v, (vec2){x, y}, v);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:scale(s [, sy]) -> v
+static int lua_vec2_scale(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   float sx = (float)luaL_checknumber(L, 2);
+   v[0] *= sx;
+   v[1] *= (float)luaL_optnumber(L, 3, sx);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:normalize() -> v (a zero vector stays zero)
+static int lua_vec2_normalize(lua_State *L) {
+   glm_vec2_normalize(check_vec2(L, 1));
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:rotate(degrees) -> v
+static int lua_vec2_rotate(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   glm_vec2_rotate(v, glm_rad((float)luaL_checknumber(L, 2)), v);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:lerp(other, t) -> v
+static int lua_vec2_lerp(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   float *o = check_vec2(L, 2);
+   glm_vec2_lerp(v, o, (float)luaL_checknumber(L, 3), v);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// v:transform(mat3 | transform) -> v
+static int lua_vec2_transform(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   float m[6];
+   check_affine(L, 2, m);
+   module_math_transform_points(m, v, v, 1);
+   lua_settop(L, 1);
+   return 1;
+}
+
+static int lua_vec2_length(lua_State *L) {
+   lua_pushnumber(L, glm_vec2_norm(check_vec2(L, 1)));
+   return 1;
+}
+
+static int lua_vec2_dot(lua_State *L) {
+   lua_pushnumber(L, glm_vec2_dot(check_vec2(L, 1), check_vec2(L, 2)));
+   return 1;
+}
+
+static int lua_vec2_cross(lua_State *L) {
+   lua_pushnumber(L, glm_vec2_cross(check_vec2(L, 1), check_vec2(L, 2)));
+   return 1;
+}
+
+static int lua_vec2_distance(lua_State *L) {
+   lua_pushnumber(L, glm_vec2_distance(check_vec2(L, 1), check_vec2(L, 2)));
+   return 1;
+}
+
+// v:unpack() -> x, y
+static int lua_vec2_unpack(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   lua_pushnumber(L, v[0]);
+   lua_pushnumber(L, v[1]);
+   return 2;
+}
+
+static int lua_vec2_clone(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   push_vec2(L, v[0], v[1]);
+   return 1;
+}
+
+static int lua_vec2_op_add(lua_State *L) {
+   float *a = check_vec2(L, 1), *b = check_vec2(L, 2);
+   push_vec2(L, a[0] + b[0], a[1] + b[1]);
+   return 1;
+}
+
+static int lua_vec2_op_sub(lua_State *L) {
+   float *a = check_vec2(L, 1), *b = check_vec2(L, 2);
+   push_vec2(L, a[0] - b[0], a[1] - b[1]);
+   return 1;
+}
+
+// vec2 * number, number * vec2
+static int lua_vec2_op_mul(lua_State *L) {
+   int vi = lua_isnumber(L, 1) ? 2 : 1;
+   float *v = check_vec2(L, vi);
+   float s = (float)luaL_checknumber(L, 3 - vi);
+   push_vec2(L, v[0] * s, v[1] * s);
+   return 1;
+}
+
+static int lua_vec2_op_unm(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   push_vec2(L, -v[0], -v[1]);
+   return 1;
+}
+
+static int lua_vec2_op_eq(lua_State *L) {
+   float *a = check_vec2(L, 1), *b = check_vec2(L, 2);
+   lua_pushboolean(L, a[0] == b[0] && a[1] == b[1]);
+   return 1;
+}
+
+static int lua_vec2_tostring(lua_State *L) {
+   float *v = check_vec2(L, 1);
+   lua_pushfstring(L, "vec2(%f, %f)", (lua_Number)v[0], (lua_Number)v[1]);
+   return 1;
+}
+
+// ---------------------------------------------------------------------------
+// mat3
+
+// mat3.new([a, b, c, d, tx, ty]) -> identity or the given affine matrix
+static int lua_mat3_new(lua_State *L) {
+   int base = lua_istable(L, 1) ? 2 : 1;
+   vec3 *m = push_mat3(L);
+   if (!lua_isnoneornil(L, base)) {
+      float a[6];
+      for (int k = 0; k < 6; k++)
+         a[k] = (float)luaL_checknumber(L, base + k);
+      affine_to_mat3(a, m);
+   }
+   return 1;
+}
+
+static int lua_mat3_identity(lua_State *L) {
+   glm_mat3_identity(check_mat3(L, 1));
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:set(mat3 | transform | a, b, c, d, tx, ty) -> m
+static int lua_mat3_set(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   float a[6];
+   if (lua_isnumber(L, 2)) {
+      for (int k = 0; k < 6; k++)
+         a[k] = (float)luaL_checknumber(L, 2 + k);
+   } else {
+      check_affine(L, 2, a);
+   }
+   affine_to_mat3(a, m);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:mul(other) -> m, with m = m * other (other applies first)
+static int lua_mat3_mul(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   mat3 o;
+   float a[6];
+   check_affine(L, 2, a);
+   affine_to_mat3(a, o);
+   glm_mat3_mul(m, o, m);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:premul(other) -> m, with m = other * m (other applies last)
+static int lua_mat3_premul(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   mat3 o;
+   float a[6];
+   check_affine(L, 2, a);
+   affine_to_mat3(a, o);
+   glm_mat3_mul(o, m, m);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:translate(x, y) -> m
+static int lua_mat3_translate(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   float x, y;
+   check_xy(L, 2, &x, &y);
+   glm_translate2d(m, (vec2){x, y});
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:rotate(degrees) -> m
+static int lua_mat3_rotate(lua_State *L) {
+   glm_rotate2d(check_mat3(L, 1), glm_rad((float)luaL_checknumber(L, 2)));
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:scale(s [, sy]) -> m
+static int lua_mat3_scale(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   float sx = (float)luaL_checknumber(L, 2);
+   glm_scale2d(m, (vec2){sx, (float)luaL_optnumber(L, 3, sx)});
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:invert() -> m, or nil (m unchanged) if it is singular
+static int lua_mat3_invert(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   if (fabsf(glm_mat3_det(m)) < 1e-12f) {
+      lua_pushnil(L);
+      return 1;
+   }
+   glm_mat3_inv(m, m);
+   lua_settop(L, 1);
+   return 1;
+}
+
+// m:transform_point(x, y | v) -> x', y'
+static int lua_mat3_transform_point(lua_State *L) {
+   float a[6], p[2];
+   mat3_to_affine(check_mat3(L, 1), a);
+   check_xy(L, 2, &p[0], &p[1]);
+   module_math_transform_points(a, p, p, 1);
+   lua_pushnumber(L, p[0]);
+   lua_pushnumber(L, p[1]);
+   return 2;
+}
+
+// m:transform_points(src [, dst [, count]]) -- f32 buffers of x, y pairs
+static int lua_mat3_transform_points(lua_State *L) {
+   float a[6];
+   mat3_to_affine(check_mat3(L, 1), a);
+   return transform_buffer(L, a);
+}
+
+// m:affine() -> a, b, c, d, tx, ty (the arguments of jobs.transform)
+static int lua_mat3_affine(lua_State *L) {
+   float a[6];
+   mat3_to_affine(check_mat3(L, 1), a);
+   for (int k = 0; k < 6; k++)
+      lua_pushnumber(L, a[k]);
+   return 6;
+}
+
+static int lua_mat3_clone(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   glm_mat3_copy(m, push_mat3(L));
+   return 1;
+}
+
+// mat3 * mat3 -> mat3, mat3 * vec2 -> vec2
+static int lua_mat3_op_mul(lua_State *L) {
+   vec3 *m = check_mat3(L, 1);
+   float *v = (float *)luaL_testudata(L, 2, VEC2_METATABLE);
+   if (v) {
+      float a[6], p[2] = {v[0], v[1]};
+      mat3_to_affine(m, a);
+      module_math_transform_points(a, p, p, 1);
+      push_vec2(L, p[0], p[1]);
+      return 1;
+   }
+   vec3 *o = check_mat3(L, 2);
+   glm_mat3_mul(m, o, push_mat3(L));
+   return 1;
+}
+
+static int lua_mat3_tostring(lua_State *L) {
+   float a[6];
+   mat3_to_affine(check_mat3(L, 1), a);
+   lua_pushfstring(L, "mat3(%f, %f, %f, %f, %f, %f)", (lua_Number)a[0], (lua_Number)a[1], (lua_Number)a[2],
+                   (lua_Number)a[3], (lua_Number)a[4], (lua_Number)a[5]);
+   return 1;
+}
+
+// ---------------------------------------------------------------------------
+// transform
+
+// transform.new([x, y, rotation, sx, sy])
+static int lua_transform_new(lua_State *L) {
+   int base = lua_istable(L, 1) ? 2 : 1;
+   transform2d *t = (transform2d *)lua_newuserdatauv(L, sizeof(transform2d), 0);
+   t->x = (float)luaL_optnumber(L, base, 0.0);
+   t->y = (float)luaL_optnumber(L, base + 1, 0.0);
+   t->rotation = (float)luaL_optnumber(L, base + 2, 0.0);
+   t->sx = (float)luaL_optnumber(L, base + 3, 1.0);
+   t->sy = (float)luaL_optnumber(L, base + 4, t->sx);
+   t->dirty = true;
+   luaL_setmetatable(L, TRANSFORM_METATABLE);
+   return 1;
+}
+
+static int lua_transform_index(lua_State *L) {
+   static const char *const fields[] = {"x", "y", "rotation", "sx", "sy", NULL};
+   transform2d *t = check_transform(L, 1);
+   const float values[] = {t->x, t->y, t->rotation, t->sx, t->sy};
+   return index_field(L, fields, values);
+}
+
+static int lua_transform_newindex(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   const char *key = luaL_checkstring(L, 2);
+   float value = (float)luaL_checknumber(L, 3);
+   if (strcmp(key, "x") == 0)
+      t->x = value;
+   else if (strcmp(key, "y") == 0)
+      t->y = value;
+   else if (strcmp(key, "rotation") == 0)
+      t->rotation = value;
+   else if (strcmp(key, "sx") == 0)
+      t->sx = value;
+   else if (strcmp(key, "sy") == 0)
+      t->sy = value;
+   else
+      return luaL_error(L, "transform has no field '%s'", key);
+   t->dirty = true;
+   return 0;
+}
+
+// t:set(x, y, rotation [, sx [, sy]]) -> t
+static int lua_transform_set(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   t->x = (float)luaL_checknumber(L, 2);
+   t->y = (float)luaL_checknumber(L, 3);
+   t->rotation = (float)luaL_checknumber(L, 4);
+   t->sx = (float)luaL_optnumber(L, 5, t->sx);
+   t->sy = (float)luaL_optnumber(L, 6, lua_isnoneornil(L, 5) ? t->sy : t->sx);
+   t->dirty = true;
+   lua_settop(L, 1);
+   return 1;
+}
+
+// t:translate(dx, dy | v) -> t
+static int lua_transform_translate(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   float dx, dy;
+   check_xy(L, 2, &dx, &dy);
+   t->x += dx;
+   t->y += dy;
+   t->dirty = true;
+   lua_settop(L, 1);
+   return 1;
+}
+
+// t:rotate(degrees) -> t
+static int lua_transform_rotate(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   t->rotation += (float)luaL_checknumber(L, 2);
+   t->dirty = true;
+   lua_settop(L, 1);
+   return 1;
+}
+
+// t:matrix([out]) -> mat3 (written into out if given)
+static int lua_transform_matrix(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   vec3 *m = lua_isnoneornil(L, 2) ? push_mat3(L) : check_mat3(L, 2);
+   affine_to_mat3(transform_matrix(t), m);
+   if (!lua_isnoneornil(L, 2))
+      lua_settop(L, 2);
+   return 1;
+}
+
+// t:transform_point(x, y | v) -> x', y'
+static int lua_transform_transform_point(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   float p[2];
+   check_xy(L, 2, &p[0], &p[1]);
+   module_math_transform_points(transform_matrix(t), p, p, 1);
+   lua_pushnumber(L, p[0]);
+   lua_pushnumber(L, p[1]);
+   return 2;
+}
+
+// t:transform_points(src [, dst [, count]])
+static int lua_transform_transform_points(lua_State *L) {
+   return transform_buffer(L, transform_matrix(check_transform(L, 1)));
+}
+
+static int lua_transform_clone(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   transform2d *copy = (transform2d *)lua_newuserdatauv(L, sizeof(transform2d), 0);
+   *copy = *t;
+   luaL_setmetatable(L, TRANSFORM_METATABLE);
+   return 1;
+}
+
+static int lua_transform_tostring(lua_State *L) {
+   transform2d *t = check_transform(L, 1);
+   lua_pushfstring(L, "transform(%f, %f, %f, %f, %f)", (lua_Number)t->x, (lua_Number)t->y,
+                   (lua_Number)t->rotation, (lua_Number)t->sx, (lua_Number)t->sy);
+   return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Registration
+
+// Create a metatable whose __index looks fields up with index_fn and falls
+// back to methods; leaves nothing on the stack
+static void register_type(lua_State *L, const char *name, const luaL_Reg *methods,
+                          lua_CFunction index_fn, const luaL_Reg *meta) {
+   luaL_newmetatable(L, name);
+   luaL_setfuncs(L, meta, 0);
+   lua_newtable(L);
+   luaL_setfuncs(L, methods, 0);
+   if (index_fn)
+      lua_pushcclosure(L, index_fn, 1);
+   lua_setfield(L, -2, "__index");
+   lua_pop(L, 1);
+}
+
+// Global table `name` with new() and callable as name(...)
+static void register_constructor(lua_State *L, const char *name, lua_CFunction ctor) {
+   lua_createtable(L, 0, 1);
+   lua_pushcfunction(L, ctor);
+   lua_setfield(L, -2, "new");
+   lua_createtable(L, 0, 1);
+   lua_pushcfunction(L, ctor);
+   lua_setfield(L, -2, "__call");
+   lua_setmetatable(L, -2);
+   lua_setglobal(L, name);
+}
+
+void module_math_register(lua_State *L) {
+   static const luaL_Reg vec2_methods[] = {
+      {"set", lua_vec2_set},
+      {"add", lua_vec2_add},
+      {"sub", lua_vec2_sub},
+      {"scale", lua_vec2_scale},
+      {"normalize", lua_vec2_normalize},
+      {"rotate", lua_vec2_rotate},
+      {"lerp", lua_vec2_lerp},
+      {"transform", lua_vec2_transform},
+      {"length", lua_vec2_length},
+      {"dot", lua_vec2_dot},
+      {"cross", lua_vec2_cross},
+      {"distance", lua_vec2_distance},
+      {"unpack", lua_vec2_unpack},
+      {"clone", lua_vec2_clone},
+      {NULL, NULL}
+   };
+   static const luaL_Reg vec2_meta[] = {
+      {"__newindex", lua_vec2_newindex},
+      {"__add", lua_vec2_op_add},
+      {"__sub", lua_vec2_op_sub},
+      {"__mul", lua_vec2_op_mul},
+      {"__unm", lua_vec2_op_unm},
+      {"__eq", lua_vec2_op_eq},
+      {"__tostring", lua_vec2_tostring},
+      {NULL, NULL}
+   };
+   static const luaL_Reg mat3_methods[] = {
+      {"identity", lua_mat3_identity},
+      {"set", lua_mat3_set},
+      {"mul", lua_mat3_mul},
+      {"premul", lua_mat3_premul},
+      {"translate", lua_mat3_translate},
+      {"rotate", lua_mat3_rotate},
+      {"scale", lua_mat3_scale},
+      {"invert", lua_mat3_invert},
+      {"transform_point", lua_mat3_transform_point},
+      {"transform_points", lua_mat3_transform_points},
+      {"affine", lua_mat3_affine},
+      {"clone", lua_mat3_clone},
+      {NULL, NULL}
+   };
+   static const luaL_Reg mat3_meta[] = {
+      {"__mul", lua_mat3_op_mul},
+      {"__tostring", lua_mat3_tostring},
+      {NULL, NULL}
+   };
+   static const luaL_Reg transform_methods[] = {
+      {"set", lua_transform_set},
+      {"translate", lua_transform_translate},
+      {"rotate", lua_transform_rotate},
+      {"matrix", lua_transform_matrix},
+      {"transform_point", lua_transform_transform_point},
+      {"transform_points", lua_transform_transform_points},
+      {"clone", lua_transform_clone},
+      {NULL, NULL}
+   };
+   static const luaL_Reg transform_meta[] = {
+      {"__newindex", lua_transform_newindex},
+      {"__tostring", lua_transform_tostring},
+      {NULL, NULL}
+   };
+
+   register_type(L, VEC2_METATABLE, vec2_methods, lua_vec2_index, vec2_meta);
+   register_type(L, MAT3_METATABLE, mat3_methods, NULL, mat3_meta);
+   register_type(L, TRANSFORM_METATABLE, transform_methods, lua_transform_index, transform_meta);
+
+   register_constructor(L, "vec2", lua_vec2_new);
+   register_constructor(L, "mat3", lua_mat3_new);
+   register_constructor(L, "transform", lua_transform_new);
+}
@@ -0,0 +1,421 @@
+// module_memory.c
+// Lua allocator. Blocks of up to POOL_MAX_SIZE bytes come from per-thread
+// free lists, one per size class, so the short-lived tables and strings a
+// script creates every frame are recycled without touching the system heap.
+// Free lists are refilled in batches from a shared depot or by carving a new
+// slab; slabs are only released by module_memory_shutdown. Larger blocks go
+// to realloc/free. Lua passes the old block size on every call, so blocks
+// carry no header: the size class follows from the size.
+//
+// Every state gets its own lua_memory_stats as allocator userdata, which
+// tracks live and peak bytes and enforces the optional hard limit (Lua runs
+// an emergency collection when an allocation is refused).
+//
+// States can also have their collector stopped and driven from the frame
+// loop instead, so collection work lands in the time left after rendering
+// rather than in the middle of update().
+#include "module_memory.h"
+#include "core_thread.h"
+#include "core_time.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 512
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_SLAB_SIZE (64 * 1024)
+#define POOL_BATCH 64                  // blocks moved from the depot at once
+#define MEMORY_STATS_FRAMES 600        // frames between summaries
+#define GC_CATCH_UP_FACTOR 4           // heap growth over the last collected size that ignores the budget
+#define GC_CATCH_UP_MIN_KB 1024
+
+typedef struct free_block {
+   struct free_block *next;
+} free_block;
+
+typedef struct slab {
+   struct slab *next;
+   unsigned char pad[POOL_GRANULE - sizeof(struct slab *)];  // keep blocks 16-byte aligned
+} slab;
+
+typedef struct {
+   lua_memory_stats stats;
+   char name[32];
+   int frames;                   // since the last summary
+   uint32_t reported_failures;   // limit failures already logged
+   int baseline_kb;              // heap size after the last completed cycle
+} memory_state;
+
+static struct {
+   core_mutex lock;
+   bool lock_ready;
+   free_block *depot[POOL_CLASSES];
+   slab *slabs;
+   size_t limit;
+   volatile int32_t live_states;
+} pool;
+
+static CORE_THREAD_LOCAL free_block *local_free[POOL_CLASSES];
+
+// Size class of a small block (0 for 1..16 bytes)
+static int size_class(size_t size) {
+   return (int)((size - 1) / POOL_GRANULE);
+}
+
+static void pool_lock(void) {
+   // The first state is created on the frontend thread before any other
+   // thread can allocate, so lazy initialization is safe
+   if (!pool.lock_ready) {
+      core_mutex_init(&pool.lock);
+      pool.lock_ready = true;
+   }
+   core_mutex_lock(&pool.lock);
+}
+
+// Refill the calling thread's list for class c; false if out of memory
+static bool refill(int c) {
+   size_t block_size = (size_t)(c + 1) * POOL_GRANULE;
+
+   pool_lock();
+   if (pool.depot[c]) {
+      free_block *first = pool.depot[c], *last = first;
+      for (int n = 1; n < POOL_BATCH && last->next; n++)
+         last = last->next;
+      pool.depot[c] = last->next;
+      last->next = NULL;
+      core_mutex_unlock(&pool.lock);
+      local_free[c] = first;
+      return true;
+   }
+
+   slab *s = (slab *)malloc(POOL_SLAB_SIZE);
+   if (!s) {
+      core_mutex_unlock(&pool.lock);
+      return false;
+   }
+   s->next = pool.slabs;
+   pool.slabs = s;
+   core_mutex_unlock(&pool.lock);
+
+   // Carve the slab back to front so the list hands out ascending addresses
+   unsigned char *base = (unsigned char *)(s + 1);
+   size_t count = (POOL_SLAB_SIZE - sizeof(slab)) / block_size;
+   free_block *head = NULL;
+   for (size_t i = count; i-- > 0;) {
+      free_block *b = (free_block *)(base + i * block_size);
+      b->next = head;
+      head = b;
+   }
+   local_free[c] = head;
+   return true;
+}
+
+static void *block_alloc(size_t size) {
+   if (size > POOL_MAX_SIZE)
+      return malloc(size);
+   int c = size_class(size);
+   if (!local_free[c] && !refill(c))
+      return NULL;
+   free_block *b = local_free[c];
+   local_free[c] = b->next;
+   return b;
+}
+
+static void block_free(void *ptr, size_t size) {
+   if (size > POOL_MAX_SIZE) {
+      free(ptr);
+      return;
+   }
+   int c = size_class(size);
+   free_block *b = (free_block *)ptr;
+   b->next = local_free[c];
+   local_free[c] = b;
+}
+
+static void *pooled_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+   memory_state *m = (memory_state *)ud;
+   lua_memory_stats *st = &m->stats;
+   size_t old_size = ptr ? osize : 0;  // without a block, osize encodes the object type
+
+   if (nsize == 0) {
+      if (ptr) {
+         block_free(ptr, osize);
+         st->live_bytes -= osize;
+      }
+      return NULL;
+   }
+
+   if (st->limit_bytes && nsize > old_size && st->live_bytes - old_size + nsize > st->limit_bytes) {
+      st->limit_failures++;
+      return NULL;
+   }
+
+   void *block;
+   if (ptr && osize > POOL_MAX_SIZE && nsize > POOL_MAX_SIZE) {
+      block = realloc(ptr, nsize);
+      if (!block)
+         return NULL;
+   } else if (ptr && osize <= POOL_MAX_SIZE && nsize <= POOL_MAX_SIZE && size_class(osize) == size_class(nsize)) {
+      block = ptr;
+   } else {
+      block = block_alloc(nsize);
+      if (!block)
+         return NULL;
+      if (ptr) {
+         memcpy(block, ptr, osize < nsize ? osize : nsize);
+         block_free(ptr, osize);
+      }
+   }
+
+   if (nsize > old_size) {
+      st->frame_allocs++;
+      st->total_allocs++;
+      st->frame_bytes += nsize - old_size;
+   }
+   st->live_bytes = st->live_bytes - old_size + nsize;
+   if (st->live_bytes > st->peak_bytes)
+      st->peak_bytes = st->live_bytes;
+   return block;
+}
+
+static int memory_panic(lua_State *L) {
+   const char *msg = lua_tostring(L, -1);
+   core_log(RETRO_LOG_ERROR, "Lua panic (unprotected error): %s", msg ? msg : "(error object is not a string)");
+   return 0;  // lets Lua abort
+}
+
+lua_State *module_memory_new_state(const char *name) {
+   memory_state *m = (memory_state *)calloc(1, sizeof(memory_state));
+   if (!m) {
+      core_log(RETRO_LOG_ERROR, "Failed to allocate Lua memory accounting");
+      return NULL;
+   }
+   snprintf(m->name, sizeof(m->name), "%s", name);
+   m->stats.limit_bytes = pool.limit;
+
+   lua_State *L = lua_newstate(pooled_alloc, m);
+   if (!L) {
+      free(m);
+      return NULL;
+   }
+   lua_atpanic(L, memory_panic);
+   core_atomic_add(&pool.live_states, 1);
+   return L;
+}
+
+void module_memory_close_state(lua_State *L) {
+   void *ud = NULL;
+   if (!L)
+      return;
+   bool pooled = lua_getallocf(L, &ud) == pooled_alloc;
+   lua_close(L);
+   if (pooled) {
+      memory_state *m = (memory_state *)ud;
+      if (m->stats.live_bytes != 0)
+         core_log(RETRO_LOG_WARN, "Lua state %s closed with %zu bytes unaccounted", m->name, m->stats.live_bytes);
+      free(m);
+      core_atomic_add(&pool.live_states, -1);
+   }
+}
+
+void module_memory_set_limit(size_t bytes) {
+   pool.limit = bytes;
+}
+
+static memory_state *get_memory_state(lua_State *L) {
+   void *ud = NULL;
+   return lua_getallocf(L, &ud) == pooled_alloc ? (memory_state *)ud : NULL;
+}
+
+const lua_memory_stats *module_memory_stats(lua_State *L) {
+   memory_state *m = get_memory_state(L);
+   return m ? &m->stats : NULL;
+}
+
+void module_memory_set_gc_mode(lua_State *L, lua_gc_mode mode) {
+   memory_state *m = get_memory_state(L);
+   if (!m)
+      return;
+   if (mode == LUA_GC_GENERATIONAL)
+      lua_gc(L, LUA_GCGEN, 0, 0);
+   else
+      lua_gc(L, LUA_GCINC, 0, 0, 0);
+   if (mode == LUA_GC_AUTO)
+      lua_gc(L, LUA_GCRESTART);
+   else
+      lua_gc(L, LUA_GCSTOP);
+   m->stats.gc_mode = mode;
+   m->baseline_kb = lua_gc(L, LUA_GCCOUNT);
+}
+
+void module_memory_collect(lua_State *L, uint64_t budget_ns) {
+   memory_state *m = get_memory_state(L);
+   if (!m || m->stats.gc_mode == LUA_GC_AUTO)
+      return;
+
+   uint64_t start = core_time_ns();
+   int kb = lua_gc(L, LUA_GCCOUNT);
+   bool catch_up = kb > GC_CATCH_UP_MIN_KB && kb > m->baseline_kb * GC_CATCH_UP_FACTOR;
+
+   if (m->stats.gc_mode == LUA_GC_GENERATIONAL) {
+      // A step is one young collection (or a major one when the heap has grown)
+      lua_gc(L, LUA_GCSTEP, 0);
+      m->stats.gc_steps++;
+      if (catch_up)
+         lua_gc(L, LUA_GCCOLLECT);
+      m->baseline_kb = lua_gc(L, LUA_GCCOUNT);
+   } else {
+      for (;;) {
+         m->stats.gc_steps++;
+         if (lua_gc(L, LUA_GCSTEP, 0)) {
+            m->stats.gc_cycles++;
+            m->baseline_kb = lua_gc(L, LUA_GCCOUNT);
+            break;
+         }
+         if (!catch_up && core_time_ns() - start >= budget_ns)
+            break;
+      }
+   }
+
+   uint64_t elapsed = core_time_ns() - start;
+   m->stats.frame_gc_ns += elapsed;
+   if (catch_up)
+      core_log(RETRO_LOG_DEBUG, "Lua GC (%s) over budget to catch up: %d KB heap, %.3f ms",
+               m->name, kb, elapsed / 1e6);
+}
+
+void module_memory_end_frame(lua_State *L) {
+   memory_state *m = get_memory_state(L);
+   if (!m)
+      return;
+   lua_memory_stats *st = &m->stats;
+   st->last_frame_allocs = st->frame_allocs;
+   st->last_frame_bytes = st->frame_bytes;
+   st->frame_allocs = 0;
+   st->frame_bytes = 0;
+   st->last_frame_gc_ns = st->frame_gc_ns;
+   if (st->frame_gc_ns > st->max_gc_ns)
+      st->max_gc_ns = st->frame_gc_ns;
+   st->frame_gc_ns = 0;
+
+   if (st->limit_failures != m->reported_failures) {
+      core_log(RETRO_LOG_WARN, "Lua state %s refused %u allocations at its %zu KB limit (%zu KB live)",
+               m->name, st->limit_failures - m->reported_failures, st->limit_bytes / 1024, st->live_bytes / 1024);
+      m->reported_failures = st->limit_failures;
+   }
+   if (++m->frames >= MEMORY_STATS_FRAMES) {
+      core_log(RETRO_LOG_DEBUG, "Lua memory (%s): %zu KB live, %zu KB peak, %u allocs / %zu KB last frame, "
+               "GC max %.3f ms/frame",
+               m->name, st->live_bytes / 1024, st->peak_bytes / 1024,
+               st->last_frame_allocs, st->last_frame_bytes / 1024, st->max_gc_ns / 1e6);
+      st->max_gc_ns = 0;
+      m->frames = 0;
+   }
+}
+
+void module_memory_thread_exit(void) {
+   bool any = false;
+   for (int c = 0; c < POOL_CLASSES; c++)
+      any = any || local_free[c];
+   if (!any)
+      return;
+
+   pool_lock();
+   for (int c = 0; c < POOL_CLASSES; c++) {
+      free_block *head = local_free[c];
+      if (!head)
+         continue;
+      free_block *last = head;
+      while (last->next)
+         last = last->next;
+      last->next = pool.depot[c];
+      pool.depot[c] = head;
+      local_free[c] = NULL;
+   }
+   core_mutex_unlock(&pool.lock);
+}
+
+void module_memory_shutdown(void) {
+   if (core_atomic_load(&pool.live_states) != 0) {
+      core_log(RETRO_LOG_WARN, "Lua memory pools kept: %d states still open", (int)pool.live_states);
+      return;
+   }
+   // Other threads handed their blocks back on exit; drop this thread's
+   // cache along with the slabs it points into
+   memset(local_free, 0, sizeof(local_free));
+   memset(pool.depot, 0, sizeof(pool.depot));
+   while (pool.slabs) {
+      slab *next = pool.slabs->next;
+      free(pool.slabs);
+      pool.slabs = next;
+   }
+   if (pool.lock_ready) {
+      core_mutex_destroy(&pool.lock);
+      pool.lock_ready = false;
+   }
+}
+
+// memory.stats() -> {live, peak, limit, frame_allocs, frame_bytes, total_allocs, limit_failures,
+//                    gc_mode, gc_ms, gc_max_ms, gc_steps, gc_cycles}
+// The frame counters and gc_ms describe the last completed frame.
+static int lua_memory_stats_fn(lua_State *L) {
+   const lua_memory_stats *st = module_memory_stats(L);
+   if (!st) {
+      lua_pushnil(L);
+      return 1;
+   }
+   static const char *const gc_modes[] = {"auto", "incremental", "generational"};
+   lua_createtable(L, 0, 12);
+   lua_pushinteger(L, (lua_Integer)st->live_bytes);
+   lua_setfield(L, -2, "live");
+   lua_pushinteger(L, (lua_Integer)st->peak_bytes);
+   lua_setfield(L, -2, "peak");
+   lua_pushinteger(L, (lua_Integer)st->limit_bytes);
+   lua_setfield(L, -2, "limit");
+   lua_pushinteger(L, (lua_Integer)st->last_frame_allocs);
+   lua_setfield(L, -2, "frame_allocs");
+   lua_pushinteger(L, (lua_Integer)st->last_frame_bytes);
+   lua_setfield(L, -2, "frame_bytes");
+   lua_pushinteger(L, (lua_Integer)st->total_allocs);
+   lua_setfield(L, -2, "total_allocs");
+   lua_pushinteger(L, (lua_Integer)st->limit_failures);
+   lua_setfield(L, -2, "limit_failures");
+   lua_pushstring(L, gc_modes[st->gc_mode]);
+   lua_setfield(L, -2, "gc_mode");
+   lua_pushnumber(L, st->last_frame_gc_ns / 1e6);
+   lua_setfield(L, -2, "gc_ms");
+   lua_pushnumber(L, st->max_gc_ns / 1e6);
+   lua_setfield(L, -2, "gc_max_ms");
+   lua_pushinteger(L, (lua_Integer)st->gc_steps);
+   lua_setfield(L, -2, "gc_steps");
+   lua_pushinteger(L, (lua_Integer)st->gc_cycles);
+   lua_setfield(L, -2, "gc_cycles");
+   return 1;
+}
+
+// memory.set_limit(bytes) -- 0 removes the cap; cannot go below live bytes
+static int lua_memory_set_limit(lua_State *L) {
+   memory_state *m = get_memory_state(L);
+   lua_Integer bytes = luaL_checkinteger(L, 1);
+   luaL_argcheck(L, bytes >= 0, 1, "limit must be >= 0");
+   if (!m)
+      return 0;
+   if (bytes != 0 && (size_t)bytes < m->stats.live_bytes)
+      return luaL_error(L, "limit %I is below the %I bytes in use", bytes, (lua_Integer)m->stats.live_bytes);
+   m->stats.limit_bytes = (size_t)bytes;
+   return 0;
+}
+
+static const luaL_Reg memory_funcs[] = {
+   {"stats", lua_memory_stats_fn},
+   {"set_limit", lua_memory_set_limit},
+   {NULL, NULL}
+};
+
+void module_memory_register(lua_State *L) {
+   luaL_newlib(L, memory_funcs);
+   lua_setglobal(L, "memory");
+}
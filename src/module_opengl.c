@@ -3,15 +3,27 @@
 #include "module_opengl.h"
 #include "font.h"
 #include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <cglm/cglm.h>
+#include "core_thread.h"
+// Images decode on job threads: keep stb_image's flip flag and failure
+// reason per thread
+#define STBI_THREAD_LOCAL CORE_THREAD_LOCAL
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h" // Include stb_image.h
 #include "libretro_core.h" // Add this
+#include "module_cmdlist.h"
+#include "module_pipeline.h"
+#include "module_shape.h"
 
-// Framebuffer dimensions
-#define HW_WIDTH 512
-#define HW_HEIGHT 512
+// Frontend framebuffer size, and where frames are drawn (render_fbo 0 is
+// the frontend framebuffer; otherwise a scaled-down internal target)
+static int output_width = VIRTUAL_WIDTH, output_height = VIRTUAL_HEIGHT;
+static GLuint render_fbo = 0;
+static int render_width = VIRTUAL_WIDTH, render_height = VIRTUAL_HEIGHT;
 
 // Global variables
 static retro_hw_get_current_framebuffer_t get_current_framebuffer;
@@ -19,25 +31,99 @@ static retro_hw_get_proc_address_t get_proc_address;
 static GLuint solid_shader_program = 0;
 static GLuint text_shader_program = 0;
 static GLuint texture_shader_program = 0;
+static GLuint instanced_shader_program = 0;
+static GLuint instanced_vao = 0;
+static GLuint instanced_vbo = 0;
+static int instanced_capacity = 0; // instances the instanced VBO holds
+static GLuint white_texture = 0;   // stands in for texture 0 in instanced draws
 static GLuint solid_vao, text_vao, texture_vao;
 static GLuint solid_vao, text_vao;
 static GLuint vbo;
+
+// Shared vertex stream for solid geometry (positions, read through
+// solid_vao) and text (positions and texcoords, read through text_vao).
+// Draws append at a running offset and the buffer is orphaned when it fills
+// up, so a draw never overwrites vertices the GPU may still be reading and
+// never waits for it.
+#define STREAM_INITIAL_SIZE (512 * 1024)  // bytes
+#define SOLID_VERTEX_SIZE (2 * sizeof(float))
+#define TEXT_VERTEX_SIZE (4 * sizeof(float))
+static GLuint stream_vbo = 0;
+static GLsizeiptr stream_capacity = 0;  // bytes
+static GLsizeiptr stream_used = 0;
 static GLuint font_texture = 0;
+
+// Glyphs of loaded fonts (see module_opengl_upload_glyph), and the text
+// batch being built: glyph quads, then six vertices per glyph
+static GLuint glyph_atlas = 0;
+static float *text_quads = NULL, *text_vertices = NULL;
+static int text_quad_capacity = 0, text_vertex_capacity = 0;  // glyphs
 static bool gl_initialized = false;
+static bool target_active = false;  // draws are going into a render target
 static bool use_default_fbo = false;
 
+// Program and texture last bound by the draws, to skip redundant binds.
+// Forgotten at frame start (the frontend draws in between) and whenever
+// something else binds a texture.
+#define BOUND_UNKNOWN ((GLuint)~0u)
+static GLuint bound_program = BOUND_UNKNOWN;
+static GLuint bound_texture = BOUND_UNKNOWN;
+
+// Textures whose pixels are all fully opaque, by id; draws of them with
+// alpha 1 may be reordered by the render queue
+static uint8_t *opaque_textures = NULL;
+static GLuint opaque_capacity = 0;
+
+// Render queue (see module_opengl_queue_draw)
+typedef struct {
+   const void *draw;
+   uint32_t rank;  // position in (layer, submission) order
+} queued_draw;
+static uint64_t *queue_keys = NULL, *queue_keys_tmp = NULL;
+static uint32_t *queue_index = NULL, *queue_index_tmp = NULL;
+static queued_draw *queue_draws = NULL;
+static int queue_count = 0, queue_capacity = 0;
+static uint32_t queue_depth_base = 0;  // draws given a depth so far this frame
+
+// Shared view-projections (see module_opengl_set_view): one per slot of
+// view_ubo, bound to uniform block binding 0, which every program's View
+// block reads. Slots are aligned to what GL allows as a range offset.
+#define VIEW_BINDING 0
+#define VIEW_MATRIX_SIZE (16 * sizeof(float))
+static GLuint view_ubo = 0;
+static GLsizeiptr view_stride = VIEW_MATRIX_SIZE;
+static unsigned char *view_staging = NULL;
+static int view_staging_capacity = 0;  // slots
+static int view_count = 0;             // slots uploaded
+static int bound_view = -1;
+
+// View that recorded draws are culled against. Like the culling counts below
+// it belongs to the thread recording frames: replay never culls, and frames
+// are recorded on one thread at a time (switching pipeline modes joins the
+// update thread first), so nothing else may read or write it.
+static float cull_view[6] = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+
+// Uniform locations, looked up once at init
+static GLint solid_model_loc, solid_color_loc;
+static GLint texture_model_loc, texture_color_loc;
+static GLint text_color_loc;
+
 // External logging function
 extern void core_log(enum retro_log_level level, const char *fmt, ...);
 
-// Texture vertex shader
+// Texture vertex shader. model is the draw's translation and the cosine and
+// sine of its rotation; the view-projection comes from the shared View block.
 static const char *texture_vertex_shader_src =
    "#version 330 core\n"
    "layout(location = 0) in vec2 position;\n"
    "layout(location = 1) in vec2 texcoord;\n"
    "out vec2 v_texcoord;\n"
-   "uniform mat4 mvp;\n"
+   "layout(std140) uniform View { mat4 view_proj; };\n"
+   "uniform vec4 model;\n"
    "void main() {\n"
-   "   gl_Position = mvp * vec4(position, 0.0, 1.0);\n"
+   "   vec2 p = vec2(position.x * model.z - position.y * model.w,\n"
+   "                 position.x * model.w + position.y * model.z) + model.xy;\n"
+   "   gl_Position = view_proj * vec4(p, 0.0, 1.0);\n"
    "   v_texcoord = texcoord;\n"
    "}\n";
 
@@ -53,13 +139,16 @@ static const char *texture_fragment_shader_src =
    "   frag_color = tex_color * color;\n"
    "}\n";
 
-// Solid vertex shader
+// Solid vertex shader (model as in the texture shader)
 static const char *solid_vertex_shader_src =
    "#version 330 core\n"
    "layout(location = 0) in vec2 position;\n"
-   "uniform mat4 mvp;\n"
+   "layout(std140) uniform View { mat4 view_proj; };\n"
+   "uniform vec4 model;\n"
    "void main() {\n"
-   "   gl_Position = mvp * vec4(position, 0.0, 1.0);\n"
+   "   vec2 p = vec2(position.x * model.z - position.y * model.w,\n"
+   "                 position.x * model.w + position.y * model.z) + model.xy;\n"
+   "   gl_Position = view_proj * vec4(p, 0.0, 1.0);\n"
    "}\n";
 
 // Solid fragment shader
@@ -71,14 +160,15 @@ static const char *solid_fragment_shader_src =
    "   frag_color = color;\n"
    "}\n";
 
-// Text vertex shader
+// Text vertex shader (positions already in the draws' coordinates)
 static const char *text_vertex_shader_src =
    "#version 330 core\n"
    "layout(location = 0) in vec2 position;\n"
    "layout(location = 1) in vec2 texcoord;\n"
    "out vec2 v_texcoord;\n"
+   "layout(std140) uniform View { mat4 view_proj; };\n"
    "void main() {\n"
-   "   gl_Position = vec4(position, 0.0, 1.0);\n"
+   "   gl_Position = view_proj * vec4(position, 0.0, 1.0);\n"
    "   v_texcoord = texcoord;\n"
    "}\n";
 
@@ -94,6 +184,34 @@ static const char *text_fragment_shader_src =
    "   frag_color = vec4(color.rgb, color.a * alpha);\n"
    "}\n";
 
+// Instanced sprite vertex shader: one instance per sprite, corners from gl_VertexID
+static const char *instanced_vertex_shader_src =
+   "#version 330 core\n"
+   "layout(location = 0) in float center_x;\n"
+   "layout(location = 1) in float center_y;\n"
+   "layout(location = 2) in float size;\n"
+   "layout(location = 3) in vec4 color;\n"
+   "out vec2 v_texcoord;\n"
+   "out vec4 v_color;\n"
+   "layout(std140) uniform View { mat4 view_proj; };\n"
+   "void main() {\n"
+   "   vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));\n"
+   "   gl_Position = view_proj * vec4(vec2(center_x, center_y) + (corner - 0.5) * size, 0.0, 1.0);\n"
+   "   v_texcoord = corner;\n"
+   "   v_color = color;\n"
+   "}\n";
+
+// Instanced sprite fragment shader
+static const char *instanced_fragment_shader_src =
+   "#version 330 core\n"
+   "in vec2 v_texcoord;\n"
+   "in vec4 v_color;\n"
+   "out vec4 frag_color;\n"
+   "uniform sampler2D texture_sampler;\n"
+   "void main() {\n"
+   "   frag_color = texture(texture_sampler, v_texcoord) * v_color;\n"
+   "}\n";
+
 // Create shader program
 static GLuint create_shader_program(const char *vs_src, const char *fs_src, const char *name) {
    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
@@ -137,6 +255,133 @@ static GLuint create_shader_program(const char *vs_src, const char *fs_src, cons
    return program;
 }
 
+static void use_program(GLuint program) {
+   if (program != bound_program) {
+      glUseProgram(program);
+      bound_program = program;
+   }
+}
+
+static void bind_texture(GLuint texture) {
+   if (texture != bound_texture) {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      bound_texture = texture;
+   }
+}
+
+// Set a draw's model transform: rotate by rotation degrees, then move to (x, y)
+static void set_model(GLint location, float x, float y, float rotation) {
+   float c = 1.0f, s = 0.0f;
+   if (rotation != 0.0f) {
+      float rad = glm_rad(rotation);
+      c = cosf(rad);
+      s = sinf(rad);
+   }
+   glUniform4f(location, x, y, c, s);
+}
+
+// Point a program's View block at the shared view buffer and its sampler
+// (if any) at texture unit 0
+static void bind_program_inputs(GLuint program, const char *sampler) {
+   GLuint block = glGetUniformBlockIndex(program, "View");
+   if (block != GL_INVALID_INDEX)
+      glUniformBlockBinding(program, block, VIEW_BINDING);
+   if (sampler) {
+      use_program(program);
+      glUniform1i(glGetUniformLocation(program, sampler), 0);
+   }
+}
+
+// Append count vertices of vertex_size bytes to the vertex stream (bound to
+// GL_ARRAY_BUFFER on return); returns the index of the first one, counted
+// in vertices of that size
+static GLint stream_vertices(const void *vertices, int count, GLsizeiptr vertex_size) {
+   glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
+   GLsizeiptr size = (GLsizeiptr)count * vertex_size;
+   GLsizeiptr offset = (stream_used + vertex_size - 1) / vertex_size * vertex_size;
+   if (offset + size > stream_capacity) {
+      if (size > stream_capacity) {
+         GLsizeiptr capacity = stream_capacity ? stream_capacity : STREAM_INITIAL_SIZE;
+         while (capacity < size)
+            capacity *= 2;
+         stream_capacity = capacity;
+      }
+      glBufferData(GL_ARRAY_BUFFER, stream_capacity, NULL, GL_STREAM_DRAW);
+      offset = 0;
+   }
+   glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)offset, size, vertices);
+   stream_used = offset + size;
+   return (GLint)(offset / vertex_size);
+}
+
+// Make room for count glyphs in a text batch array of floats_per_glyph
+// floats per glyph; false when out of memory
+static bool reserve_text(float **array, int *capacity, int count, int floats_per_glyph) {
+   if (count <= *capacity)
+      return true;
+   int grown_capacity = *capacity ? *capacity : 64;
+   while (grown_capacity < count)
+      grown_capacity *= 2;
+   float *grown = (float *)realloc(*array, (size_t)grown_capacity * floats_per_glyph * sizeof(float));
+   if (!grown) {
+      core_log(RETRO_LOG_ERROR, "Out of memory for %d glyphs of text", count);
+      return false;
+   }
+   *array = grown;
+   *capacity = grown_capacity;
+   return true;
+}
+
+// Draw count glyph quads {x0, y0, x1, y1, u0, v0, u1, v1}, offset by
+// (ox, oy), from texture with the text shader in one call
+static void draw_text_quads(GLuint texture, const float *quads, int count, float ox, float oy,
+                            float r, float g, float b, float a) {
+   if (!reserve_text(&text_vertices, &text_vertex_capacity, count, 24))
+      return;
+   float *v = text_vertices;
+   for (int i = 0; i < count; i++, quads += 8) {
+      float x0 = ox + quads[0], y0 = oy + quads[1], x1 = ox + quads[2], y1 = oy + quads[3];
+      float u0 = quads[4], v0 = quads[5], u1 = quads[6], v1 = quads[7];
+      const float corners[24] = {
+         x0, y0, u0, v0,  x1, y0, u1, v0,  x0, y1, u0, v1,
+         x1, y0, u1, v0,  x1, y1, u1, v1,  x0, y1, u0, v1
+      };
+      memcpy(v, corners, sizeof(corners));
+      v += 24;
+   }
+
+   use_program(text_shader_program);
+   glBindVertexArray(text_vao);
+   GLint first = stream_vertices(text_vertices, count * 6, TEXT_VERTEX_SIZE);
+   bind_texture(texture);
+   glUniform4f(text_color_loc, r, g, b, a);
+   glDrawArrays(GL_TRIANGLES, first, count * 6);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glBindVertexArray(0);
+}
+
+static void set_texture_opaque(GLuint texture, bool opaque) {
+   if (texture >= opaque_capacity) {
+      if (!opaque)
+         return;
+      GLuint capacity = opaque_capacity ? opaque_capacity : 256;
+      while (capacity <= texture)
+         capacity *= 2;
+      uint8_t *grown = (uint8_t *)realloc(opaque_textures, capacity);
+      if (!grown)
+         return;
+      memset(grown + opaque_capacity, 0, capacity - opaque_capacity);
+      opaque_textures = grown;
+      opaque_capacity = capacity;
+   }
+   opaque_textures[texture] = opaque;
+}
+
+static bool texture_is_opaque(GLuint texture) {
+   return texture < opaque_capacity && opaque_textures[texture];
+}
+
 // Create font texture 
 static void create_font_texture(void) {
    uint8_t texture_data[760 * 8] = {0};
@@ -163,11 +408,33 @@ static void create_font_texture(void) {
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
    glBindTexture(GL_TEXTURE_2D, 0);
+   bound_texture = BOUND_UNKNOWN;
    module_opengl_check_error("create_font_texture");
 
    core_log(RETRO_LOG_INFO, "Font texture created (760x8)");
 }
 
+// Create the glyph atlas, cleared so the padding around glyphs samples as
+// transparent
+static void create_glyph_atlas(void) {
+   uint8_t *cleared = (uint8_t *)calloc((size_t)GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE, 1);
+   glGenTextures(1, &glyph_atlas);
+   glBindTexture(GL_TEXTURE_2D, glyph_atlas);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, cleared);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   bound_texture = BOUND_UNKNOWN;
+   free(cleared);
+   module_opengl_check_error("create_glyph_atlas");
+
+   core_log(RETRO_LOG_INFO, "Glyph atlas created (%dx%d)", GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE);
+}
+
 void module_opengl_set_callbacks(retro_hw_get_proc_address_t proc_address,
                                 retro_hw_get_current_framebuffer_t framebuffer_cb,
                                 bool *default_fbo) {
@@ -179,44 +446,248 @@ void module_opengl_set_callbacks(retro_hw_get_proc_address_t proc_address,
 }
 
 
-// Load image and create OpenGL texture
-GLuint module_opengl_load_image(const char *asset_name, int *width, int *height) {
+// Build model-view-projection for a 2D draw centred at (x, y), rotated in degrees
+void module_opengl_build_mvp(float x, float y, float rotation,
+                             float vp_width, float vp_height, float *out_mvp) {
+   mat4 model, view, proj;
+   vec4 *mvp = (vec4 *)out_mvp;
+   glm_mat4_identity(model);
+   glm_mat4_identity(view);
+   glm_mat4_identity(proj);
+   glm_translate(model, (vec3){x, y, 0.0f});
+   glm_rotate(model, glm_rad(rotation), (vec3){0.0f, 0.0f, 1.0f});
+   glm_ortho(-vp_width / 2.0f, vp_width / 2.0f, vp_height / 2.0f, -vp_height / 2.0f, -1.0f, 1.0f, proj);
+   glm_mat4_mul(proj, view, mvp);
+   glm_mat4_mul(mvp, model, mvp);
+}
+
+// Projection of the virtual space times a view affine
+static void build_view_proj(const float *affine, float *out) {
+   mat4 proj;
+   mat4 view = {
+      {affine[0], affine[1], 0.0f, 0.0f},
+      {affine[2], affine[3], 0.0f, 0.0f},
+      {0.0f, 0.0f, 1.0f, 0.0f},
+      {affine[4], affine[5], 0.0f, 1.0f}
+   };
+   glm_ortho(-VIRTUAL_WIDTH / 2.0f, VIRTUAL_WIDTH / 2.0f, VIRTUAL_HEIGHT / 2.0f, -VIRTUAL_HEIGHT / 2.0f,
+             -1.0f, 1.0f, proj);
+   glm_mat4_mul(proj, view, (vec4 *)out);
+}
+
+void module_opengl_upload_views(const float *affines, int count) {
+   if (count > view_staging_capacity) {
+      int capacity = view_staging_capacity ? view_staging_capacity : 64;
+      while (capacity < count)
+         capacity *= 2;
+      unsigned char *grown = (unsigned char *)realloc(view_staging, (size_t)capacity * view_stride);
+      if (!grown) {
+         core_log(RETRO_LOG_ERROR, "Out of memory for %d views, drawing with the first", count);
+         count = view_staging_capacity > 0 ? view_staging_capacity : 0;
+         if (count == 0)
+            return;
+      } else {
+         view_staging = grown;
+         view_staging_capacity = capacity;
+      }
+   }
+   for (int i = 0; i < count; i++)
+      build_view_proj(affines + i * 6, (float *)(view_staging + i * view_stride));
+
+   glBindBuffer(GL_UNIFORM_BUFFER, view_ubo);
+   glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)count * view_stride, view_staging, GL_STREAM_DRAW);
+   glBindBuffer(GL_UNIFORM_BUFFER, 0);
+   view_count = count;
+   bound_view = -1;
+   module_opengl_use_view(0);
+}
+
+void module_opengl_use_view(int index) {
+   if (index < 0 || index >= view_count)
+      index = 0;
+   if (index != bound_view) {
+      glBindBufferRange(GL_UNIFORM_BUFFER, VIEW_BINDING, view_ubo, (GLintptr)index * view_stride, VIEW_MATRIX_SIZE);
+      bound_view = index;
+   }
+}
+
+void module_opengl_set_view(const float *affine) {
+   memcpy(cull_view, affine, sizeof(cull_view));
+   cmdlist *list = module_cmdlist_recording();
+   if (list)
+      module_cmdlist_set_view(list, affine);
+   else if (gl_initialized)
+      module_opengl_upload_views(affine, 1);
+}
+
+void module_opengl_view_bounds(float vp_width, float vp_height,
+                               float *min_x, float *min_y, float *max_x, float *max_y) {
+   // Map the viewport box back through the inverse view
+   const float *v = cull_view;
+   float det = v[0] * v[3] - v[1] * v[2];
+   if (fabsf(det) < 1e-12f) {
+      *min_x = *min_y = -FLT_MAX;
+      *max_x = *max_y = FLT_MAX;
+      return;
+   }
+   float ia = v[3] / det, ib = -v[1] / det, ic = -v[2] / det, id = v[0] / det;
+   float cx = -(ia * v[4] + ic * v[5]), cy = -(ib * v[4] + id * v[5]);
+   float hx = vp_width * 0.5f, hy = vp_height * 0.5f;
+   float ex = fabsf(ia) * hx + fabsf(ic) * hy, ey = fabsf(ib) * hx + fabsf(id) * hy;
+   *min_x = cx - ex;
+   *min_y = cy - ey;
+   *max_x = cx + ex;
+   *max_y = cy + ey;
+}
+
+
+// ---------------------------------------------------------------------------
+// Viewport culling. Draws are tested when they are recorded, so nothing off
+// screen reaches a command list; replayed draws are not tested again. The
+// visible area is the virtual viewport centred on the origin, as in
+// module_opengl_build_mvp, seen through the current view: boxes are moved
+// into the viewport's space by the view and grown to stay axis-aligned.
+// Counts cover the frame being recorded and are published by
+// module_opengl_end_cull_frame; they are the recording thread's, like
+// cull_view, and module_opengl_cull_stats is called from Lua on that thread.
+static int cull_submitted = 0, cull_culled = 0;
+static int cull_last_submitted = 0, cull_last_culled = 0;
+
+// Instanced sprites that survive culling (recording thread only)
+static float *cull_sprite_data = NULL;
+static int cull_sprite_capacity = 0;
+
+bool module_opengl_rect_visible(float x, float y, float w, float h, float rotation,
+                                float vp_width, float vp_height) {
+   float ex = fabsf(w) * 0.5f, ey = fabsf(h) * 0.5f;
+   if (rotation != 0.0f) {
+      float rad = glm_rad(rotation);
+      float c = fabsf(cosf(rad)), s = fabsf(sinf(rad));
+      float rx = ex * c + ey * s;
+      ey = ex * s + ey * c;
+      ex = rx;
+   }
+   const float *v = cull_view;
+   float vx = v[0] * x + v[2] * y + v[4], vy = v[1] * x + v[3] * y + v[5];
+   float vex = fabsf(v[0]) * ex + fabsf(v[2]) * ey, vey = fabsf(v[1]) * ex + fabsf(v[3]) * ey;
+   return fabsf(vx) - vex <= vp_width * 0.5f && fabsf(vy) - vey <= vp_height * 0.5f;
+}
+
+// Count a draw as submitted or culled; returns whether it is visible
+static bool cull_draw(bool visible) {
+   if (visible)
+      cull_submitted++;
+   else
+      cull_culled++;
+   return visible;
+}
+
+int module_opengl_cull_sprites(int count, const float *xs, const float *ys, const float *sizes,
+                               const uint32_t *colors, float vp_width, float vp_height,
+                               float *out_xs, float *out_ys, float *out_sizes, uint32_t *out_colors) {
+   // Branchless compaction: every sprite is copied, the cursor only advances
+   // past visible ones
+   const float *v = cull_view;
+   float kx = (fabsf(v[0]) + fabsf(v[2])) * 0.5f, ky = (fabsf(v[1]) + fabsf(v[3])) * 0.5f;
+   float hx = vp_width * 0.5f, hy = vp_height * 0.5f;
+   int n = 0;
+   for (int i = 0; i < count; i++) {
+      float vx = v[0] * xs[i] + v[2] * ys[i] + v[4], vy = v[1] * xs[i] + v[3] * ys[i] + v[5];
+      out_xs[n] = xs[i];
+      out_ys[n] = ys[i];
+      out_sizes[n] = sizes[i];
+      out_colors[n] = colors[i];
+      n += (fabsf(vx) - sizes[i] * kx <= hx) & (fabsf(vy) - sizes[i] * ky <= hy);
+   }
+   cull_submitted += n;
+   cull_culled += count - n;
+   return n;
+}
+
+void module_opengl_end_cull_frame(void) {
+   cull_last_submitted = cull_submitted;
+   cull_last_culled = cull_culled;
+   cull_submitted = cull_culled = 0;
+}
+
+void module_opengl_cull_stats(int *submitted, int *culled) {
+   *submitted = cull_last_submitted;
+   *culled = cull_last_culled;
+}
+
+typedef struct {
+   const unsigned char *pixels;  // RGBA8
+   int width, height;
+   GLuint texture;               // out
+} texture_upload;
+
+static void upload_texture(void *arg) {
+   texture_upload *upload = (texture_upload *)arg;
+   glGenTextures(1, &upload->texture);
+   glBindTexture(GL_TEXTURE_2D, upload->texture);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, upload->width, upload->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, upload->pixels);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   bound_texture = BOUND_UNKNOWN;
+   module_opengl_check_error("load_image texture creation");
+
+   bool opaque = true;
+   size_t pixels = (size_t)upload->width * upload->height;
+   for (size_t i = 0; i < pixels && opaque; i++)
+      opaque = upload->pixels[i * 4 + 3] == 255;
+   set_texture_opaque(upload->texture, opaque);
+}
+
+
+unsigned char *module_opengl_decode_image(const char *asset_name, int *width, int *height) {
    char *image_data = NULL;
    size_t image_size = 0;
 
    if (!extract_asset_from_zip(asset_name, &image_data, &image_size)) {
       core_log(RETRO_LOG_ERROR, "Failed to extract image asset: %s", asset_name);
-      return 0;
+      return NULL;
    }
 
    if (image_size > INT_MAX) {
       core_log(RETRO_LOG_ERROR, "Image size (%zu) exceeds maximum allowed (%d)", image_size, INT_MAX);
       free(image_data);
-      return 0;
+      return NULL;
    }
 
    int channels;
-   stbi_set_flip_vertically_on_load(1);
+   stbi_set_flip_vertically_on_load_thread(1);
    unsigned char *data = stbi_load_from_memory((stbi_uc *)image_data, (int)image_size, width, height, &channels, 4);
    free(image_data);
-   if (!data) {
+   if (!data)
       core_log(RETRO_LOG_ERROR, "Failed to load image %s: %s", asset_name, stbi_failure_reason());
-      return 0;
-   }
+   return data;
+}
 
-   GLuint texture;
-   glGenTextures(1, &texture);
-   glBindTexture(GL_TEXTURE_2D, texture);
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, *width, *height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-   glBindTexture(GL_TEXTURE_2D, 0);
-   module_opengl_check_error("load_image texture creation");
+GLuint module_opengl_upload_image(const unsigned char *pixels, int width, int height) {
+   // Decoding is thread-safe; a pipelined update hands only the upload to the GL thread
+   texture_upload upload = {pixels, width, height, 0};
+   if (module_pipeline_is_update_thread())
+      module_pipeline_call_gl(upload_texture, &upload);
+   else
+      upload_texture(&upload);
+   return upload.texture;
+}
 
-   stbi_image_free(data);
-   core_log(RETRO_LOG_INFO, "Loaded image %s (%dx%d, channels=%d) as texture %u", asset_name, *width, *height, channels, texture);
+void module_opengl_free_image(unsigned char *pixels) {
+   stbi_image_free(pixels);
+}
+
+// Load image and create OpenGL texture
+GLuint module_opengl_load_image(const char *asset_name, int *width, int *height) {
+   unsigned char *data = module_opengl_decode_image(asset_name, width, height);
+   if (!data)
+      return 0;
+   GLuint texture = module_opengl_upload_image(data, *width, *height);
+   module_opengl_free_image(data);
+   core_log(RETRO_LOG_INFO, "Loaded image %s (%dx%d) as texture %u", asset_name, *width, *height, texture);
    return texture;
 }
 
@@ -225,6 +696,12 @@ GLuint module_opengl_load_image(const char *asset_name, int *width, int *height)
 void module_opengl_draw_texture(GLuint texture_id, float x, float y, float w, float h,
                                 float rotation, float r, float g, float b, float a,
                                 float vp_width, float vp_height) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      if (cull_draw(module_opengl_rect_visible(x, y, w, h, rotation, vp_width, vp_height)))
+         module_cmdlist_texture(list, texture_id, x, y, w, h, rotation, r, g, b, a, vp_width, vp_height);
+      return;
+   }
    if (!glIsProgram(texture_shader_program) || !glIsVertexArray(texture_vao) || !glIsBuffer(vbo) || !glIsTexture(texture_id)) {
       core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_texture");
       return;
@@ -244,42 +721,311 @@ void module_opengl_draw_texture(GLuint texture_id, float x, float y, float w, fl
    core_log(RETRO_LOG_DEBUG, "Texture quad vertices: BL(%f, %f), BR(%f, %f), TL(%f, %f), TR(%f, %f)",
             vertices[0], vertices[1], vertices[4], vertices[5], vertices[8], vertices[9], vertices[20], vertices[21]);
 
-   mat4 model, view, proj, mvp;
-   glm_mat4_identity(model);
-   glm_mat4_identity(view);
-   glm_mat4_identity(proj);
-   glm_translate(model, (vec3){x, y, 0.0f});
-   glm_rotate(model, glm_rad(rotation), (vec3){0.0f, 0.0f, 1.0f});
-   glm_ortho(-vp_width / 2.0f, vp_width / 2.0f, vp_height / 2.0f, -vp_height / 2.0f, -1.0f, 1.0f, proj);
-   glm_mat4_mul(proj, view, mvp);
-   glm_mat4_mul(mvp, model, mvp);
-
-   glUseProgram(texture_shader_program);
+   use_program(texture_shader_program);
    glBindVertexArray(texture_vao);
    glBindBuffer(GL_ARRAY_BUFFER, vbo);
    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
 
-   GLint mvp_loc = glGetUniformLocation(texture_shader_program, "mvp");
-   glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, (float *)mvp);
+   set_model(texture_model_loc, x, y, rotation);
+   glUniform4f(texture_color_loc, r, g, b, a);
+   bind_texture(texture_id);
 
-   GLint color_loc = glGetUniformLocation(texture_shader_program, "color");
-   glUniform4f(color_loc, r, g, b, a);
+   glDrawArrays(GL_TRIANGLES, 0, 6);
 
-   GLint texture_loc = glGetUniformLocation(texture_shader_program, "texture_sampler");
-   glUniform1i(texture_loc, 0);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glBindVertexArray(0);
+   module_opengl_check_error("draw_texture");
 
-   glActiveTexture(GL_TEXTURE0);
-   glBindTexture(GL_TEXTURE_2D, texture_id);
+   core_log(RETRO_LOG_DEBUG, "Drew texture %u at (%f, %f), size (%f, %f), rotation %f", texture_id, x, y, w, h, rotation);
+}
 
-   glDrawArrays(GL_TRIANGLES, 0, 6);
 
+// Alpha blending for the current destination; render targets keep premultiplied colour
+static void set_default_blend(void) {
+   if (target_active)
+      glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+   else
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+typedef struct {
+   int count;
+   GLuint *vaos, *vbos;
+} mesh_create;
+
+static void create_meshes(void *arg) {
+   mesh_create *create = (mesh_create *)arg;
+   glGenVertexArrays(create->count, create->vaos);
+   glGenBuffers(create->count, create->vbos);
+   for (int i = 0; i < create->count; i++) {
+      glBindVertexArray(create->vaos[i]);
+      glBindBuffer(GL_ARRAY_BUFFER, create->vbos[i]);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+   }
+   glBindVertexArray(0);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   module_opengl_check_error("create_meshes");
+}
+
+bool module_opengl_create_meshes(int count, GLuint *vaos, GLuint *vbos) {
+   mesh_create create = {count, vaos, vbos};
+   if (count <= 0)
+      return true;
+   if (module_pipeline_is_update_thread())
+      module_pipeline_call_gl(create_meshes, &create);
+   else
+      create_meshes(&create);
+   return vaos[0] != 0 && vbos[0] != 0;
+}
+
+void module_opengl_upload_mesh(GLuint vbo, const float *vertices, int num_vertices) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_upload_mesh(list, vbo, vertices, num_vertices);
+      return;
+   }
+   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)num_vertices * 4 * sizeof(float), vertices, GL_STATIC_DRAW);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   module_opengl_check_error("upload_mesh");
+}
+
+// Draw a static mesh with the texture shader, translated by (x, y)
+void module_opengl_draw_mesh(GLuint vao, int num_vertices, GLuint texture_id, float x, float y,
+                             float r, float g, float b, float a, float vp_width, float vp_height) {
+   if (num_vertices <= 0)
+      return;
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_draw_mesh(list, vao, num_vertices, texture_id, x, y, r, g, b, a, vp_width, vp_height);
+      return;
+   }
+   if (!glIsProgram(texture_shader_program) || !glIsVertexArray(vao) || !glIsTexture(texture_id)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_mesh");
+      return;
+   }
+
+   use_program(texture_shader_program);
+   glBindVertexArray(vao);
+   set_model(texture_model_loc, x, y, 0.0f);
+   glUniform4f(texture_color_loc, r, g, b, a);
+   bind_texture(texture_id);
+
+   glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+
+   glBindVertexArray(0);
+   module_opengl_check_error("draw_mesh");
+}
+
+void module_opengl_free_meshes(int count, const GLuint *vaos, const GLuint *vbos) {
+   if (count <= 0)
+      return;
+   // Keep the delete ordered after the recorded draws that may still use them
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_free_meshes(list, count, vaos, vbos);
+      return;
+   }
+   glDeleteVertexArrays(count, vaos);
+   glDeleteBuffers(count, vbos);
+}
+
+
+typedef struct {
+   int width, height;
+   GLuint fbo, texture;  // out
+} target_create;
+
+static void create_target(void *arg) {
+   target_create *create = (target_create *)arg;
+   GLint previous = 0;
+   glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+   glGenTextures(1, &create->texture);
+   glBindTexture(GL_TEXTURE_2D, create->texture);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, create->width, create->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
    glBindTexture(GL_TEXTURE_2D, 0);
+   bound_texture = BOUND_UNKNOWN;
+
+   glGenFramebuffers(1, &create->fbo);
+   glBindFramebuffer(GL_FRAMEBUFFER, create->fbo);
+   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, create->texture, 0);
+   GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+   if (status == GL_FRAMEBUFFER_COMPLETE) {
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+   }
+   glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previous);
+   if (status != GL_FRAMEBUFFER_COMPLETE) {
+      core_log(RETRO_LOG_ERROR, "Render target %dx%d incomplete (status: %d)", create->width, create->height, status);
+      glDeleteFramebuffers(1, &create->fbo);
+      glDeleteTextures(1, &create->texture);
+      create->fbo = create->texture = 0;
+   }
+   module_opengl_check_error("create_target");
+}
+
+bool module_opengl_create_target(int width, int height, GLuint *fbo, GLuint *texture) {
+   target_create create = {width, height, 0, 0};
+   if (module_pipeline_is_update_thread())
+      module_pipeline_call_gl(create_target, &create);
+   else
+      create_target(&create);
+   *fbo = create.fbo;
+   *texture = create.texture;
+   return create.fbo != 0;
+}
+
+void module_opengl_begin_target(GLuint fbo, int width, int height) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_begin_target(list, fbo, width, height);
+      return;
+   }
+   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+   glViewport(0, 0, width, height);
+   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+   glClear(GL_COLOR_BUFFER_BIT);
+   glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+   // Accumulate premultiplied colour so the target composites like the draws it holds
+   target_active = true;
+   set_default_blend();
+   module_opengl_check_error("begin_target");
+}
+
+void module_opengl_end_target(void) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_end_target(list);
+      return;
+   }
+   target_active = false;
+   set_default_blend();
+   module_opengl_bind_framebuffer();
+   module_opengl_set_viewport();
+}
+
+void module_opengl_draw_target(GLuint texture, float x, float y, float w, float h, float opacity,
+                               float vp_width, float vp_height) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      if (cull_draw(module_opengl_rect_visible(x, y, w, h, 0.0f, vp_width, vp_height)))
+         module_cmdlist_draw_target(list, texture, x, y, w, h, opacity, vp_width, vp_height);
+      return;
+   }
+   // The target's rows run bottom-up, so flip the quad; colours are premultiplied
+   glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+   module_opengl_draw_texture(texture, x, y, w, -h, 0.0f, opacity, opacity, opacity, opacity, vp_width, vp_height);
+   set_default_blend();
+}
+
+void module_opengl_free_target(GLuint fbo, GLuint texture) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_free_target(list, fbo, texture);
+      return;
+   }
+   glDeleteFramebuffers(1, &fbo);
+   glDeleteTextures(1, &texture);
+   if (texture == bound_texture)
+      bound_texture = BOUND_UNKNOWN;
+}
+
+
+// Point the instance attributes at their regions of the instanced VBO
+static void set_instanced_attributes(void) {
+   GLsizeiptr stride = (GLsizeiptr)instanced_capacity * 4;
+   glBindVertexArray(instanced_vao);
+   glBindBuffer(GL_ARRAY_BUFFER, instanced_vbo);
+   for (GLuint i = 0; i < 3; i++) {
+      glEnableVertexAttribArray(i);
+      glVertexAttribPointer(i, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)(stride * i));
+      glVertexAttribDivisor(i, 1);
+   }
+   glEnableVertexAttribArray(3);
+   glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uint32_t), (void *)(stride * 3));
+   glVertexAttribDivisor(3, 1);
+   glBindVertexArray(0);
+}
+
+
+// Draw count square sprites in one instanced call
+void module_opengl_draw_texture_instanced(GLuint texture_id, int count,
+                                          const float *xs, const float *ys, const float *sizes,
+                                          const uint32_t *colors, bool additive,
+                                          float vp_width, float vp_height) {
+   if (count <= 0)
+      return;
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      // Cull into scratch arrays and record only the visible sprites
+      if (count > cull_sprite_capacity) {
+         float *grown = (float *)realloc(cull_sprite_data, (size_t)count * 4 * sizeof(float));
+         if (!grown) {
+            module_cmdlist_texture_instanced(list, texture_id, count, xs, ys, sizes, colors, additive, vp_width, vp_height);
+            return;
+         }
+         cull_sprite_data = grown;
+         cull_sprite_capacity = count;
+      }
+      float *cx = cull_sprite_data, *cy = cx + count, *cs = cy + count;
+      uint32_t *cc = (uint32_t *)(cs + count);
+      int visible = module_opengl_cull_sprites(count, xs, ys, sizes, colors, vp_width, vp_height, cx, cy, cs, cc);
+      if (visible == count)
+         module_cmdlist_texture_instanced(list, texture_id, count, xs, ys, sizes, colors, additive, vp_width, vp_height);
+      else if (visible > 0)
+         module_cmdlist_texture_instanced(list, texture_id, visible, cx, cy, cs, cc, additive, vp_width, vp_height);
+      return;
+   }
+   if (!glIsProgram(instanced_shader_program) || !glIsVertexArray(instanced_vao) || !glIsBuffer(instanced_vbo)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_texture_instanced");
+      return;
+   }
+   if (texture_id == 0)
+      texture_id = white_texture;
+
+   // Grow (or orphan) the instance buffer; each attribute gets its own region
+   glBindBuffer(GL_ARRAY_BUFFER, instanced_vbo);
+   if (count > instanced_capacity) {
+      int capacity = instanced_capacity ? instanced_capacity : 1024;
+      while (capacity < count)
+         capacity *= 2;
+      instanced_capacity = capacity;
+      glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * 16, NULL, GL_STREAM_DRAW);
+      set_instanced_attributes();
+      glBindBuffer(GL_ARRAY_BUFFER, instanced_vbo);
+   } else {
+      glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)instanced_capacity * 16, NULL, GL_STREAM_DRAW);
+   }
+   GLsizeiptr region = (GLsizeiptr)instanced_capacity * 4, bytes = (GLsizeiptr)count * 4;
+   glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, xs);
+   glBufferSubData(GL_ARRAY_BUFFER, region, bytes, ys);
+   glBufferSubData(GL_ARRAY_BUFFER, region * 2, bytes, sizes);
+   glBufferSubData(GL_ARRAY_BUFFER, region * 3, bytes, colors);
+
+   use_program(instanced_shader_program);
+   glBindVertexArray(instanced_vao);
+   bind_texture(texture_id);
+   if (additive)
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+   glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+
+   if (additive)
+      set_default_blend();
    glBindBuffer(GL_ARRAY_BUFFER, 0);
    glBindVertexArray(0);
-   glUseProgram(0);
-   module_opengl_check_error("draw_texture");
+   module_opengl_check_error("draw_texture_instanced");
 
-   core_log(RETRO_LOG_DEBUG, "Drew texture %u at (%f, %f), size (%f, %f), rotation %f", texture_id, x, y, w, h, rotation);
+   core_log(RETRO_LOG_DEBUG, "Drew %d instanced sprites with texture %u", count, texture_id);
 }
 
 
@@ -329,25 +1075,69 @@ void module_opengl_init(void) {
       return;
    }
 
+   instanced_shader_program = create_shader_program(instanced_vertex_shader_src, instanced_fragment_shader_src, "Instanced");
+   if (!instanced_shader_program) {
+      core_log(RETRO_LOG_ERROR, "Failed to create instanced shader program");
+      return;
+   }
+
+   solid_model_loc = glGetUniformLocation(solid_shader_program, "model");
+   solid_color_loc = glGetUniformLocation(solid_shader_program, "color");
+   texture_model_loc = glGetUniformLocation(texture_shader_program, "model");
+   texture_color_loc = glGetUniformLocation(texture_shader_program, "color");
+   text_color_loc = glGetUniformLocation(text_shader_program, "color");
+   bind_program_inputs(solid_shader_program, NULL);
+   bind_program_inputs(text_shader_program, "font_texture");
+   bind_program_inputs(texture_shader_program, "texture_sampler");
+   bind_program_inputs(instanced_shader_program, "texture_sampler");
+
+   // Shared view buffer, starting with the identity view
+   GLint alignment = 0;
+   glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+   view_stride = VIEW_MATRIX_SIZE;
+   if (alignment > 0)
+      view_stride = (view_stride + alignment - 1) / alignment * alignment;
+   glGenBuffers(1, &view_ubo);
+   const float identity[6] = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+   module_opengl_upload_views(identity, 1);
+
    create_font_texture();
+   create_glyph_atlas();
+
+   // 1x1 white texture for untextured instanced sprites
+   const uint8_t white_pixel[4] = {255, 255, 255, 255};
+   glGenTextures(1, &white_texture);
+   glBindTexture(GL_TEXTURE_2D, white_texture);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white_pixel);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   bound_texture = bound_program = BOUND_UNKNOWN;
 
    // Set up VBO
    glGenBuffers(1, &vbo);
    glBindBuffer(GL_ARRAY_BUFFER, vbo);
    glBufferData(GL_ARRAY_BUFFER, 6 * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
 
-   // Solid VAO (position only)
+   // Solid vertex stream
+   glGenBuffers(1, &stream_vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
+   stream_capacity = STREAM_INITIAL_SIZE;
+   stream_used = 0;
+   glBufferData(GL_ARRAY_BUFFER, stream_capacity, NULL, GL_STREAM_DRAW);
+
+   // Solid VAO (position only, from the stream)
    glGenVertexArrays(1, &solid_vao);
    glBindVertexArray(solid_vao);
-   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
    glEnableVertexAttribArray(0);
    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
    glBindVertexArray(0);
 
-   // Text VAO (position + texcoord)
+   // Text VAO (position + texcoord, from the stream)
    glGenVertexArrays(1, &text_vao);
    glBindVertexArray(text_vao);
-   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, stream_vbo);
    glEnableVertexAttribArray(0);
    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
    glEnableVertexAttribArray(1);
@@ -364,6 +1154,11 @@ void module_opengl_init(void) {
    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
    glBindVertexArray(0);
 
+   // Instanced sprite VAO (per-instance attributes, sized on first draw)
+   glGenVertexArrays(1, &instanced_vao);
+   glGenBuffers(1, &instanced_vbo);
+   instanced_capacity = 0;
+
    glBindBuffer(GL_ARRAY_BUFFER, 0);
    module_opengl_check_error("init_opengl VAO setup");
 
@@ -387,11 +1182,42 @@ void module_opengl_deinit(void) {
       glDeleteProgram(solid_shader_program);
       glDeleteProgram(text_shader_program);
       glDeleteProgram(texture_shader_program);
+      glDeleteProgram(instanced_shader_program);
       glDeleteTextures(1, &font_texture);
+      glDeleteTextures(1, &glyph_atlas);
+      glDeleteTextures(1, &white_texture);
       glDeleteBuffers(1, &vbo);
+      glDeleteBuffers(1, &instanced_vbo);
+      glDeleteBuffers(1, &view_ubo);
+      glDeleteBuffers(1, &stream_vbo);
+      stream_capacity = stream_used = 0;
+      glyph_atlas = 0;
+      free(text_quads);
+      free(text_vertices);
+      text_quads = text_vertices = NULL;
+      text_quad_capacity = text_vertex_capacity = 0;
       glDeleteVertexArrays(1, &solid_vao);
       glDeleteVertexArrays(1, &text_vao);
       glDeleteVertexArrays(1, &texture_vao);
+      glDeleteVertexArrays(1, &instanced_vao);
+      instanced_capacity = 0;
+      free(opaque_textures);
+      opaque_textures = NULL;
+      opaque_capacity = 0;
+      free(queue_keys);
+      free(queue_keys_tmp);
+      free(queue_index);
+      free(queue_index_tmp);
+      free(queue_draws);
+      queue_keys = queue_keys_tmp = NULL;
+      queue_index = queue_index_tmp = NULL;
+      queue_draws = NULL;
+      queue_count = queue_capacity = 0;
+      free(view_staging);
+      view_staging = NULL;
+      view_staging_capacity = view_count = 0;
+      view_ubo = 0;
+      bound_view = -1;
       gl_initialized = false;
       core_log(RETRO_LOG_INFO, "OpenGL deinitialized");
    }
@@ -405,7 +1231,13 @@ void module_opengl_deinit(void) {
 void module_opengl_draw_solid_quad(float x, float y, float w, float h,
                                    float rotation, float r, float g, float b, float a,
                                    float vp_width, float vp_height) {
-   if (!glIsProgram(solid_shader_program) || !glIsVertexArray(solid_vao) || !glIsBuffer(vbo)) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      if (cull_draw(module_opengl_rect_visible(x, y, w, h, rotation, vp_width, vp_height)))
+         module_cmdlist_solid_quad(list, x, y, w, h, rotation, r, g, b, a, vp_width, vp_height);
+      return;
+   }
+   if (!glIsProgram(solid_shader_program) || !glIsVertexArray(solid_vao) || !glIsBuffer(stream_vbo)) {
       core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_solid_quad");
       return;
    }
@@ -424,39 +1256,17 @@ void module_opengl_draw_solid_quad(float x, float y, float w, float h,
    core_log(RETRO_LOG_DEBUG, "Quad vertices: BL(%f, %f), BR(%f, %f), TL(%f, %f), TR(%f, %f)",
             vertices[0], vertices[1], vertices[2], vertices[3], vertices[4], vertices[5], vertices[10], vertices[11]);
 
-   mat4 model, view, proj, mvp;
-   glm_mat4_identity(model);
-   glm_mat4_identity(view);
-   glm_mat4_identity(proj);
-   glm_translate(model, (vec3){x, y, 0.0f});
-   glm_rotate(model, glm_rad(rotation), (vec3){0.0f, 0.0f, 1.0f});
-   glm_ortho(-vp_width / 2.0f, vp_width / 2.0f, vp_height / 2.0f, -vp_height / 2.0f, -1.0f, 1.0f, proj);
-   glm_mat4_mul(proj, view, mvp);
-   glm_mat4_mul(mvp, model, mvp);
-
-   for (int i = 0; i < 6; i++) {
-      vec4 v = {vertices[i * 2], vertices[i * 2 + 1], 0.0f, 1.0f};
-      vec4 out;
-      glm_mat4_mulv(mvp, v, out);
-      core_log(RETRO_LOG_DEBUG, "Vertex %d transformed: (%f, %f, %f, %f)", i, out[0], out[1], out[2], out[3]);
-   }
-
-   glUseProgram(solid_shader_program);
+   use_program(solid_shader_program);
    glBindVertexArray(solid_vao);
-   glBindBuffer(GL_ARRAY_BUFFER, vbo);
-   glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+   GLint first = stream_vertices(vertices, 6, SOLID_VERTEX_SIZE);
 
-   GLint mvp_loc = glGetUniformLocation(solid_shader_program, "mvp");
-   glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, (float *)mvp);
+   set_model(solid_model_loc, x, y, rotation);
+   glUniform4f(solid_color_loc, r, g, b, a);
 
-   GLint color_loc = glGetUniformLocation(solid_shader_program, "color");
-   glUniform4f(color_loc, r, g, b, a);
-
-   glDrawArrays(GL_TRIANGLES, 0, 6);
+   glDrawArrays(GL_TRIANGLES, first, 6);
 
    glBindBuffer(GL_ARRAY_BUFFER, 0);
    glBindVertexArray(0);
-   glUseProgram(0);
    module_opengl_check_error("draw_solid_quad");
 
    core_log(RETRO_LOG_DEBUG, "Drew solid quad at (%f, %f), size (%f, %f), rotation %f", x, y, w, h, rotation);
@@ -466,68 +1276,68 @@ void module_opengl_draw_solid_quad(float x, float y, float w, float h,
 void module_opengl_draw_custom_quad(float *vertices, int num_vertices, float x, float y,
                                    float rotation, float r, float g, float b, float a,
                                    float vp_width, float vp_height) {
-    if (!glIsProgram(solid_shader_program) || !glIsVertexArray(solid_vao) || !glIsBuffer(vbo)) {
-        core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_custom_quad");
+    if (num_vertices == 4) {
+        // Define triangles explicitly: 0-1-2 and 1-2-3
+        float triangle_vertices[] = {
+            vertices[0], vertices[1], // Vertex 0
+            vertices[2], vertices[3], // Vertex 1
+            vertices[4], vertices[5], // Vertex 2
+            vertices[2], vertices[3], // Vertex 1
+            vertices[4], vertices[5], // Vertex 2
+            vertices[6], vertices[7]  // Vertex 3
+        };
+        module_opengl_draw_triangles(triangle_vertices, 6, x, y, rotation, r, g, b, a, vp_width, vp_height);
         return;
     }
 
-    if (num_vertices != 4) {
-        core_log(RETRO_LOG_ERROR, "draw_custom_quad expects exactly 4 vertices, got %d", num_vertices);
+    const float *triangles;
+    int count = module_shape_polygon(vertices, num_vertices, &triangles);
+    if (count == 0) {
+        core_log(RETRO_LOG_ERROR, "draw_custom_quad needs 3 or more vertices enclosing an area, got %d", num_vertices);
         return;
     }
+    module_opengl_draw_triangles(triangles, count, x, y, rotation, r, g, b, a, vp_width, vp_height);
+}
 
-    // Log vertices
-    for (int i = 0; i < num_vertices; i++) {
-        core_log(RETRO_LOG_DEBUG, "Vertex %d: (%f, %f)", i, vertices[i * 2], vertices[i * 2 + 1]);
-    }
-
-    // Define triangles explicitly: 0-1-2 and 1-2-3
-    float triangle_vertices[] = {
-        vertices[0], vertices[1], // Vertex 0
-        vertices[2], vertices[3], // Vertex 1
-        vertices[4], vertices[5], // Vertex 2
-        vertices[2], vertices[3], // Vertex 1
-        vertices[4], vertices[5], // Vertex 2
-        vertices[6], vertices[7]  // Vertex 3
-    };
-
-    mat4 model, view, proj, mvp;
-    glm_mat4_identity(model);
-    glm_mat4_identity(view);
-    glm_mat4_identity(proj);
-    glm_translate(model, (vec3){x, y, 0.0f});
-    glm_rotate(model, glm_rad(rotation), (vec3){0.0f, 0.0f, 1.0f});
-    glm_ortho(-vp_width / 2.0f, vp_width / 2.0f, vp_height / 2.0f, -vp_height / 2.0f, -1.0f, 1.0f, proj);
-    glm_mat4_mul(proj, view, mvp);
-    glm_mat4_mul(mvp, model, mvp);
-
-    // Log transformed vertices
-    for (int i = 0; i < 6; i++) {
-        vec4 v = {triangle_vertices[i * 2], triangle_vertices[i * 2 + 1], 0.0f, 1.0f};
-        vec4 out;
-        glm_mat4_mulv(mvp, v, out);
-        core_log(RETRO_LOG_DEBUG, "Transformed vertex %d: (%f, %f, %f, %f)", i, out[0], out[1], out[2], out[3]);
-    }
 
-    glUseProgram(solid_shader_program);
-    glBindVertexArray(solid_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 6 * 2 * sizeof(float), triangle_vertices);
+void module_opengl_draw_triangles(const float *vertices, int num_vertices, float x, float y,
+                                  float rotation, float r, float g, float b, float a,
+                                  float vp_width, float vp_height) {
+   num_vertices -= num_vertices % 3;
+   if (num_vertices <= 0)
+      return;
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      // Any rotation of the vertices stays within their farthest distance from (x, y)
+      float radius2 = 0.0f;
+      for (int i = 0; i < num_vertices; i++) {
+         float d2 = vertices[i * 2] * vertices[i * 2] + vertices[i * 2 + 1] * vertices[i * 2 + 1];
+         radius2 = d2 > radius2 ? d2 : radius2;
+      }
+      float size = 2.0f * sqrtf(radius2);
+      if (cull_draw(module_opengl_rect_visible(x, y, size, size, 0.0f, vp_width, vp_height)))
+         module_cmdlist_triangles(list, vertices, num_vertices, x, y, rotation, r, g, b, a, vp_width, vp_height);
+      return;
+   }
+   if (!glIsProgram(solid_shader_program) || !glIsVertexArray(solid_vao) || !glIsBuffer(stream_vbo)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_triangles");
+      return;
+   }
 
-    GLint mvp_loc = glGetUniformLocation(solid_shader_program, "mvp");
-    glUniformMatrix4fv(mvp_loc, 1, GL_FALSE, (float *)mvp);
+   use_program(solid_shader_program);
+   glBindVertexArray(solid_vao);
+   GLint first = stream_vertices(vertices, num_vertices, SOLID_VERTEX_SIZE);
 
-    GLint color_loc = glGetUniformLocation(solid_shader_program, "color");
-    glUniform4f(color_loc, r, g, b, a);
+   set_model(solid_model_loc, x, y, rotation);
+   glUniform4f(solid_color_loc, r, g, b, a);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+   glDrawArrays(GL_TRIANGLES, first, num_vertices);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glUseProgram(0);
-    module_opengl_check_error("draw_custom_quad");
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glBindVertexArray(0);
+   module_opengl_check_error("draw_triangles");
 
-    core_log(RETRO_LOG_DEBUG, "Drew custom quad at (%f, %f), vertices=%d, rotation=%f", x, y, num_vertices, rotation);
+   core_log(RETRO_LOG_DEBUG, "Drew %d triangles at (%f, %f), rotation=%f", num_vertices / 3, x, y, rotation);
 }
 
 
@@ -535,79 +1345,127 @@ void module_opengl_draw_custom_quad(float *vertices, int num_vertices, float x,
 void module_opengl_draw_text(float x, float y, const char *text,
                              float r, float g, float b, float a,
                              float vp_width, float vp_height) {
-   if (!glIsProgram(text_shader_program) || !glIsVertexArray(text_vao) || !glIsBuffer(vbo) || !glIsTexture(font_texture)) {
-      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_text: program=%d, vao=%d, vbo=%d, texture=%d",
-               glIsProgram(text_shader_program), glIsVertexArray(text_vao), glIsBuffer(vbo), glIsTexture(font_texture));
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      // Text runs right and down from (x, y) in 8x8 cells, in screen coordinates
+      float w = 8.0f * (float)strlen(text);
+      float cx = x + w * 0.5f - vp_width * 0.5f, cy = y + 4.0f - vp_height * 0.5f;
+      if (cull_draw(module_opengl_rect_visible(cx, cy, w, 8.0f, 0.0f, vp_width, vp_height)))
+         module_cmdlist_text(list, x, y, text, r, g, b, a, vp_width, vp_height);
       return;
    }
-
-   glUseProgram(text_shader_program);
-   glBindVertexArray(text_vao);
-   glBindBuffer(GL_ARRAY_BUFFER, vbo);
-   glActiveTexture(GL_TEXTURE0);
-   glBindTexture(GL_TEXTURE_2D, font_texture);
-
-   GLint texture_loc = glGetUniformLocation(text_shader_program, "font_texture");
-   if (texture_loc == -1) {
-      core_log(RETRO_LOG_ERROR, "Invalid uniform location for font_texture");
-      return;
-   }
-   glUniform1i(texture_loc, 0);
-
-   GLint color_loc = glGetUniformLocation(text_shader_program, "color");
-   if (color_loc == -1) {
-      core_log(RETRO_LOG_ERROR, "Invalid uniform location for color");
+   if (!glIsProgram(text_shader_program) || !glIsVertexArray(text_vao) || !glIsBuffer(stream_vbo) || !glIsTexture(font_texture)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_text: program=%d, vao=%d, vbo=%d, texture=%d",
+               glIsProgram(text_shader_program), glIsVertexArray(text_vao), glIsBuffer(stream_vbo), glIsTexture(font_texture));
       return;
    }
-   glUniform4f(color_loc, r, g, b, a);
 
    float char_width = 8.0f;
    float char_height = 8.0f;
    float atlas_width = 760.0f;
-   float atlas_height = 8.0f;
 
-   for (size_t i = 0; text[i]; i++) {
+   // One quad per printable character, drawn as a single batch
+   size_t len = strlen(text);
+   if (len > INT_MAX / 24 || !reserve_text(&text_quads, &text_quad_capacity, (int)len, 8))
+      return;
+   int count = 0;
+   for (size_t i = 0; i < len; i++) {
       unsigned char c = text[i];
       if (c < 32 || c > 126) continue;
       int char_index = c - 32;
 
-      float tex_x0 = (char_index * char_width) / atlas_width;
-      float tex_x1 = ((char_index + 1) * char_width) / atlas_width;
-      float tex_y0 = 0.0f;
-      float tex_y1 = 1.0f;
-
-      float px = x + i * char_width - vp_width / 2.0f;
-      float py = y - vp_height / 2.0f;
-      float px2 = px + char_width;
-      float py2 = py + char_height;
-
-      float x0 = px / (vp_width / 2.0f);
-      float y0 = -py / (vp_height / 2.0f);
-      float x1 = px2 / (vp_width / 2.0f);
-      float y1 = -py2 / (vp_height / 2.0f);
-
-      float vertices[] = {
-         x0, y0, tex_x0, tex_y0,
-         x1, y0, tex_x1, tex_y0,
-         x0, y1, tex_x0, tex_y1,
-         x1, y1, tex_x1, tex_y1
-      };
-
-      glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      module_opengl_check_error("draw_text per character");
+      float *q = text_quads + count++ * 8;
+      q[0] = i * char_width;
+      q[1] = 0.0f;
+      q[2] = q[0] + char_width;
+      q[3] = char_height;
+      q[4] = (char_index * char_width) / atlas_width;
+      q[5] = 0.0f;
+      q[6] = ((char_index + 1) * char_width) / atlas_width;
+      q[7] = 1.0f;
    }
 
-   glBindTexture(GL_TEXTURE_2D, 0);
-   glBindBuffer(GL_ARRAY_BUFFER, 0);
-   glBindVertexArray(0);
-   glUseProgram(0);
+   // Top-left origin to the centred coordinates the view maps
+   if (count > 0)
+      draw_text_quads(font_texture, text_quads, count, x - vp_width / 2.0f, y - vp_height / 2.0f, r, g, b, a);
    module_opengl_check_error("draw_text");
 
    core_log(RETRO_LOG_DEBUG, "Drew text '%s' at (%f, %f)", text, x, y);
 }
 
+bool module_opengl_upload_glyph(int x, int y, int w, int h, const unsigned char *pixels) {
+   cmdlist *list = module_cmdlist_recording();
+   if (list)
+      return module_cmdlist_upload_glyph(list, x, y, w, h, pixels);
+   if (!glIsTexture(glyph_atlas)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in upload_glyph: no glyph atlas");
+      return false;
+   }
+
+   bind_texture(glyph_atlas);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RED, GL_UNSIGNED_BYTE, pixels);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+   module_opengl_check_error("upload_glyph");
+   return true;
+}
+
+void module_opengl_draw_glyphs(const float *quads, int count, float x, float y,
+                               float r, float g, float b, float a,
+                               float vp_width, float vp_height) {
+   if (count <= 0)
+      return;
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+      for (int i = 0; i < count; i++) {
+         const float *q = quads + i * 8;
+         min_x = fminf(min_x, q[0]);
+         min_y = fminf(min_y, q[1]);
+         max_x = fmaxf(max_x, q[2]);
+         max_y = fmaxf(max_y, q[3]);
+      }
+      float cx = x + (min_x + max_x) * 0.5f - vp_width * 0.5f;
+      float cy = y + (min_y + max_y) * 0.5f - vp_height * 0.5f;
+      if (cull_draw(module_opengl_rect_visible(cx, cy, max_x - min_x, max_y - min_y, 0.0f, vp_width, vp_height)))
+         module_cmdlist_glyphs(list, quads, count, x, y, r, g, b, a, vp_width, vp_height);
+      return;
+   }
+   if (!glIsProgram(text_shader_program) || !glIsVertexArray(text_vao) || !glIsBuffer(stream_vbo) || !glIsTexture(glyph_atlas)) {
+      core_log(RETRO_LOG_ERROR, "Invalid GL state in draw_glyphs");
+      return;
+   }
+
+   draw_text_quads(glyph_atlas, quads, count, x - vp_width / 2.0f, y - vp_height / 2.0f, r, g, b, a);
+   module_opengl_check_error("draw_glyphs");
+
+   core_log(RETRO_LOG_DEBUG, "Drew %d glyphs at (%f, %f)", count, x, y);
+}
+
+void module_opengl_set_output_size(int width, int height) {
+   output_width = width;
+   output_height = height;
+   if (!render_fbo) {
+      render_width = width;
+      render_height = height;
+   }
+}
+
+void module_opengl_set_render_target(GLuint fbo, int width, int height) {
+   render_fbo = fbo;
+   render_width = fbo ? width : output_width;
+   render_height = fbo ? height : output_height;
+}
+
 bool module_opengl_bind_framebuffer(void) {
+   if (render_fbo) {
+      glBindFramebuffer(GL_FRAMEBUFFER, render_fbo);
+      return true;
+   }
+   return module_opengl_bind_output_framebuffer();
+}
+
+bool module_opengl_bind_output_framebuffer(void) {
    GLuint fbo = 0;
    if (use_default_fbo || !get_current_framebuffer) {
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -636,12 +1494,14 @@ bool module_opengl_bind_framebuffer(void) {
 }
 
 void module_opengl_set_viewport(void) {
-   glViewport(0, 0, HW_WIDTH, HW_HEIGHT);
-  //  core_log(RETRO_LOG_INFO, "Set viewport to %dx%d", HW_WIDTH, HW_HEIGHT);
+   glViewport(0, 0, render_width, render_height);
+  //  core_log(RETRO_LOG_INFO, "Set viewport to %dx%d", render_width, render_height);
    module_opengl_check_error("glViewport");
 }
 
 void module_opengl_clear(void) {
+   bound_program = bound_texture = BOUND_UNKNOWN;
+   queue_depth_base = 0;
    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
    module_opengl_check_error("glClear");
@@ -650,8 +1510,17 @@ void module_opengl_clear(void) {
 
 
 void module_opengl_free_texture(GLuint texture_id) {
+   // Keep the delete ordered after the recorded draws that may still use it
+   cmdlist *list = module_cmdlist_recording();
+   if (list) {
+      module_cmdlist_free_texture(list, texture_id);
+      return;
+   }
    if (glIsTexture(texture_id)) {
       glDeleteTextures(1, &texture_id);
+      set_texture_opaque(texture_id, false);
+      if (texture_id == bound_texture)
+         bound_texture = BOUND_UNKNOWN;
       core_log(RETRO_LOG_INFO, "Freed texture %u", texture_id);
    } else {
       core_log(RETRO_LOG_WARN, "Attempted to free invalid texture %u", texture_id);
@@ -664,6 +1533,8 @@ void module_opengl_free_texture(GLuint texture_id) {
 void module_opengl_check_error(const char *context) {
    GLenum err;
    bool has_error = false;
+   if (module_cmdlist_recording())
+      return; // nothing was issued yet; errors surface when the list is replayed
    while ((err = glGetError()) != GL_NO_ERROR) {
       has_error = true;
       core_log(RETRO_LOG_ERROR, "OpenGL error in %s: %d", context, err);
@@ -674,4 +1545,158 @@ void module_opengl_check_error(const char *context) {
 
 bool module_opengl_is_initialized(void) {
    return gl_initialized;
-}
\ No newline at end of file
+}
+
+// ---------------------------------------------------------------------------
+// Render queue. Draws replayed from a command list are queued with a 64-bit
+// sort key and issued when the queue is flushed: at the end of the list and
+// before commands that change what later draws see (render target switches,
+// mesh uploads). Keys, most significant bits first:
+//
+//   63..56  layer, biased by 128
+//   55      set for translucent draws
+//   54..52  program  (opaque draws only)
+//   51..28  texture  (opaque draws only)
+//   27..0   submission order
+//
+// so each layer issues its opaque draws grouped by program and texture, then
+// its translucent draws in submission order. Opaque draws may be reordered
+// because each is drawn at a depth that follows its (layer, submission)
+// position with depth testing on; translucent draws test against that depth
+// without writing it, so back-to-front blending is unchanged. Render targets
+// have no depth buffer, so inside them only the layer order applies.
+#define QUEUE_ORDER_BITS 28
+#define QUEUE_TEXTURE_BITS 24
+#define QUEUE_DEPTH_STEP (1.0 / (1 << 22))  // depth buffers hold at least 24 bits
+
+static bool grow_queue(void) {
+   int capacity = queue_capacity ? queue_capacity * 2 : 1024;
+   uint64_t *keys = (uint64_t *)realloc(queue_keys, (size_t)capacity * sizeof(uint64_t));
+   if (keys)
+      queue_keys = keys;
+   uint64_t *keys_tmp = (uint64_t *)realloc(queue_keys_tmp, (size_t)capacity * sizeof(uint64_t));
+   if (keys_tmp)
+      queue_keys_tmp = keys_tmp;
+   uint32_t *index = (uint32_t *)realloc(queue_index, (size_t)capacity * sizeof(uint32_t));
+   if (index)
+      queue_index = index;
+   uint32_t *index_tmp = (uint32_t *)realloc(queue_index_tmp, (size_t)capacity * sizeof(uint32_t));
+   if (index_tmp)
+      queue_index_tmp = index_tmp;
+   queued_draw *draws = (queued_draw *)realloc(queue_draws, (size_t)capacity * sizeof(queued_draw));
+   if (draws)
+      queue_draws = draws;
+   if (!keys || !keys_tmp || !index || !index_tmp || !draws)
+      return false;
+   queue_capacity = capacity;
+   return true;
+}
+
+bool module_opengl_queue_draw(int layer, draw_program program, GLuint texture, float alpha, const void *draw) {
+   if (queue_count == queue_capacity && !grow_queue())
+      return false;
+   if (queue_count == (1 << QUEUE_ORDER_BITS))
+      return false;
+   bool opaque = alpha >= 1.0f && !target_active &&
+                 (program == DRAW_PROGRAM_SOLID || (program == DRAW_PROGRAM_TEXTURE && texture_is_opaque(texture)));
+   uint64_t key = (uint64_t)(uint8_t)(layer + 128) << 56 | (uint64_t)queue_count;
+   if (opaque)
+      key |= (uint64_t)program << 52 | (uint64_t)(texture & ((1u << QUEUE_TEXTURE_BITS) - 1)) << QUEUE_ORDER_BITS;
+   else
+      key |= 1ull << 55;
+   queue_keys[queue_count] = key;
+   queue_index[queue_count] = (uint32_t)queue_count;
+   queue_draws[queue_count].draw = draw;
+   queue_count++;
+   return true;
+}
+
+// LSD radix sort of the keys (and their draw indices), one byte per pass;
+// passes where every key has the same byte are skipped
+static void sort_queue(void) {
+   uint64_t *keys = queue_keys, *keys_out = queue_keys_tmp;
+   uint32_t *index = queue_index, *index_out = queue_index_tmp;
+   for (int shift = 0; shift < 64; shift += 8) {
+      int counts[256] = {0};
+      for (int i = 0; i < queue_count; i++)
+         counts[(keys[i] >> shift) & 0xff]++;
+      if (counts[(keys[0] >> shift) & 0xff] == queue_count)
+         continue;
+      int offset = 0;
+      for (int b = 0; b < 256; b++) {
+         int c = counts[b];
+         counts[b] = offset;
+         offset += c;
+      }
+      for (int i = 0; i < queue_count; i++) {
+         int dst = counts[(keys[i] >> shift) & 0xff]++;
+         keys_out[dst] = keys[i];
+         index_out[dst] = index[i];
+      }
+      uint64_t *kt = keys; keys = keys_out; keys_out = kt;
+      uint32_t *it = index; index = index_out; index_out = it;
+   }
+   queue_keys = keys;
+   queue_keys_tmp = keys_out;
+   queue_index = index;
+   queue_index_tmp = index_out;
+}
+
+// Rank every draw by (layer, submission order): a counting pass over layers
+static void rank_queue(void) {
+   uint32_t base[256] = {0};
+   for (int i = 0; i < queue_count; i++)
+      base[queue_keys[i] >> 56]++;
+   uint32_t offset = 0;
+   for (int l = 0; l < 256; l++) {
+      uint32_t c = base[l];
+      base[l] = offset;
+      offset += c;
+   }
+   for (int i = 0; i < queue_count; i++)
+      queue_draws[i].rank = base[queue_keys[i] >> 56]++;
+}
+
+void module_opengl_flush_queue(void (*issue)(const void *draw)) {
+   if (queue_count == 0)
+      return;
+   // Keys still in submission order here
+   bool depth = !target_active;
+   if (depth)
+      rank_queue();
+   sort_queue();
+
+   bound_program = bound_texture = BOUND_UNKNOWN;
+   if (depth) {
+      glEnable(GL_DEPTH_TEST);
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_FALSE);
+   }
+   bool opaque_state = false;
+   for (int i = 0; i < queue_count; i++) {
+      const queued_draw *q = &queue_draws[queue_index[i]];
+      if (depth) {
+         bool opaque = !(queue_keys[i] & (1ull << 55));
+         if (opaque != opaque_state) {
+            glDepthMask(opaque ? GL_TRUE : GL_FALSE);
+            if (opaque)
+               glDisable(GL_BLEND);
+            else
+               glEnable(GL_BLEND);
+            opaque_state = opaque;
+         }
+         double d = 1.0 - (double)(queue_depth_base + q->rank + 1) * QUEUE_DEPTH_STEP;
+         glDepthRange(d, d);
+      }
+      issue(q->draw);
+   }
+   if (depth) {
+      glDepthRange(0.0, 1.0);
+      glDepthMask(GL_TRUE);
+      glEnable(GL_BLEND);
+      glDisable(GL_DEPTH_TEST);
+      queue_depth_base += (uint32_t)queue_count;
+   }
+   queue_count = 0;
+   module_opengl_check_error("flush_queue");
+}
@@ -0,0 +1,532 @@
+// module_particles.c
+// Native particle emitters. Particles are stored structure-of-arrays per
+// emitter; integration and colour/size-over-life run as SIMD kernels (AVX or
+// SSE2 when the compiler targets them, scalar otherwise). Each emitter is drawn
+// with one instanced sprite draw straight from its arrays.
+#include "module_particles.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PARTICLE_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_LANES 4
+#else
+#define PARTICLE_LANES 1
+#endif
+
+#define PARTICLES_DEFAULT_MAX 4096
+#define PARTICLES_PI 3.14159265358979f
+
+typedef struct {
+   particle_emitter_config config;
+   float x, y;
+   bool visible;
+   float spawn_accum;  // fractional particles carried between frames
+   uint32_t rng;
+
+   int count;
+   int capacity;
+   float *px, *py;
+   float *vx, *vy;
+   float *age;
+   float *inv_life;
+   float *size;        // filled by the appearance kernel before drawing
+   uint32_t *color;
+} particle_emitter;
+
+#define PARTICLE_ARRAYS(X) X(px) X(py) X(vx) X(vy) X(age) X(inv_life) X(size) X(color)
+
+static particle_emitter **emitters = NULL;
+static int emitter_capacity = 0;
+
+static particle_emitter *get_emitter(int id) {
+   return id >= 0 && id < emitter_capacity ? emitters[id] : NULL;
+}
+
+static bool emitter_grow(particle_emitter *e, int capacity) {
+   if (capacity > e->config.max_particles)
+      capacity = e->config.max_particles;
+   if (capacity <= e->capacity)
+      return capacity > e->count;
+#define GROW_ARRAY(field) { \
+      void *p = realloc(e->field, (size_t)capacity * sizeof(*e->field)); \
+      if (!p) return false; \
+      e->field = p; \
+   }
+   PARTICLE_ARRAYS(GROW_ARRAY)
+#undef GROW_ARRAY
+   e->capacity = capacity;
+   return true;
+}
+
+static void emitter_free(particle_emitter *e) {
+#define FREE_ARRAY(field) free(e->field);
+   PARTICLE_ARRAYS(FREE_ARRAY)
+#undef FREE_ARRAY
+   free(e);
+}
+
+static inline float next_random(uint32_t *state) {
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   *state = x;
+   return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float random_range(uint32_t *state, const float range[2]) {
+   return range[0] + (range[1] - range[0]) * next_random(state);
+}
+
+// ---------------------------------------------------------------------------
+// Kernels
+
+// Velocity, position and age; n need not be a multiple of the lane count
+static void kernel_integrate(particle_emitter *e, float dt) {
+   const float gx = e->config.gravity[0] * dt, gy = e->config.gravity[1] * dt;
+   const float damp = fmaxf(0.0f, 1.0f - e->config.drag * dt);
+   float *px = e->px, *py = e->py, *vx = e->vx, *vy = e->vy, *age = e->age;
+   int n = e->count, i = 0;
+
+#if PARTICLE_LANES == 8
+   const __m256 v_gx = _mm256_set1_ps(gx), v_gy = _mm256_set1_ps(gy);
+   const __m256 v_damp = _mm256_set1_ps(damp), v_dt = _mm256_set1_ps(dt);
+   for (; i + 8 <= n; i += 8) {
+      __m256 nvx = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(vx + i), v_gx), v_damp);
+      __m256 nvy = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(vy + i), v_gy), v_damp);
+      _mm256_storeu_ps(vx + i, nvx);
+      _mm256_storeu_ps(vy + i, nvy);
+      _mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(nvx, v_dt)));
+      _mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(nvy, v_dt)));
+      _mm256_storeu_ps(age + i, _mm256_add_ps(_mm256_loadu_ps(age + i), v_dt));
+   }
+#elif PARTICLE_LANES == 4
+   const __m128 v_gx = _mm_set1_ps(gx), v_gy = _mm_set1_ps(gy);
+   const __m128 v_damp = _mm_set1_ps(damp), v_dt = _mm_set1_ps(dt);
+   for (; i + 4 <= n; i += 4) {
+      __m128 nvx = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vx + i), v_gx), v_damp);
+      __m128 nvy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vy + i), v_gy), v_damp);
+      _mm_storeu_ps(vx + i, nvx);
+      _mm_storeu_ps(vy + i, nvy);
+      _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(nvx, v_dt)));
+      _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(nvy, v_dt)));
+      _mm_storeu_ps(age + i, _mm_add_ps(_mm_loadu_ps(age + i), v_dt));
+   }
+#endif
+   for (; i < n; i++) {
+      vx[i] = (vx[i] + gx) * damp;
+      vy[i] = (vy[i] + gy) * damp;
+      px[i] += vx[i] * dt;
+      py[i] += vy[i] * dt;
+      age[i] += dt;
+   }
+}
+
+#if PARTICLE_LANES > 1
+// Pack four lanes of 0..255 channel values into RGBA8 (little-endian byte order)
+static inline __m128i pack_rgba(__m128i r, __m128i g, __m128i b, __m128i a) {
+   return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                       _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+}
+#endif
+
+// Size and colour interpolated over normalized age
+static void kernel_appearance(particle_emitter *e) {
+   const particle_emitter_config *c = &e->config;
+   const float s0 = c->size[0], ds = c->size[1] - c->size[0];
+   float c0[4], dc[4];
+   for (int k = 0; k < 4; k++) {
+      c0[k] = c->color_start[k] * 255.0f;
+      dc[k] = (c->color_end[k] - c->color_start[k]) * 255.0f;
+   }
+   const float *age = e->age, *inv_life = e->inv_life;
+   float *size = e->size;
+   uint32_t *color = e->color;
+   int n = e->count, i = 0;
+
+#if PARTICLE_LANES == 8
+   const __m256 one = _mm256_set1_ps(1.0f);
+   const __m256 v_s0 = _mm256_set1_ps(s0), v_ds = _mm256_set1_ps(ds);
+   __m256 v_c0[4], v_dc[4];
+   for (int k = 0; k < 4; k++) {
+      v_c0[k] = _mm256_set1_ps(c0[k]);
+      v_dc[k] = _mm256_set1_ps(dc[k]);
+   }
+   for (; i + 8 <= n; i += 8) {
+      __m256 t = _mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(age + i), _mm256_loadu_ps(inv_life + i)), one);
+      __m256i ch[4];
+      _mm256_storeu_ps(size + i, _mm256_add_ps(v_s0, _mm256_mul_ps(v_ds, t)));
+      for (int k = 0; k < 4; k++)
+         ch[k] = _mm256_cvtps_epi32(_mm256_add_ps(v_c0[k], _mm256_mul_ps(v_dc[k], t)));
+      // AVX has no 256-bit integer shifts; pack each half with SSE2
+      _mm_storeu_si128((__m128i *)(color + i),
+                       pack_rgba(_mm256_castsi256_si128(ch[0]), _mm256_castsi256_si128(ch[1]),
+                                 _mm256_castsi256_si128(ch[2]), _mm256_castsi256_si128(ch[3])));
+      _mm_storeu_si128((__m128i *)(color + i + 4),
+                       pack_rgba(_mm256_extractf128_si256(ch[0], 1), _mm256_extractf128_si256(ch[1], 1),
+                                 _mm256_extractf128_si256(ch[2], 1), _mm256_extractf128_si256(ch[3], 1)));
+   }
+#elif PARTICLE_LANES == 4
+   const __m128 one = _mm_set1_ps(1.0f);
+   const __m128 v_s0 = _mm_set1_ps(s0), v_ds = _mm_set1_ps(ds);
+   __m128 v_c0[4], v_dc[4];
+   for (int k = 0; k < 4; k++) {
+      v_c0[k] = _mm_set1_ps(c0[k]);
+      v_dc[k] = _mm_set1_ps(dc[k]);
+   }
+   for (; i + 4 <= n; i += 4) {
+      __m128 t = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(age + i), _mm_loadu_ps(inv_life + i)), one);
+      __m128i ch[4];
+      _mm_storeu_ps(size + i, _mm_add_ps(v_s0, _mm_mul_ps(v_ds, t)));
+      for (int k = 0; k < 4; k++)
+         ch[k] = _mm_cvtps_epi32(_mm_add_ps(v_c0[k], _mm_mul_ps(v_dc[k], t)));
+      _mm_storeu_si128((__m128i *)(color + i), pack_rgba(ch[0], ch[1], ch[2], ch[3]));
+   }
+#endif
+   for (; i < n; i++) {
+      float t = fminf(age[i] * inv_life[i], 1.0f);
+      uint32_t packed = 0;
+      size[i] = s0 + ds * t;
+      for (int k = 0; k < 4; k++)
+         packed |= (uint32_t)lrintf(c0[k] + dc[k] * t) << (8 * k);
+      color[i] = packed;
+   }
+}
+
+// Swap-remove particles past their lifetime
+static void retire_dead(particle_emitter *e) {
+   int i = 0;
+   while (i < e->count) {
+      if (e->age[i] * e->inv_life[i] < 1.0f) {
+         i++;
+         continue;
+      }
+      int last = --e->count;
+      e->px[i] = e->px[last];
+      e->py[i] = e->py[last];
+      e->vx[i] = e->vx[last];
+      e->vy[i] = e->vy[last];
+      e->age[i] = e->age[last];
+      e->inv_life[i] = e->inv_life[last];
+   }
+}
+
+static int spawn(particle_emitter *e, int count) {
+   const particle_emitter_config *c = &e->config;
+   // Never ask for more than the emitter may hold, so the sums below stay
+   // in range whatever count a script passes
+   if (count > e->config.max_particles - e->count)
+      count = e->config.max_particles - e->count;
+   if (count <= 0)
+      return 0;
+   if (e->count + count > e->capacity) {
+      int needed = e->count + count;
+      int capacity = e->capacity ? e->capacity : 256;
+      while (capacity < needed)
+         capacity = capacity > INT_MAX / 2 ? needed : capacity * 2;
+      if (!emitter_grow(e, capacity))
+         return 0;
+   }
+   if (count > e->capacity - e->count)
+      count = e->capacity - e->count;
+
+   for (int k = 0; k < count; k++) {
+      int i = e->count + k;
+      float angle = random_range(&e->rng, c->angle) * (PARTICLES_PI / 180.0f);
+      float speed = random_range(&e->rng, c->speed);
+      float life = fmaxf(random_range(&e->rng, c->life), 0.001f);
+      float r = c->radius * sqrtf(next_random(&e->rng));
+      float theta = 2.0f * PARTICLES_PI * next_random(&e->rng);
+      e->px[i] = e->x + r * cosf(theta);
+      e->py[i] = e->y + r * sinf(theta);
+      e->vx[i] = speed * cosf(angle);
+      e->vy[i] = speed * sinf(angle);
+      e->age[i] = 0.0f;
+      e->inv_life[i] = 1.0f / life;
+   }
+   e->count += count;
+   return count;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+void module_particles_default_config(particle_emitter_config *config) {
+   memset(config, 0, sizeof(*config));
+   config->max_particles = PARTICLES_DEFAULT_MAX;
+   config->life[0] = config->life[1] = 1.0f;
+   config->speed[0] = config->speed[1] = 100.0f;
+   config->angle[1] = 360.0f;
+   config->size[0] = config->size[1] = 4.0f;
+   for (int k = 0; k < 4; k++)
+      config->color_start[k] = config->color_end[k] = 1.0f;
+   config->color_end[3] = 0.0f;
+}
+
+int module_particles_create(const particle_emitter_config *config, float x, float y) {
+   int id = 0;
+   while (id < emitter_capacity && emitters[id])
+      id++;
+   if (id == emitter_capacity) {
+      int capacity = emitter_capacity ? emitter_capacity * 2 : 16;
+      particle_emitter **p = (particle_emitter **)realloc(emitters, (size_t)capacity * sizeof(*emitters));
+      if (!p) {
+         core_log(RETRO_LOG_ERROR, "Particles: failed to grow emitter table");
+         return -1;
+      }
+      memset(p + emitter_capacity, 0, (size_t)(capacity - emitter_capacity) * sizeof(*p));
+      emitters = p;
+      emitter_capacity = capacity;
+   }
+
+   particle_emitter *e = (particle_emitter *)calloc(1, sizeof(particle_emitter));
+   if (!e) {
+      core_log(RETRO_LOG_ERROR, "Particles: failed to allocate emitter");
+      return -1;
+   }
+   e->config = *config;
+   if (e->config.max_particles <= 0)
+      e->config.max_particles = PARTICLES_DEFAULT_MAX;
+   for (int k = 0; k < 4; k++) {
+      e->config.color_start[k] = fminf(fmaxf(e->config.color_start[k], 0.0f), 1.0f);
+      e->config.color_end[k] = fminf(fmaxf(e->config.color_end[k], 0.0f), 1.0f);
+   }
+   e->x = x;
+   e->y = y;
+   e->visible = true;
+   e->rng = 0x9E3779B9u ^ (uint32_t)(id * 7919 + 1); // deterministic for replays
+   emitters[id] = e;
+   return id;
+}
+
+void module_particles_destroy(int id) {
+   particle_emitter *e = get_emitter(id);
+   if (!e)
+      return;
+   emitter_free(e);
+   emitters[id] = NULL;
+}
+
+void module_particles_clear(void) {
+   for (int id = 0; id < emitter_capacity; id++)
+      module_particles_destroy(id);
+}
+
+void module_particles_deinit(void) {
+   module_particles_clear();
+   free(emitters);
+   emitters = NULL;
+   emitter_capacity = 0;
+}
+
+void module_particles_set_position(int id, float x, float y) {
+   particle_emitter *e = get_emitter(id);
+   if (e) {
+      e->x = x;
+      e->y = y;
+   }
+}
+
+void module_particles_set_rate(int id, float rate) {
+   particle_emitter *e = get_emitter(id);
+   if (e)
+      e->config.rate = rate > 0.0f ? rate : 0.0f;
+}
+
+void module_particles_set_visible(int id, bool visible) {
+   particle_emitter *e = get_emitter(id);
+   if (e)
+      e->visible = visible;
+}
+
+int module_particles_burst(int id, int count) {
+   particle_emitter *e = get_emitter(id);
+   return e ? spawn(e, count) : 0;
+}
+
+int module_particles_count(int id) {
+   if (id >= 0) {
+      particle_emitter *e = get_emitter(id);
+      return e ? e->count : 0;
+   }
+   int total = 0;
+   for (int i = 0; i < emitter_capacity; i++)
+      total += emitters[i] ? emitters[i]->count : 0;
+   return total;
+}
+
+void module_particles_update(float dt) {
+   for (int id = 0; id < emitter_capacity; id++) {
+      particle_emitter *e = emitters[id];
+      if (!e)
+         continue;
+      kernel_integrate(e, dt);
+      retire_dead(e);
+      if (e->config.rate > 0.0f) {
+         e->spawn_accum += e->config.rate * dt;
+         int n = (int)e->spawn_accum;
+         e->spawn_accum -= (float)n;
+         spawn(e, n);
+      }
+   }
+}
+
+void module_particles_render(float vp_width, float vp_height) {
+   for (int id = 0; id < emitter_capacity; id++) {
+      particle_emitter *e = emitters[id];
+      if (!e || !e->visible || e->count == 0)
+         continue;
+      kernel_appearance(e);
+      module_opengl_draw_texture_instanced(e->config.texture, e->count, e->px, e->py, e->size, e->color,
+                                           e->config.additive, vp_width, vp_height);
+   }
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings
+
+static int check_emitter(lua_State *L, int arg) {
+   lua_Integer id = luaL_checkinteger(L, arg);
+   luaL_argcheck(L, get_emitter((int)id) != NULL && id == (int)id, arg, "invalid emitter id");
+   return (int)id;
+}
+
+// Read field `key` as a number or a {min, max} / {x, y} pair
+static void read_pair(lua_State *L, int table, const char *key, float out[2]) {
+   int type = lua_getfield(L, table, key);
+   if (type == LUA_TNUMBER) {
+      out[0] = out[1] = (float)lua_tonumber(L, -1);
+   } else if (type == LUA_TTABLE) {
+      lua_rawgeti(L, -1, 1);
+      lua_rawgeti(L, -2, 2);
+      out[0] = (float)luaL_optnumber(L, -2, out[0]);
+      out[1] = (float)luaL_optnumber(L, -1, out[0]);
+      lua_pop(L, 2);
+   } else if (type != LUA_TNIL) {
+      luaL_error(L, "particle field '%s' must be a number or a table", key);
+   }
+   lua_pop(L, 1);
+}
+
+static void read_color(lua_State *L, int table, const char *key, float out[4]) {
+   if (lua_getfield(L, table, key) == LUA_TTABLE) {
+      for (int k = 0; k < 4; k++) {
+         lua_rawgeti(L, -1, k + 1);
+         out[k] = (float)luaL_optnumber(L, -1, out[k]);
+         lua_pop(L, 1);
+      }
+   }
+   lua_pop(L, 1);
+}
+
+static float read_number(lua_State *L, int table, const char *key, float def) {
+   lua_getfield(L, table, key);
+   float v = (float)luaL_optnumber(L, -1, def);
+   lua_pop(L, 1);
+   return v;
+}
+
+// particles.emitter({max, texture, blend, rate, life, speed, angle, radius,
+//                    gravity, drag, size, color_start, color_end} [, x, y])
+static int lua_particles_emitter(lua_State *L) {
+   particle_emitter_config config;
+   module_particles_default_config(&config);
+   luaL_checktype(L, 1, LUA_TTABLE);
+
+   config.max_particles = (int)read_number(L, 1, "max", (float)config.max_particles);
+   config.texture = (unsigned int)read_number(L, 1, "texture", 0.0f);
+   lua_getfield(L, 1, "blend");
+   config.additive = lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), "add") == 0;
+   lua_pop(L, 1);
+   config.rate = read_number(L, 1, "rate", config.rate);
+   config.radius = read_number(L, 1, "radius", config.radius);
+   config.drag = read_number(L, 1, "drag", config.drag);
+   read_pair(L, 1, "life", config.life);
+   read_pair(L, 1, "speed", config.speed);
+   read_pair(L, 1, "angle", config.angle);
+   read_pair(L, 1, "gravity", config.gravity);
+   read_pair(L, 1, "size", config.size);
+   read_color(L, 1, "color_start", config.color_start);
+   read_color(L, 1, "color_end", config.color_end);
+
+   int id = module_particles_create(&config, (float)luaL_optnumber(L, 2, 0.0), (float)luaL_optnumber(L, 3, 0.0));
+   if (id < 0)
+      lua_pushnil(L);
+   else
+      lua_pushinteger(L, id);
+   return 1;
+}
+
+// particles.burst(id, count [, x, y])
+static int lua_particles_burst(lua_State *L) {
+   int id = check_emitter(L, 1);
+   int count = (int)luaL_checkinteger(L, 2);
+   particle_emitter *e = get_emitter(id);
+   float x = e->x, y = e->y;
+   if (!lua_isnoneornil(L, 3)) {
+      e->x = (float)luaL_checknumber(L, 3);
+      e->y = (float)luaL_checknumber(L, 4);
+   }
+   lua_pushinteger(L, module_particles_burst(id, count));
+   e->x = x;
+   e->y = y;
+   return 1;
+}
+
+static int lua_particles_set_position(lua_State *L) {
+   module_particles_set_position(check_emitter(L, 1), (float)luaL_checknumber(L, 2), (float)luaL_checknumber(L, 3));
+   return 0;
+}
+
+static int lua_particles_set_rate(lua_State *L) {
+   module_particles_set_rate(check_emitter(L, 1), (float)luaL_checknumber(L, 2));
+   return 0;
+}
+
+static int lua_particles_set_visible(lua_State *L) {
+   module_particles_set_visible(check_emitter(L, 1), lua_toboolean(L, 2));
+   return 0;
+}
+
+// particles.count([id]) -- live particles of one emitter or of all
+static int lua_particles_count(lua_State *L) {
+   lua_pushinteger(L, module_particles_count(lua_isnoneornil(L, 1) ? -1 : check_emitter(L, 1)));
+   return 1;
+}
+
+static int lua_particles_destroy(lua_State *L) {
+   module_particles_destroy(check_emitter(L, 1));
+   return 0;
+}
+
+static int lua_particles_clear(lua_State *L) {
+   (void)L;
+   module_particles_clear();
+   return 0;
+}
+
+static const luaL_Reg particles_funcs[] = {
+   {"emitter", lua_particles_emitter},
+   {"burst", lua_particles_burst},
+   {"set_position", lua_particles_set_position},
+   {"set_rate", lua_particles_set_rate},
+   {"set_visible", lua_particles_set_visible},
+   {"count", lua_particles_count},
+   {"destroy", lua_particles_destroy},
+   {"clear", lua_particles_clear},
+   {NULL, NULL}
+};
+
+void module_particles_register(lua_State *L) {
+   luaL_newlib(L, particles_funcs);
+   lua_setglobal(L, "particles");
+}
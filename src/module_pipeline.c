@@ -0,0 +1,402 @@
+// module_pipeline.c
+// Frame execution. Every frame's particles, Lua update and scene draws are
+// recorded into a command list and then replayed into GL. In direct mode both
+// happen back to back on the frontend thread. In pipelined mode a dedicated
+// update thread records frame N+1 into one list while the frontend thread
+// replays frame N from the other, so a frame costs roughly max(update, GL)
+// instead of their sum:
+//
+//   frontend:  sync N | latch input | start N+1 | replay N | present
+//   update:            ... N ...    |        update N+1 ...
+//
+// Work that needs the GL context during an update (texture uploads) is handed
+// to the frontend thread, which services it while it waits in sync.
+//
+// Lua garbage collection runs on whichever thread owns the state, after the
+// frame's work, in the time left of the frame period.
+//
+// When the frontend can dupe frames, a recorded frame whose bytes match the
+// last frame drawn (or that the script marked with present(false)) is not
+// replayed at all and the frontend repeats what it already shows.
+#include "module_pipeline.h"
+#include "module_camera.h"
+#include "module_cmdlist.h"
+#include "module_font.h"
+#include "module_layer.h"
+#include "module_lua.h"
+#include "module_memory.h"
+#include "module_opengl.h"
+#include "module_particles.h"
+#include "module_resolution.h"
+#include "module_scene.h"
+#include "module_tilemap.h"
+#include "core_thread.h"
+#include "core_time.h"
+#include "libretro_core.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PIPELINE_STATS_FRAMES 600  // frames between timing reports
+#define PIPELINE_FRAME_NS 16666667ull  // 60 fps
+
+static struct {
+   bool enabled;
+   cmdlist *lists[2];
+   cmdlist *ready;          // recorded, waiting to be replayed
+
+   core_thread thread;
+   bool in_flight;          // an update was started and not synced yet
+   core_mutex lock;
+   core_cond cond;
+
+   // Guarded by lock
+   bool quit;
+   bool update_requested;
+   bool update_done;
+   cmdlist *update_list;
+   float update_time, vp_width, vp_height;
+   void (*gl_fn)(void *);
+   void *gl_data;
+   bool gl_done;
+   uint64_t last_update_ns;
+
+   uint64_t gc_budget_ns;
+
+   // Copy of the last list drawn into the frontend framebuffer
+   unsigned char *shown;
+   size_t shown_size, shown_capacity;
+   bool shown_valid;
+
+   // Timing, reported every PIPELINE_STATS_FRAMES frames
+   uint64_t update_ns, replay_ns, wait_ns;
+   int stats_frames, dupes;
+} pipeline = {.gc_budget_ns = 2000000};
+
+static CORE_THREAD_LOCAL bool is_update_thread = false;
+
+// Record everything a frame draws into list (direct GL if list is NULL);
+// returns the time taken
+static uint64_t run_update(cmdlist *list, float animation_time, float vp_width, float vp_height) {
+   uint64_t start = core_time_ns();
+   module_opengl_end_cull_frame();
+   if (list) {
+      module_cmdlist_reset(list);
+      module_cmdlist_begin(list);
+   }
+   module_camera_begin_frame();
+   module_font_begin_frame();
+   module_layer_begin_frame();
+
+   // Release tilemaps collected last frame after the draws that used them
+   module_tilemap_flush();
+
+   // Advance particles before the script so bursts it spawns are drawn at age 0
+   module_particles_update(0.016f);
+   module_lua_update(animation_time);
+   module_layer_end_frame();
+
+   // Draw the retained scene and particles on top of the immediate-mode draws
+   // of layer 0
+   if (list)
+      module_cmdlist_set_layer(list, 0);
+   module_scene_render(vp_width, vp_height);
+   module_opengl_check_error("scene_render");
+   module_particles_render(vp_width, vp_height);
+   module_opengl_check_error("particles_render");
+
+   if (list)
+      module_cmdlist_end();
+   return core_time_ns() - start;
+}
+
+// Spend what is left of the frame (up to the budget) on GC, then close the
+// state's frame statistics
+static void finish_lua_frame(uint64_t frame_start_ns) {
+   lua_State *L = module_lua_get_state();
+   if (!L)
+      return;
+   uint64_t elapsed = core_time_ns() - frame_start_ns;
+   uint64_t left = elapsed < PIPELINE_FRAME_NS ? PIPELINE_FRAME_NS - elapsed : 0;
+   module_memory_collect(L, left < pipeline.gc_budget_ns ? left : pipeline.gc_budget_ns);
+   module_memory_end_frame(L);
+}
+
+static CORE_THREAD_FUNC(update_thread_main) {
+   (void)arg;
+   is_update_thread = true;
+   core_mutex_lock(&pipeline.lock);
+   for (;;) {
+      while (!pipeline.update_requested && !pipeline.quit)
+         core_cond_wait(&pipeline.cond, &pipeline.lock);
+      if (pipeline.quit)
+         break;
+      pipeline.update_requested = false;
+      cmdlist *list = pipeline.update_list;
+      float t = pipeline.update_time, w = pipeline.vp_width, h = pipeline.vp_height;
+      core_mutex_unlock(&pipeline.lock);
+
+      uint64_t start = core_time_ns();
+      uint64_t elapsed = run_update(list, t, w, h);
+      finish_lua_frame(start);
+
+      core_mutex_lock(&pipeline.lock);
+      pipeline.last_update_ns = elapsed;
+      pipeline.update_done = true;
+      core_cond_broadcast(&pipeline.cond);
+   }
+   core_mutex_unlock(&pipeline.lock);
+   module_memory_thread_exit();
+   return CORE_THREAD_RETURN;
+}
+
+// Forget the recorded frame without showing it. Its uploads and frees still
+// reach GL, since later frames draw with what it uploaded and never free
+// what it released; with the context gone they died with it.
+static void drop_ready(void) {
+   if (pipeline.ready && module_opengl_is_initialized())
+      module_cmdlist_replay_resources(pipeline.ready);
+   pipeline.ready = NULL;
+}
+
+static bool create_lists(void) {
+   for (int i = 0; i < 2; i++) {
+      if (!pipeline.lists[i] && !(pipeline.lists[i] = module_cmdlist_create()))
+         return false;
+   }
+   return true;
+}
+
+bool module_pipeline_set_enabled(bool enabled) {
+   if (enabled == pipeline.enabled)
+      return true;
+
+   if (!enabled) {
+      module_pipeline_sync();
+      core_mutex_lock(&pipeline.lock);
+      pipeline.quit = true;
+      core_cond_broadcast(&pipeline.cond);
+      core_mutex_unlock(&pipeline.lock);
+      core_thread_join(pipeline.thread);
+      core_cond_destroy(&pipeline.cond);
+      core_mutex_destroy(&pipeline.lock);
+      pipeline.enabled = false;
+      drop_ready(); // the last pipelined frame is not shown
+      pipeline.shown_valid = false;
+      core_log(RETRO_LOG_INFO, "Pipelined frames disabled");
+      return true;
+   }
+
+   if (!create_lists())
+      return false;
+   core_mutex_init(&pipeline.lock);
+   core_cond_init(&pipeline.cond);
+   pipeline.quit = false;
+   pipeline.update_requested = false;
+   pipeline.gl_fn = NULL;
+   if (!core_thread_create(&pipeline.thread, update_thread_main, NULL)) {
+      core_log(RETRO_LOG_ERROR, "Failed to start update thread, keeping direct frames");
+      core_cond_destroy(&pipeline.cond);
+      core_mutex_destroy(&pipeline.lock);
+      return false;
+   }
+   pipeline.enabled = true;
+   drop_ready();
+   pipeline.shown_valid = false;
+   core_log(RETRO_LOG_INFO, "Pipelined frames enabled (one frame of input latency)");
+   return true;
+}
+
+bool module_pipeline_enabled(void) {
+   return pipeline.enabled;
+}
+
+bool module_pipeline_is_update_thread(void) {
+   return is_update_thread;
+}
+
+void module_pipeline_sync(void) {
+   if (!pipeline.in_flight)
+      return;
+
+   uint64_t start = core_time_ns();
+   core_mutex_lock(&pipeline.lock);
+   while (!pipeline.update_done) {
+      if (pipeline.gl_fn) {
+         void (*fn)(void *) = pipeline.gl_fn;
+         void *data = pipeline.gl_data;
+         core_mutex_unlock(&pipeline.lock);
+         fn(data);
+         core_mutex_lock(&pipeline.lock);
+         pipeline.gl_fn = NULL;
+         pipeline.gl_done = true;
+         core_cond_broadcast(&pipeline.cond);
+         continue;
+      }
+      core_cond_wait(&pipeline.cond, &pipeline.lock);
+   }
+   pipeline.ready = pipeline.update_list;
+   pipeline.update_ns += pipeline.last_update_ns;
+   core_mutex_unlock(&pipeline.lock);
+   pipeline.in_flight = false;
+   pipeline.wait_ns += core_time_ns() - start;
+}
+
+void module_pipeline_call_gl(void (*fn)(void *), void *data) {
+   if (!is_update_thread) {
+      fn(data);
+      return;
+   }
+   core_mutex_lock(&pipeline.lock);
+   pipeline.gl_fn = fn;
+   pipeline.gl_data = data;
+   pipeline.gl_done = false;
+   core_cond_broadcast(&pipeline.cond);
+   while (!pipeline.gl_done)
+      core_cond_wait(&pipeline.cond, &pipeline.lock);
+   core_mutex_unlock(&pipeline.lock);
+}
+
+static void report_stats(void) {
+   if (++pipeline.stats_frames < PIPELINE_STATS_FRAMES)
+      return;
+   double n = (double)pipeline.stats_frames * 1e6;
+   core_log(RETRO_LOG_DEBUG, "Frame timing (%s, %d frames): update %.3f ms, replay %.3f ms, wait %.3f ms, %d duped",
+            pipeline.enabled ? "pipelined" : "direct", pipeline.stats_frames,
+            pipeline.update_ns / n, pipeline.replay_ns / n, pipeline.wait_ns / n, pipeline.dupes);
+   pipeline.update_ns = pipeline.replay_ns = pipeline.wait_ns = 0;
+   pipeline.stats_frames = pipeline.dupes = 0;
+}
+
+// True if list would draw exactly what is on screen, or the script declined
+// to present it and it changes no GPU resources
+static bool can_dupe(const cmdlist *list) {
+   if (!pipeline.shown_valid)
+      return false;
+   if (!list)
+      return pipeline.shown_size == 0;
+   if (!module_cmdlist_wants_present(list) && !module_cmdlist_mutates(list))
+      return true;
+   size_t size = module_cmdlist_size(list);
+   return size == pipeline.shown_size &&
+          (size == 0 || memcmp(module_cmdlist_data(list), pipeline.shown, size) == 0);
+}
+
+// Remember list as the frame on screen (only needed while duping)
+static void remember_shown(const cmdlist *list) {
+   size_t size = list ? module_cmdlist_size(list) : 0;
+   if (size > pipeline.shown_capacity) {
+      unsigned char *grown = (unsigned char *)realloc(pipeline.shown, size);
+      if (!grown) {
+         pipeline.shown_valid = false;
+         return;
+      }
+      pipeline.shown = grown;
+      pipeline.shown_capacity = size;
+   }
+   if (size)
+      memcpy(pipeline.shown, module_cmdlist_data(list), size);
+   pipeline.shown_size = size;
+   pipeline.shown_valid = true;
+}
+
+// Bind and clear the frontend framebuffer
+static void begin_frame(void) {
+   module_opengl_bind_framebuffer();
+   module_opengl_check_error("framebuffer binding");
+   module_opengl_set_viewport();
+   module_opengl_clear();
+}
+
+// Draw list (a cleared frame if NULL) into the frontend framebuffer, or
+// leave it to the frontend to repeat the last frame; returns false then
+static bool present(const cmdlist *list, bool can_skip) {
+   if (can_skip && can_dupe(list)) {
+      if (list)
+         module_cmdlist_replay_resources(list);
+      pipeline.dupes++;
+      return false;
+   }
+
+   module_resolution_begin_frame();
+   begin_frame();
+   if (list) {
+      uint64_t start = core_time_ns();
+      module_cmdlist_replay(list);
+      pipeline.replay_ns += core_time_ns() - start;
+   }
+   module_resolution_end_frame();
+
+   if (can_skip)
+      remember_shown(list);
+   else
+      pipeline.shown_valid = false;
+   return true;
+}
+
+bool module_pipeline_frame(float animation_time, float vp_width, float vp_height, bool can_skip) {
+   bool presented;
+   if (!pipeline.enabled) {
+      if (!pipeline.lists[0])
+         create_lists();
+      if (pipeline.lists[0]) {
+         pipeline.update_ns += run_update(pipeline.lists[0], animation_time, vp_width, vp_height);
+         presented = present(pipeline.lists[0], can_skip);
+      } else {
+         // Without a list the update draws straight into the framebuffer
+         module_resolution_begin_frame();
+         begin_frame();
+         pipeline.update_ns += run_update(NULL, animation_time, vp_width, vp_height);
+         module_resolution_end_frame();
+         pipeline.shown_valid = false;
+         presented = true;
+      }
+      report_stats();
+      return presented;
+   }
+
+   // Start the next update into the list that is not about to be replayed.
+   // The first pipelined frame has nothing recorded yet and stays cleared.
+   module_pipeline_sync();
+   cmdlist *ready = pipeline.ready;
+   pipeline.ready = NULL;  // presented below, or its resources replayed if duped
+   core_mutex_lock(&pipeline.lock);
+   pipeline.update_list = ready == pipeline.lists[0] ? pipeline.lists[1] : pipeline.lists[0];
+   pipeline.update_time = animation_time;
+   pipeline.vp_width = vp_width;
+   pipeline.vp_height = vp_height;
+   pipeline.update_done = false;
+   pipeline.update_requested = true;
+   core_cond_broadcast(&pipeline.cond);
+   core_mutex_unlock(&pipeline.lock);
+   pipeline.in_flight = true;
+
+   presented = present(ready, can_skip);
+   report_stats();
+   return presented;
+}
+
+void module_pipeline_invalidate_frame(void) {
+   pipeline.shown_valid = false;
+}
+
+void module_pipeline_end_frame(uint64_t frame_start_ns) {
+   if (!pipeline.enabled)
+      finish_lua_frame(frame_start_ns);
+}
+
+void module_pipeline_set_gc_budget(double milliseconds) {
+   pipeline.gc_budget_ns = milliseconds > 0.0 ? (uint64_t)(milliseconds * 1e6) : 0;
+}
+
+void module_pipeline_shutdown(void) {
+   module_pipeline_set_enabled(false);
+   drop_ready();
+   for (int i = 0; i < 2; i++) {
+      module_cmdlist_destroy(pipeline.lists[i]);
+      pipeline.lists[i] = NULL;
+   }
+   free(pipeline.shown);
+   pipeline.shown = NULL;
+   pipeline.shown_size = pipeline.shown_capacity = 0;
+   pipeline.shown_valid = false;
+}
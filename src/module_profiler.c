@@ -0,0 +1,452 @@
+// module_profiler.c
+// Sampling Lua profiler. While running, the core's count hook (module_lua.c)
+// calls module_profiler_sample every PROFILER_HOOK_INSTRUCTIONS instructions;
+// once per sampling interval it walks the Lua stack and counts the sample
+// against the folded stack, the function on top and its current line. A
+// sample is only taken while Lua code runs, so time spent inside C bindings
+// is not credited to the Lua caller. The bindings are instead timed directly:
+// start() wraps the core's C functions (globals, subsystem tables and userdata
+// methods) in a closure that counts calls and nanoseconds, and stop() puts
+// the originals back.
+//
+// stop() writes the folded stacks ("main chunk;update (script.lua:10);draw 42"
+// per line, the input format of flamegraph.pl and speedscope) and logs the
+// top functions, lines and bindings.
+#include "module_profiler.h"
+#include "module_lua.h"
+#include "libretro_core.h"
+#include "core_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILER_DEFAULT_RATE 1000      // samples per second
+#define PROFILER_MAX_DEPTH 64           // stack frames kept per sample
+#define PROFILER_TOP_N 15               // rows per section of the summary
+#define PROFILER_DEFAULT_PATH "profile.folded"
+#define PROFILER_FRAME_CHARS 160
+#define STD_GLOBALS_KEY "lrcgl.std_globals"
+
+// String-keyed sample counters (open addressing, FNV-1a)
+typedef struct {
+   char *key;
+   uint32_t hash;
+   uint64_t count;
+} profile_entry;
+
+typedef struct {
+   profile_entry *entries;
+   uint32_t capacity;  // power of two
+   uint32_t used;
+} profile_table;
+
+// Time spent in one wrapped C binding
+typedef struct {
+   char *name;
+   uint64_t calls;
+   uint64_t ns;
+} binding_stats;
+
+static struct {
+   bool running;
+   uint64_t interval_ns;
+   uint64_t next_sample_ns;
+   uint64_t start_ns;
+   uint64_t samples;
+   uint64_t dropped;    // samples lost to allocation failures
+
+   profile_table stacks;
+   profile_table functions;
+   profile_table lines;
+
+   binding_stats *bindings;
+   int num_bindings, binding_capacity;
+} profiler;
+
+static int profiled_binding(lua_State *L);
+
+static uint32_t hash_string(const char *s) {
+   uint32_t h = 2166136261u;
+   for (; *s; s++)
+      h = (h ^ (unsigned char)*s) * 16777619u;
+   return h;
+}
+
+static bool table_grow(profile_table *t) {
+   uint32_t capacity = t->capacity ? t->capacity * 2 : 256;
+   profile_entry *entries = (profile_entry *)calloc(capacity, sizeof(profile_entry));
+   if (!entries)
+      return false;
+   for (uint32_t i = 0; i < t->capacity; i++) {
+      profile_entry *e = &t->entries[i];
+      if (!e->key)
+         continue;
+      uint32_t j = e->hash & (capacity - 1);
+      while (entries[j].key)
+         j = (j + 1) & (capacity - 1);
+      entries[j] = *e;
+   }
+   free(t->entries);
+   t->entries = entries;
+   t->capacity = capacity;
+   return true;
+}
+
+static bool table_add(profile_table *t, const char *key) {
+   if ((t->used + 1) * 4 > t->capacity * 3 && !table_grow(t))
+      return false;
+   uint32_t hash = hash_string(key);
+   uint32_t i = hash & (t->capacity - 1);
+   while (t->entries[i].key) {
+      profile_entry *e = &t->entries[i];
+      if (e->hash == hash && strcmp(e->key, key) == 0) {
+         e->count++;
+         return true;
+      }
+      i = (i + 1) & (t->capacity - 1);
+   }
+   size_t len = strlen(key) + 1;
+   char *copy = (char *)malloc(len);
+   if (!copy)
+      return false;
+   memcpy(copy, key, len);
+   t->entries[i] = (profile_entry){copy, hash, 1};
+   t->used++;
+   return true;
+}
+
+static void table_clear(profile_table *t) {
+   for (uint32_t i = 0; i < t->capacity; i++)
+      free(t->entries[i].key);
+   free(t->entries);
+   *t = (profile_table){0};
+}
+
+// Describe a stack frame; ';' and newlines would break the folded format
+static void frame_name(lua_State *T, lua_Debug *ar, char *out, size_t size) {
+   lua_getinfo(T, "Sn", ar);
+   if (ar->what[0] == 'C')
+      snprintf(out, size, "%s [C]", ar->name ? ar->name : "?");
+   else if (ar->what[0] == 'm')
+      snprintf(out, size, "main chunk (%s)", ar->short_src);
+   else
+      snprintf(out, size, "%s (%s:%d)", ar->name ? ar->name : "anonymous", ar->short_src, ar->linedefined);
+   for (char *c = out; *c; c++) {
+      if (*c == ';' || *c == '\n' || *c == '\r')
+         *c = ',';
+   }
+}
+
+bool module_profiler_running(void) {
+   return profiler.running;
+}
+
+void module_profiler_sample(lua_State *T, uint64_t now) {
+   if (!profiler.running || now < profiler.next_sample_ns)
+      return;
+   profiler.next_sample_ns = now + profiler.interval_ns;
+   profiler.samples++;
+
+   // Collect frames innermost first, then join them root first
+   static char frames[PROFILER_MAX_DEPTH][PROFILER_FRAME_CHARS];
+   static char stack[PROFILER_MAX_DEPTH * PROFILER_FRAME_CHARS];
+   lua_Debug ar;
+   int depth = 0;
+   while (depth < PROFILER_MAX_DEPTH && lua_getstack(T, depth, &ar)) {
+      frame_name(T, &ar, frames[depth], PROFILER_FRAME_CHARS);
+      if (depth == 0) {
+         lua_getinfo(T, "l", &ar);
+         if (ar.currentline > 0) {
+            char line[PROFILER_FRAME_CHARS];
+            snprintf(line, sizeof(line), "%s:%d", ar.short_src, ar.currentline);
+            if (!table_add(&profiler.lines, line))
+               profiler.dropped++;
+         }
+      }
+      depth++;
+   }
+   if (depth == 0)
+      return;
+
+   size_t len = 0;
+   for (int i = depth - 1; i >= 0; i--) {
+      size_t n = strlen(frames[i]);
+      if (len)
+         stack[len++] = ';';
+      memcpy(stack + len, frames[i], n);
+      len += n;
+   }
+   stack[len] = '\0';
+
+   if (!table_add(&profiler.stacks, stack) || !table_add(&profiler.functions, frames[0]))
+      profiler.dropped++;
+}
+
+// Binding wrappers
+
+// Closure standing in for a C binding: upvalue 1 is the original function,
+// upvalue 2 the index of its stats
+static int profiled_binding(lua_State *L) {
+   lua_CFunction fn = lua_tocfunction(L, lua_upvalueindex(1));
+   int slot = (int)lua_tointeger(L, lua_upvalueindex(2));
+   uint64_t start = core_time_ns();
+   int results = fn(L);
+   // Errors and yields skip this; such calls go uncounted
+   binding_stats *b = &profiler.bindings[slot];
+   b->calls++;
+   b->ns += core_time_ns() - start;
+   return results;
+}
+
+static int add_binding(const char *prefix, const char *name) {
+   if (profiler.num_bindings == profiler.binding_capacity) {
+      int capacity = profiler.binding_capacity ? profiler.binding_capacity * 2 : 64;
+      binding_stats *b = (binding_stats *)realloc(profiler.bindings, capacity * sizeof(binding_stats));
+      if (!b)
+         return -1;
+      profiler.bindings = b;
+      profiler.binding_capacity = capacity;
+   }
+   size_t len = strlen(prefix) + strlen(name) + 1;
+   char *full = (char *)malloc(len);
+   if (!full)
+      return -1;
+   snprintf(full, len, "%s%s", prefix, name);
+   profiler.bindings[profiler.num_bindings] = (binding_stats){full, 0, 0};
+   return profiler.num_bindings++;
+}
+
+// Replace the C functions of the table at idx with timed wrappers (wrap) or
+// put the originals back (!wrap). prefix is prepended to the names. Names
+// that are keys of the table at skip (if not 0) are left alone.
+static void wrap_table(lua_State *L, int idx, const char *prefix, int skip, bool wrap) {
+   idx = lua_absindex(L, idx);
+   lua_pushnil(L);
+   while (lua_next(L, idx)) {
+      bool skipped = false;
+      if (skip && lua_type(L, -2) == LUA_TSTRING) {
+         lua_pushvalue(L, -2);
+         skipped = lua_rawget(L, skip) != LUA_TNIL;
+         lua_pop(L, 1);
+      }
+      if (!skipped && lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)) {
+         bool wrapped = lua_tocfunction(L, -1) == profiled_binding;
+         if (wrap && !wrapped) {
+            int slot = add_binding(prefix, lua_tostring(L, -2));
+            if (slot >= 0) {
+               lua_pushinteger(L, slot);
+               lua_pushcclosure(L, profiled_binding, 2);  // takes the original as upvalue 1
+               lua_pushvalue(L, -2);
+               lua_insert(L, -2);
+               lua_rawset(L, idx);
+               continue;
+            }
+         } else if (!wrap && wrapped) {
+            lua_pushvalue(L, -2);
+            lua_getupvalue(L, -2, 1);
+            lua_rawset(L, idx);
+         }
+      }
+      lua_pop(L, 1);
+   }
+}
+
+// Visit the core's bindings: globals that are not part of the standard
+// library, the functions of non-standard global tables, and the methods of
+// the core's userdata types
+static void wrap_bindings(lua_State *L, bool wrap) {
+   lua_getfield(L, LUA_REGISTRYINDEX, STD_GLOBALS_KEY);
+   int std_globals = lua_istable(L, -1) ? lua_gettop(L) : 0;
+   lua_pushglobaltable(L);
+   int globals = lua_gettop(L);
+
+   // Global functions first (print, pairs, pcall, ... stay unwrapped), then
+   // one level into tables
+   wrap_table(L, globals, "", std_globals, wrap);
+   lua_pushnil(L);
+   while (lua_next(L, globals)) {
+      if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+         lua_pushvalue(L, -2);
+         bool is_std = std_globals && lua_rawget(L, std_globals) != LUA_TNIL;
+         lua_pop(L, 1);
+         const char *name = lua_tostring(L, -2);
+         // The profiler's own table stays unwrapped: stop() frees the stats
+         if (!is_std && strcmp(name, "profiler") != 0) {
+            char prefix[64];
+            snprintf(prefix, sizeof(prefix), "%s.", name);
+            wrap_table(L, -1, prefix, 0, wrap);
+         }
+      }
+      lua_pop(L, 1);
+   }
+
+   // Userdata methods live in the __index tables of "lrcgl.*" metatables,
+   // in the methods table an __index closure keeps as its first upvalue
+   // (types with fields, such as vec2), or in a "methods" table of the
+   // metatable that a C __index looks up (buffer)
+   lua_pushnil(L);
+   while (lua_next(L, LUA_REGISTRYINDEX)) {
+      if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1) &&
+          strncmp(lua_tostring(L, -2), "lrcgl.", 6) == 0) {
+         char prefix[64];
+         snprintf(prefix, sizeof(prefix), "%s:", lua_tostring(L, -2) + 6);
+         int type = lua_getfield(L, -1, "__index");
+         if (type == LUA_TTABLE) {
+            wrap_table(L, -1, prefix, 0, wrap);
+         } else if (type == LUA_TFUNCTION && lua_getupvalue(L, -1, 1)) {
+            if (lua_istable(L, -1))
+               wrap_table(L, -1, prefix, 0, wrap);
+            lua_pop(L, 1);
+         }
+         lua_pop(L, 1);
+         if (lua_getfield(L, -1, "methods") == LUA_TTABLE)
+            wrap_table(L, -1, prefix, 0, wrap);
+         lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+   }
+   lua_pop(L, 2);
+}
+
+// Summary and output
+
+static int compare_entries(const void *a, const void *b) {
+   const profile_entry *x = *(const profile_entry *const *)a, *y = *(const profile_entry *const *)b;
+   return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static int compare_bindings(const void *a, const void *b) {
+   const binding_stats *x = (const binding_stats *)a, *y = (const binding_stats *)b;
+   return x->ns < y->ns ? 1 : x->ns > y->ns ? -1 : 0;
+}
+
+static void log_top(const char *title, const profile_table *t) {
+   if (!t->used)
+      return;
+   const profile_entry **sorted = (const profile_entry **)malloc(t->used * sizeof(*sorted));
+   if (!sorted)
+      return;
+   uint32_t n = 0;
+   for (uint32_t i = 0; i < t->capacity; i++) {
+      if (t->entries[i].key)
+         sorted[n++] = &t->entries[i];
+   }
+   qsort(sorted, n, sizeof(*sorted), compare_entries);
+   core_log(RETRO_LOG_INFO, "Profiler: top %s (self samples):", title);
+   for (uint32_t i = 0; i < n && i < PROFILER_TOP_N; i++) {
+      core_log(RETRO_LOG_INFO, "  %6.2f%% %8llu  %s", 100.0 * sorted[i]->count / profiler.samples,
+               (unsigned long long)sorted[i]->count, sorted[i]->key);
+   }
+   free(sorted);
+}
+
+static void log_summary(void) {
+   double seconds = (core_time_ns() - profiler.start_ns) / 1e9;
+   core_log(RETRO_LOG_INFO, "Profiler: %llu samples over %.2f s (%llu dropped)",
+            (unsigned long long)profiler.samples, seconds, (unsigned long long)profiler.dropped);
+   if (profiler.samples) {
+      log_top("functions", &profiler.functions);
+      log_top("lines", &profiler.lines);
+   }
+
+   qsort(profiler.bindings, profiler.num_bindings, sizeof(binding_stats), compare_bindings);
+   bool header = false;
+   for (int i = 0; i < profiler.num_bindings && i < PROFILER_TOP_N; i++) {
+      const binding_stats *b = &profiler.bindings[i];
+      if (!b->calls)
+         break;
+      if (!header) {
+         core_log(RETRO_LOG_INFO, "Profiler: top C bindings (total ms, calls, us/call):");
+         header = true;
+      }
+      core_log(RETRO_LOG_INFO, "  %10.3f %8llu %8.2f  %s", b->ns / 1e6, (unsigned long long)b->calls,
+               b->ns / 1e3 / b->calls, b->name);
+   }
+}
+
+static bool write_folded(const char *path) {
+   FILE *f = fopen(path, "w");
+   if (!f) {
+      core_log(RETRO_LOG_ERROR, "Profiler: failed to open %s", path);
+      return false;
+   }
+   for (uint32_t i = 0; i < profiler.stacks.capacity; i++) {
+      const profile_entry *e = &profiler.stacks.entries[i];
+      if (e->key)
+         fprintf(f, "%s %llu\n", e->key, (unsigned long long)e->count);
+   }
+   fclose(f);
+   return true;
+}
+
+static void reset(void) {
+   table_clear(&profiler.stacks);
+   table_clear(&profiler.functions);
+   table_clear(&profiler.lines);
+   for (int i = 0; i < profiler.num_bindings; i++)
+      free(profiler.bindings[i].name);
+   free(profiler.bindings);
+   profiler.bindings = NULL;
+   profiler.num_bindings = profiler.binding_capacity = 0;
+   profiler.samples = profiler.dropped = 0;
+}
+
+// Lua API
+
+// profiler.start([rate_hz]): rate defaults to 1000 samples per second
+static int lua_profiler_start(lua_State *L) {
+   lua_Number rate = luaL_optnumber(L, 1, PROFILER_DEFAULT_RATE);
+   luaL_argcheck(L, rate > 0 && rate <= 1e6, 1, "rate must be in (0, 1000000] Hz");
+   if (profiler.running)
+      return 0;
+
+   reset();
+   wrap_bindings(L, true);
+   profiler.interval_ns = (uint64_t)(1e9 / rate);
+   profiler.start_ns = core_time_ns();
+   profiler.next_sample_ns = profiler.start_ns;
+   profiler.running = true;
+   module_lua_refresh_hook(L);
+   core_log(RETRO_LOG_INFO, "Profiler started at %.0f Hz (%d bindings timed)", rate, profiler.num_bindings);
+   return 0;
+}
+
+// profiler.stop([path]) -> samples, path: write folded stacks, log the summary
+static int lua_profiler_stop(lua_State *L) {
+   const char *path = luaL_optstring(L, 1, PROFILER_DEFAULT_PATH);
+   if (!profiler.running)
+      return 0;
+
+   profiler.running = false;
+   module_lua_refresh_hook(L);
+   wrap_bindings(L, false);
+   log_summary();
+   bool written = write_folded(path);
+   if (written)
+      core_log(RETRO_LOG_INFO, "Profiler: folded stacks written to %s", path);
+
+   lua_pushinteger(L, (lua_Integer)profiler.samples);
+   if (written)
+      lua_pushstring(L, path);
+   else
+      lua_pushnil(L);
+   reset();
+   return 2;
+}
+
+// profiler.running() -> bool
+static int lua_profiler_running(lua_State *L) {
+   lua_pushboolean(L, profiler.running);
+   return 1;
+}
+
+void module_profiler_register(lua_State *L) {
+   static const luaL_Reg funcs[] = {
+      {"start", lua_profiler_start},
+      {"stop", lua_profiler_stop},
+      {"running", lua_profiler_running},
+      {NULL, NULL}
+   };
+   luaL_newlib(L, funcs);
+   lua_setglobal(L, "profiler");
+}
@@ -0,0 +1,202 @@
+// module_replay.c
+// Deterministic input recording and playback. Each frame stores the joypad
+// button state of every recorded port plus the animation time handed to Lua:
+//
+//   header: "LRCR" | u16 version | u16 ports | u32 frame_count
+//   frame:  f32 animation_time | u16 buttons[ports]
+//
+// All values are little-endian.
+#include "module_replay.h"
+#include "libretro_core.h"
+#include <stdio.h>
+#include <string.h>
+
+#define REPLAY_MAGIC "LRCR"
+#define REPLAY_VERSION 1
+#define REPLAY_PORTS 2
+#define REPLAY_BUTTONS 16
+#define REPLAY_HEADER_SIZE 12
+
+static replay_mode mode = REPLAY_OFF;
+static FILE *replay_file = NULL;
+static uint32_t frame_count = 0;
+static uint32_t frame_index = 0;
+static uint16_t buttons[REPLAY_PORTS];
+static retro_input_state_t passthrough_cb = NULL;
+static bool warned_unrecorded = false;
+static bool latched = false;  // buttons hold a snapshot outside of replays
+
+static void put_u16(uint8_t *p, uint16_t v) {
+   p[0] = (uint8_t)v;
+   p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+   put_u16(p, (uint16_t)v);
+   put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+   return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+   return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static void put_f32(uint8_t *p, float f) {
+   uint32_t bits;
+   memcpy(&bits, &f, sizeof(bits));
+   put_u32(p, bits);
+}
+
+static float get_f32(const uint8_t *p) {
+   uint32_t bits = get_u32(p);
+   float f;
+   memcpy(&f, &bits, sizeof(f));
+   return f;
+}
+
+static void write_header(void) {
+   uint8_t header[REPLAY_HEADER_SIZE];
+   memcpy(header, REPLAY_MAGIC, 4);
+   put_u16(header + 4, REPLAY_VERSION);
+   put_u16(header + 6, REPLAY_PORTS);
+   put_u32(header + 8, frame_count);
+   fseek(replay_file, 0, SEEK_SET);
+   fwrite(header, 1, sizeof(header), replay_file);
+}
+
+bool module_replay_start(replay_mode new_mode, const char *path) {
+   module_replay_stop();
+   latched = false;
+   if (new_mode == REPLAY_OFF)
+      return true;
+
+   replay_file = fopen(path, new_mode == REPLAY_RECORD ? "wb" : "rb");
+   if (!replay_file) {
+      core_log(RETRO_LOG_ERROR, "Failed to open replay file: %s", path);
+      return false;
+   }
+
+   frame_count = 0;
+   frame_index = 0;
+   warned_unrecorded = false;
+   memset(buttons, 0, sizeof(buttons));
+
+   if (new_mode == REPLAY_RECORD) {
+      write_header();
+   } else {
+      uint8_t header[REPLAY_HEADER_SIZE];
+      if (fread(header, 1, sizeof(header), replay_file) != sizeof(header) ||
+          memcmp(header, REPLAY_MAGIC, 4) != 0 ||
+          get_u16(header + 4) != REPLAY_VERSION ||
+          get_u16(header + 6) != REPLAY_PORTS) {
+         core_log(RETRO_LOG_ERROR, "Invalid replay file: %s", path);
+         fclose(replay_file);
+         replay_file = NULL;
+         return false;
+      }
+      frame_count = get_u32(header + 8);
+   }
+
+   mode = new_mode;
+   core_log(RETRO_LOG_INFO, "Replay %s: %s (%u frames)",
+            mode == REPLAY_RECORD ? "recording" : "playback", path, frame_count);
+   return true;
+}
+
+void module_replay_stop(void) {
+   latched = false;
+   if (!replay_file)
+      return;
+
+   if (mode == REPLAY_RECORD) {
+      write_header();
+      core_log(RETRO_LOG_INFO, "Replay recorded %u frames", frame_count);
+   }
+   fclose(replay_file);
+   replay_file = NULL;
+   mode = REPLAY_OFF;
+}
+
+replay_mode module_replay_get_mode(void) {
+   return mode;
+}
+
+static uint16_t poll_buttons(retro_input_state_t frontend_cb, unsigned port) {
+   uint16_t mask = 0;
+   if (frontend_cb) {
+      for (unsigned id = 0; id < REPLAY_BUTTONS; id++) {
+         if (frontend_cb(port, RETRO_DEVICE_JOYPAD, 0, id))
+            mask |= (uint16_t)(1u << id);
+      }
+   }
+   return mask;
+}
+
+void module_replay_frame(retro_input_state_t frontend_cb, float *animation_time) {
+   uint8_t frame[4 + REPLAY_PORTS * 2];
+   passthrough_cb = frontend_cb;
+
+   if (mode == REPLAY_RECORD) {
+      put_f32(frame, *animation_time);
+      for (unsigned port = 0; port < REPLAY_PORTS; port++) {
+         buttons[port] = poll_buttons(frontend_cb, port);
+         put_u16(frame + 4 + port * 2, buttons[port]);
+      }
+      if (fwrite(frame, 1, sizeof(frame), replay_file) != sizeof(frame)) {
+         core_log(RETRO_LOG_ERROR, "Failed to write replay frame %u, stopping recording", frame_count);
+         module_replay_stop();
+         return;
+      }
+      frame_count++;
+   } else if (mode == REPLAY_PLAYBACK) {
+      if (frame_index >= frame_count ||
+          fread(frame, 1, sizeof(frame), replay_file) != sizeof(frame)) {
+         core_log(RETRO_LOG_INFO, "Replay finished after %u frames", frame_index);
+         module_replay_stop();
+         // This frame's update still reads a snapshot: every button released
+         memset(buttons, 0, sizeof(buttons));
+         latched = true;
+         return;
+      }
+      *animation_time = get_f32(frame);
+      for (unsigned port = 0; port < REPLAY_PORTS; port++)
+         buttons[port] = get_u16(frame + 4 + port * 2);
+      frame_index++;
+   }
+}
+
+void module_replay_latch(retro_input_state_t frontend_cb) {
+   passthrough_cb = frontend_cb;
+   for (unsigned port = 0; port < REPLAY_PORTS; port++)
+      buttons[port] = poll_buttons(frontend_cb, port);
+   latched = true;
+}
+
+void module_replay_unlatch(void) {
+   latched = false;
+}
+
+int16_t module_replay_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+   if (mode == REPLAY_OFF && !latched)
+      return passthrough_cb ? passthrough_cb(port, device, index, id) : 0;
+
+   if (device == RETRO_DEVICE_JOYPAD && port < REPLAY_PORTS) {
+      if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
+         return (int16_t)buttons[port];
+      if (id < REPLAY_BUTTONS)
+         return (buttons[port] >> id) & 1;
+      return 0;
+   }
+
+   if (!warned_unrecorded) {
+      core_log(RETRO_LOG_WARN, "Replay: input port=%u device=%u is not %s", port, device,
+               mode == REPLAY_OFF ? "latched" : "recorded");
+      warned_unrecorded = true;
+   }
+   if (mode == REPLAY_RECORD && passthrough_cb)
+      return passthrough_cb(port, device, index, id);
+   return 0;
+}
@@ -0,0 +1,225 @@
+// module_resolution.c
+// Dynamic resolution. Scripts draw in the fixed virtual space; this module
+// decides how many pixels a frame gets. Each frame's GL work is timed with a
+// GL_TIME_ELAPSED query, read back a few frames later once the result is
+// available, and smoothed. When the smoothed time goes over the budget the
+// render scale drops in proportion (fill cost follows area, so by the square
+// root of the overrun); when a step up would still leave headroom it climbs
+// back one step at a time. Scales are multiples of 1/RESOLUTION_STEPS.
+//
+// Below scale 1 the frame is drawn into the lower-left corner of an internal
+// target as large as the output (with a depth buffer, like the frontend's),
+// so changing size never reallocates, and is upscaled into the frontend
+// framebuffer with a linear blit.
+#include "module_resolution.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <math.h>
+#include <stdint.h>
+
+#define RESOLUTION_STEPS 32
+#define RESOLUTION_QUERIES 4         // frames of GPU timing in flight
+#define RESOLUTION_SETTLE_FRAMES 15  // samples after a change before the next
+#define RESOLUTION_SMOOTHING 0.2     // weight of a new sample
+#define RESOLUTION_HEADROOM 0.85     // a step up must stay under this share of the budget
+
+static struct {
+   int output_width, output_height;
+   uint64_t budget_ns;               // 0: fixed resolution
+   int min_step, step;
+   int render_width, render_height;  // this frame's
+
+   GLuint fbo, texture, depth;       // internal target at output size
+   int target_width, target_height;
+   bool scaled;                      // this frame renders into the target
+
+   GLuint queries[RESOLUTION_QUERIES];
+   bool pending[RESOLUTION_QUERIES];
+   int next_query;
+   bool timing;                      // a query is open for this frame
+   double smoothed_ns;
+   int settle;
+} res = {VIRTUAL_WIDTH, VIRTUAL_HEIGHT, 0, RESOLUTION_STEPS, RESOLUTION_STEPS};
+
+static void free_target(void) {
+   if (res.fbo)
+      module_opengl_free_target(res.fbo, res.texture);
+   if (res.depth)
+      glDeleteRenderbuffers(1, &res.depth);
+   res.fbo = res.texture = res.depth = 0;
+}
+
+// Give the internal target a depth buffer like the frontend's, which the
+// render queue orders opaque draws with
+static void attach_depth(void) {
+   glGenRenderbuffers(1, &res.depth);
+   glBindRenderbuffer(GL_RENDERBUFFER, res.depth);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, res.output_width, res.output_height);
+   glBindRenderbuffer(GL_RENDERBUFFER, 0);
+   glBindFramebuffer(GL_FRAMEBUFFER, res.fbo);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, res.depth);
+   module_opengl_check_error("resolution depth buffer");
+}
+
+void module_resolution_configure(int width, int height, double budget_ms, float min_scale) {
+   if (width != res.output_width || height != res.output_height)
+      free_target();
+   res.output_width = width;
+   res.output_height = height;
+   res.budget_ns = budget_ms > 0.0 ? (uint64_t)(budget_ms * 1e6) : 0;
+   res.min_step = (int)ceilf(min_scale * RESOLUTION_STEPS);
+   if (res.min_step < 1)
+      res.min_step = 1;
+   if (res.min_step > RESOLUTION_STEPS)
+      res.min_step = RESOLUTION_STEPS;
+   res.step = RESOLUTION_STEPS;
+   res.smoothed_ns = 0.0;
+   res.settle = 0;
+   module_opengl_set_output_size(width, height);
+   if (res.budget_ns)
+      core_log(RETRO_LOG_INFO, "Output %dx%d, dynamic resolution down to %d%% for %.1f ms of GPU time",
+               width, height, res.min_step * 100 / RESOLUTION_STEPS, budget_ms);
+   else
+      core_log(RETRO_LOG_INFO, "Output %dx%d, fixed resolution", width, height);
+}
+
+void module_resolution_output_size(int *width, int *height) {
+   *width = res.output_width;
+   *height = res.output_height;
+}
+
+float module_resolution_scale(void) {
+   return (float)res.step / RESOLUTION_STEPS;
+}
+
+// Fold a frame's GPU time into the average and move the scale if needed
+static void add_sample(uint64_t ns) {
+   res.smoothed_ns = res.smoothed_ns > 0.0
+                        ? res.smoothed_ns + (ns - res.smoothed_ns) * RESOLUTION_SMOOTHING
+                        : (double)ns;
+   if (res.settle > 0) {
+      res.settle--;
+      return;
+   }
+
+   double budget = (double)res.budget_ns;
+   int step = res.step;
+   if (res.smoothed_ns > budget) {
+      step = (int)(res.step * sqrt(budget / res.smoothed_ns));
+      if (step >= res.step)
+         step = res.step - 1;
+   } else if (res.step < RESOLUTION_STEPS) {
+      double up = (double)(res.step + 1) / res.step;
+      if (res.smoothed_ns * up * up < budget * RESOLUTION_HEADROOM)
+         step = res.step + 1;
+   }
+   if (step < res.min_step)
+      step = res.min_step;
+   if (step == res.step)
+      return;
+
+   core_log(RETRO_LOG_DEBUG, "Render scale %d%% (GPU %.2f ms, budget %.2f ms)",
+            step * 100 / RESOLUTION_STEPS, res.smoothed_ns / 1e6, budget / 1e6);
+
+   // Rescale the average to the new area so the next decision starts from it
+   double ratio = (double)step / res.step;
+   res.smoothed_ns *= ratio * ratio;
+   res.step = step;
+   res.settle = RESOLUTION_SETTLE_FRAMES;
+}
+
+static void read_queries(void) {
+   for (int i = 0; i < RESOLUTION_QUERIES; i++) {
+      if (!res.pending[i])
+         continue;
+      GLint available = 0;
+      glGetQueryObjectiv(res.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available)
+         continue;
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(res.queries[i], GL_QUERY_RESULT, &ns);
+      res.pending[i] = false;
+      add_sample((uint64_t)ns);
+   }
+}
+
+// Start timing this frame on a free query, if any
+static void start_query(void) {
+   if (!res.queries[0])
+      glGenQueries(RESOLUTION_QUERIES, res.queries);
+   int slot = res.next_query;
+   if (res.pending[slot])
+      return;
+   glBeginQuery(GL_TIME_ELAPSED, res.queries[slot]);
+   res.pending[slot] = true;
+   res.next_query = (slot + 1) % RESOLUTION_QUERIES;
+   res.timing = true;
+}
+
+void module_resolution_begin_frame(void) {
+   res.scaled = false;
+   res.timing = false;
+   if (!res.budget_ns)
+      return;
+
+   read_queries();
+   start_query();
+
+   if (res.step == RESOLUTION_STEPS)
+      return;
+   if (res.fbo && (res.target_width != res.output_width || res.target_height != res.output_height))
+      free_target();
+   if (!res.fbo) {
+      if (!module_opengl_create_target(res.output_width, res.output_height, &res.fbo, &res.texture))
+         return;
+      attach_depth();
+      res.target_width = res.output_width;
+      res.target_height = res.output_height;
+   }
+
+   // Sizes rounded to 8 pixels keep the upscale's sampling pattern stable
+   res.render_width = ((res.output_width * res.step / RESOLUTION_STEPS) + 7) & ~7;
+   res.render_height = ((res.output_height * res.step / RESOLUTION_STEPS) + 7) & ~7;
+   if (res.render_width > res.output_width)
+      res.render_width = res.output_width;
+   if (res.render_height > res.output_height)
+      res.render_height = res.output_height;
+   module_opengl_set_render_target(res.fbo, res.render_width, res.render_height);
+   res.scaled = true;
+}
+
+void module_resolution_end_frame(void) {
+   if (res.scaled) {
+      module_opengl_bind_output_framebuffer();
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, res.fbo);
+      glBlitFramebuffer(0, 0, res.render_width, res.render_height,
+                        0, 0, res.output_width, res.output_height,
+                        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+      module_opengl_bind_output_framebuffer();
+      module_opengl_set_render_target(0, 0, 0);
+      module_opengl_check_error("resolution upscale");
+      res.scaled = false;
+   }
+   if (res.timing) {
+      glEndQuery(GL_TIME_ELAPSED);
+      res.timing = false;
+   }
+}
+
+void module_resolution_context_reset(void) {
+   res.fbo = res.texture = res.depth = 0;
+   for (int i = 0; i < RESOLUTION_QUERIES; i++) {
+      res.queries[i] = 0;
+      res.pending[i] = false;
+   }
+   res.next_query = 0;
+   res.scaled = res.timing = false;
+   module_opengl_set_render_target(0, 0, 0);
+}
+
+void module_resolution_context_destroy(void) {
+   free_target();
+   if (res.queries[0])
+      glDeleteQueries(RESOLUTION_QUERIES, res.queries);
+   module_resolution_context_reset();
+}
@@ -0,0 +1,642 @@
+// module_scene.c
+// Retained-mode scene. Nodes are stored structure-of-arrays and indexed by id.
+// A depth-first draw order (with the end of each node's subtree) is rebuilt
+// only when the hierarchy changes; world transforms are recomputed only for
+// subtrees below a node whose local transform changed.
+#include "module_scene.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCENE_INITIAL_CAPACITY 256
+
+// Node flags
+#define NODE_ALIVE       0x01
+#define NODE_VISIBLE     0x02
+#define NODE_DIRTY       0x04 // local transform changed
+#define NODE_CHILD_DIRTY 0x08 // some descendant is dirty
+
+typedef struct {
+   int capacity;
+   int count;       // highest used id + 1
+   int free_head;   // free list threaded through next_sibling
+   bool order_dirty;
+
+   uint8_t *kind;
+   uint8_t *flags;
+   int32_t *parent;
+   int32_t *first_child;
+   int32_t *last_child;
+   int32_t *next_sibling;
+   int32_t *prev_sibling;
+
+   // Local transform
+   float *x, *y, *rotation, *sx, *sy;
+   // World transform (similarity: translation, rotation, per-axis scale)
+   float *wx, *wy, *wrotation, *wsx, *wsy;
+
+   float *w, *h;
+   float *r, *g, *b, *a;
+   unsigned int *texture;
+   char **text;
+
+   // Depth-first order and, per position, the position past its subtree
+   int32_t *order;
+   int32_t *subtree_end;
+   int32_t *order_pos;
+   int order_count;
+} scene_storage;
+
+static scene_storage scene;
+
+#define SCENE_ARRAYS(X) \
+   X(kind) X(flags) X(parent) X(first_child) X(last_child) X(next_sibling) X(prev_sibling) \
+   X(x) X(y) X(rotation) X(sx) X(sy) X(wx) X(wy) X(wrotation) X(wsx) X(wsy) \
+   X(w) X(h) X(r) X(g) X(b) X(a) X(texture) X(text) X(order) X(subtree_end) X(order_pos)
+
+static bool scene_grow(int capacity) {
+#define GROW_ARRAY(field) { \
+      void *p = realloc(scene.field, (size_t)capacity * sizeof(*scene.field)); \
+      if (!p) return false; \
+      scene.field = p; \
+   }
+   SCENE_ARRAYS(GROW_ARRAY)
+#undef GROW_ARRAY
+   scene.capacity = capacity;
+   return true;
+}
+
+static bool node_alive(int node) {
+   return node >= 0 && node < scene.count && (scene.flags[node] & NODE_ALIVE);
+}
+
+static void mark_dirty(int node) {
+   scene.flags[node] |= NODE_DIRTY;
+   for (int p = scene.parent[node]; p >= 0 && !(scene.flags[p] & NODE_CHILD_DIRTY); p = scene.parent[p])
+      scene.flags[p] |= NODE_CHILD_DIRTY;
+}
+
+static void link_child(int node, int parent) {
+   scene.parent[node] = parent;
+   scene.next_sibling[node] = -1;
+   scene.prev_sibling[node] = scene.last_child[parent];
+   if (scene.last_child[parent] >= 0)
+      scene.next_sibling[scene.last_child[parent]] = node;
+   else
+      scene.first_child[parent] = node;
+   scene.last_child[parent] = node;
+}
+
+static void unlink_child(int node) {
+   int parent = scene.parent[node];
+   if (parent < 0)
+      return;
+   if (scene.prev_sibling[node] >= 0)
+      scene.next_sibling[scene.prev_sibling[node]] = scene.next_sibling[node];
+   else
+      scene.first_child[parent] = scene.next_sibling[node];
+   if (scene.next_sibling[node] >= 0)
+      scene.prev_sibling[scene.next_sibling[node]] = scene.prev_sibling[node];
+   else
+      scene.last_child[parent] = scene.prev_sibling[node];
+   scene.parent[node] = -1;
+}
+
+static int alloc_node(void) {
+   int node;
+   if (scene.free_head >= 0) {
+      node = scene.free_head;
+      scene.free_head = scene.next_sibling[node];
+   } else {
+      if (scene.count == scene.capacity && !scene_grow(scene.capacity * 2)) {
+         core_log(RETRO_LOG_ERROR, "Scene: failed to grow node storage to %d", scene.capacity * 2);
+         return -1;
+      }
+      node = scene.count++;
+   }
+
+   scene.flags[node] = NODE_ALIVE | NODE_VISIBLE;
+   scene.parent[node] = -1;
+   scene.first_child[node] = scene.last_child[node] = -1;
+   scene.next_sibling[node] = scene.prev_sibling[node] = -1;
+   scene.x[node] = scene.y[node] = scene.rotation[node] = 0.0f;
+   scene.sx[node] = scene.sy[node] = 1.0f;
+   scene.wx[node] = scene.wy[node] = scene.wrotation[node] = 0.0f;
+   scene.wsx[node] = scene.wsy[node] = 1.0f;
+   scene.w[node] = scene.h[node] = 0.0f;
+   scene.r[node] = scene.g[node] = scene.b[node] = scene.a[node] = 1.0f;
+   scene.texture[node] = 0;
+   scene.text[node] = NULL;
+   return node;
+}
+
+bool module_scene_init(void) {
+   if (scene.capacity)
+      return true;
+
+   memset(&scene, 0, sizeof(scene));
+   scene.free_head = -1;
+   if (!scene_grow(SCENE_INITIAL_CAPACITY)) {
+      core_log(RETRO_LOG_ERROR, "Scene: failed to allocate node storage");
+      module_scene_deinit();
+      return false;
+   }
+
+   int root = alloc_node();
+   scene.kind[root] = SCENE_NODE_GROUP;
+   scene.order_dirty = true;
+   core_log(RETRO_LOG_INFO, "Scene initialized");
+   return true;
+}
+
+void module_scene_deinit(void) {
+   for (int i = 0; i < scene.count; i++)
+      free(scene.text ? scene.text[i] : NULL);
+#define FREE_ARRAY(field) free(scene.field);
+   SCENE_ARRAYS(FREE_ARRAY)
+#undef FREE_ARRAY
+   memset(&scene, 0, sizeof(scene));
+   scene.free_head = -1;
+}
+
+void module_scene_clear(void) {
+   if (!scene.capacity)
+      return;
+   for (int i = 1; i < scene.count; i++) {
+      free(scene.text[i]);
+      scene.text[i] = NULL;
+   }
+   scene.count = 1;
+   scene.free_head = -1;
+   scene.first_child[SCENE_ROOT] = scene.last_child[SCENE_ROOT] = -1;
+   scene.flags[SCENE_ROOT] &= ~(NODE_DIRTY | NODE_CHILD_DIRTY);
+   scene.order_dirty = true;
+}
+
+int module_scene_create(scene_node_kind kind, int parent) {
+   if (!scene.capacity && !module_scene_init())
+      return -1;
+   if (!node_alive(parent))
+      parent = SCENE_ROOT;
+
+   int node = alloc_node();
+   if (node < 0)
+      return -1;
+   scene.kind[node] = (uint8_t)kind;
+   link_child(node, parent);
+   mark_dirty(node);
+   scene.order_dirty = true;
+   return node;
+}
+
+void module_scene_destroy(int node) {
+   if (!node_alive(node) || node == SCENE_ROOT)
+      return;
+
+   unlink_child(node);
+
+   // Free the subtree depth-first, reusing next_sibling as the free list link
+   int stack_top = node;
+   scene.next_sibling[node] = -1;
+   while (stack_top >= 0) {
+      int n = stack_top;
+      stack_top = scene.next_sibling[n];
+      for (int c = scene.first_child[n]; c >= 0;) {
+         int next = scene.next_sibling[c];
+         scene.next_sibling[c] = stack_top;
+         stack_top = c;
+         c = next;
+      }
+      free(scene.text[n]);
+      scene.text[n] = NULL;
+      scene.flags[n] = 0;
+      scene.next_sibling[n] = scene.free_head;
+      scene.free_head = n;
+   }
+   scene.order_dirty = true;
+}
+
+bool module_scene_is_valid(int node) {
+   return node_alive(node);
+}
+
+bool module_scene_set_parent(int node, int parent) {
+   if (!node_alive(node) || node == SCENE_ROOT)
+      return false;
+   if (!node_alive(parent))
+      parent = SCENE_ROOT;
+   for (int p = parent; p >= 0; p = scene.parent[p]) {
+      if (p == node) {
+         core_log(RETRO_LOG_ERROR, "Scene: cannot parent node %d under its own descendant %d", node, parent);
+         return false;
+      }
+   }
+   unlink_child(node);
+   link_child(node, parent);
+   mark_dirty(node);
+   scene.order_dirty = true;
+   return true;
+}
+
+void module_scene_set_position(int node, float x, float y) {
+   if (!node_alive(node))
+      return;
+   scene.x[node] = x;
+   scene.y[node] = y;
+   mark_dirty(node);
+}
+
+void module_scene_set_rotation(int node, float degrees) {
+   if (!node_alive(node))
+      return;
+   scene.rotation[node] = degrees;
+   mark_dirty(node);
+}
+
+void module_scene_set_scale(int node, float sx, float sy) {
+   if (!node_alive(node))
+      return;
+   scene.sx[node] = sx;
+   scene.sy[node] = sy;
+   mark_dirty(node);
+}
+
+void module_scene_set_size(int node, float w, float h) {
+   if (!node_alive(node))
+      return;
+   scene.w[node] = w;
+   scene.h[node] = h;
+}
+
+void module_scene_set_color(int node, float r, float g, float b, float a) {
+   if (!node_alive(node))
+      return;
+   scene.r[node] = r;
+   scene.g[node] = g;
+   scene.b[node] = b;
+   scene.a[node] = a;
+}
+
+void module_scene_set_texture(int node, unsigned int texture_id) {
+   if (node_alive(node))
+      scene.texture[node] = texture_id;
+}
+
+void module_scene_set_text(int node, const char *text) {
+   if (!node_alive(node))
+      return;
+   free(scene.text[node]);
+   scene.text[node] = NULL;
+   if (text) {
+      size_t len = strlen(text);
+      scene.text[node] = (char *)malloc(len + 1);
+      if (scene.text[node])
+         memcpy(scene.text[node], text, len + 1);
+   }
+}
+
+void module_scene_set_visible(int node, bool visible) {
+   if (!node_alive(node))
+      return;
+   if (visible)
+      scene.flags[node] |= NODE_VISIBLE;
+   else
+      scene.flags[node] &= ~NODE_VISIBLE;
+}
+
+static float *property_array(scene_property prop) {
+   switch (prop) {
+      case SCENE_PROP_X: return scene.x;
+      case SCENE_PROP_Y: return scene.y;
+      case SCENE_PROP_ROTATION: return scene.rotation;
+      case SCENE_PROP_SX: return scene.sx;
+      case SCENE_PROP_SY: return scene.sy;
+      case SCENE_PROP_W: return scene.w;
+      case SCENE_PROP_H: return scene.h;
+      case SCENE_PROP_R: return scene.r;
+      case SCENE_PROP_G: return scene.g;
+      case SCENE_PROP_B: return scene.b;
+      case SCENE_PROP_A: return scene.a;
+      default: return NULL;
+   }
+}
+
+float module_scene_get_property(int node, scene_property prop) {
+   float *values = property_array(prop);
+   return node_alive(node) && values ? values[node] : 0.0f;
+}
+
+void module_scene_set_property(int node, scene_property prop, float value) {
+   float *values = property_array(prop);
+   if (!node_alive(node) || !values)
+      return;
+   values[node] = value;
+   if (prop <= SCENE_PROP_SY)
+      mark_dirty(node);
+}
+
+// Rebuild the depth-first order after the hierarchy changed
+static void rebuild_order(void) {
+   int pos = 0;
+   int n = SCENE_ROOT;
+
+   // Iterative pre-order walk; a node's subtree ends when the walk climbs past it
+   while (n >= 0) {
+      scene.order_pos[n] = pos;
+      scene.order[pos++] = n;
+      if (scene.first_child[n] >= 0) {
+         n = scene.first_child[n];
+         continue;
+      }
+      for (;;) {
+         scene.subtree_end[scene.order_pos[n]] = pos;
+         if (n == SCENE_ROOT) {
+            n = -1;
+            break;
+         }
+         if (scene.next_sibling[n] >= 0) {
+            n = scene.next_sibling[n];
+            break;
+         }
+         n = scene.parent[n];
+      }
+   }
+   scene.order_count = pos;
+   scene.order_dirty = false;
+}
+
+static void compute_world(int node) {
+   int p = scene.parent[node];
+   if (p < 0) {
+      scene.wx[node] = scene.x[node];
+      scene.wy[node] = scene.y[node];
+      scene.wrotation[node] = scene.rotation[node];
+      scene.wsx[node] = scene.sx[node];
+      scene.wsy[node] = scene.sy[node];
+      return;
+   }
+   float rad = scene.wrotation[p] * (3.14159265358979323846f / 180.0f);
+   float c = cosf(rad), s = sinf(rad);
+   float lx = scene.x[node] * scene.wsx[p];
+   float ly = scene.y[node] * scene.wsy[p];
+   scene.wx[node] = scene.wx[p] + lx * c - ly * s;
+   scene.wy[node] = scene.wy[p] + lx * s + ly * c;
+   scene.wrotation[node] = scene.wrotation[p] + scene.rotation[node];
+   scene.wsx[node] = scene.wsx[p] * scene.sx[node];
+   scene.wsy[node] = scene.wsy[p] * scene.sy[node];
+}
+
+void module_scene_update(void) {
+   if (!scene.capacity)
+      return;
+   if (scene.order_dirty)
+      rebuild_order();
+
+   int pos = 0;
+   while (pos < scene.order_count) {
+      int node = scene.order[pos];
+      uint8_t flags = scene.flags[node];
+      if (flags & NODE_DIRTY) {
+         // Recompute the whole subtree; parents precede children in the order
+         int end = scene.subtree_end[pos];
+         for (int p = pos; p < end; p++) {
+            int n = scene.order[p];
+            compute_world(n);
+            scene.flags[n] &= ~(NODE_DIRTY | NODE_CHILD_DIRTY);
+         }
+         pos = end;
+      } else if (flags & NODE_CHILD_DIRTY) {
+         scene.flags[node] &= ~NODE_CHILD_DIRTY;
+         pos++;
+      } else {
+         pos = scene.subtree_end[pos];
+      }
+   }
+}
+
+void module_scene_get_world(int node, float *x, float *y, float *rotation, float *sx, float *sy) {
+   if (!node_alive(node))
+      return;
+   if (scene.flags[node] & NODE_DIRTY || scene.order_dirty)
+      module_scene_update();
+   if (x) *x = scene.wx[node];
+   if (y) *y = scene.wy[node];
+   if (rotation) *rotation = scene.wrotation[node];
+   if (sx) *sx = scene.wsx[node];
+   if (sy) *sy = scene.wsy[node];
+}
+
+void module_scene_render(float vp_width, float vp_height) {
+   if (!scene.capacity || scene.count <= 1)
+      return;
+   module_scene_update();
+
+   int pos = 0;
+   while (pos < scene.order_count) {
+      int n = scene.order[pos];
+      if (!(scene.flags[n] & NODE_VISIBLE)) {
+         pos = scene.subtree_end[pos];
+         continue;
+      }
+      switch (scene.kind[n]) {
+         case SCENE_NODE_QUAD:
+            module_opengl_draw_solid_quad(scene.wx[n], scene.wy[n],
+                                          scene.w[n] * scene.wsx[n], scene.h[n] * scene.wsy[n],
+                                          scene.wrotation[n], scene.r[n], scene.g[n], scene.b[n], scene.a[n],
+                                          vp_width, vp_height);
+            break;
+         case SCENE_NODE_SPRITE:
+            if (scene.texture[n])
+               module_opengl_draw_texture(scene.texture[n], scene.wx[n], scene.wy[n],
+                                          scene.w[n] * scene.wsx[n], scene.h[n] * scene.wsy[n],
+                                          scene.wrotation[n], scene.r[n], scene.g[n], scene.b[n], scene.a[n],
+                                          vp_width, vp_height);
+            break;
+         case SCENE_NODE_TEXT:
+            // The text batch has no transform: only the world position applies,
+            // moved from the scene's centred coordinates to the top-left
+            // coordinates draw_text takes
+            if (scene.text[n])
+               module_opengl_draw_text(scene.wx[n] + vp_width * 0.5f, scene.wy[n] + vp_height * 0.5f, scene.text[n],
+                                       scene.r[n], scene.g[n], scene.b[n], scene.a[n],
+                                       vp_width, vp_height);
+            break;
+         default:
+            break;
+      }
+      pos++;
+   }
+}
+
+
+// Lua bindings
+
+static int check_node(lua_State *L, int arg) {
+   int node = (int)luaL_checkinteger(L, arg);
+   luaL_argcheck(L, node_alive(node), arg, "invalid scene node");
+   return node;
+}
+
+static int opt_parent(lua_State *L, int arg) {
+   return lua_isnoneornil(L, arg) ? SCENE_ROOT : check_node(L, arg);
+}
+
+static int push_node(lua_State *L, int node) {
+   if (node < 0)
+      lua_pushnil(L);
+   else
+      lua_pushinteger(L, node);
+   return 1;
+}
+
+// scene.group([parent])
+static int lua_scene_group(lua_State *L) {
+   return push_node(L, module_scene_create(SCENE_NODE_GROUP, opt_parent(L, 1)));
+}
+
+// scene.quad(w, h, r, g, b, a [, parent])
+static int lua_scene_quad(lua_State *L) {
+   float w = (float)luaL_checknumber(L, 1);
+   float h = (float)luaL_checknumber(L, 2);
+   float r = (float)luaL_optnumber(L, 3, 1.0);
+   float g = (float)luaL_optnumber(L, 4, 1.0);
+   float b = (float)luaL_optnumber(L, 5, 1.0);
+   float a = (float)luaL_optnumber(L, 6, 1.0);
+   int node = module_scene_create(SCENE_NODE_QUAD, opt_parent(L, 7));
+   module_scene_set_size(node, w, h);
+   module_scene_set_color(node, r, g, b, a);
+   return push_node(L, node);
+}
+
+// scene.sprite(texture_id, w, h [, parent])
+static int lua_scene_sprite(lua_State *L) {
+   unsigned int texture_id = (unsigned int)luaL_checkinteger(L, 1);
+   float w = (float)luaL_checknumber(L, 2);
+   float h = (float)luaL_checknumber(L, 3);
+   int node = module_scene_create(SCENE_NODE_SPRITE, opt_parent(L, 4));
+   module_scene_set_texture(node, texture_id);
+   module_scene_set_size(node, w, h);
+   return push_node(L, node);
+}
+
+// scene.text(text, r, g, b, a [, parent]); drawn unrotated and unscaled
+static int lua_scene_text(lua_State *L) {
+   const char *text = luaL_checkstring(L, 1);
+   float r = (float)luaL_optnumber(L, 2, 1.0);
+   float g = (float)luaL_optnumber(L, 3, 1.0);
+   float b = (float)luaL_optnumber(L, 4, 1.0);
+   float a = (float)luaL_optnumber(L, 5, 1.0);
+   int node = module_scene_create(SCENE_NODE_TEXT, opt_parent(L, 6));
+   module_scene_set_text(node, text);
+   module_scene_set_color(node, r, g, b, a);
+   return push_node(L, node);
+}
+
+static int lua_scene_destroy(lua_State *L) {
+   module_scene_destroy(check_node(L, 1));
+   return 0;
+}
+
+static int lua_scene_clear(lua_State *L) {
+   (void)L;
+   module_scene_clear();
+   return 0;
+}
+
+static int lua_scene_set_parent(lua_State *L) {
+   lua_pushboolean(L, module_scene_set_parent(check_node(L, 1), opt_parent(L, 2)));
+   return 1;
+}
+
+static int lua_scene_set_position(lua_State *L) {
+   module_scene_set_position(check_node(L, 1), (float)luaL_checknumber(L, 2), (float)luaL_checknumber(L, 3));
+   return 0;
+}
+
+static int lua_scene_set_rotation(lua_State *L) {
+   module_scene_set_rotation(check_node(L, 1), (float)luaL_checknumber(L, 2));
+   return 0;
+}
+
+static int lua_scene_set_scale(lua_State *L) {
+   float sx = (float)luaL_checknumber(L, 2);
+   module_scene_set_scale(check_node(L, 1), sx, (float)luaL_optnumber(L, 3, sx));
+   return 0;
+}
+
+static int lua_scene_set_size(lua_State *L) {
+   module_scene_set_size(check_node(L, 1), (float)luaL_checknumber(L, 2), (float)luaL_checknumber(L, 3));
+   return 0;
+}
+
+static int lua_scene_set_color(lua_State *L) {
+   module_scene_set_color(check_node(L, 1), (float)luaL_checknumber(L, 2), (float)luaL_checknumber(L, 3),
+                          (float)luaL_checknumber(L, 4), (float)luaL_optnumber(L, 5, 1.0));
+   return 0;
+}
+
+static int lua_scene_set_texture(lua_State *L) {
+   module_scene_set_texture(check_node(L, 1), (unsigned int)luaL_checkinteger(L, 2));
+   return 0;
+}
+
+static int lua_scene_set_text(lua_State *L) {
+   module_scene_set_text(check_node(L, 1), luaL_checkstring(L, 2));
+   return 0;
+}
+
+static int lua_scene_set_visible(lua_State *L) {
+   module_scene_set_visible(check_node(L, 1), lua_toboolean(L, 2));
+   return 0;
+}
+
+static int lua_scene_get_position(lua_State *L) {
+   int node = check_node(L, 1);
+   lua_pushnumber(L, scene.x[node]);
+   lua_pushnumber(L, scene.y[node]);
+   return 2;
+}
+
+// scene.get_world(node) -> x, y, rotation, sx, sy
+static int lua_scene_get_world(lua_State *L) {
+   float x = 0, y = 0, rotation = 0, sx = 1, sy = 1;
+   module_scene_get_world(check_node(L, 1), &x, &y, &rotation, &sx, &sy);
+   lua_pushnumber(L, x);
+   lua_pushnumber(L, y);
+   lua_pushnumber(L, rotation);
+   lua_pushnumber(L, sx);
+   lua_pushnumber(L, sy);
+   return 5;
+}
+
+static const luaL_Reg scene_funcs[] = {
+   {"group", lua_scene_group},
+   {"quad", lua_scene_quad},
+   {"sprite", lua_scene_sprite},
+   {"text", lua_scene_text},
+   {"destroy", lua_scene_destroy},
+   {"clear", lua_scene_clear},
+   {"set_parent", lua_scene_set_parent},
+   {"set_position", lua_scene_set_position},
+   {"set_rotation", lua_scene_set_rotation},
+   {"set_scale", lua_scene_set_scale},
+   {"set_size", lua_scene_set_size},
+   {"set_color", lua_scene_set_color},
+   {"set_texture", lua_scene_set_texture},
+   {"set_text", lua_scene_set_text},
+   {"set_visible", lua_scene_set_visible},
+   {"get_position", lua_scene_get_position},
+   {"get_world", lua_scene_get_world},
+   {NULL, NULL}
+};
+
+void module_scene_register(lua_State *L) {
+   luaL_newlib(L, scene_funcs);
+   lua_pushinteger(L, SCENE_ROOT);
+   lua_setfield(L, -2, "root");
+   lua_setglobal(L, "scene");
+}
@@ -0,0 +1,633 @@
+// module_shape.c
+// Shape tessellation: polygons by ear clipping, polyline strokes with
+// mitred joins, circles, arcs and rounded rectangles, all turned into
+// triangle lists around the shape's own origin. The draw functions place
+// them with the solid shader's model transform, so a shape's triangles do
+// not depend on where it is drawn and can be reused.
+//
+// Results live in a direct-mapped cache keyed by the shape's kind and
+// parameters (a polygon's key holds its points): the key is hashed to a
+// slot, compared in full on a hit, and a miss tessellates into the slot,
+// replacing what was there. Shapes drawn every frame are tessellated once;
+// the triangles are copied into the frame's command list and from there
+// into the shared solid vertex stream like any other solid draw.
+#include "module_shape.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHAPE_CACHE_SLOTS 256      // power of two
+#define SHAPE_TOLERANCE 0.25f      // farthest a chord strays from its curve
+#define SHAPE_MIN_SEGMENTS 8       // per full circle
+#define SHAPE_MAX_SEGMENTS 256
+#define SHAPE_MITER_LIMIT 4.0f     // longest mitre, in half widths
+#define SHAPE_PI 3.14159265358979f
+
+typedef enum {
+   SHAPE_POLYGON = 1,
+   SHAPE_STROKE,
+   SHAPE_STROKE_CLOSED,
+   SHAPE_CIRCLE,
+   SHAPE_ARC,
+   SHAPE_ROUNDED_RECT
+} shape_kind;
+
+typedef struct {
+   uint64_t hash;
+   float *key;        // kind, then parameters
+   int key_len;       // floats; 0 for an empty slot
+   int key_capacity;
+   float *vertices;
+   int num_vertices;
+   int vertex_capacity;
+} shape_entry;
+
+static shape_entry cache[SHAPE_CACHE_SLOTS];
+
+// Key of the shape being looked up
+static float *key_buf = NULL;
+static int key_len = 0, key_capacity = 0;
+static uint64_t key_hash = 0;
+
+// Triangles being built (vertices), and scratch for the tessellators
+static float *out_buf = NULL;
+static int out_count = 0, out_capacity = 0;
+static bool out_failed = false;
+static void *scratch = NULL;
+static size_t scratch_size = 0;
+
+static bool grow(void **buf, int *capacity, int needed, size_t item_size) {
+   if (needed <= *capacity)
+      return true;
+   int capacity_new = *capacity ? *capacity : 64;
+   while (capacity_new < needed)
+      capacity_new *= 2;
+   void *grown = realloc(*buf, (size_t)capacity_new * item_size);
+   if (!grown)
+      return false;
+   *buf = grown;
+   *capacity = capacity_new;
+   return true;
+}
+
+static void *get_scratch(size_t size) {
+   if (size > scratch_size) {
+      void *grown = realloc(scratch, size);
+      if (!grown)
+         return NULL;
+      scratch = grown;
+      scratch_size = size;
+   }
+   return scratch;
+}
+
+// ---------------------------------------------------------------------------
+// Cache
+
+// Start a key of kind followed by floats parameters; returns where they go
+static float *begin_key(shape_kind kind, int floats) {
+   if (!grow((void **)&key_buf, &key_capacity, floats + 1, sizeof(float)))
+      return NULL;
+   key_buf[0] = (float)kind;
+   key_len = floats + 1;
+   return key_buf + 1;
+}
+
+// Look the current key up; returns the vertex count of a hit or -1
+static int lookup(const float **out) {
+   // FNV-1a over the key's bytes
+   uint64_t hash = 14695981039346656037ull;
+   const unsigned char *bytes = (const unsigned char *)key_buf;
+   for (size_t i = 0; i < (size_t)key_len * sizeof(float); i++)
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+   key_hash = hash;
+
+   shape_entry *e = &cache[hash & (SHAPE_CACHE_SLOTS - 1)];
+   if (e->key_len == key_len && e->hash == hash &&
+       memcmp(e->key, key_buf, (size_t)key_len * sizeof(float)) == 0) {
+      *out = e->vertices;
+      return e->num_vertices;
+   }
+   out_count = 0;
+   out_failed = false;
+   return -1;
+}
+
+// Move the triangles just built into the current key's slot
+static int store(const float **out) {
+   if (out_failed) {
+      core_log(RETRO_LOG_ERROR, "Shape: out of memory tessellating %d vertices", out_count);
+      return 0;
+   }
+   shape_entry *e = &cache[key_hash & (SHAPE_CACHE_SLOTS - 1)];
+   e->key_len = 0;
+   if (!grow((void **)&e->key, &e->key_capacity, key_len, sizeof(float)) ||
+       !grow((void **)&e->vertices, &e->vertex_capacity, out_count * 2, sizeof(float))) {
+      // Still draw this once from the build buffer
+      *out = out_buf;
+      return out_count;
+   }
+   memcpy(e->key, key_buf, (size_t)key_len * sizeof(float));
+   memcpy(e->vertices, out_buf, (size_t)out_count * 2 * sizeof(float));
+   e->hash = key_hash;
+   e->key_len = key_len;
+   e->num_vertices = out_count;
+   *out = e->vertices;
+   return out_count;
+}
+
+static void emit_triangle(float ax, float ay, float bx, float by, float cx, float cy) {
+   if (!grow((void **)&out_buf, &out_capacity, (out_count + 3) * 2, sizeof(float))) {
+      out_failed = true;
+      return;
+   }
+   float *v = out_buf + out_count * 2;
+   v[0] = ax; v[1] = ay;
+   v[2] = bx; v[3] = by;
+   v[4] = cx; v[5] = cy;
+   out_count += 3;
+}
+
+// Segments for sweep radians of a curve of radius, keeping each chord
+// within SHAPE_TOLERANCE of it
+static int segments_for(float radius, float sweep) {
+   float r = fabsf(radius);
+   int full = SHAPE_MAX_SEGMENTS;
+   if (r > SHAPE_TOLERANCE)
+      full = (int)ceilf(2.0f * SHAPE_PI / (2.0f * acosf(1.0f - SHAPE_TOLERANCE / r)));
+   if (full < SHAPE_MIN_SEGMENTS)
+      full = SHAPE_MIN_SEGMENTS;
+   if (full > SHAPE_MAX_SEGMENTS)
+      full = SHAPE_MAX_SEGMENTS;
+   int n = (int)ceilf(full * fabsf(sweep) / (2.0f * SHAPE_PI));
+   return n < 1 ? 1 : n;
+}
+
+// ---------------------------------------------------------------------------
+// Polygons
+
+static bool point_in_triangle(const float *p, const float *a, const float *b, const float *c) {
+   float d0 = (b[0] - a[0]) * (p[1] - a[1]) - (b[1] - a[1]) * (p[0] - a[0]);
+   float d1 = (c[0] - b[0]) * (p[1] - b[1]) - (c[1] - b[1]) * (p[0] - b[0]);
+   float d2 = (a[0] - c[0]) * (p[1] - c[1]) - (a[1] - c[1]) * (p[0] - c[0]);
+   bool negative = d0 < 0.0f || d1 < 0.0f || d2 < 0.0f;
+   bool positive = d0 > 0.0f || d1 > 0.0f || d2 > 0.0f;
+   return !(negative && positive);
+}
+
+// Whether the corner at idx[i] of the remaining outline is an ear: convex in
+// the outline's winding (sign) with no other remaining point inside it
+static bool is_ear(const float *p, const int *idx, int remaining, int i, float sign) {
+   const float *a = p + idx[(i + remaining - 1) % remaining] * 2;
+   const float *b = p + idx[i] * 2;
+   const float *c = p + idx[(i + 1) % remaining] * 2;
+   float cross = (b[0] - a[0]) * (c[1] - b[1]) - (b[1] - a[1]) * (c[0] - b[0]);
+   if (cross * sign <= 0.0f)
+      return false;
+   for (int j = 0; j < remaining; j++) {
+      const float *q = p + idx[j] * 2;
+      if (q == a || q == b || q == c)
+         continue;
+      if (point_in_triangle(q, a, b, c))
+         return false;
+   }
+   return true;
+}
+
+static void triangulate(const float *p, int count) {
+   float area = 0.0f;
+   for (int i = 0, j = count - 1; i < count; j = i++)
+      area += p[j * 2] * p[i * 2 + 1] - p[i * 2] * p[j * 2 + 1];
+   if (area == 0.0f)
+      return;
+   float sign = area > 0.0f ? 1.0f : -1.0f;
+
+   int *idx = (int *)get_scratch((size_t)count * sizeof(int));
+   if (!idx) {
+      out_failed = true;
+      return;
+   }
+   for (int i = 0; i < count; i++)
+      idx[i] = i;
+
+   // Clip ears until a triangle is left. An outline with no ear is not
+   // simple; clipping the corner anyway still ends with every point used.
+   int remaining = count, i = 0, misses = 0;
+   while (remaining > 3) {
+      if (!is_ear(p, idx, remaining, i, sign) && ++misses < remaining) {
+         i = (i + 1) % remaining;
+         continue;
+      }
+      const float *a = p + idx[(i + remaining - 1) % remaining] * 2;
+      const float *b = p + idx[i] * 2;
+      const float *c = p + idx[(i + 1) % remaining] * 2;
+      emit_triangle(a[0], a[1], b[0], b[1], c[0], c[1]);
+      memmove(idx + i, idx + i + 1, (size_t)(remaining - i - 1) * sizeof(int));
+      remaining--;
+      misses = 0;
+      if (i == remaining)
+         i = 0;
+   }
+   emit_triangle(p[idx[0] * 2], p[idx[0] * 2 + 1], p[idx[1] * 2], p[idx[1] * 2 + 1],
+                 p[idx[2] * 2], p[idx[2] * 2 + 1]);
+}
+
+int module_shape_polygon(const float *points, int count, const float **out) {
+   if (count < 3)
+      return 0;
+   float *params = begin_key(SHAPE_POLYGON, count * 2);
+   if (!params)
+      return 0;
+   memcpy(params, points, (size_t)count * 2 * sizeof(float));
+   int n = lookup(out);
+   if (n >= 0)
+      return n;
+   triangulate(points, count);
+   return store(out);
+}
+
+// ---------------------------------------------------------------------------
+// Strokes
+
+// Edges of the stroke where it enters and leaves a point, left and right of
+// the direction of travel
+typedef struct {
+   float in_l[2], in_r[2], out_l[2], out_r[2];
+} stroke_joint;
+
+static void set_edges(float *l, float *r, const float *p, const float *n, float half) {
+   l[0] = p[0] + n[0] * half;
+   l[1] = p[1] + n[1] * half;
+   r[0] = p[0] - n[0] * half;
+   r[1] = p[1] - n[1] * half;
+}
+
+static void stroke(const float *points, int count, float width, bool closed) {
+   // Drop repeated points, which have no direction
+   float *p = (float *)get_scratch((size_t)count * (2 * sizeof(float) + sizeof(stroke_joint)));
+   if (!p) {
+      out_failed = true;
+      return;
+   }
+   int n = 0;
+   for (int i = 0; i < count; i++) {
+      if (n > 0 && points[i * 2] == p[n * 2 - 2] && points[i * 2 + 1] == p[n * 2 - 1])
+         continue;
+      p[n * 2] = points[i * 2];
+      p[n * 2 + 1] = points[i * 2 + 1];
+      n++;
+   }
+   if (closed && n > 2 && p[0] == p[n * 2 - 2] && p[1] == p[n * 2 - 1])
+      n--;
+   if (n < 2)
+      return;
+   if (n == 2)
+      closed = false;
+
+   stroke_joint *joints = (stroke_joint *)(p + count * 2);
+   float half = width * 0.5f;
+   int segments = closed ? n : n - 1;
+   for (int i = 0; i < n; i++) {
+      const float *pt = p + i * 2;
+      bool has_in = closed || i > 0, has_out = closed || i < n - 1;
+      float n_in[2] = {0.0f, 0.0f}, n_out[2] = {0.0f, 0.0f};
+      if (has_in) {
+         const float *prev = p + ((i + n - 1) % n) * 2;
+         float dx = pt[0] - prev[0], dy = pt[1] - prev[1], len = sqrtf(dx * dx + dy * dy);
+         n_in[0] = -dy / len;
+         n_in[1] = dx / len;
+      }
+      if (has_out) {
+         const float *next = p + ((i + 1) % n) * 2;
+         float dx = next[0] - pt[0], dy = next[1] - pt[1], len = sqrtf(dx * dx + dy * dy);
+         n_out[0] = -dy / len;
+         n_out[1] = dx / len;
+      }
+      stroke_joint *j = &joints[i];
+      if (!has_in || !has_out) {
+         const float *nrm = has_in ? n_in : n_out;
+         set_edges(j->in_l, j->in_r, pt, nrm, half);
+         set_edges(j->out_l, j->out_r, pt, nrm, half);
+         continue;
+      }
+
+      // Mitre along the bisector, unless the corner is too sharp for it
+      float m[2] = {n_in[0] + n_out[0], n_in[1] + n_out[1]};
+      float m_len = sqrtf(m[0] * m[0] + m[1] * m[1]);
+      float cos_half = m_len > 1e-6f ? (m[0] * n_out[0] + m[1] * n_out[1]) / m_len : 0.0f;
+      if (cos_half * SHAPE_MITER_LIMIT >= 1.0f) {
+         float scale = 1.0f / (m_len * cos_half);
+         float miter[2] = {m[0] * scale, m[1] * scale};
+         set_edges(j->in_l, j->in_r, pt, miter, half);
+         set_edges(j->out_l, j->out_r, pt, miter, half);
+      } else {
+         set_edges(j->in_l, j->in_r, pt, n_in, half);
+         set_edges(j->out_l, j->out_r, pt, n_out, half);
+         emit_triangle(pt[0], pt[1], j->in_l[0], j->in_l[1], j->out_l[0], j->out_l[1]);
+         emit_triangle(pt[0], pt[1], j->in_r[0], j->in_r[1], j->out_r[0], j->out_r[1]);
+      }
+   }
+
+   for (int s = 0; s < segments; s++) {
+      const stroke_joint *a = &joints[s], *b = &joints[(s + 1) % n];
+      emit_triangle(a->out_l[0], a->out_l[1], a->out_r[0], a->out_r[1], b->in_l[0], b->in_l[1]);
+      emit_triangle(a->out_r[0], a->out_r[1], b->in_r[0], b->in_r[1], b->in_l[0], b->in_l[1]);
+   }
+}
+
+int module_shape_stroke(const float *points, int count, float width, bool closed, const float **out) {
+   if (count < 2 || !(width > 0.0f))
+      return 0;
+   float *params = begin_key(closed ? SHAPE_STROKE_CLOSED : SHAPE_STROKE, 1 + count * 2);
+   if (!params)
+      return 0;
+   params[0] = width;
+   memcpy(params + 1, points, (size_t)count * 2 * sizeof(float));
+   int n = lookup(out);
+   if (n >= 0)
+      return n;
+   stroke(points, count, width, closed);
+   return store(out);
+}
+
+// ---------------------------------------------------------------------------
+// Curves
+
+// Fill (inner < 0) or band between inner and outer of the arc from start
+// over sweep radians
+static void arc(float inner, float outer, float start, float sweep) {
+   int segments = segments_for(outer, sweep);
+   float step = sweep / segments;
+   float c0 = cosf(start), s0 = sinf(start);
+   for (int i = 1; i <= segments; i++) {
+      float angle = start + step * i;
+      float c1 = cosf(angle), s1 = sinf(angle);
+      if (inner < 0.0f) {
+         emit_triangle(0.0f, 0.0f, c0 * outer, s0 * outer, c1 * outer, s1 * outer);
+      } else {
+         emit_triangle(c0 * outer, s0 * outer, c1 * outer, s1 * outer, c0 * inner, s0 * inner);
+         emit_triangle(c1 * outer, s1 * outer, c1 * inner, s1 * inner, c0 * inner, s0 * inner);
+      }
+      c0 = c1;
+      s0 = s1;
+   }
+}
+
+// Radii of a ring thickness wide centred on radius (inner < 0: filled)
+static void ring_radii(float radius, float thickness, float *inner, float *outer) {
+   if (thickness > 0.0f) {
+      *outer = radius + thickness * 0.5f;
+      *inner = radius - thickness * 0.5f;
+      if (*inner < 0.0f)
+         *inner = 0.0f;
+   } else {
+      *outer = radius;
+      *inner = -1.0f;
+   }
+}
+
+int module_shape_circle(float radius, float thickness, const float **out) {
+   if (!(radius > 0.0f))
+      return 0;
+   float *params = begin_key(SHAPE_CIRCLE, 2);
+   if (!params)
+      return 0;
+   params[0] = radius;
+   params[1] = thickness > 0.0f ? thickness : 0.0f;
+   int n = lookup(out);
+   if (n >= 0)
+      return n;
+   float inner, outer;
+   ring_radii(radius, thickness, &inner, &outer);
+   arc(inner, outer, 0.0f, 2.0f * SHAPE_PI);
+   return store(out);
+}
+
+int module_shape_arc(float radius, float start, float end, float thickness, const float **out) {
+   float sweep = end - start;
+   if (!(radius > 0.0f) || sweep == 0.0f)
+      return 0;
+   if (sweep > 360.0f)
+      sweep = 360.0f;
+   if (sweep < -360.0f)
+      sweep = -360.0f;
+   float *params = begin_key(SHAPE_ARC, 4);
+   if (!params)
+      return 0;
+   params[0] = radius;
+   params[1] = start;
+   params[2] = sweep;
+   params[3] = thickness > 0.0f ? thickness : 0.0f;
+   int n = lookup(out);
+   if (n >= 0)
+      return n;
+   float inner, outer;
+   ring_radii(radius, thickness, &inner, &outer);
+   arc(inner, outer, start * (SHAPE_PI / 180.0f), sweep * (SHAPE_PI / 180.0f));
+   return store(out);
+}
+
+int module_shape_rounded_rect(float w, float h, float radius, const float **out) {
+   w = fabsf(w);
+   h = fabsf(h);
+   if (w == 0.0f || h == 0.0f)
+      return 0;
+   float limit = (w < h ? w : h) * 0.5f;
+   radius = radius < 0.0f ? 0.0f : radius > limit ? limit : radius;
+   float *params = begin_key(SHAPE_ROUNDED_RECT, 3);
+   if (!params)
+      return 0;
+   params[0] = w;
+   params[1] = h;
+   params[2] = radius;
+   int n = lookup(out);
+   if (n >= 0)
+      return n;
+
+   float hw = w * 0.5f, hh = h * 0.5f;
+   if (radius == 0.0f) {
+      emit_triangle(-hw, -hh, hw, -hh, -hw, hh);
+      emit_triangle(hw, -hh, hw, hh, -hw, hh);
+      return store(out);
+   }
+
+   // Fan from the centre over the outline, one quarter circle per corner
+   static const float corners[4][2] = {{1.0f, 1.0f}, {-1.0f, 1.0f}, {-1.0f, -1.0f}, {1.0f, -1.0f}};
+   int segments = segments_for(radius, SHAPE_PI * 0.5f);
+   float step = SHAPE_PI * 0.5f / segments;
+   float first[2] = {0.0f, 0.0f}, prev[2] = {0.0f, 0.0f};
+   for (int c = 0; c < 4; c++) {
+      float cx = corners[c][0] * (hw - radius), cy = corners[c][1] * (hh - radius);
+      for (int i = 0; i <= segments; i++) {
+         float angle = SHAPE_PI * 0.5f * c + step * i;
+         float pt[2] = {cx + cosf(angle) * radius, cy + sinf(angle) * radius};
+         if (c == 0 && i == 0)
+            memcpy(first, pt, sizeof(pt));
+         else
+            emit_triangle(0.0f, 0.0f, prev[0], prev[1], pt[0], pt[1]);
+         memcpy(prev, pt, sizeof(pt));
+      }
+   }
+   emit_triangle(0.0f, 0.0f, prev[0], prev[1], first[0], first[1]);
+   return store(out);
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings
+
+// Read a table of {x, y} points; returns them in a buffer valid until the
+// next call. With origin set, the first point is stored there and the
+// points are made relative to it.
+static float *check_points(lua_State *L, int arg, int min_count, float *origin, int *count) {
+   static float *points = NULL;
+   static int capacity = 0;
+   luaL_checktype(L, arg, LUA_TTABLE);
+   lua_Unsigned n = lua_rawlen(L, arg);
+   luaL_argcheck(L, n >= (lua_Unsigned)min_count, arg, "not enough points");
+   luaL_argcheck(L, n <= INT32_MAX / 2, arg, "too many points");
+   if (!grow((void **)&points, &capacity, (int)n * 2, sizeof(float)))
+      luaL_error(L, "out of memory for %d points", (int)n);
+   for (lua_Unsigned i = 0; i < n; i++) {
+      lua_rawgeti(L, arg, (lua_Integer)i + 1);
+      luaL_checktype(L, -1, LUA_TTABLE);
+      lua_rawgeti(L, -1, 1);
+      lua_rawgeti(L, -2, 2);
+      points[i * 2] = (float)luaL_checknumber(L, -2);
+      points[i * 2 + 1] = (float)luaL_checknumber(L, -1);
+      lua_pop(L, 3);
+   }
+   if (origin) {
+      origin[0] = points[0];
+      origin[1] = points[1];
+      for (lua_Unsigned i = 0; i < n; i++) {
+         points[i * 2] -= origin[0];
+         points[i * 2 + 1] -= origin[1];
+      }
+   }
+   *count = (int)n;
+   return points;
+}
+
+static void draw_shape(const float *triangles, int count, float x, float y, float rotation,
+                       float r, float g, float b, float a) {
+   if (count > 0)
+      module_opengl_draw_triangles(triangles, count, x, y, rotation, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
+}
+
+// draw_polygon(points, x, y, rotation, r, g, b, a)
+static int lua_draw_polygon(lua_State *L) {
+   int count;
+   float *points = check_points(L, 1, 3, NULL, &count);
+   float x = (float)luaL_checknumber(L, 2);
+   float y = (float)luaL_checknumber(L, 3);
+   float rotation = (float)luaL_checknumber(L, 4);
+   float r = (float)luaL_checknumber(L, 5);
+   float g = (float)luaL_checknumber(L, 6);
+   float b = (float)luaL_checknumber(L, 7);
+   float a = (float)luaL_checknumber(L, 8);
+   const float *triangles;
+   int vertices = module_shape_polygon(points, count, &triangles);
+   draw_shape(triangles, vertices, x, y, rotation, r, g, b, a);
+   return 0;
+}
+
+// draw_line(x1, y1, x2, y2, width, r, g, b, a)
+static int lua_draw_line(lua_State *L) {
+   float x1 = (float)luaL_checknumber(L, 1);
+   float y1 = (float)luaL_checknumber(L, 2);
+   float x2 = (float)luaL_checknumber(L, 3);
+   float y2 = (float)luaL_checknumber(L, 4);
+   float width = (float)luaL_checknumber(L, 5);
+   float r = (float)luaL_checknumber(L, 6);
+   float g = (float)luaL_checknumber(L, 7);
+   float b = (float)luaL_checknumber(L, 8);
+   float a = (float)luaL_checknumber(L, 9);
+   // Relative to the start, so lines of the same length and direction share triangles
+   const float points[4] = {0.0f, 0.0f, x2 - x1, y2 - y1};
+   const float *triangles;
+   int vertices = module_shape_stroke(points, 2, width, false, &triangles);
+   draw_shape(triangles, vertices, x1, y1, 0.0f, r, g, b, a);
+   return 0;
+}
+
+// draw_polyline(points, width, r, g, b, a [, closed])
+static int lua_draw_polyline(lua_State *L) {
+   int count;
+   float origin[2];
+   float *points = check_points(L, 1, 2, origin, &count);
+   float width = (float)luaL_checknumber(L, 2);
+   float r = (float)luaL_checknumber(L, 3);
+   float g = (float)luaL_checknumber(L, 4);
+   float b = (float)luaL_checknumber(L, 5);
+   float a = (float)luaL_checknumber(L, 6);
+   bool closed = lua_toboolean(L, 7);
+   const float *triangles;
+   int vertices = module_shape_stroke(points, count, width, closed, &triangles);
+   draw_shape(triangles, vertices, origin[0], origin[1], 0.0f, r, g, b, a);
+   return 0;
+}
+
+// draw_circle(x, y, radius, r, g, b, a [, thickness])
+static int lua_draw_circle(lua_State *L) {
+   float x = (float)luaL_checknumber(L, 1);
+   float y = (float)luaL_checknumber(L, 2);
+   float radius = (float)luaL_checknumber(L, 3);
+   float r = (float)luaL_checknumber(L, 4);
+   float g = (float)luaL_checknumber(L, 5);
+   float b = (float)luaL_checknumber(L, 6);
+   float a = (float)luaL_checknumber(L, 7);
+   float thickness = (float)luaL_optnumber(L, 8, 0.0);
+   const float *triangles;
+   int vertices = module_shape_circle(radius, thickness, &triangles);
+   draw_shape(triangles, vertices, x, y, 0.0f, r, g, b, a);
+   return 0;
+}
+
+// draw_arc(x, y, radius, start, end, r, g, b, a [, thickness])
+static int lua_draw_arc(lua_State *L) {
+   float x = (float)luaL_checknumber(L, 1);
+   float y = (float)luaL_checknumber(L, 2);
+   float radius = (float)luaL_checknumber(L, 3);
+   float start = (float)luaL_checknumber(L, 4);
+   float end = (float)luaL_checknumber(L, 5);
+   float r = (float)luaL_checknumber(L, 6);
+   float g = (float)luaL_checknumber(L, 7);
+   float b = (float)luaL_checknumber(L, 8);
+   float a = (float)luaL_checknumber(L, 9);
+   float thickness = (float)luaL_optnumber(L, 10, 0.0);
+   const float *triangles;
+   int vertices = module_shape_arc(radius, start, end, thickness, &triangles);
+   draw_shape(triangles, vertices, x, y, 0.0f, r, g, b, a);
+   return 0;
+}
+
+// draw_rounded_rect(x, y, w, h, radius, rotation, r, g, b, a)
+static int lua_draw_rounded_rect(lua_State *L) {
+   float x = (float)luaL_checknumber(L, 1);
+   float y = (float)luaL_checknumber(L, 2);
+   float w = (float)luaL_checknumber(L, 3);
+   float h = (float)luaL_checknumber(L, 4);
+   float radius = (float)luaL_checknumber(L, 5);
+   float rotation = (float)luaL_checknumber(L, 6);
+   float r = (float)luaL_checknumber(L, 7);
+   float g = (float)luaL_checknumber(L, 8);
+   float b = (float)luaL_checknumber(L, 9);
+   float a = (float)luaL_checknumber(L, 10);
+   const float *triangles;
+   int vertices = module_shape_rounded_rect(w, h, radius, &triangles);
+   draw_shape(triangles, vertices, x, y, rotation, r, g, b, a);
+   return 0;
+}
+
+void module_shape_register(lua_State *L) {
+   lua_register(L, "draw_polygon", lua_draw_polygon);
+   lua_register(L, "draw_line", lua_draw_line);
+   lua_register(L, "draw_polyline", lua_draw_polyline);
+   lua_register(L, "draw_circle", lua_draw_circle);
+   lua_register(L, "draw_arc", lua_draw_arc);
+   lua_register(L, "draw_rounded_rect", lua_draw_rounded_rect);
+}
@@ -0,0 +1,505 @@
+// module_tasks.c
+// Frame scheduler for Lua coroutines. tasks.spawn(fn, ...) runs fn in a
+// coroutine right away, until it finishes or waits. A waiting task is parked
+// in a min-heap keyed by the frame (wait_frames) or animation time
+// (wait_seconds) it wakes at, or on the waiter list of an async load (await).
+// Each frame, module_tasks_update pops only the tasks that are due, so idle
+// tasks cost nothing.
+//
+// Coroutine threads that finish normally are kept in a pool and reused by
+// later spawns (a finished Lua thread accepts a new function), which saves a
+// thread allocation and its garbage per task. Threads that end in an error
+// are dropped.
+//
+// Async image loads decode on the job system and upload their texture from
+// module_tasks_update once the decode is done.
+#include "module_tasks.h"
+#include "module_jobs.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TASKS_POOL_MAX 64  // idle threads kept for reuse
+#define ASYNC_METATABLE "lrcgl.async"
+
+typedef enum {
+   ASYNC_PENDING = 0,
+   ASYNC_DONE,
+   ASYNC_FAILED
+} async_state;
+
+// An image load in flight or finished. Owned by its Lua handle once done;
+// while pending, by the pending list (a collected handle marks it abandoned).
+typedef struct async_load {
+   job job;
+   char *asset;
+   unsigned char *pixels;  // written by the decode job
+   int width, height;
+   async_state state;
+   GLuint texture;
+   bool abandoned;
+   int *waiters;           // tasks blocked in await
+   int num_waiters, waiter_capacity;
+   struct async_load *next;
+} async_load;
+
+typedef struct {
+   lua_State *thread;
+   int ref;                // registry reference keeping the thread alive
+   bool active;
+   bool waiting;           // parked by a wait call rather than preempted
+   int num_results;        // values handed to the task when it next resumes
+   lua_Integer results[3];
+} task;
+
+typedef struct {
+   double key;             // frame number or animation time
+   uint32_t seq;           // FIFO among equal keys
+   int task;
+} wake_entry;
+
+typedef struct {
+   wake_entry *items;
+   int count, capacity;
+} wake_heap;
+
+typedef struct {
+   lua_State *thread;
+   int ref;
+} pooled_thread;
+
+static struct {
+   task *tasks;
+   int num_tasks, task_capacity;
+   int *free_slots;        // room for every slot
+   int num_free, free_capacity;
+   int current;            // task being resumed, -1 outside tasks
+   int active;
+
+   pooled_thread pool[TASKS_POOL_MAX];
+   int pool_count;
+
+   wake_heap frames;       // keyed by frame number
+   wake_heap timers;       // keyed by animation time
+   uint32_t seq;
+   uint64_t frame;
+   double time;
+
+   int *due;               // tasks to resume this frame
+   int num_due, due_capacity;
+
+   async_load *pending;
+} sched = {.current = -1};
+
+static bool grow(void **items, int *capacity, int count, size_t item_size) {
+   if (count < *capacity)
+      return true;
+   int new_capacity = *capacity ? *capacity * 2 : 32;
+   void *p = realloc(*items, (size_t)new_capacity * item_size);
+   if (!p)
+      return false;
+   *items = p;
+   *capacity = new_capacity;
+   return true;
+}
+
+// ---------------------------------------------------------------------------
+// Wake queues
+
+static bool entry_before(const wake_entry *a, const wake_entry *b) {
+   return a->key < b->key || (a->key == b->key && (int32_t)(a->seq - b->seq) < 0);
+}
+
+static bool heap_push(wake_heap *h, double key, int task) {
+   if (!grow((void **)&h->items, &h->capacity, h->count, sizeof(wake_entry)))
+      return false;
+   wake_entry e = {key, sched.seq++, task};
+   int i = h->count++;
+   while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (!entry_before(&e, &h->items[parent]))
+         break;
+      h->items[i] = h->items[parent];
+      i = parent;
+   }
+   h->items[i] = e;
+   return true;
+}
+
+static int heap_pop(wake_heap *h) {
+   int task = h->items[0].task;
+   wake_entry last = h->items[--h->count];
+   int i = 0;
+   for (;;) {
+      int child = i * 2 + 1;
+      if (child >= h->count)
+         break;
+      if (child + 1 < h->count && entry_before(&h->items[child + 1], &h->items[child]))
+         child++;
+      if (!entry_before(&h->items[child], &last))
+         break;
+      h->items[i] = h->items[child];
+      i = child;
+   }
+   if (h->count)
+      h->items[i] = last;
+   return task;
+}
+
+static void mark_due(int task) {
+   if (grow((void **)&sched.due, &sched.due_capacity, sched.num_due, sizeof(int)))
+      sched.due[sched.num_due++] = task;
+   else
+      core_log(RETRO_LOG_ERROR, "Tasks: out of memory, a task will not resume");
+}
+
+// ---------------------------------------------------------------------------
+// Tasks
+
+// Take a free slot with a fresh or pooled thread; returns -1 on failure
+static int new_task(lua_State *L) {
+   int idx;
+   if (sched.num_free > 0) {
+      idx = sched.free_slots[--sched.num_free];
+   } else {
+      if (!grow((void **)&sched.tasks, &sched.task_capacity, sched.num_tasks, sizeof(task)) ||
+          !grow((void **)&sched.free_slots, &sched.free_capacity, sched.num_tasks, sizeof(int)))
+         return -1;
+      idx = sched.num_tasks++;
+   }
+
+   task *t = &sched.tasks[idx];
+   memset(t, 0, sizeof(*t));
+   if (sched.pool_count > 0) {
+      pooled_thread *p = &sched.pool[--sched.pool_count];
+      t->thread = p->thread;
+      t->ref = p->ref;
+   } else {
+      t->thread = lua_newthread(L);
+      t->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+   }
+   t->active = true;
+   sched.active++;
+   return idx;
+}
+
+static void free_task(lua_State *L, int idx, bool reuse_thread) {
+   task *t = &sched.tasks[idx];
+   if (reuse_thread && sched.pool_count < TASKS_POOL_MAX) {
+      lua_settop(t->thread, 0);
+      sched.pool[sched.pool_count++] = (pooled_thread){t->thread, t->ref};
+   } else {
+      luaL_unref(L, LUA_REGISTRYINDEX, t->ref);
+   }
+   t->active = false;
+   t->thread = NULL;
+   sched.active--;
+   sched.free_slots[sched.num_free++] = idx;
+}
+
+// Resume a task with nargs values already pushed on its thread
+static void resume_task(lua_State *L, int idx, int nargs) {
+   lua_State *T = sched.tasks[idx].thread;
+   sched.tasks[idx].waiting = false;
+   int previous = sched.current;
+   sched.current = idx;
+   int nres = 0;
+   int status = lua_resume(T, L, nargs, &nres);
+   sched.current = previous;
+
+   // Reload: tasks spawned meanwhile may have moved the array
+   task *t = &sched.tasks[idx];
+   if (status == LUA_YIELD) {
+      lua_pop(T, nres);
+      // Preempted by the watchdog or a plain coroutine.yield: continue next frame
+      if (!t->waiting && !heap_push(&sched.frames, (double)(sched.frame + 1), idx)) {
+         core_log(RETRO_LOG_ERROR, "Tasks: out of memory, dropping a task");
+         free_task(L, idx, false);
+      }
+      return;
+   }
+   if (status == LUA_OK) {
+      free_task(L, idx, true);
+      return;
+   }
+   const char *msg = lua_tostring(T, -1);
+   luaL_traceback(L, T, msg ? msg : "(error object is not a string)", 0);
+   core_log(RETRO_LOG_ERROR, "Lua task error: %s", lua_tostring(L, -1));
+   lua_pop(L, 1);
+   free_task(L, idx, false);
+}
+
+bool module_tasks_is_running(lua_State *T) {
+   return sched.current >= 0 && sched.tasks[sched.current].thread == T;
+}
+
+// Index of the task running on L, raising an error outside tasks
+static int current_task(lua_State *L, const char *fn) {
+   if (sched.current < 0 || sched.tasks[sched.current].thread != L)
+      return luaL_error(L, "%s can only be called from a task started by tasks.spawn", fn);
+   if (!lua_isyieldable(L))
+      return luaL_error(L, "%s cannot wait across a C call (metamethod or iterator)", fn);
+   return sched.current;
+}
+
+// ---------------------------------------------------------------------------
+// Async loads
+
+static void decode_job(void *data) {
+   async_load *load = (async_load *)data;
+   load->pixels = module_opengl_decode_image(load->asset, &load->width, &load->height);
+}
+
+static void free_load(async_load *load) {
+   if (load->pixels)
+      module_opengl_free_image(load->pixels);
+   free(load->asset);
+   free(load->waiters);
+   free(load);
+}
+
+// Upload finished decodes and wake the tasks awaiting them
+static void poll_loads(void) {
+   async_load **link = &sched.pending;
+   while (*link) {
+      async_load *load = *link;
+      if (!module_jobs_done(&load->job)) {
+         link = &load->next;
+         continue;
+      }
+      *link = load->next;
+      if (load->abandoned) {
+         free_load(load);
+         continue;
+      }
+
+      if (load->pixels) {
+         load->texture = module_opengl_upload_image(load->pixels, load->width, load->height);
+         module_opengl_free_image(load->pixels);
+         load->pixels = NULL;
+      }
+      load->state = load->texture ? ASYNC_DONE : ASYNC_FAILED;
+      if (load->texture)
+         core_log(RETRO_LOG_INFO, "Loaded image %s (%dx%d) as texture %u", load->asset, load->width, load->height, load->texture);
+
+      for (int i = 0; i < load->num_waiters; i++) {
+         task *t = &sched.tasks[load->waiters[i]];
+         if (load->state == ASYNC_DONE) {
+            t->results[0] = load->texture;
+            t->results[1] = load->width;
+            t->results[2] = load->height;
+            t->num_results = 3;
+         } else {
+            t->num_results = 0;  // resumed with no values: await returns nil
+         }
+         mark_due(load->waiters[i]);
+      }
+      load->num_waiters = 0;
+   }
+}
+
+static async_load **check_handle(lua_State *L, int arg) {
+   async_load **ud = (async_load **)luaL_checkudata(L, arg, ASYNC_METATABLE);
+   if (!*ud)
+      luaL_argerror(L, arg, "handle already released");
+   return ud;
+}
+
+static int push_load_result(lua_State *L, const async_load *load) {
+   if (load->state != ASYNC_DONE) {
+      lua_pushnil(L);
+      return 1;
+   }
+   lua_pushinteger(L, load->texture);
+   lua_pushinteger(L, load->width);
+   lua_pushinteger(L, load->height);
+   return 3;
+}
+
+// ---------------------------------------------------------------------------
+// Lua API
+
+// tasks.spawn(fn, ...): run fn(...) as a task until it finishes or waits
+static int lua_tasks_spawn(lua_State *L) {
+   luaL_checktype(L, 1, LUA_TFUNCTION);
+   int nargs = lua_gettop(L) - 1;
+   int idx = new_task(L);
+   if (idx < 0)
+      return luaL_error(L, "tasks.spawn: out of memory");
+   lua_State *T = sched.tasks[idx].thread;
+   if (!lua_checkstack(T, nargs + 1)) {
+      free_task(L, idx, true);
+      return luaL_error(L, "tasks.spawn: too many arguments");
+   }
+   lua_xmove(L, T, nargs + 1);
+   resume_task(L, idx, nargs);
+   return 0;
+}
+
+// tasks.wait_frames([n = 1]): continue n frames later
+static int lua_tasks_wait_frames(lua_State *L) {
+   lua_Integer n = luaL_optinteger(L, 1, 1);
+   int idx = current_task(L, "wait_frames");
+   if (n < 1)
+      n = 1;
+   if (!heap_push(&sched.frames, (double)sched.frame + (double)n, idx))
+      return luaL_error(L, "wait_frames: out of memory");
+   sched.tasks[idx].waiting = true;
+   return lua_yield(L, 0);
+}
+
+// tasks.wait_seconds(t): continue on the first frame whose time is t seconds later
+static int lua_tasks_wait_seconds(lua_State *L) {
+   lua_Number seconds = luaL_checknumber(L, 1);
+   int idx = current_task(L, "wait_seconds");
+   // Never due in the frame that is being run, or the task would spin
+   if (!heap_push(seconds > 0 ? &sched.timers : &sched.frames,
+                  seconds > 0 ? sched.time + seconds : (double)(sched.frame + 1), idx))
+      return luaL_error(L, "wait_seconds: out of memory");
+   sched.tasks[idx].waiting = true;
+   return lua_yield(L, 0);
+}
+
+// tasks.await(handle) -> texture_id, width, height (nil if the load failed)
+static int lua_tasks_await(lua_State *L) {
+   async_load *load = *check_handle(L, 1);
+   if (load->state != ASYNC_PENDING)
+      return push_load_result(L, load);
+
+   int idx = current_task(L, "await");
+   if (!grow((void **)&load->waiters, &load->waiter_capacity, load->num_waiters, sizeof(int)))
+      return luaL_error(L, "await: out of memory");
+   load->waiters[load->num_waiters++] = idx;
+   sched.tasks[idx].waiting = true;
+   // The results are pushed by module_tasks_update when it resumes the task
+   return lua_yield(L, 0);
+}
+
+// tasks.load_image(asset_name) -> handle: decode in the background
+static int lua_tasks_load_image(lua_State *L) {
+   const char *asset = luaL_checkstring(L, 1);
+   async_load **ud = (async_load **)lua_newuserdatauv(L, sizeof(async_load *), 0);
+   *ud = NULL;
+   luaL_setmetatable(L, ASYNC_METATABLE);
+
+   async_load *load = (async_load *)calloc(1, sizeof(async_load));
+   size_t len = strlen(asset) + 1;
+   if (load)
+      load->asset = (char *)malloc(len);
+   if (!load || !load->asset) {
+      free(load);
+      return luaL_error(L, "tasks.load_image: out of memory");
+   }
+   memcpy(load->asset, asset, len);
+   load->next = sched.pending;
+   sched.pending = load;
+   *ud = load;
+
+   module_jobs_prepare(&load->job, decode_job, load);
+   module_jobs_submit(&load->job);
+   return 1;
+}
+
+// handle:done() -> bool
+static int lua_async_done(lua_State *L) {
+   lua_pushboolean(L, (*check_handle(L, 1))->state != ASYNC_PENDING);
+   return 1;
+}
+
+// handle:result() -> texture_id, width, height, or nil while pending or failed
+static int lua_async_result(lua_State *L) {
+   return push_load_result(L, *check_handle(L, 1));
+}
+
+static int lua_async_gc(lua_State *L) {
+   async_load **ud = (async_load **)luaL_checkudata(L, 1, ASYNC_METATABLE);
+   async_load *load = *ud;
+   *ud = NULL;
+   if (!load)
+      return 0;
+   if (load->state == ASYNC_PENDING)
+      load->abandoned = true;  // freed by poll_loads once the decode is done
+   else
+      free_load(load);
+   return 0;
+}
+
+// tasks.count() -> active tasks, pooled threads
+static int lua_tasks_count(lua_State *L) {
+   lua_pushinteger(L, sched.active);
+   lua_pushinteger(L, sched.pool_count);
+   return 2;
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+void module_tasks_update(lua_State *L, double time) {
+   sched.frame++;
+   sched.time = time;
+   sched.num_due = 0;
+
+   poll_loads();
+   while (sched.frames.count && sched.frames.items[0].key <= (double)sched.frame)
+      mark_due(heap_pop(&sched.frames));
+   while (sched.timers.count && sched.timers.items[0].key <= time)
+      mark_due(heap_pop(&sched.timers));
+
+   // Tasks that wait again are queued for a later frame, not appended here
+   int count = sched.num_due;
+   for (int i = 0; i < count; i++) {
+      int idx = sched.due[i];
+      task *t = &sched.tasks[idx];
+      int nargs = t->num_results;
+      for (int k = 0; k < nargs; k++)
+         lua_pushinteger(t->thread, t->results[k]);
+      t->num_results = 0;
+      resume_task(L, idx, nargs);
+   }
+   sched.num_due = 0;
+}
+
+void module_tasks_shutdown(void) {
+   while (sched.pending) {
+      async_load *load = sched.pending;
+      sched.pending = load->next;
+      module_jobs_wait(&load->job);
+      free_load(load);
+   }
+   free(sched.tasks);
+   free(sched.free_slots);
+   free(sched.frames.items);
+   free(sched.timers.items);
+   free(sched.due);
+   memset(&sched, 0, sizeof(sched));
+   sched.current = -1;
+}
+
+void module_tasks_register(lua_State *L) {
+   static const luaL_Reg async_methods[] = {
+      {"done", lua_async_done},
+      {"result", lua_async_result},
+      {NULL, NULL}
+   };
+   if (luaL_newmetatable(L, ASYNC_METATABLE)) {
+      luaL_newlib(L, async_methods);
+      lua_setfield(L, -2, "__index");
+      lua_pushcfunction(L, lua_async_gc);
+      lua_setfield(L, -2, "__gc");
+   }
+   lua_pop(L, 1);
+
+   static const luaL_Reg funcs[] = {
+      {"spawn", lua_tasks_spawn},
+      {"wait_frames", lua_tasks_wait_frames},
+      {"wait_seconds", lua_tasks_wait_seconds},
+      {"await", lua_tasks_await},
+      {"load_image", lua_tasks_load_image},
+      {"count", lua_tasks_count},
+      {NULL, NULL}
+   };
+   luaL_newlib(L, funcs);
+   lua_setglobal(L, "tasks");
+}
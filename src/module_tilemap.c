@@ -0,0 +1,497 @@
+// module_tilemap.c
+// Tile maps drawn from static chunk meshes. The grid is split into
+// TILEMAP_CHUNK x TILEMAP_CHUNK chunks, each with its own vertex buffer that
+// holds two triangles per non-empty tile. A chunk's mesh is built the first
+// time it is drawn and rebuilt only after one of its tiles changed, so a
+// frame costs one draw per visible chunk however large the map is. Drawing
+// visits only the chunk range that intersects the viewport; dirty chunks
+// outside it wait until they scroll into view.
+#include "module_tilemap.h"
+#include "module_cmdlist.h"
+#include "module_opengl.h"
+#include "libretro_core.h"
+#include "core_thread.h"
+#include <lauxlib.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILEMAP_CHUNK 32
+#define TILEMAP_METATABLE "lrcgl.tilemap"
+#define TILE_FLOATS 24  // two triangles of x, y, u, v
+
+typedef struct {
+   int num_vertices;
+   bool dirty;
+} tile_chunk;
+
+struct tilemap {
+   GLuint texture;
+   int texture_w, texture_h;
+   int tile_w, tile_h;
+   int tileset_cols, tileset_count;
+
+   int cols, rows;
+   uint32_t *tiles;  // row-major
+
+   int chunks_x, chunks_y;
+   tile_chunk *chunks;
+   GLuint *vaos, *vbos;
+   float *vertices;  // build scratch for one chunk
+   int generation;   // mesh_generation the chunk meshes were created in
+
+   // Statistics of the last draw
+   int drawn, rebuilt;
+};
+
+// GL objects of maps destroyed while no command list was recording (Lua
+// garbage collection between frames), released by module_tilemap_flush.
+// Only touched by the thread that owns the Lua state.
+static struct {
+   GLuint *vaos, *vbos, *textures;
+   int count, texture_count;
+   int capacity, texture_capacity;
+} graveyard;
+
+// Bumped by module_tilemap_flush after the GL context was recreated; maps
+// whose meshes are older recreate them and rebuild every chunk when drawn
+static int mesh_generation = 0;
+static volatile int32_t meshes_lost = 0;  // set by module_tilemap_context_reset
+
+static bool grow_names(GLuint **array, int *capacity, int needed) {
+   if (needed <= *capacity)
+      return true;
+   int new_capacity = *capacity ? *capacity : 64;
+   while (new_capacity < needed)
+      new_capacity *= 2;
+   GLuint *p = realloc(*array, (size_t)new_capacity * sizeof(GLuint));
+   if (!p)
+      return false;
+   *array = p;
+   *capacity = new_capacity;
+   return true;
+}
+
+static bool graveyard_push(const tilemap *map, int num_chunks) {
+   int needed = graveyard.count + num_chunks;
+   if (!grow_names(&graveyard.textures, &graveyard.texture_capacity, graveyard.texture_count + 1))
+      return false;
+   // Both mesh arrays share one capacity, so grow the second from the old value
+   int capacity = graveyard.capacity;
+   if (!grow_names(&graveyard.vaos, &capacity, needed))
+      return false;
+   if (!grow_names(&graveyard.vbos, &graveyard.capacity, needed))
+      return false;
+   memcpy(graveyard.vaos + graveyard.count, map->vaos, (size_t)num_chunks * sizeof(GLuint));
+   memcpy(graveyard.vbos + graveyard.count, map->vbos, (size_t)num_chunks * sizeof(GLuint));
+   graveyard.count = needed;
+   graveyard.textures[graveyard.texture_count++] = map->texture;
+   return true;
+}
+
+// ---------------------------------------------------------------------------
+// Maps
+
+tilemap *module_tilemap_create(const char *tileset_asset, int tile_w, int tile_h, int cols, int rows) {
+   if (tile_w <= 0 || tile_h <= 0 || cols <= 0 || rows <= 0 || (size_t)cols * rows > INT32_MAX) {
+      core_log(RETRO_LOG_ERROR, "Tilemap: invalid size %dx%d tiles of %dx%d", cols, rows, tile_w, tile_h);
+      return NULL;
+   }
+   tilemap *map = (tilemap *)calloc(1, sizeof(tilemap));
+   if (!map)
+      return NULL;
+   map->texture = module_opengl_load_image(tileset_asset, &map->texture_w, &map->texture_h);
+   if (!map->texture) {
+      free(map);
+      return NULL;
+   }
+   map->tile_w = tile_w;
+   map->tile_h = tile_h;
+   map->tileset_cols = map->texture_w / tile_w;
+   map->tileset_count = map->tileset_cols * (map->texture_h / tile_h);
+   map->cols = cols;
+   map->rows = rows;
+   map->chunks_x = (cols + TILEMAP_CHUNK - 1) / TILEMAP_CHUNK;
+   map->chunks_y = (rows + TILEMAP_CHUNK - 1) / TILEMAP_CHUNK;
+
+   int num_chunks = map->chunks_x * map->chunks_y;
+   map->tiles = (uint32_t *)calloc((size_t)cols * rows, sizeof(uint32_t));
+   map->chunks = (tile_chunk *)calloc((size_t)num_chunks, sizeof(tile_chunk));
+   map->vaos = (GLuint *)calloc((size_t)num_chunks, sizeof(GLuint));
+   map->vbos = (GLuint *)calloc((size_t)num_chunks, sizeof(GLuint));
+   map->vertices = (float *)malloc((size_t)TILEMAP_CHUNK * TILEMAP_CHUNK * TILE_FLOATS * sizeof(float));
+   if (!map->tiles || !map->chunks || !map->vaos || !map->vbos || !map->vertices ||
+       !module_opengl_create_meshes(num_chunks, map->vaos, map->vbos)) {
+      core_log(RETRO_LOG_ERROR, "Tilemap: failed to allocate %d chunks", num_chunks);
+      module_tilemap_destroy(map);
+      return NULL;
+   }
+   for (int c = 0; c < num_chunks; c++)
+      map->chunks[c].dirty = true;
+   map->generation = mesh_generation;
+   core_log(RETRO_LOG_INFO, "Tilemap: %dx%d tiles in %d chunks, tileset %s with %d tiles",
+            cols, rows, num_chunks, tileset_asset, map->tileset_count);
+   return map;
+}
+
+// Count the rows and columns of a CSV grid; false if the rows differ in length
+static bool csv_dimensions(const char *text, size_t size, int *cols, int *rows) {
+   int row_cols = 0;
+   bool in_value = false;
+   *cols = 0;
+   *rows = 0;
+   for (size_t i = 0; i <= size; i++) {
+      char c = i < size ? text[i] : '\n';
+      if (c == ',' || c == '\n') {
+         // Tiled ends every row but the last with a comma
+         if (in_value)
+            row_cols++;
+         in_value = false;
+         if (c == ',' || row_cols == 0)
+            continue;
+         if (*rows == 0)
+            *cols = row_cols;
+         else if (row_cols != *cols)
+            return false;
+         (*rows)++;
+         row_cols = 0;
+      } else if (c != '\r' && c != ' ' && c != '\t') {
+         in_value = true;
+      }
+   }
+   return *rows > 0;
+}
+
+tilemap *module_tilemap_load_csv(const char *tileset_asset, int tile_w, int tile_h, const char *csv_asset) {
+   char *text = NULL;
+   size_t size = 0;
+   if (!extract_asset_from_zip(csv_asset, &text, &size)) {
+      core_log(RETRO_LOG_ERROR, "Tilemap: failed to extract %s", csv_asset);
+      return NULL;
+   }
+   int cols, rows;
+   if (!csv_dimensions(text, size, &cols, &rows)) {
+      core_log(RETRO_LOG_ERROR, "Tilemap: %s is not a rectangular CSV grid", csv_asset);
+      free(text);
+      return NULL;
+   }
+   tilemap *map = module_tilemap_create(tileset_asset, tile_w, tile_h, cols, rows);
+   if (map) {
+      // Rows are known to be complete, so the values can be read in order
+      size_t i = 0, n = (size_t)cols * rows;
+      for (size_t k = 0; k < n; k++) {
+         while (i < size && (text[i] < '0' || text[i] > '9'))
+            i++;
+         uint32_t value = 0;
+         while (i < size && text[i] >= '0' && text[i] <= '9')
+            value = value * 10u + (uint32_t)(text[i++] - '0');
+         map->tiles[k] = value;
+      }
+   }
+   free(text);
+   return map;
+}
+
+void module_tilemap_destroy(tilemap *map) {
+   if (!map)
+      return;
+   int num_chunks = map->chunks_x * map->chunks_y;
+   if (!module_opengl_is_initialized() || map->generation != mesh_generation) {
+      // The names died with the context they were created in
+   } else if (map->vaos && map->vbos && map->vaos[0]) {
+      if (module_cmdlist_recording()) {
+         module_opengl_free_meshes(num_chunks, map->vaos, map->vbos);
+         module_opengl_free_texture(map->texture);
+      } else if (!graveyard_push(map, num_chunks)) {
+         core_log(RETRO_LOG_WARN, "Tilemap: leaking GL objects of a collected map");
+      }
+   } else if (map->texture) {
+      module_opengl_free_texture(map->texture);
+   }
+   free(map->tiles);
+   free(map->chunks);
+   free(map->vaos);
+   free(map->vbos);
+   free(map->vertices);
+   free(map);
+}
+
+void module_tilemap_flush(void) {
+   if (core_atomic_load(&meshes_lost)) {
+      // The buried names belonged to the old context; drop them
+      core_atomic_store(&meshes_lost, 0);
+      mesh_generation++;
+   } else {
+      module_opengl_free_meshes(graveyard.count, graveyard.vaos, graveyard.vbos);
+      for (int i = 0; i < graveyard.texture_count; i++)
+         module_opengl_free_texture(graveyard.textures[i]);
+   }
+   graveyard.count = 0;
+   graveyard.texture_count = 0;
+}
+
+void module_tilemap_context_reset(void) {
+   core_atomic_store(&meshes_lost, 1);
+}
+
+void module_tilemap_shutdown(void) {
+   free(graveyard.vaos);
+   free(graveyard.vbos);
+   free(graveyard.textures);
+   memset(&graveyard, 0, sizeof(graveyard));
+}
+
+uint32_t module_tilemap_get(const tilemap *map, int col, int row) {
+   if (col < 0 || col >= map->cols || row < 0 || row >= map->rows)
+      return 0;
+   return map->tiles[(size_t)row * map->cols + col];
+}
+
+void module_tilemap_set(tilemap *map, int col, int row, uint32_t tile) {
+   if (col < 0 || col >= map->cols || row < 0 || row >= map->rows)
+      return;
+   uint32_t *slot = &map->tiles[(size_t)row * map->cols + col];
+   if (*slot == tile)
+      return;
+   *slot = tile;
+   map->chunks[(row / TILEMAP_CHUNK) * map->chunks_x + col / TILEMAP_CHUNK].dirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Chunk meshes
+
+// Fill map->vertices for chunk (cx, cy) in map-local pixels; returns the vertex count
+static int build_chunk(tilemap *map, int cx, int cy) {
+   const float tw = (float)map->tile_w, th = (float)map->tile_h;
+   // Inset the UVs by half a texel so linear filtering does not bleed neighbours
+   const float inv_w = 1.0f / (float)map->texture_w, inv_h = 1.0f / (float)map->texture_h;
+   const float du = map->tile_w * inv_w, dv = map->tile_h * inv_h;
+   const float inset_u = 0.5f * inv_w, inset_v = 0.5f * inv_h;
+   int col_end = (cx + 1) * TILEMAP_CHUNK < map->cols ? (cx + 1) * TILEMAP_CHUNK : map->cols;
+   int row_end = (cy + 1) * TILEMAP_CHUNK < map->rows ? (cy + 1) * TILEMAP_CHUNK : map->rows;
+   float *v = map->vertices;
+
+   for (int row = cy * TILEMAP_CHUNK; row < row_end; row++) {
+      const uint32_t *tiles = map->tiles + (size_t)row * map->cols;
+      for (int col = cx * TILEMAP_CHUNK; col < col_end; col++) {
+         uint32_t tile = tiles[col];
+         uint32_t index = (tile & TILEMAP_TILE_MASK) - 1;
+         if ((tile & TILEMAP_TILE_MASK) == 0 || index >= (uint32_t)map->tileset_count)
+            continue;
+
+         // Tileset rows count from the top; images are stored bottom-up, and a
+         // tile's top edge maps to its lower v like draw_texture
+         int tx = (int)(index % (uint32_t)map->tileset_cols), ty = (int)(index / (uint32_t)map->tileset_cols);
+         float u0 = tx * du + inset_u, u1 = (tx + 1) * du - inset_u;
+         float v0 = 1.0f - (ty + 1) * dv + inset_v, v1 = 1.0f - ty * dv - inset_v;
+         if (tile & TILEMAP_FLIP_H) {
+            float t = u0; u0 = u1; u1 = t;
+         }
+         if (tile & TILEMAP_FLIP_V) {
+            float t = v0; v0 = v1; v1 = t;
+         }
+
+         float x0 = col * tw, y0 = row * th, x1 = x0 + tw, y1 = y0 + th;
+         const float quad[TILE_FLOATS] = {
+            x0, y0, u0, v0,  x1, y0, u1, v0,  x0, y1, u0, v1,
+            x1, y0, u1, v0,  x0, y1, u0, v1,  x1, y1, u1, v1
+         };
+         memcpy(v, quad, sizeof(quad));
+         v += TILE_FLOATS;
+      }
+   }
+   return (int)((v - map->vertices) / 4);
+}
+
+// Chunk under coordinate v (in chunks), kept within -1..count so that the
+// unbounded extent of a degenerate view converts safely
+static int chunk_index(float v, int count) {
+   v = floorf(v);
+   return v < -1.0f ? -1 : v > (float)count ? count : (int)v;
+}
+
+void module_tilemap_draw(tilemap *map, float x, float y, float r, float g, float b, float a,
+                         float vp_width, float vp_height) {
+   map->drawn = 0;
+   map->rebuilt = 0;
+   if (map->generation != mesh_generation) {
+      // The context was recreated: make new meshes and rebuild every chunk
+      int num_chunks = map->chunks_x * map->chunks_y;
+      if (!module_opengl_create_meshes(num_chunks, map->vaos, map->vbos)) {
+         core_log(RETRO_LOG_ERROR, "Tilemap: failed to recreate %d chunks", num_chunks);
+         return;
+      }
+      for (int c = 0; c < num_chunks; c++)
+         map->chunks[c].dirty = true;
+      map->generation = mesh_generation;
+   }
+
+   // Chunk range under the viewport, which spans [-vp/2, vp/2] around the
+   // origin as the current view sees it
+   float chunk_w = (float)map->tile_w * TILEMAP_CHUNK, chunk_h = (float)map->tile_h * TILEMAP_CHUNK;
+   float min_x, min_y, max_x, max_y;
+   module_opengl_view_bounds(vp_width, vp_height, &min_x, &min_y, &max_x, &max_y);
+   int cx0 = chunk_index((min_x - x) / chunk_w, map->chunks_x);
+   int cy0 = chunk_index((min_y - y) / chunk_h, map->chunks_y);
+   int cx1 = chunk_index((max_x - x) / chunk_w, map->chunks_x);
+   int cy1 = chunk_index((max_y - y) / chunk_h, map->chunks_y);
+   if (cx0 < 0) cx0 = 0;
+   if (cy0 < 0) cy0 = 0;
+   if (cx1 >= map->chunks_x) cx1 = map->chunks_x - 1;
+   if (cy1 >= map->chunks_y) cy1 = map->chunks_y - 1;
+
+   for (int cy = cy0; cy <= cy1; cy++) {
+      for (int cx = cx0; cx <= cx1; cx++) {
+         int c = cy * map->chunks_x + cx;
+         tile_chunk *chunk = &map->chunks[c];
+         if (chunk->dirty) {
+            chunk->num_vertices = build_chunk(map, cx, cy);
+            chunk->dirty = false;
+            module_opengl_upload_mesh(map->vbos[c], map->vertices, chunk->num_vertices);
+            map->rebuilt++;
+         }
+         if (chunk->num_vertices == 0)
+            continue;
+         module_opengl_draw_mesh(map->vaos[c], chunk->num_vertices, map->texture, x, y,
+                                 r, g, b, a, vp_width, vp_height);
+         map->drawn++;
+      }
+   }
+}
+
+// ---------------------------------------------------------------------------
+// Lua bindings (columns and rows are 1-based in Lua)
+
+static tilemap *check_map(lua_State *L, int arg) {
+   tilemap **ud = (tilemap **)luaL_checkudata(L, arg, TILEMAP_METATABLE);
+   luaL_argcheck(L, *ud != NULL, arg, "tilemap is destroyed");
+   return *ud;
+}
+
+static int push_map(lua_State *L, tilemap *map) {
+   if (!map) {
+      lua_pushnil(L);
+      return 1;
+   }
+   tilemap **ud = (tilemap **)lua_newuserdatauv(L, sizeof(tilemap *), 0);
+   *ud = map;
+   luaL_setmetatable(L, TILEMAP_METATABLE);
+   return 1;
+}
+
+// tilemap.new(tileset, tile_w, tile_h, cols, rows) -> map or nil
+static int lua_tilemap_new(lua_State *L) {
+   const char *tileset = luaL_checkstring(L, 1);
+   int tile_w = (int)luaL_checkinteger(L, 2);
+   int tile_h = (int)luaL_checkinteger(L, 3);
+   int cols = (int)luaL_checkinteger(L, 4);
+   int rows = (int)luaL_checkinteger(L, 5);
+   return push_map(L, module_tilemap_create(tileset, tile_w, tile_h, cols, rows));
+}
+
+// tilemap.load(tileset, tile_w, tile_h, csv_asset) -> map or nil
+static int lua_tilemap_load(lua_State *L) {
+   const char *tileset = luaL_checkstring(L, 1);
+   int tile_w = (int)luaL_checkinteger(L, 2);
+   int tile_h = (int)luaL_checkinteger(L, 3);
+   const char *csv = luaL_checkstring(L, 4);
+   return push_map(L, module_tilemap_load_csv(tileset, tile_w, tile_h, csv));
+}
+
+static int lua_tilemap_gc(lua_State *L) {
+   tilemap **ud = (tilemap **)luaL_checkudata(L, 1, TILEMAP_METATABLE);
+   module_tilemap_destroy(*ud);
+   *ud = NULL;
+   return 0;
+}
+
+static int lua_tilemap_get(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   lua_Integer col = luaL_checkinteger(L, 2), row = luaL_checkinteger(L, 3);
+   lua_pushinteger(L, (lua_Integer)module_tilemap_get(map, (int)col - 1, (int)row - 1));
+   return 1;
+}
+
+static int lua_tilemap_set(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   lua_Integer col = luaL_checkinteger(L, 2), row = luaL_checkinteger(L, 3);
+   lua_Integer tile = luaL_checkinteger(L, 4);
+   luaL_argcheck(L, col >= 1 && col <= map->cols, 2, "column out of range");
+   luaL_argcheck(L, row >= 1 && row <= map->rows, 3, "row out of range");
+   module_tilemap_set(map, (int)col - 1, (int)row - 1, (uint32_t)tile);
+   return 0;
+}
+
+// map:fill(tile [, col, row, cols, rows])
+static int lua_tilemap_fill(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   uint32_t tile = (uint32_t)luaL_checkinteger(L, 2);
+   int col0 = (int)luaL_optinteger(L, 3, 1) - 1, row0 = (int)luaL_optinteger(L, 4, 1) - 1;
+   int cols = (int)luaL_optinteger(L, 5, map->cols), rows = (int)luaL_optinteger(L, 6, map->rows);
+   for (int row = row0 < 0 ? 0 : row0; row < row0 + rows && row < map->rows; row++)
+      for (int col = col0 < 0 ? 0 : col0; col < col0 + cols && col < map->cols; col++)
+         module_tilemap_set(map, col, row, tile);
+   return 0;
+}
+
+// map:draw(x, y [, r, g, b, a]) -- (x, y) is the map's top-left corner
+static int lua_tilemap_draw(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   float x = (float)luaL_checknumber(L, 2);
+   float y = (float)luaL_checknumber(L, 3);
+   float r = (float)luaL_optnumber(L, 4, 1.0);
+   float g = (float)luaL_optnumber(L, 5, 1.0);
+   float b = (float)luaL_optnumber(L, 6, 1.0);
+   float a = (float)luaL_optnumber(L, 7, 1.0);
+   module_tilemap_draw(map, x, y, r, g, b, a, VIRTUAL_WIDTH, VIRTUAL_HEIGHT);
+   return 0;
+}
+
+// map:size() -> cols, rows, tile_w, tile_h
+static int lua_tilemap_size(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   lua_pushinteger(L, map->cols);
+   lua_pushinteger(L, map->rows);
+   lua_pushinteger(L, map->tile_w);
+   lua_pushinteger(L, map->tile_h);
+   return 4;
+}
+
+// map:stats() -> chunks drawn and rebuilt by the last draw, total chunks
+static int lua_tilemap_stats(lua_State *L) {
+   tilemap *map = check_map(L, 1);
+   lua_pushinteger(L, map->drawn);
+   lua_pushinteger(L, map->rebuilt);
+   lua_pushinteger(L, map->chunks_x * map->chunks_y);
+   return 3;
+}
+
+static const luaL_Reg tilemap_methods[] = {
+   {"get", lua_tilemap_get},
+   {"set", lua_tilemap_set},
+   {"fill", lua_tilemap_fill},
+   {"draw", lua_tilemap_draw},
+   {"size", lua_tilemap_size},
+   {"stats", lua_tilemap_stats},
+   {"destroy", lua_tilemap_gc},
+   {NULL, NULL}
+};
+
+static const luaL_Reg tilemap_funcs[] = {
+   {"new", lua_tilemap_new},
+   {"load", lua_tilemap_load},
+   {NULL, NULL}
+};
+
+void module_tilemap_register(lua_State *L) {
+   if (luaL_newmetatable(L, TILEMAP_METATABLE)) {
+      lua_pushcfunction(L, lua_tilemap_gc);
+      lua_setfield(L, -2, "__gc");
+      luaL_newlib(L, tilemap_methods);
+      lua_setfield(L, -2, "__index");
+   }
+   lua_pop(L, 1);
+
+   luaL_newlib(L, tilemap_funcs);
+   lua_setglobal(L, "tilemap");
+}
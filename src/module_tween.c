@@ -0,0 +1,701 @@
+// module_tween.c
+// Native tweens. Lua registers a tween once (a scene node property or an f32
+// buffer element, from/to, duration, easing) and the core evaluates all of
+// them in one pass before update(). Tweens are stored structure-of-arrays in
+// a dense block; ids map to dense positions through a generation-checked slot
+// table, and a hash of the targets makes a new tween on a busy target replace
+// the old one.
+//
+// Each frame advances the clocks, then counting-sorts the tweens by easing so
+// every curve runs as a SIMD kernel (AVX or SSE2 when the compiler targets
+// them, scalar otherwise) over a contiguous range, then interpolates and
+// writes the targets. Tweens that finished are reported to the completion
+// handler in one call per frame.
+#include "module_tween.h"
+#include "module_buffer.h"
+#include "module_scene.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TWEEN_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TWEEN_LANES 4
+#else
+#define TWEEN_LANES 1
+#endif
+
+#define TWEEN_INITIAL_CAPACITY 64  // multiple of TWEEN_LANES, doubled when full
+#define TWEEN_MAX_STEP 0.1f        // longest frame step, so a stall does not skip animations
+#define TWEEN_MIN_DURATION 1e-6f
+#define TWEEN_BUFFER 0xff          // prop value of buffer targets
+
+#define ROUND_LANES(n) (((n) + TWEEN_LANES - 1) / TWEEN_LANES * TWEEN_LANES)
+
+typedef enum {
+   EASE_LINEAR = 0,
+   EASE_QUAD_IN,
+   EASE_QUAD_OUT,
+   EASE_QUAD_IN_OUT,
+   EASE_CUBIC_IN,
+   EASE_CUBIC_OUT,
+   EASE_CUBIC_IN_OUT,
+   EASE_SINE_IN,
+   EASE_SINE_OUT,
+   EASE_SINE_IN_OUT,
+   EASE_BACK_IN,
+   EASE_BACK_OUT,
+   EASE_COUNT
+} tween_easing;
+
+static const char *const easing_names[] = {
+   "linear", "quad_in", "quad_out", "quad_in_out", "cubic_in", "cubic_out", "cubic_in_out",
+   "sine_in", "sine_out", "sine_in_out", "back_in", "back_out", NULL
+};
+
+// Same order as scene_property
+static const char *const property_names[] = {
+   "x", "y", "rotation", "sx", "sy", "w", "h", "r", "g", "b", "a", NULL
+};
+
+typedef struct {
+   // Dense tween storage, capacity a multiple of TWEEN_LANES so kernels can
+   // run whole vectors past count (the padding lanes are never read back)
+   int count;
+   int capacity;
+   uint64_t *key;         // target identity, see node_key / buffer_key
+   int32_t *slot;
+   int32_t *target;       // node id or 0-based buffer index
+   uint8_t *prop;         // scene_property or TWEEN_BUFFER
+   uint8_t *easing;
+   core_buffer **buffer;
+   int *buffer_ref;       // keeps the buffer alive while the tween runs
+   float *from, *delta;
+   float *elapsed;        // starts at -delay
+   float *inv_duration;
+   float *t;              // normalized time
+   float *value;          // eased, then interpolated
+
+   // Id slots: id = generation << 32 | slot
+   int slot_capacity;
+   uint32_t *slot_gen;
+   int32_t *slot_dense;   // -1 when free
+   int32_t *free_slots;
+   int free_count;
+
+   // Open-addressed target hash, slot per entry (-1 empty)
+   int32_t *map;
+   int map_bits;
+
+   // Easing sort scratch, one lane-aligned run per easing
+   int scratch_capacity;
+   int32_t *order;
+   float *sorted;
+
+   // Finished slots and the completion event
+   int finished_capacity;
+   int32_t *finished;     // slot, or ~slot for tweens dropped without an event
+   lua_Integer *ids;
+   int complete_ref;
+   int ids_ref;
+   int ids_count;
+
+   double last_time;
+   bool has_time;
+} tween_storage;
+
+static tween_storage tweens = { .complete_ref = LUA_NOREF, .ids_ref = LUA_NOREF };
+
+#define TWEEN_ARRAYS(X) \
+   X(key) X(slot) X(target) X(prop) X(easing) X(buffer) X(buffer_ref) \
+   X(from) X(delta) X(elapsed) X(inv_duration) X(t) X(value)
+
+// ---------------------------------------------------------------------------
+// Storage
+
+static uint64_t node_key(int node, int prop) {
+   return (1ull << 63) | ((uint64_t)node << 8) | (uint64_t)prop;
+}
+
+static uint64_t buffer_key(const core_buffer *buf, int index) {
+   return (uint64_t)(uintptr_t)(BUFFER_F32_DATA(buf) + index);
+}
+
+static uint32_t hash_key(uint64_t key) {
+   return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - tweens.map_bits));
+}
+
+static uint64_t slot_key(int32_t slot) {
+   return tweens.key[tweens.slot_dense[slot]];
+}
+
+static int map_find(uint64_t key) {
+   uint32_t mask = (1u << tweens.map_bits) - 1;
+   for (uint32_t h = hash_key(key); tweens.map[h] >= 0; h = (h + 1) & mask)
+      if (slot_key(tweens.map[h]) == key)
+         return (int)h;
+   return -1;
+}
+
+static void map_insert(int32_t slot) {
+   uint32_t mask = (1u << tweens.map_bits) - 1;
+   uint32_t h = hash_key(slot_key(slot));
+   while (tweens.map[h] >= 0)
+      h = (h + 1) & mask;
+   tweens.map[h] = slot;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void map_remove(int pos) {
+   uint32_t mask = (1u << tweens.map_bits) - 1;
+   uint32_t hole = (uint32_t)pos;
+   tweens.map[hole] = -1;
+   for (uint32_t j = (hole + 1) & mask; tweens.map[j] >= 0; j = (j + 1) & mask) {
+      uint32_t home = hash_key(slot_key(tweens.map[j]));
+      if (((j - home) & mask) >= ((j - hole) & mask)) {
+         tweens.map[hole] = tweens.map[j];
+         tweens.map[j] = -1;
+         hole = j;
+      }
+   }
+}
+
+static bool map_rehash(int bits) {
+   int32_t *map = malloc(sizeof(*map) << bits);
+   if (!map)
+      return false;
+   memset(map, 0xff, sizeof(*map) << bits);
+   free(tweens.map);
+   tweens.map = map;
+   tweens.map_bits = bits;
+   for (int i = 0; i < tweens.count; i++)
+      map_insert(tweens.slot[i]);
+   return true;
+}
+
+static bool tween_grow(void) {
+   int capacity = tweens.capacity ? tweens.capacity * 2 : TWEEN_INITIAL_CAPACITY;
+#define GROW_ARRAY(field) { \
+      void *p = realloc(tweens.field, (size_t)capacity * sizeof(*tweens.field)); \
+      if (!p) return false; \
+      tweens.field = p; \
+   }
+   TWEEN_ARRAYS(GROW_ARRAY)
+#undef GROW_ARRAY
+   tweens.capacity = capacity;
+   // Keep the hash at most half full
+   return (1 << tweens.map_bits) >= 2 * capacity || map_rehash(tweens.map_bits ? tweens.map_bits + 1 : 8);
+}
+
+static int32_t alloc_slot(void) {
+   if (tweens.free_count > 0)
+      return tweens.free_slots[--tweens.free_count];
+   if (tweens.slot_capacity == INT32_MAX)
+      return -1;
+   int capacity = tweens.slot_capacity ? tweens.slot_capacity * 2 : TWEEN_INITIAL_CAPACITY;
+   uint32_t *gen = realloc(tweens.slot_gen, (size_t)capacity * sizeof(*gen));
+   if (gen)
+      tweens.slot_gen = gen;
+   int32_t *dense = realloc(tweens.slot_dense, (size_t)capacity * sizeof(*dense));
+   if (dense)
+      tweens.slot_dense = dense;
+   int32_t *free_slots = realloc(tweens.free_slots, (size_t)capacity * sizeof(*free_slots));
+   if (free_slots)
+      tweens.free_slots = free_slots;
+   if (!gen || !dense || !free_slots)
+      return -1;
+   // Hand out the new slots lowest first
+   for (int s = capacity - 1; s >= tweens.slot_capacity; s--) {
+      tweens.slot_gen[s] = 1;
+      tweens.slot_dense[s] = -1;
+      tweens.free_slots[tweens.free_count++] = s;
+   }
+   tweens.slot_capacity = capacity;
+   return tweens.free_slots[--tweens.free_count];
+}
+
+static lua_Integer slot_id(int32_t slot) {
+   return (lua_Integer)(((uint64_t)tweens.slot_gen[slot] << 32) | (uint32_t)slot);
+}
+
+// Dense position of a live tween id, or -1
+static int find_id(lua_Integer id) {
+   uint64_t bits = (uint64_t)id;
+   uint32_t slot = (uint32_t)bits;
+   if (slot >= (uint32_t)tweens.slot_capacity || tweens.slot_gen[slot] != (uint32_t)(bits >> 32))
+      return -1;
+   return tweens.slot_dense[slot];
+}
+
+// Remove the tween at dense position i; L may be NULL once the state is gone
+static void remove_tween(lua_State *L, int i) {
+   int32_t slot = tweens.slot[i];
+   int last = tweens.count - 1;
+   if (L && tweens.buffer_ref[i] != LUA_NOREF)
+      luaL_unref(L, LUA_REGISTRYINDEX, tweens.buffer_ref[i]);
+   map_remove(map_find(tweens.key[i]));
+   tweens.slot_dense[slot] = -1;
+   tweens.slot_gen[slot]++;
+   tweens.free_slots[tweens.free_count++] = slot;
+   if (i != last) {
+#define MOVE_FIELD(field) tweens.field[i] = tweens.field[last];
+      TWEEN_ARRAYS(MOVE_FIELD)
+#undef MOVE_FIELD
+      tweens.slot_dense[tweens.slot[i]] = i;
+   }
+   tweens.count = last;
+}
+
+static void clear_tweens(lua_State *L) {
+   while (tweens.count > 0)
+      remove_tween(L, tweens.count - 1);
+}
+
+// ---------------------------------------------------------------------------
+// Kernels
+
+#if TWEEN_LANES == 8
+typedef __m256 vfloat;
+#define V_SET(x) _mm256_set1_ps(x)
+#define V_LOAD(p) _mm256_loadu_ps(p)
+#define V_STORE(p, v) _mm256_storeu_ps(p, v)
+#define V_ADD(a, b) _mm256_add_ps(a, b)
+#define V_SUB(a, b) _mm256_sub_ps(a, b)
+#define V_MUL(a, b) _mm256_mul_ps(a, b)
+#define V_MIN(a, b) _mm256_min_ps(a, b)
+#define V_MAX(a, b) _mm256_max_ps(a, b)
+#define V_SELECT_LT(a, b, x, y) _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_LT_OQ))
+#elif TWEEN_LANES == 4
+typedef __m128 vfloat;
+#define V_SET(x) _mm_set1_ps(x)
+#define V_LOAD(p) _mm_loadu_ps(p)
+#define V_STORE(p, v) _mm_storeu_ps(p, v)
+#define V_ADD(a, b) _mm_add_ps(a, b)
+#define V_SUB(a, b) _mm_sub_ps(a, b)
+#define V_MUL(a, b) _mm_mul_ps(a, b)
+#define V_MIN(a, b) _mm_min_ps(a, b)
+#define V_MAX(a, b) _mm_max_ps(a, b)
+static inline __m128 select_lt(__m128 a, __m128 b, __m128 x, __m128 y) {
+   __m128 m = _mm_cmplt_ps(a, b);
+   return _mm_or_ps(_mm_and_ps(m, x), _mm_andnot_ps(m, y));
+}
+#define V_SELECT_LT(a, b, x, y) select_lt(a, b, x, y)
+#else
+typedef float vfloat;
+#define V_SET(x) (x)
+#define V_LOAD(p) (*(p))
+#define V_STORE(p, v) (*(p) = (v))
+#define V_ADD(a, b) ((a) + (b))
+#define V_SUB(a, b) ((a) - (b))
+#define V_MUL(a, b) ((a) * (b))
+#define V_MIN(a, b) fminf(a, b)
+#define V_MAX(a, b) fmaxf(a, b)
+#define V_SELECT_LT(a, b, x, y) ((a) < (b) ? (x) : (y))
+#endif
+
+// sin(x) for x in [-pi/2, pi/2], odd Taylor polynomial to x^9 (error < 4e-6)
+static inline vfloat v_sin(vfloat x) {
+   vfloat x2 = V_MUL(x, x);
+   vfloat p = V_SET(1.0f / 362880.0f);
+   p = V_ADD(V_MUL(p, x2), V_SET(-1.0f / 5040.0f));
+   p = V_ADD(V_MUL(p, x2), V_SET(1.0f / 120.0f));
+   p = V_ADD(V_MUL(p, x2), V_SET(-1.0f / 6.0f));
+   p = V_ADD(V_MUL(p, x2), V_SET(1.0f));
+   return V_MUL(p, x);
+}
+
+static inline vfloat ease_linear(vfloat t) { return t; }
+static inline vfloat ease_quad_in(vfloat t) { return V_MUL(t, t); }
+static inline vfloat ease_quad_out(vfloat t) { return V_MUL(t, V_SUB(V_SET(2.0f), t)); }
+static inline vfloat ease_cubic_in(vfloat t) { return V_MUL(V_MUL(t, t), t); }
+
+static inline vfloat ease_cubic_out(vfloat t) {
+   vfloat u = V_SUB(V_SET(1.0f), t);
+   return V_SUB(V_SET(1.0f), V_MUL(V_MUL(u, u), u));
+}
+
+static inline vfloat ease_quad_in_out(vfloat t) {
+   vfloat u = V_SUB(V_SET(1.0f), t);
+   vfloat in = V_MUL(V_SET(2.0f), V_MUL(t, t));
+   vfloat out = V_SUB(V_SET(1.0f), V_MUL(V_SET(2.0f), V_MUL(u, u)));
+   return V_SELECT_LT(t, V_SET(0.5f), in, out);
+}
+
+static inline vfloat ease_cubic_in_out(vfloat t) {
+   vfloat u = V_SUB(V_SET(1.0f), t);
+   vfloat in = V_MUL(V_SET(4.0f), V_MUL(V_MUL(t, t), t));
+   vfloat out = V_SUB(V_SET(1.0f), V_MUL(V_SET(4.0f), V_MUL(V_MUL(u, u), u)));
+   return V_SELECT_LT(t, V_SET(0.5f), in, out);
+}
+
+// 1 - cos(t pi/2) = 1 - sin((1 - t) pi/2)
+static inline vfloat ease_sine_in(vfloat t) {
+   return V_SUB(V_SET(1.0f), v_sin(V_MUL(V_SUB(V_SET(1.0f), t), V_SET(1.57079633f))));
+}
+
+static inline vfloat ease_sine_out(vfloat t) {
+   return v_sin(V_MUL(t, V_SET(1.57079633f)));
+}
+
+// (1 - cos(t pi)) / 2 = (1 - sin(pi/2 - t pi)) / 2
+static inline vfloat ease_sine_in_out(vfloat t) {
+   vfloat s = v_sin(V_SUB(V_SET(1.57079633f), V_MUL(t, V_SET(3.14159265f))));
+   return V_MUL(V_SET(0.5f), V_SUB(V_SET(1.0f), s));
+}
+
+#define BACK_C1 1.70158f
+#define BACK_C3 2.70158f
+
+static inline vfloat ease_back_in(vfloat t) {
+   vfloat t2 = V_MUL(t, t);
+   return V_SUB(V_MUL(V_SET(BACK_C3), V_MUL(t2, t)), V_MUL(V_SET(BACK_C1), t2));
+}
+
+static inline vfloat ease_back_out(vfloat t) {
+   vfloat u = V_SUB(t, V_SET(1.0f));
+   vfloat u2 = V_MUL(u, u);
+   return V_ADD(V_SET(1.0f), V_ADD(V_MUL(V_SET(BACK_C3), V_MUL(u2, u)), V_MUL(V_SET(BACK_C1), u2)));
+}
+
+// One kernel per easing over n values in place; n is a multiple of TWEEN_LANES
+#define EASE_KERNEL(name) \
+   static void kernel_##name(float *t, int n) { \
+      for (int i = 0; i < n; i += TWEEN_LANES) \
+         V_STORE(t + i, name(V_LOAD(t + i))); \
+   }
+EASE_KERNEL(ease_quad_in)
+EASE_KERNEL(ease_quad_out)
+EASE_KERNEL(ease_quad_in_out)
+EASE_KERNEL(ease_cubic_in)
+EASE_KERNEL(ease_cubic_out)
+EASE_KERNEL(ease_cubic_in_out)
+EASE_KERNEL(ease_sine_in)
+EASE_KERNEL(ease_sine_out)
+EASE_KERNEL(ease_sine_in_out)
+EASE_KERNEL(ease_back_in)
+EASE_KERNEL(ease_back_out)
+#undef EASE_KERNEL
+
+static void kernel_ease_linear(float *t, int n) {
+   (void)t;
+   (void)n;
+}
+
+static void (*const ease_kernels[EASE_COUNT])(float *, int) = {
+   kernel_ease_linear,
+   kernel_ease_quad_in, kernel_ease_quad_out, kernel_ease_quad_in_out,
+   kernel_ease_cubic_in, kernel_ease_cubic_out, kernel_ease_cubic_in_out,
+   kernel_ease_sine_in, kernel_ease_sine_out, kernel_ease_sine_in_out,
+   kernel_ease_back_in, kernel_ease_back_out
+};
+
+// elapsed += dt; t = clamp(elapsed / duration, 0, 1)
+static void kernel_advance(float dt, int n) {
+   const vfloat v_dt = V_SET(dt), zero = V_SET(0.0f), one = V_SET(1.0f);
+   float *elapsed = tweens.elapsed, *inv_duration = tweens.inv_duration, *t = tweens.t;
+   for (int i = 0; i < n; i += TWEEN_LANES) {
+      vfloat e = V_ADD(V_LOAD(elapsed + i), v_dt);
+      V_STORE(elapsed + i, e);
+      V_STORE(t + i, V_MIN(V_MAX(V_MUL(e, V_LOAD(inv_duration + i)), zero), one));
+   }
+}
+
+// value = from + delta * value
+static void kernel_lerp(int n) {
+   const float *from = tweens.from, *delta = tweens.delta;
+   float *value = tweens.value;
+   for (int i = 0; i < n; i += TWEEN_LANES)
+      V_STORE(value + i, V_ADD(V_LOAD(from + i), V_MUL(V_LOAD(delta + i), V_LOAD(value + i))));
+}
+
+static bool scratch_reserve(int count) {
+   if (count <= tweens.scratch_capacity)
+      return true;
+   int32_t *order = realloc(tweens.order, (size_t)count * sizeof(*order));
+   if (order)
+      tweens.order = order;
+   float *sorted = realloc(tweens.sorted, (size_t)count * sizeof(*sorted));
+   if (sorted)
+      tweens.sorted = sorted;
+   if (!order || !sorted)
+      return false;
+   tweens.scratch_capacity = count;
+   return true;
+}
+
+// value = ease(t), with the tweens grouped by easing so each curve is one kernel call
+static void ease_all(void) {
+   int n = tweens.count;
+   int counts[EASE_COUNT] = {0}, start[EASE_COUNT];
+   int used = 0, last = 0;
+   for (int i = 0; i < n; i++)
+      counts[tweens.easing[i]]++;
+   for (int e = 0; e < EASE_COUNT; e++)
+      if (counts[e]) {
+         used++;
+         last = e;
+      }
+
+   // A single curve needs no sorting
+   if (used == 1) {
+      memcpy(tweens.value, tweens.t, (size_t)n * sizeof(float));
+      ease_kernels[last](tweens.value, ROUND_LANES(n));
+      return;
+   }
+
+   int total = 0;
+   for (int e = 0; e < EASE_COUNT; e++) {
+      start[e] = total;
+      total += ROUND_LANES(counts[e]);
+   }
+   if (!scratch_reserve(total)) {
+      // Out of memory: fall back to linear rather than stalling the animations
+      memcpy(tweens.value, tweens.t, (size_t)n * sizeof(float));
+      return;
+   }
+
+   int cursor[EASE_COUNT];
+   memcpy(cursor, start, sizeof(cursor));
+   for (int i = 0; i < n; i++) {
+      int pos = cursor[tweens.easing[i]]++;
+      tweens.order[pos] = i;
+      tweens.sorted[pos] = tweens.t[i];
+   }
+   for (int e = 0; e < EASE_COUNT; e++) {
+      if (!counts[e])
+         continue;
+      ease_kernels[e](tweens.sorted + start[e], ROUND_LANES(counts[e]));
+      for (int pos = start[e]; pos < start[e] + counts[e]; pos++)
+         tweens.value[tweens.order[pos]] = tweens.sorted[pos];
+   }
+}
+
+// ---------------------------------------------------------------------------
+// Frame update
+
+// Call the completion handler with the ids of the finished tweens
+static void send_completions(lua_State *L, int finished) {
+   if (tweens.complete_ref == LUA_NOREF)
+      return;
+   lua_rawgeti(L, LUA_REGISTRYINDEX, tweens.complete_ref);
+   if (tweens.ids_ref == LUA_NOREF) {
+      lua_createtable(L, finished, 0);
+      lua_pushvalue(L, -1);
+      tweens.ids_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+   } else {
+      lua_rawgeti(L, LUA_REGISTRYINDEX, tweens.ids_ref);
+   }
+   for (int k = 0; k < finished; k++) {
+      lua_pushinteger(L, tweens.ids[k]);
+      lua_rawseti(L, -2, k + 1);
+   }
+   // The table is reused; clear what the previous frame left past the end
+   for (int k = finished; k < tweens.ids_count; k++) {
+      lua_pushnil(L);
+      lua_rawseti(L, -2, k + 1);
+   }
+   tweens.ids_count = finished;
+   if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      core_log(RETRO_LOG_ERROR, "Tween completion handler error: %s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+   }
+}
+
+void module_tween_update(lua_State *L, double time) {
+   float dt = tweens.has_time ? (float)(time - tweens.last_time) : 0.0f;
+   dt = fminf(fmaxf(dt, 0.0f), TWEEN_MAX_STEP);
+   tweens.last_time = time;
+   tweens.has_time = true;
+   if (tweens.count == 0)
+      return;
+
+   int n = tweens.count;
+   kernel_advance(dt, ROUND_LANES(n));
+   ease_all();
+   kernel_lerp(ROUND_LANES(n));
+
+   if (tweens.finished_capacity < n) {
+      int32_t *finished = realloc(tweens.finished, (size_t)tweens.capacity * sizeof(*finished));
+      if (finished)
+         tweens.finished = finished;
+      lua_Integer *ids = realloc(tweens.ids, (size_t)tweens.capacity * sizeof(*ids));
+      if (ids)
+         tweens.ids = ids;
+      if (!finished || !ids) {
+         core_log(RETRO_LOG_ERROR, "Tween: out of memory for %d completions", n);
+         return;
+      }
+      tweens.finished_capacity = tweens.capacity;
+   }
+
+   // Write the targets; tweens still in their delay leave them alone
+   int finished = 0;
+   for (int i = 0; i < n; i++) {
+      if (tweens.elapsed[i] < 0.0f)
+         continue;
+      bool done = tweens.t[i] >= 1.0f;
+      float v = done ? tweens.from[i] + tweens.delta[i] : tweens.value[i];
+      if (tweens.prop[i] == TWEEN_BUFFER) {
+         BUFFER_F32_DATA(tweens.buffer[i])[tweens.target[i]] = v;
+      } else if (module_scene_is_valid(tweens.target[i])) {
+         module_scene_set_property(tweens.target[i], (scene_property)tweens.prop[i], v);
+      } else {
+         // The node was destroyed: drop the tween without an event
+         tweens.finished[finished++] = ~tweens.slot[i];
+         continue;
+      }
+      if (done)
+         tweens.finished[finished++] = tweens.slot[i];
+   }
+   if (finished == 0)
+      return;
+
+   // Remove by slot (removal moves tweens around), taking the ids first
+   int events = 0;
+   for (int k = 0; k < finished; k++) {
+      int32_t slot = tweens.finished[k];
+      if (slot >= 0)
+         tweens.ids[events++] = slot_id(slot);
+      else
+         slot = ~slot;
+      remove_tween(L, tweens.slot_dense[slot]);
+   }
+   if (events > 0)
+      send_completions(L, events);
+}
+
+void module_tween_shutdown(void) {
+   // The registry references died with the state
+   clear_tweens(NULL);
+   tweens.complete_ref = LUA_NOREF;
+   tweens.ids_ref = LUA_NOREF;
+   tweens.ids_count = 0;
+   tweens.has_time = false;
+}
+
+// ---------------------------------------------------------------------------
+// Lua API
+
+// Common tail of tween.node and tween.buffer: arguments to, duration [, easing
+// [, from [, delay]]] start at arg; buf_arg is the buffer to keep alive or 0
+static int start_tween(lua_State *L, int arg, uint64_t key, int target, int prop,
+                       core_buffer *buf, int buf_arg, float current) {
+   float to = (float)luaL_checknumber(L, arg);
+   float duration = (float)luaL_checknumber(L, arg + 1);
+   int easing = luaL_checkoption(L, arg + 2, "linear", easing_names);
+   float from = (float)luaL_optnumber(L, arg + 3, current);
+   float delay = (float)luaL_optnumber(L, arg + 4, 0.0);
+   luaL_argcheck(L, duration >= 0.0f, arg + 1, "duration must not be negative");
+
+   // A new tween on the same target replaces the running one
+   int pos = tweens.map ? map_find(key) : -1;
+   if (pos >= 0)
+      remove_tween(L, tweens.slot_dense[tweens.map[pos]]);
+
+   if (tweens.count == tweens.capacity && !tween_grow())
+      return luaL_error(L, "tween: out of memory");
+   int32_t slot = alloc_slot();
+   if (slot < 0)
+      return luaL_error(L, "tween: out of memory");
+
+   int i = tweens.count++;
+   tweens.key[i] = key;
+   tweens.slot[i] = slot;
+   tweens.target[i] = target;
+   tweens.prop[i] = (uint8_t)prop;
+   tweens.easing[i] = (uint8_t)easing;
+   tweens.buffer[i] = buf;
+   tweens.buffer_ref[i] = LUA_NOREF;
+   if (buf_arg) {
+      lua_pushvalue(L, buf_arg);
+      tweens.buffer_ref[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+   }
+   tweens.from[i] = from;
+   tweens.delta[i] = to - from;
+   tweens.elapsed[i] = -fmaxf(delay, 0.0f);
+   tweens.inv_duration[i] = 1.0f / fmaxf(duration, TWEEN_MIN_DURATION);
+   tweens.t[i] = 0.0f;
+   tweens.value[i] = from;
+   tweens.slot_dense[slot] = i;
+   map_insert(slot);
+
+   lua_pushinteger(L, slot_id(slot));
+   return 1;
+}
+
+// tween.node(node, prop, to, duration [, easing [, from [, delay]]]) -> id
+static int lua_tween_node(lua_State *L) {
+   int node = (int)luaL_checkinteger(L, 1);
+   luaL_argcheck(L, module_scene_is_valid(node), 1, "invalid scene node");
+   int prop = luaL_checkoption(L, 2, NULL, property_names);
+   return start_tween(L, 3, node_key(node, prop), node, prop, NULL, 0,
+                      module_scene_get_property(node, (scene_property)prop));
+}
+
+// tween.buffer(buf, index, to, duration [, easing [, from [, delay]]]) -> id
+static int lua_tween_buffer(lua_State *L) {
+   core_buffer *buf = module_buffer_check(L, 1, BUFFER_F32);
+   lua_Integer index = luaL_checkinteger(L, 2);
+   luaL_argcheck(L, index >= 1 && (size_t)index <= buf->count, 2, "index out of range");
+   int i = (int)index - 1;
+   return start_tween(L, 3, buffer_key(buf, i), i, TWEEN_BUFFER, buf, 1, BUFFER_F32_DATA(buf)[i]);
+}
+
+// tween.cancel(id) -> true if the tween was running; no completion event
+static int lua_tween_cancel(lua_State *L) {
+   int i = find_id(luaL_checkinteger(L, 1));
+   if (i >= 0)
+      remove_tween(L, i);
+   lua_pushboolean(L, i >= 0);
+   return 1;
+}
+
+static int lua_tween_active(lua_State *L) {
+   lua_pushboolean(L, find_id(luaL_checkinteger(L, 1)) >= 0);
+   return 1;
+}
+
+static int lua_tween_count(lua_State *L) {
+   lua_pushinteger(L, tweens.count);
+   return 1;
+}
+
+static int lua_tween_clear(lua_State *L) {
+   clear_tweens(L);
+   return 0;
+}
+
+// tween.on_complete(fn | nil): fn(ids) once per frame with the finished ids.
+// The ids table is reused between calls.
+static int lua_tween_on_complete(lua_State *L) {
+   if (!lua_isnoneornil(L, 1))
+      luaL_checktype(L, 1, LUA_TFUNCTION);
+   luaL_unref(L, LUA_REGISTRYINDEX, tweens.complete_ref);
+   tweens.complete_ref = LUA_NOREF;
+   if (!lua_isnoneornil(L, 1)) {
+      lua_pushvalue(L, 1);
+      tweens.complete_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+   }
+   return 0;
+}
+
+void module_tween_register(lua_State *L) {
+   static const luaL_Reg tween_funcs[] = {
+      {"node", lua_tween_node},
+      {"buffer", lua_tween_buffer},
+      {"cancel", lua_tween_cancel},
+      {"active", lua_tween_active},
+      {"count", lua_tween_count},
+      {"clear", lua_tween_clear},
+      {"on_complete", lua_tween_on_complete},
+      {NULL, NULL}
+   };
+   luaL_newlib(L, tween_funcs);
+   lua_setglobal(L, "tween");
+}
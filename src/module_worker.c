@@ -0,0 +1,571 @@
+// module_worker.c
+// Worker Lua states. Each worker runs an isolated lua_State on its own thread
+// with the standard libraries, typed buffers and `require` from the content
+// zip, but none of the drawing or input bindings. The main state and a worker
+// exchange serialized values through two single-producer/single-consumer
+// lock-free rings; the worker sleeps on a condition variable only while its
+// inbox is empty.
+#include "module_worker.h"
+#include "module_buffer.h"
+#include "module_lua.h"
+#include "module_memory.h"
+#include "core_thread.h"
+#include "libretro_core.h"
+#include <lauxlib.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKER_METATABLE "lrcgl.worker"
+#define CHANNEL_CAPACITY 256  // power of two
+#define SERIALIZE_MAX_DEPTH 32
+
+// Value tags of the message encoding
+enum {
+   TAG_NIL = 0,
+   TAG_FALSE,
+   TAG_TRUE,
+   TAG_INTEGER,
+   TAG_NUMBER,
+   TAG_STRING,
+   TAG_TABLE,     // key/value pairs until TAG_END
+   TAG_BUFFER,
+   TAG_END
+};
+
+typedef struct {
+   worker_message *slots[CHANNEL_CAPACITY];
+   volatile int32_t head;  // next slot to read, written by the consumer only
+   volatile int32_t tail;  // next slot to write, written by the producer only
+} message_channel;
+
+struct lua_worker {
+   char name[128];
+   char *source;
+   size_t source_size;
+   core_thread thread;
+   bool started;
+
+   message_channel inbox;   // main -> worker
+   message_channel outbox;  // worker -> main
+   core_mutex wake_lock;
+   core_cond wake;
+   volatile int32_t quit;
+   volatile int32_t finished;
+   char error[256];         // valid once finished is set
+};
+
+// ---------------------------------------------------------------------------
+// Channels
+
+static bool channel_push(message_channel *c, worker_message *msg) {
+   int32_t tail = core_atomic_load(&c->tail);
+   if ((uint32_t)tail - (uint32_t)core_atomic_load(&c->head) == CHANNEL_CAPACITY)
+      return false;
+   c->slots[(uint32_t)tail & (CHANNEL_CAPACITY - 1)] = msg;
+   core_atomic_store(&c->tail, (int32_t)((uint32_t)tail + 1));
+   return true;
+}
+
+static worker_message *channel_pop(message_channel *c) {
+   int32_t head = core_atomic_load(&c->head);
+   if (head == core_atomic_load(&c->tail))
+      return NULL;
+   worker_message *msg = c->slots[(uint32_t)head & (CHANNEL_CAPACITY - 1)];
+   core_atomic_store(&c->head, (int32_t)((uint32_t)head + 1));
+   return msg;
+}
+
+static void channel_drain(message_channel *c) {
+   worker_message *msg;
+   while ((msg = channel_pop(c)) != NULL)
+      free(msg);
+}
+
+// ---------------------------------------------------------------------------
+// Serialization
+
+typedef struct {
+   unsigned char *data;
+   size_t size;
+   size_t capacity;
+} byte_writer;
+
+static bool put_bytes(byte_writer *w, const void *p, size_t n) {
+   if (w->size + n > w->capacity) {
+      size_t capacity = w->capacity ? w->capacity : 64;
+      while (capacity < w->size + n)
+         capacity *= 2;
+      unsigned char *data = (unsigned char *)realloc(w->data, capacity);
+      if (!data)
+         return false;
+      w->data = data;
+      w->capacity = capacity;
+   }
+   memcpy(w->data + w->size, p, n);
+   w->size += n;
+   return true;
+}
+
+static bool put_tag(byte_writer *w, unsigned char tag) {
+   return put_bytes(w, &tag, 1);
+}
+
+static const char *write_value(lua_State *L, int idx, byte_writer *w, int depth) {
+   switch (lua_type(L, idx)) {
+      case LUA_TNIL:
+         return put_tag(w, TAG_NIL) ? NULL : "out of memory";
+      case LUA_TBOOLEAN:
+         return put_tag(w, lua_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE) ? NULL : "out of memory";
+      case LUA_TNUMBER:
+         if (lua_isinteger(L, idx)) {
+            lua_Integer v = lua_tointeger(L, idx);
+            return put_tag(w, TAG_INTEGER) && put_bytes(w, &v, sizeof(v)) ? NULL : "out of memory";
+         } else {
+            lua_Number v = lua_tonumber(L, idx);
+            return put_tag(w, TAG_NUMBER) && put_bytes(w, &v, sizeof(v)) ? NULL : "out of memory";
+         }
+      case LUA_TSTRING: {
+         size_t len;
+         const char *s = lua_tolstring(L, idx, &len);
+         return put_tag(w, TAG_STRING) && put_bytes(w, &len, sizeof(len)) && put_bytes(w, s, len)
+                ? NULL : "out of memory";
+      }
+      case LUA_TTABLE: {
+         const char *err = NULL;
+         if (depth >= SERIALIZE_MAX_DEPTH)
+            return "tables nested too deeply (or cyclic)";
+         if (!lua_checkstack(L, 3))
+            return "stack overflow";
+         if (!put_tag(w, TAG_TABLE))
+            return "out of memory";
+         lua_pushnil(L);
+         while (lua_next(L, idx) != 0) {
+            int top = lua_gettop(L);
+            if ((err = write_value(L, top - 1, w, depth + 1)) != NULL ||
+                (err = write_value(L, top, w, depth + 1)) != NULL) {
+               lua_pop(L, 2);
+               return err;
+            }
+            lua_pop(L, 1);
+         }
+         return put_tag(w, TAG_END) ? NULL : "out of memory";
+      }
+      case LUA_TUSERDATA: {
+         core_buffer *buf = module_buffer_test(L, idx);
+         if (buf) {
+            unsigned char type = (unsigned char)buf->type;
+            return put_tag(w, TAG_BUFFER) && put_bytes(w, &type, 1) && put_bytes(w, &buf->count, sizeof(buf->count)) &&
+                   put_bytes(w, buf->data, buf->count * 4) ? NULL : "out of memory";
+         }
+         return "userdata other than typed buffers cannot be sent";
+      }
+      default:
+         return "functions, threads and light userdata cannot be sent";
+   }
+}
+
+worker_message *module_worker_serialize(lua_State *L, int idx, const char **err) {
+   byte_writer w = {NULL, 0, 0};
+   idx = lua_absindex(L, idx);
+   *err = write_value(L, idx, &w, 0);
+   if (*err) {
+      free(w.data);
+      return NULL;
+   }
+   worker_message *msg = (worker_message *)malloc(sizeof(worker_message) + w.size);
+   if (!msg) {
+      free(w.data);
+      *err = "out of memory";
+      return NULL;
+   }
+   msg->size = w.size;
+   memcpy(msg->data, w.data, w.size);
+   free(w.data);
+   return msg;
+}
+
+typedef struct {
+   const unsigned char *p;
+   const unsigned char *end;
+} byte_reader;
+
+static bool get_bytes(byte_reader *r, void *out, size_t n) {
+   if ((size_t)(r->end - r->p) < n)
+      return false;
+   memcpy(out, r->p, n);
+   r->p += n;
+   return true;
+}
+
+// Push the next value; *tag receives its tag (TAG_END pushes nothing)
+static bool read_value(lua_State *L, byte_reader *r, int depth, unsigned char *tag) {
+   if (!get_bytes(r, tag, 1) || !lua_checkstack(L, 3) || depth > SERIALIZE_MAX_DEPTH)
+      return false;
+   switch (*tag) {
+      case TAG_NIL: lua_pushnil(L); return true;
+      case TAG_FALSE: lua_pushboolean(L, 0); return true;
+      case TAG_TRUE: lua_pushboolean(L, 1); return true;
+      case TAG_INTEGER: {
+         lua_Integer v;
+         if (!get_bytes(r, &v, sizeof(v)))
+            return false;
+         lua_pushinteger(L, v);
+         return true;
+      }
+      case TAG_NUMBER: {
+         lua_Number v;
+         if (!get_bytes(r, &v, sizeof(v)))
+            return false;
+         lua_pushnumber(L, v);
+         return true;
+      }
+      case TAG_STRING: {
+         size_t len;
+         if (!get_bytes(r, &len, sizeof(len)) || (size_t)(r->end - r->p) < len)
+            return false;
+         lua_pushlstring(L, (const char *)r->p, len);
+         r->p += len;
+         return true;
+      }
+      case TAG_TABLE: {
+         unsigned char key_tag, value_tag;
+         lua_newtable(L);
+         for (;;) {
+            if (!read_value(L, r, depth + 1, &key_tag))
+               return false;
+            if (key_tag == TAG_END)
+               return true;
+            if (!read_value(L, r, depth + 1, &value_tag) || value_tag == TAG_END || key_tag == TAG_NIL)
+               return false;
+            lua_rawset(L, -3);
+         }
+      }
+      case TAG_BUFFER: {
+         unsigned char type;
+         size_t count;
+         if (!get_bytes(r, &type, 1) || type > BUFFER_U32 || !get_bytes(r, &count, sizeof(count)) ||
+             (size_t)(r->end - r->p) / 4 < count)
+            return false;
+         core_buffer *buf = module_buffer_push(L, (buffer_type)type, count);
+         memcpy(buf->data, r->p, count * 4);
+         r->p += count * 4;
+         return true;
+      }
+      case TAG_END:
+         return true;
+      default:
+         return false;
+   }
+}
+
+bool module_worker_deserialize(lua_State *L, const worker_message *msg) {
+   byte_reader r = {msg->data, msg->data + msg->size};
+   int top = lua_gettop(L);
+   unsigned char tag;
+   if (!read_value(L, &r, 0, &tag) || tag == TAG_END || r.p != r.end) {
+      lua_settop(L, top);
+      return false;
+   }
+   return true;
+}
+
+// ---------------------------------------------------------------------------
+// Worker thread
+
+static lua_worker *get_self(lua_State *L) {
+   lua_worker *w;
+   lua_getfield(L, LUA_REGISTRYINDEX, "lrcgl.worker_self");
+   w = (lua_worker *)lua_touserdata(L, -1);
+   lua_pop(L, 1);
+   return w;
+}
+
+// post(value) -- send a value to the main state (waits while the outbox is full)
+static int lua_worker_post(lua_State *L) {
+   lua_worker *w = get_self(L);
+   const char *err;
+   worker_message *msg = module_worker_serialize(L, 1, &err);
+   if (!msg)
+      return luaL_error(L, "post: %s", err);
+   while (!channel_push(&w->outbox, msg)) {
+      if (core_atomic_load(&w->quit)) {
+         free(msg);
+         lua_pushboolean(L, 0);
+         return 1;
+      }
+      core_thread_yield();
+   }
+   lua_pushboolean(L, 1);
+   return 1;
+}
+
+static int lua_worker_print(lua_State *L) {
+   lua_worker *w = get_self(L);
+   int n = lua_gettop(L);
+   for (int i = 1; i <= n; i++) {
+      const char *str = luaL_tolstring(L, i, NULL);
+      core_log(RETRO_LOG_INFO, "Lua worker %s: %s", w->name, str);
+      lua_pop(L, 1);
+   }
+   return 0;
+}
+
+static void worker_fail(lua_worker *w, lua_State *L, const char *what) {
+   const char *msg = lua_tostring(L, -1);
+   snprintf(w->error, sizeof(w->error), "%s: %s", what, msg ? msg : "(no message)");
+   core_log(RETRO_LOG_ERROR, "Lua worker %s %s", w->name, w->error);
+}
+
+// Push the value a message holds (argument 1, a light userdata). Decoding
+// allocates, so it runs under lua_pcall and the caller frees the message
+// whatever happens.
+static int push_message(lua_State *L) {
+   const worker_message *msg = (const worker_message *)lua_touserdata(L, 1);
+   if (!module_worker_deserialize(L, msg))
+      return luaL_error(L, "malformed message");
+   return 1;
+}
+
+// Hand a message (argument 1) to on_message and post a non-nil return value
+// back as a reply; run under lua_pcall
+static int deliver_message(lua_State *L) {
+   lua_getglobal(L, "on_message");
+   lua_pushcfunction(L, push_message);
+   lua_pushvalue(L, 1);
+   lua_call(L, 1, 1);
+   lua_call(L, 1, 1);
+   if (!lua_isnil(L, -1)) {
+      lua_pushcfunction(L, lua_worker_post);
+      lua_insert(L, -2);
+      lua_call(L, 1, 1);
+   }
+   return 0;
+}
+
+static CORE_THREAD_FUNC(worker_main) {
+   lua_worker *w = (lua_worker *)arg;
+   lua_State *L = module_memory_new_state(w->name);
+   if (!L) {
+      snprintf(w->error, sizeof(w->error), "failed to create Lua state");
+      core_atomic_store(&w->finished, 1);
+      return CORE_THREAD_RETURN;
+   }
+
+   // No GL or input bindings: only libraries that are safe off the main thread
+   luaL_openlibs(L);
+   lua_pushlightuserdata(L, w);
+   lua_setfield(L, LUA_REGISTRYINDEX, "lrcgl.worker_self");
+   lua_register(L, "print", lua_worker_print);
+   lua_register(L, "post", lua_worker_post);
+   module_buffer_register(L);
+   module_memory_register(L);
+   module_lua_install_zip_searcher(L);
+
+   if (luaL_loadbuffer(L, w->source, w->source_size, w->name) != LUA_OK || lua_pcall(L, 0, 0, 0) != LUA_OK) {
+      worker_fail(w, L, "failed to load");
+      goto done;
+   }
+   free(w->source);
+   w->source = NULL;
+
+   lua_getglobal(L, "on_message");
+   if (!lua_isfunction(L, -1)) {
+      snprintf(w->error, sizeof(w->error), "script does not define on_message(value)");
+      core_log(RETRO_LOG_ERROR, "Lua worker %s %s", w->name, w->error);
+      goto done;
+   }
+   lua_pop(L, 1);
+
+   while (!core_atomic_load(&w->quit)) {
+      worker_message *msg = channel_pop(&w->inbox);
+      if (!msg) {
+         core_mutex_lock(&w->wake_lock);
+         while (core_atomic_load(&w->inbox.head) == core_atomic_load(&w->inbox.tail) && !core_atomic_load(&w->quit))
+            core_cond_wait(&w->wake, &w->wake_lock);
+         core_mutex_unlock(&w->wake_lock);
+         continue;
+      }
+
+      lua_pushcfunction(L, deliver_message);
+      lua_pushlightuserdata(L, msg);
+      int status = lua_pcall(L, 1, 0, 0);
+      free(msg);
+      if (status != LUA_OK) {
+         worker_fail(w, L, "on_message failed");
+         break;
+      }
+      lua_settop(L, 0);
+   }
+
+done:
+   module_memory_close_state(L);
+   module_memory_thread_exit();
+   core_atomic_store(&w->finished, 1);
+   return CORE_THREAD_RETURN;
+}
+
+lua_worker *module_worker_spawn(const char *asset_name) {
+   lua_worker *w = (lua_worker *)calloc(1, sizeof(lua_worker));
+   if (!w) {
+      core_log(RETRO_LOG_ERROR, "Failed to allocate Lua worker");
+      return NULL;
+   }
+   snprintf(w->name, sizeof(w->name), "%s", asset_name);
+   if (!extract_asset_from_zip(asset_name, &w->source, &w->source_size)) {
+      core_log(RETRO_LOG_ERROR, "Lua worker script %s not found in content", asset_name);
+      free(w);
+      return NULL;
+   }
+   core_mutex_init(&w->wake_lock);
+   core_cond_init(&w->wake);
+   if (!core_thread_create(&w->thread, worker_main, w)) {
+      core_log(RETRO_LOG_ERROR, "Failed to start thread for Lua worker %s", asset_name);
+      module_worker_destroy(w);
+      return NULL;
+   }
+   w->started = true;
+   core_log(RETRO_LOG_INFO, "Started Lua worker %s", asset_name);
+   return w;
+}
+
+void module_worker_destroy(lua_worker *w) {
+   if (!w)
+      return;
+   if (w->started) {
+      core_mutex_lock(&w->wake_lock);
+      core_atomic_store(&w->quit, 1);
+      core_cond_signal(&w->wake);
+      core_mutex_unlock(&w->wake_lock);
+      core_thread_join(w->thread);
+   }
+   channel_drain(&w->inbox);
+   channel_drain(&w->outbox);
+   core_cond_destroy(&w->wake);
+   core_mutex_destroy(&w->wake_lock);
+   free(w->source);
+   free(w);
+}
+
+// ---------------------------------------------------------------------------
+// Main-state bindings
+
+static lua_worker **check_worker_ud(lua_State *L, int arg) {
+   return (lua_worker **)luaL_checkudata(L, arg, WORKER_METATABLE);
+}
+
+static lua_worker *check_worker(lua_State *L, int arg) {
+   lua_worker **ud = check_worker_ud(L, arg);
+   luaL_argcheck(L, *ud != NULL, arg, "worker is stopped");
+   return *ud;
+}
+
+// worker.spawn(asset_name) -> worker or nil
+static int lua_worker_spawn(lua_State *L) {
+   const char *asset_name = luaL_checkstring(L, 1);
+   lua_worker **ud = (lua_worker **)lua_newuserdatauv(L, sizeof(lua_worker *), 0);
+   *ud = NULL;
+   luaL_setmetatable(L, WORKER_METATABLE);
+   *ud = module_worker_spawn(asset_name);
+   if (!*ud)
+      lua_pushnil(L);
+   return 1;
+}
+
+// w:send(value) -> true, or false if the inbox is full or the worker stopped
+static int lua_worker_send(lua_State *L) {
+   lua_worker *w = check_worker(L, 1);
+   const char *err;
+   luaL_checkany(L, 2);
+   if (core_atomic_load(&w->finished)) {
+      lua_pushboolean(L, 0);
+      return 1;
+   }
+   worker_message *msg = module_worker_serialize(L, 2, &err);
+   if (!msg)
+      return luaL_error(L, "send: %s", err);
+   if (!channel_push(&w->inbox, msg)) {
+      free(msg);
+      lua_pushboolean(L, 0);
+      return 1;
+   }
+   core_mutex_lock(&w->wake_lock);
+   core_cond_signal(&w->wake);
+   core_mutex_unlock(&w->wake_lock);
+   lua_pushboolean(L, 1);
+   return 1;
+}
+
+// w:receive() -> true, value, or false if nothing is pending (never blocks)
+static int lua_worker_receive(lua_State *L) {
+   lua_worker *w = check_worker(L, 1);
+   worker_message *msg = channel_pop(&w->outbox);
+   if (!msg) {
+      lua_pushboolean(L, 0);
+      return 1;
+   }
+   lua_pushcfunction(L, push_message);
+   lua_pushlightuserdata(L, msg);
+   int status = lua_pcall(L, 1, 1, 0);
+   free(msg);
+   if (status == LUA_ERRMEM)
+      return lua_error(L);
+   if (status != LUA_OK)
+      return luaL_error(L, "receive: %s from worker %s", lua_tostring(L, -1), w->name);
+   lua_pushboolean(L, 1);
+   lua_insert(L, -2);
+   return 2;
+}
+
+// w:alive() -> false once the worker stopped or failed
+static int lua_worker_alive(lua_State *L) {
+   lua_worker **ud = check_worker_ud(L, 1);
+   lua_pushboolean(L, *ud && !core_atomic_load(&(*ud)->finished));
+   return 1;
+}
+
+// w:error() -> message or nil
+static int lua_worker_error(lua_State *L) {
+   lua_worker **ud = check_worker_ud(L, 1);
+   if (*ud && core_atomic_load(&(*ud)->finished) && (*ud)->error[0])
+      lua_pushstring(L, (*ud)->error);
+   else
+      lua_pushnil(L);
+   return 1;
+}
+
+// w:stop() (also run when the handle is collected)
+static int lua_worker_stop(lua_State *L) {
+   lua_worker **ud = check_worker_ud(L, 1);
+   module_worker_destroy(*ud);
+   *ud = NULL;
+   return 0;
+}
+
+static const luaL_Reg worker_methods[] = {
+   {"send", lua_worker_send},
+   {"receive", lua_worker_receive},
+   {"alive", lua_worker_alive},
+   {"error", lua_worker_error},
+   {"stop", lua_worker_stop},
+   {NULL, NULL}
+};
+
+static const luaL_Reg worker_funcs[] = {
+   {"spawn", lua_worker_spawn},
+   {NULL, NULL}
+};
+
+void module_worker_register(lua_State *L) {
+   if (luaL_newmetatable(L, WORKER_METATABLE)) {
+      lua_pushcfunction(L, lua_worker_stop);
+      lua_setfield(L, -2, "__gc");
+      luaL_newlib(L, worker_methods);
+      lua_setfield(L, -2, "__index");
+   }
+   lua_pop(L, 1);
+
+   luaL_newlib(L, worker_funcs);
+   lua_setglobal(L, "worker");
+}